@@ -0,0 +1,600 @@
+/**
+ * @file   AIOCalCache.c
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  Cache of A/D calibration tables, from files and from :AUTO: runs
+ *
+ * AIOUSB_ADC_LoadCalTable() used to stat, open and read a 128K file
+ * every time it was called, and every ADC_SetCal(":AUTO:") measured the
+ * board all over again. The cache keeps the most recently used tables:
+ * files are mapped read-only and trusted for as long as stat() reports
+ * the same file, size and modification time, and :AUTO: results are
+ * kept per board serial number, in memory and optionally on disk in a
+ * directory given with AIOCalCacheSetDirectory().
+ */
+
+#include "AIOCalCache.h"
+#include "AIOUSB_Core.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __cplusplus
+namespace AIOUSB {
+#endif
+
+/**
+ * @brief One cached table. Entries the cache lets go of while someone
+ * still holds them are detached and freed by the last release.
+ */
+struct aio_cal_cache_entry {
+    AIOCalTable view;                   /**< what callers get, must stay first */
+    AIOUSB_BOOL isFile;
+    char *path;                         /**< file entries: the name asked for */
+    dev_t dev;                          /**< file entries: identity at mapping time */
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    uint64_t serialNumber;              /**< :AUTO: entries */
+    size_t bytes;
+    AIOUSB_BOOL mapped;                 /**< table is an mmap() of bytes, else malloc()ed */
+    unsigned refs;
+    AIOUSB_BOOL detached;
+    uint64_t lastUse;
+};
+
+static pthread_mutex_t calCacheLock = PTHREAD_MUTEX_INITIALIZER;
+static struct aio_cal_cache_entry *calCache[ AIO_CAL_CACHE_ENTRIES ];
+static uint64_t calCacheClock = 0;
+static uint64_t calCacheHits = 0;
+static uint64_t calCacheMisses = 0;
+static char *calCacheDirectory = NULL;
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief 64 bit FNV-1a over the words of a table
+ */
+uint64_t AIOCalTableHash( const unsigned short *table, unsigned long words )
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    unsigned long index;
+    if ( !table )
+        return 0;
+    for ( index = 0; index < words; index ++ ) {
+        hash ^= table[ index ];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+/*----------------------------------------------------------------------------*/
+static void _aio_cal_cache_free( struct aio_cal_cache_entry *entry )
+{
+    if ( entry->mapped )
+        munmap( (void *)entry->view.table, entry->bytes );
+    else
+        free( (void *)entry->view.table );
+    free( entry->path );
+    free( entry );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Takes an entry out of the cache. Must be called with
+ * calCacheLock held.
+ */
+static void _aio_cal_cache_drop( unsigned slot )
+{
+    struct aio_cal_cache_entry *entry = calCache[ slot ];
+    calCache[ slot ] = NULL;
+    if ( !entry )
+        return;
+    if ( entry->refs )
+        entry->detached = AIOUSB_TRUE;
+    else
+        _aio_cal_cache_free( entry );
+}
+
+/*----------------------------------------------------------------------------*/
+static AIOCalTable *_aio_cal_cache_take( struct aio_cal_cache_entry *entry )
+{
+    entry->refs ++;
+    entry->lastUse = ++calCacheClock;
+    return &entry->view;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Adds entry in place of any older one for the same file or
+ * board, or else the least recently used, and hands it to the caller.
+ * Must be called with calCacheLock held.
+ */
+static AIOCalTable *_aio_cal_cache_insert( struct aio_cal_cache_entry *entry )
+{
+    unsigned slot, victim = 0;
+
+    for ( slot = 0; slot < AIO_CAL_CACHE_ENTRIES; slot ++ ) {
+        struct aio_cal_cache_entry *other = calCache[ slot ];
+        if ( !other )
+            continue;
+        if ( other->isFile == entry->isFile &&
+             ( entry->isFile ? strcmp( other->path, entry->path ) == 0 : other->serialNumber == entry->serialNumber ) )
+            _aio_cal_cache_drop( slot );
+    }
+    for ( slot = 0; slot < AIO_CAL_CACHE_ENTRIES; slot ++ ) {
+        if ( !calCache[ slot ] ) {
+            victim = slot;
+            break;
+        }
+        if ( calCache[ slot ]->lastUse < calCache[ victim ]->lastUse )
+            victim = slot;
+    }
+    _aio_cal_cache_drop( victim );
+    calCache[ victim ] = entry;
+
+    return _aio_cal_cache_take( entry );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Maps fileName read-only into a new entry, which must hold
+ * exactly words words
+ */
+static AIORESULT _aio_cal_cache_map( const char *fileName, unsigned long words, struct aio_cal_cache_entry **pEntry )
+{
+    struct aio_cal_cache_entry *entry;
+    struct stat fileInfo;
+    void *table;
+    int fd = open( fileName, O_RDONLY );
+    if ( fd < 0 )
+        return AIOUSB_ERROR_FILE_NOT_FOUND;
+    if ( fstat( fd, &fileInfo ) != 0 ) {
+        close( fd );
+        return AIOUSB_ERROR_FILE_NOT_FOUND;
+    }
+    if ( fileInfo.st_size != (off_t)( words * sizeof(unsigned short) ) ) {
+        close( fd );
+        return AIOUSB_ERROR_INVALID_DATA;
+    }
+    table = mmap( NULL, fileInfo.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    close( fd );
+    if ( table == MAP_FAILED )
+        return AIOUSB_ERROR_FILE_NOT_FOUND;
+
+    entry = (struct aio_cal_cache_entry *)calloc( 1, sizeof(struct aio_cal_cache_entry) );
+    if ( !entry ) {
+        munmap( table, fileInfo.st_size );
+        return AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+    }
+    entry->view.table = (const unsigned short *)table;
+    entry->view.words = words;
+    entry->view.hash  = AIOCalTableHash( entry->view.table, words );
+    entry->dev    = fileInfo.st_dev;
+    entry->ino    = fileInfo.st_ino;
+    entry->size   = fileInfo.st_size;
+    entry->mtime  = fileInfo.st_mtim;
+    entry->bytes  = fileInfo.st_size;
+    entry->mapped = AIOUSB_TRUE;
+    *pEntry = entry;
+
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+static char *_aio_cal_cache_auto_path( const char *directory, uint64_t serialNumber )
+{
+    size_t length = strlen( directory ) + 32;
+    char *path = (char *)malloc( length );
+    if ( path )
+        snprintf( path, length, "%s/%016llx.autocal", directory, (unsigned long long)serialNumber );
+    return path;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Looks up a CAL_TABLE_WORDS calibration file, mapping it if it
+ * isn't cached or has changed since it was
+ * @param fileName
+ * @return the table, to be given back with AIOCalCacheRelease(), or NULL
+ * with aio_errno set: -AIOUSB_ERROR_FILE_NOT_FOUND, or
+ * -AIOUSB_ERROR_INVALID_DATA if the file is the wrong size
+ */
+AIOCalTable *AIOCalCacheOpenFile( const char *fileName )
+{
+    struct aio_cal_cache_entry *entry = NULL;
+    struct stat fileInfo;
+    AIOCalTable *table = NULL;
+    AIORESULT result;
+    unsigned slot;
+
+    if ( !fileName ) {
+        aio_errno = -AIOUSB_ERROR_INVALID_PARAMETER;
+        return NULL;
+    }
+    if ( stat( fileName, &fileInfo ) != 0 ) {
+        aio_errno = -AIOUSB_ERROR_FILE_NOT_FOUND;
+        return NULL;
+    }
+
+    pthread_mutex_lock( &calCacheLock );
+    for ( slot = 0; slot < AIO_CAL_CACHE_ENTRIES && !table; slot ++ ) {
+        entry = calCache[ slot ];
+        if ( !entry || !entry->isFile || strcmp( entry->path, fileName ) != 0 )
+            continue;
+        if ( entry->dev == fileInfo.st_dev && entry->ino == fileInfo.st_ino &&
+             entry->size == fileInfo.st_size &&
+             entry->mtime.tv_sec == fileInfo.st_mtim.tv_sec &&
+             entry->mtime.tv_nsec == fileInfo.st_mtim.tv_nsec ) {
+            calCacheHits ++;
+            table = _aio_cal_cache_take( entry );
+        } else {
+            _aio_cal_cache_drop( slot );
+        }
+    }
+    if ( !table )
+        calCacheMisses ++;
+    pthread_mutex_unlock( &calCacheLock );
+    if ( table )
+        return table;
+
+    result = _aio_cal_cache_map( fileName, CAL_TABLE_WORDS, &entry );
+    if ( result == AIOUSB_SUCCESS ) {
+        entry->isFile = AIOUSB_TRUE;
+        entry->path = strdup( fileName );
+        if ( !entry->path ) {
+            _aio_cal_cache_free( entry );
+            result = AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+        }
+    }
+    if ( result != AIOUSB_SUCCESS ) {
+        aio_errno = -result;
+        return NULL;
+    }
+
+    pthread_mutex_lock( &calCacheLock );
+    table = _aio_cal_cache_insert( entry );
+    pthread_mutex_unlock( &calCacheLock );
+
+    return table;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Looks up the tables of the last :AUTO: calibration of a board,
+ * in memory and then in the cache directory
+ * @param serialNumber
+ * @return the tables, to be given back with AIOCalCacheRelease(), or NULL
+ * with aio_errno set to -AIOUSB_ERROR_FILE_NOT_FOUND if there are none
+ */
+AIOCalTable *AIOCalCacheOpenAuto( uint64_t serialNumber )
+{
+    struct aio_cal_cache_entry *entry = NULL;
+    AIOCalTable *table = NULL;
+    AIORESULT result = AIOUSB_ERROR_FILE_NOT_FOUND;
+    char *path = NULL;
+    unsigned slot;
+
+    pthread_mutex_lock( &calCacheLock );
+    for ( slot = 0; slot < AIO_CAL_CACHE_ENTRIES && !table; slot ++ ) {
+        entry = calCache[ slot ];
+        if ( entry && !entry->isFile && entry->serialNumber == serialNumber ) {
+            calCacheHits ++;
+            table = _aio_cal_cache_take( entry );
+        }
+    }
+    if ( !table ) {
+        calCacheMisses ++;
+        if ( calCacheDirectory )
+            path = _aio_cal_cache_auto_path( calCacheDirectory, serialNumber );
+    }
+    pthread_mutex_unlock( &calCacheLock );
+    if ( table )
+        return table;
+
+    if ( path )
+        result = _aio_cal_cache_map( path, 2 * CAL_TABLE_WORDS, &entry );
+    free( path );
+    if ( result != AIOUSB_SUCCESS ) {
+        aio_errno = -result;
+        return NULL;
+    }
+    entry->serialNumber = serialNumber;
+
+    pthread_mutex_lock( &calCacheLock );
+    table = _aio_cal_cache_insert( entry );
+    pthread_mutex_unlock( &calCacheLock );
+
+    return table;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Keeps a copy of a board's :AUTO: tables, and writes them to the
+ * cache directory if there is one
+ * @param serialNumber
+ * @param tables 2 * CAL_TABLE_WORDS words, in the order they were loaded
+ * @param words
+ * @return AIOUSB_SUCCESS, or -AIOUSB_ERROR_FILE_NOT_FOUND if the copy on
+ * disk couldn't be written; the one in memory is kept regardless
+ */
+AIORET_TYPE AIOCalCacheStoreAuto( uint64_t serialNumber, const unsigned short *tables, unsigned long words )
+{
+    AIO_ASSERT( tables );
+    if ( words != 2 * CAL_TABLE_WORDS )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+
+    AIORET_TYPE retval = AIOUSB_SUCCESS;
+    char *path = NULL;
+    struct aio_cal_cache_entry *entry = (struct aio_cal_cache_entry *)calloc( 1, sizeof(struct aio_cal_cache_entry) );
+    unsigned short *copy = (unsigned short *)malloc( words * sizeof(unsigned short) );
+    if ( !entry || !copy ) {
+        free( entry );
+        free( copy );
+        return -AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+    }
+    memcpy( copy, tables, words * sizeof(unsigned short) );
+    entry->view.table    = copy;
+    entry->view.words    = words;
+    entry->view.hash     = AIOCalTableHash( copy, words );
+    entry->serialNumber  = serialNumber;
+    entry->bytes         = words * sizeof(unsigned short);
+
+    pthread_mutex_lock( &calCacheLock );
+    _aio_cal_cache_insert( entry );
+    entry->refs --;                     /* the cache keeps it, nobody holds it */
+    if ( calCacheDirectory )
+        path = _aio_cal_cache_auto_path( calCacheDirectory, serialNumber );
+    pthread_mutex_unlock( &calCacheLock );
+
+    if ( path ) {
+        /* write beside it and rename, so a reader never maps half a file */
+        size_t length = strlen( path ) + 8;
+        char *temp = (char *)malloc( length );
+        FILE *calFile = NULL;
+        if ( temp ) {
+            snprintf( temp, length, "%s.tmp", path );
+            calFile = fopen( temp, "w" );
+        }
+        if ( calFile ) {
+            size_t wordsWritten = fwrite( tables, sizeof(unsigned short), words, calFile );
+            if ( fclose( calFile ) != 0 || wordsWritten != words || rename( temp, path ) != 0 ) {
+                remove( temp );
+                retval = -AIOUSB_ERROR_FILE_NOT_FOUND;
+            }
+        } else {
+            retval = -AIOUSB_ERROR_FILE_NOT_FOUND;
+        }
+        free( temp );
+        free( path );
+    }
+
+    return retval;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIOCalCacheRelease( AIOCalTable *table )
+{
+    AIO_ASSERT( table );
+    struct aio_cal_cache_entry *entry = (struct aio_cal_cache_entry *)table;
+
+    pthread_mutex_lock( &calCacheLock );
+    if ( --entry->refs == 0 && entry->detached )
+        _aio_cal_cache_free( entry );
+    pthread_mutex_unlock( &calCacheLock );
+
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Sets where :AUTO: tables are kept between runs, one file per
+ * board serial number
+ * @param directory an existing directory, or NULL to keep them in memory only
+ */
+AIORET_TYPE AIOCalCacheSetDirectory( const char *directory )
+{
+    struct stat fileInfo;
+    char *copy = NULL;
+
+    if ( directory ) {
+        if ( stat( directory, &fileInfo ) != 0 || !S_ISDIR( fileInfo.st_mode ) )
+            return -AIOUSB_ERROR_FILE_NOT_FOUND;
+        copy = strdup( directory );
+        if ( !copy )
+            return -AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+    }
+
+    pthread_mutex_lock( &calCacheLock );
+    free( calCacheDirectory );
+    calCacheDirectory = copy;
+    pthread_mutex_unlock( &calCacheLock );
+
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Drops every cached table and starts the hit and miss counts
+ * over. Tables on disk are left alone.
+ */
+AIORET_TYPE AIOCalCacheClear( void )
+{
+    unsigned slot;
+    pthread_mutex_lock( &calCacheLock );
+    for ( slot = 0; slot < AIO_CAL_CACHE_ENTRIES; slot ++ )
+        _aio_cal_cache_drop( slot );
+    calCacheHits = 0;
+    calCacheMisses = 0;
+    pthread_mutex_unlock( &calCacheLock );
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIOCalCacheGetHits( void )
+{
+    AIORET_TYPE retval;
+    pthread_mutex_lock( &calCacheLock );
+    retval = (AIORET_TYPE)calCacheHits;
+    pthread_mutex_unlock( &calCacheLock );
+    return retval;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIOCalCacheGetMisses( void )
+{
+    AIORET_TYPE retval;
+    pthread_mutex_lock( &calCacheLock );
+    retval = (AIORET_TYPE)calCacheMisses;
+    pthread_mutex_unlock( &calCacheLock );
+    return retval;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+/*****************************************************************************
+ * Self-test
+ ****************************************************************************/
+
+#ifdef SELF_TEST
+
+#include "gtest/gtest.h"
+
+using namespace AIOUSB;
+
+static void fill_tables( unsigned short *tables, unsigned long words, unsigned short seed )
+{
+    for ( unsigned long i = 0; i < words; i ++ )
+        tables[i] = (unsigned short)( i * 7 + seed );
+}
+
+TEST(AIOCalCache,AutoTablesComeBackFromTheDirectory)
+{
+    static unsigned short tables[ 2 * CAL_TABLE_WORDS ];
+    char directory[] = "/tmp/aiocalcacheXXXXXX";
+    ASSERT_TRUE( mkdtemp( directory ) );
+    fill_tables( tables, 2 * CAL_TABLE_WORDS, 3 );
+
+    AIOCalCacheClear();
+    EXPECT_EQ( -AIOUSB_ERROR_FILE_NOT_FOUND, AIOCalCacheSetDirectory( "/nonexistent/aiocal" ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOCalCacheSetDirectory( directory ) );
+    EXPECT_EQ( -AIOUSB_ERROR_INVALID_PARAMETER, AIOCalCacheStoreAuto( 0x1234, tables, CAL_TABLE_WORDS ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOCalCacheStoreAuto( 0x1234, tables, 2 * CAL_TABLE_WORDS ) );
+
+    /* forget the copy in memory, so the next one has to come from disk */
+    AIOCalCacheClear();
+    AIOCalTable *table = AIOCalCacheOpenAuto( 0x1234 );
+    ASSERT_TRUE( table );
+    EXPECT_EQ( 2ul * CAL_TABLE_WORDS, table->words );
+    EXPECT_EQ( AIOCalTableHash( tables, 2 * CAL_TABLE_WORDS ), table->hash );
+    EXPECT_EQ( 0, memcmp( tables, table->table, sizeof(tables) ) );
+    EXPECT_EQ( 0, AIOCalCacheGetHits() );
+    EXPECT_EQ( 1, AIOCalCacheGetMisses() );
+    AIOCalCacheRelease( table );
+
+    table = AIOCalCacheOpenAuto( 0x1234 );
+    ASSERT_TRUE( table );
+    EXPECT_EQ( 1, AIOCalCacheGetHits() );
+    AIOCalCacheRelease( table );
+
+    EXPECT_FALSE( AIOCalCacheOpenAuto( 0x5678 ) );
+    EXPECT_EQ( -AIOUSB_ERROR_FILE_NOT_FOUND, aio_errno );
+
+    char path[ 64 ];
+    snprintf( path, sizeof(path), "%s/%016llx.autocal", directory, 0x1234ull );
+    EXPECT_EQ( 0, unlink( path ) );
+    EXPECT_EQ( 0, rmdir( directory ) );
+    AIOCalCacheSetDirectory( NULL );
+    AIOCalCacheClear();
+}
+
+TEST(AIOCalCache,HeldTablesOutliveEviction)
+{
+    static unsigned short tables[ 2 * CAL_TABLE_WORDS ];
+    AIOCalCacheClear();
+
+    fill_tables( tables, 2 * CAL_TABLE_WORDS, 0 );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOCalCacheStoreAuto( 100, tables, 2 * CAL_TABLE_WORDS ) );
+    AIOCalTable *held = AIOCalCacheOpenAuto( 100 );
+    ASSERT_TRUE( held );
+
+    for ( int serial = 101; serial <= 100 + AIO_CAL_CACHE_ENTRIES; serial ++ ) {
+        fill_tables( tables, 2 * CAL_TABLE_WORDS, serial );
+        ASSERT_EQ( AIOUSB_SUCCESS, AIOCalCacheStoreAuto( serial, tables, 2 * CAL_TABLE_WORDS ) );
+    }
+    EXPECT_FALSE( AIOCalCacheOpenAuto( 100 ) ) << "least recently used goes first";
+    AIOCalTable *recent = AIOCalCacheOpenAuto( 100 + AIO_CAL_CACHE_ENTRIES );
+    ASSERT_TRUE( recent );
+    EXPECT_EQ( 100 + AIO_CAL_CACHE_ENTRIES, recent->table[0] );
+    AIOCalCacheRelease( recent );
+
+    EXPECT_EQ( 7, held->table[1] ) << "still readable after eviction";
+    EXPECT_EQ( AIOCalTableHash( held->table, held->words ), held->hash );
+    AIOCalCacheRelease( held );
+    AIOCalCacheClear();
+}
+
+TEST(AIOCalCache,FilesAreMappedOnceUntilTheyChange)
+{
+    static unsigned short table[ CAL_TABLE_WORDS ];
+    char name[] = "/tmp/aiocalfileXXXXXX";
+    int fd = mkstemp( name );
+    ASSERT_GE( fd, 0 );
+    fill_tables( table, CAL_TABLE_WORDS, 1 );
+    ASSERT_EQ( (ssize_t)sizeof(table), write( fd, table, sizeof(table) ) );
+    close( fd );
+    AIOCalCacheClear();
+
+    AIOCalTable *first = AIOCalCacheOpenFile( name );
+    ASSERT_TRUE( first );
+    AIOCalTable *second = AIOCalCacheOpenFile( name );
+    EXPECT_EQ( first, second );
+    EXPECT_EQ( 1, AIOCalCacheGetHits() );
+    AIOCalCacheRelease( second );
+
+    /* a new file under the same name is picked up */
+    char other[] = "/tmp/aiocalfileXXXXXX";
+    fd = mkstemp( other );
+    ASSERT_GE( fd, 0 );
+    fill_tables( table, CAL_TABLE_WORDS, 2 );
+    ASSERT_EQ( (ssize_t)sizeof(table), write( fd, table, sizeof(table) ) );
+    close( fd );
+    ASSERT_EQ( 0, rename( other, name ) );
+    second = AIOCalCacheOpenFile( name );
+    ASSERT_TRUE( second );
+    EXPECT_NE( first->hash, second->hash );
+    EXPECT_EQ( 2, second->table[0] );
+    EXPECT_EQ( 1, first->table[0] ) << "the old mapping stays good while held";
+    EXPECT_EQ( 2, AIOCalCacheGetMisses() );
+    AIOCalCacheRelease( first );
+    AIOCalCacheRelease( second );
+
+    ASSERT_EQ( 0, truncate( name, 100 ) );
+    EXPECT_FALSE( AIOCalCacheOpenFile( name ) );
+    EXPECT_EQ( -AIOUSB_ERROR_INVALID_DATA, aio_errno );
+    unlink( name );
+    EXPECT_FALSE( AIOCalCacheOpenFile( name ) );
+    EXPECT_EQ( -AIOUSB_ERROR_FILE_NOT_FOUND, aio_errno );
+    AIOCalCacheClear();
+}
+
+int main(int argc, char *argv[] )
+{
+    testing::InitGoogleTest(&argc, argv);
+    testing::TestEventListeners & listeners = testing::UnitTest::GetInstance()->listeners();
+#ifdef GTEST_TAP_PRINT_TO_STDOUT
+    delete listeners.Release(listeners.default_result_printer());
+#endif
+
+    return RUN_ALL_TESTS();
+}
+
+#endif
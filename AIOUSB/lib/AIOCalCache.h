@@ -0,0 +1,50 @@
+/**
+ * @file   AIOCalCache.h
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  Cache of A/D calibration tables, from files and from :AUTO: runs
+ *
+ */
+
+#ifndef _AIO_CAL_CACHE_H
+#define _AIO_CAL_CACHE_H
+
+#include "AIOTypes.h"
+#include <stdint.h>
+
+#ifdef __aiousb_cplusplus
+namespace AIOUSB
+{
+#endif
+
+#define AIO_CAL_CACHE_ENTRIES 16
+
+/**
+ * @brief A calibration table held by the cache. Returned by the
+ * AIOCalCacheOpen functions and valid until AIOCalCacheRelease(), even if
+ * the cache drops or replaces the entry in the meantime.
+ */
+typedef struct AIOCalTable {
+    const unsigned short *table;
+    unsigned long words;                /**< CAL_TABLE_WORDS, or twice that for :AUTO: */
+    uint64_t hash;                      /**< AIOCalTableHash() of all the words */
+} AIOCalTable;
+
+/* BEGIN AIOUSB_API */
+PUBLIC_EXTERN uint64_t AIOCalTableHash( const unsigned short *table, unsigned long words );
+PUBLIC_EXTERN AIOCalTable *AIOCalCacheOpenFile( const char *fileName );
+PUBLIC_EXTERN AIOCalTable *AIOCalCacheOpenAuto( uint64_t serialNumber );
+PUBLIC_EXTERN AIORET_TYPE AIOCalCacheStoreAuto( uint64_t serialNumber, const unsigned short *tables, unsigned long words );
+PUBLIC_EXTERN AIORET_TYPE AIOCalCacheRelease( AIOCalTable *table );
+PUBLIC_EXTERN AIORET_TYPE AIOCalCacheSetDirectory( const char *directory );
+PUBLIC_EXTERN AIORET_TYPE AIOCalCacheClear( void );
+PUBLIC_EXTERN AIORET_TYPE AIOCalCacheGetHits( void );
+PUBLIC_EXTERN AIORET_TYPE AIOCalCacheGetMisses( void );
+/* END AIOUSB_API */
+
+#ifdef __aiousb_cplusplus
+}
+#endif
+
+#endif
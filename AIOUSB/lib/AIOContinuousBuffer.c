@@ -21,6 +21,7 @@
 #include "ADCConfigBlock.h"
 #include "AIOChannelMask.h"
 #include "AIOUSB_CTR.h"
+#include "AIOTime.h"
 #include "AIOUSB_Core.h"
 #include "AIODeviceTable.h"
 #include "AIOFifo.h"
@@ -39,6 +40,40 @@ AIORET_TYPE _AIOContinuousBufResizeFifo( AIOContinuousBuf *buf );
 AIORET_TYPE  AIOContinuousBufForceTerminateAcqusitionOverrun( AIOContinuousBuf *buf );
 AIORET_TYPE  AIOContinuousBufForceTerminateAcqusition( AIOContinuousBuf *buf );
 
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief State for polling counters alongside an acquisition. The bulk
+ * stream carries nothing but A/D samples, so the worker reads the
+ * counters itself between bulk blocks and tags each reading, best
+ * effort, with the number of scans that had reached the host by then.
+ */
+struct aio_contbuf_counters {
+    unsigned numCounters;
+    unsigned short *select;             /**< selected counters */
+    unsigned short *readings;           /**< one CTR_8254ReadAll(), every counter on the board */
+    unsigned short *previous;
+    uint64_t *totals;
+    uint64_t lastNs;
+    AIOContinuousBufCounterSample *row;
+    AIOFifo *fifo;
+    int64_t overruns;                   /**< rows dropped because the ring was full */
+};
+
+/*----------------------------------------------------------------------------*/
+static void _aiocontbuf_delete_counters( struct aio_contbuf_counters *counters )
+{
+    if ( !counters )
+        return;
+    if ( counters->fifo )
+        DeleteAIOFifo( counters->fifo );
+    free( counters->select );
+    free( counters->readings );
+    free( counters->previous );
+    free( counters->totals );
+    free( counters->row );
+    free( counters );
+}
+
 /*-------------------------------  Constructors  -----------------------------*/
 AIOContinuousBuf *NewAIOContinuousBufForCounts( unsigned long DeviceIndex, unsigned scancounts, unsigned num_channels )
 {
@@ -318,6 +353,7 @@ AIORET_TYPE DeleteAIOContinuousBuf( AIOContinuousBuf *buf )
         free( buf->buffer );
     if ( buf->fifo  )
         DeleteAIOFifoCounts( (AIOFifoCounts *)buf->fifo );
+    _aiocontbuf_delete_counters( buf->counters );
     free( buf );
     return AIOUSB_SUCCESS;
 }
@@ -679,6 +715,130 @@ PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufGetClock( AIOContinuousBuf *buf )
     return buf->hz;
 }
 
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Has the host poll the given counters during an acquisition: once
+ * when it starts and again after every bulk block, with one
+ * CTR_8254ReadAll() each time. Each reading is queued as a row of
+ * AIOContinuousBufCounterSample, one per counter, tagged with the number
+ * of scans that had reached the host by then.
+ *
+ * The tag is best effort. The firmware's counter scan mode
+ * (AIOContinuousBufSetDefaultModeForCounterScan()) only clocks the A/D
+ * from counter 0 and the bulk stream never carries counter values, so
+ * the counters are read over the control pipe between blocks. The board
+ * keeps scanning meanwhile, so a reading can be up to a block or so
+ * later than its tag, and the resolution is one streaming block.
+ * @param buf
+ * @param counters counter numbers counting across blocks, each at most once
+ * @param numCounters 0 stops reading counters
+ * @param bufferReadings rows the ring holds
+ * @return AIOUSB_SUCCESS or a negative error
+ */
+AIORET_TYPE AIOContinuousBufSetPolledCounters( AIOContinuousBuf *buf, const unsigned short *counters, unsigned numCounters, unsigned bufferReadings )
+{
+    AIO_ASSERT_AIOCONTBUF( buf );
+    AIO_ERROR_VALID_AIORET_TYPE( AIOUSB_ERROR_INVALID_THREAD, !( buf->status & RUNNING ) );
+    AIORESULT result = AIOUSB_SUCCESS;
+    struct aio_contbuf_counters *tmp = NULL;
+    unsigned index, other;
+
+    if ( numCounters ) {
+        AIO_ASSERT( counters );
+        AIO_ASSERT( bufferReadings );
+        AIOUSBDevice *device = AIODeviceTableGetDeviceAtIndex( AIOContinuousBufGetDeviceIndex( buf ), &result );
+        AIO_ERROR_VALID_DATA( -(AIORET_TYPE)result, result == AIOUSB_SUCCESS );
+        AIO_ERROR_VALID_AIORET_TYPE( AIOUSB_ERROR_NOT_SUPPORTED, device->Counters );
+        unsigned boardCounters = device->Counters * COUNTERS_PER_BLOCK;
+        for ( index = 0; index < numCounters; index ++ ) {
+            AIO_ERROR_VALID_AIORET_TYPE( AIOUSB_ERROR_INVALID_PARAMETER, counters[ index ] < boardCounters );
+            for ( other = 0; other < index; other ++ )
+                AIO_ERROR_VALID_AIORET_TYPE( AIOUSB_ERROR_INVALID_PARAMETER, counters[ other ] != counters[ index ] );
+        }
+
+        tmp = (struct aio_contbuf_counters *)calloc( 1, sizeof(struct aio_contbuf_counters) );
+        AIO_ERROR_VALID_AIORET_TYPE( AIOUSB_ERROR_NOT_ENOUGH_MEMORY, tmp );
+        tmp->numCounters = numCounters;
+        tmp->select   = (unsigned short *)malloc( numCounters * sizeof(unsigned short) );
+        tmp->readings = (unsigned short *)calloc( boardCounters, sizeof(unsigned short) );
+        tmp->previous = (unsigned short *)calloc( numCounters, sizeof(unsigned short) );
+        tmp->totals   = (uint64_t *)calloc( numCounters, sizeof(uint64_t) );
+        tmp->row      = (AIOContinuousBufCounterSample *)calloc( numCounters, sizeof(AIOContinuousBufCounterSample) );
+        tmp->fifo     = NewAIOFifo( ( bufferReadings + 1 ) * numCounters * sizeof(AIOContinuousBufCounterSample),
+                                    sizeof(AIOContinuousBufCounterSample) );
+        if ( !tmp->select || !tmp->readings || !tmp->previous || !tmp->totals || !tmp->row || !tmp->fifo || !tmp->fifo->data ) {
+            _aiocontbuf_delete_counters( tmp );
+            return -AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+        }
+        memcpy( tmp->select, counters, numCounters * sizeof(unsigned short) );
+    }
+
+    AIOContinuousBufLock( buf );
+    _aiocontbuf_delete_counters( buf->counters );
+    buf->counters = tmp;
+    AIOContinuousBufUnlock( buf );
+
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Takes as many whole rows of counter readings as fit in maxSamples
+ * @return samples copied, a multiple of the number of counters, or a
+ * negative error
+ */
+AIORET_TYPE AIOContinuousBufReadCounterSamples( AIOContinuousBuf *buf, AIOContinuousBufCounterSample *samples, unsigned maxSamples )
+{
+    AIO_ASSERT_AIOCONTBUF( buf );
+    AIO_ASSERT( samples );
+    AIO_ERROR_VALID_AIORET_TYPE( AIOUSB_ERROR_NOT_SUPPORTED, buf->counters );
+    AIORET_TYPE retval;
+    struct aio_contbuf_counters *counters = buf->counters;
+    size_t rowBytes = counters->numCounters * sizeof(AIOContinuousBufCounterSample);
+
+    AIOContinuousBufLock( buf );
+    size_t rows = MIN( AIOFifoReadSize( counters->fifo ) / rowBytes, maxSamples / counters->numCounters );
+    if ( rows )
+        AIOFifoRead( counters->fifo, samples, rows * rowBytes );
+    retval = rows * counters->numCounters;
+    AIOContinuousBufUnlock( buf );
+
+    return retval;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIOContinuousBufCounterSamplesAvailable( AIOContinuousBuf *buf )
+{
+    AIO_ASSERT_AIOCONTBUF( buf );
+    AIO_ERROR_VALID_AIORET_TYPE( AIOUSB_ERROR_NOT_SUPPORTED, buf->counters );
+    AIORET_TYPE retval;
+
+    AIOContinuousBufLock( buf );
+    retval = AIOFifoReadSize( buf->counters->fifo ) / sizeof(AIOContinuousBufCounterSample);
+    AIOContinuousBufUnlock( buf );
+
+    return retval;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @return rows of counter readings dropped because the caller didn't read
+ * them in time
+ */
+AIORET_TYPE AIOContinuousBufGetCounterOverruns( AIOContinuousBuf *buf )
+{
+    AIO_ASSERT_AIOCONTBUF( buf );
+    AIO_ERROR_VALID_AIORET_TYPE( AIOUSB_ERROR_NOT_SUPPORTED, buf->counters );
+    AIORET_TYPE retval;
+
+    AIOContinuousBufLock( buf );
+    retval = buf->counters->overruns;
+    AIOContinuousBufUnlock( buf );
+
+    return retval;
+}
+
+/*----------------------------------------------------------------------------*/
 AIORET_TYPE  AIOContinuousBufForceTerminateAcqusition( AIOContinuousBuf *buf )
 {
     AIORET_TYPE retval = AIOUSB_SUCCESS;
@@ -823,9 +983,23 @@ AIORET_TYPE AIOContinuousBuf_SmartCountsToVolts( AIOContinuousBuf *buf,
     AIOUSBDevice *deviceDesc = AIODeviceTableGetDeviceAtIndex( AIOContinuousBufGetDeviceIndex(buf), (AIORESULT*)&retval );
     AIO_ERROR_VALID_AIORET_TYPE( retval, retval == AIOUSB_SUCCESS );
     int number_channels = AIOContinuousBufNumberChannels(buf);
-
+    AIOHostCalChannel *cal = NULL;
+
+    if ( deviceDesc->hostCal ) {
+        cal = (AIOHostCalChannel *)malloc( number_channels * sizeof(AIOHostCalChannel) );
+        AIO_ERROR_VALID_AIORET_TYPE( AIOUSB_ERROR_NOT_ENOUGH_MEMORY, cal );
+        if ( AIOHostCalResolve( deviceDesc->hostCal, &deviceDesc->cachedConfigBlock, 0, number_channels, cal ) != AIOUSB_SUCCESS ) {
+            free( cal );
+            return -AIOUSB_ERROR_INVALID_GAINCODE;
+        }
+    }
 
     for (unsigned ch = 0; ch < count;  ch ++ , *channel = ((*channel+1)% number_channels ) , *pos += 1 ) {
+        if ( cal ) {
+            tobuf[ *pos ] = AIOHostCalChannelToVolts( &cal[ *channel % number_channels ], data[ ch ] );
+            retval += 1;
+            continue;
+        }
         int gain = ADCConfigBlockGetGainCode( &deviceDesc->cachedConfigBlock, *channel );
         AIO_ERROR_VALID_AIORET_TYPE( AIOUSB_ERROR_INVALID_GAINCODE, gain >= AIOUSB_SUCCESS );
         struct ADRange *range = &adRanges[ gain ];
@@ -833,6 +1007,7 @@ AIORET_TYPE AIOContinuousBuf_SmartCountsToVolts( AIOContinuousBuf *buf,
         retval += 1;
     }
 
+    free( cal );
     return retval;
 } /** @endcond */
 
@@ -952,6 +1127,48 @@ AIORET_TYPE AIOContinuousBufGetTotalSamplesExpected(  AIOContinuousBuf *buf )
     return tmp;
 }
 
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Reads the selected counters and queues one row tagged with scan.
+ * The first reading of an acquisition is the baseline that later deltas
+ * and totals count from.
+ */
+static void _aiocontbuf_read_counters( AIOContinuousBuf *buf, int64_t scan, AIOUSB_BOOL baseline )
+{
+    struct aio_contbuf_counters *counters = buf->counters;
+    unsigned index;
+    if ( !counters )
+        return;
+
+    AIORESULT result = CTR_8254ReadAll( AIOContinuousBufGetDeviceIndex( buf ), counters->readings );
+    if ( result != AIOUSB_SUCCESS ) {
+        AIOUSB_ERROR("Unable to read counters: %d\n", (int)result );
+        return;
+    }
+    uint64_t ns = AIOTimeNowNs();
+    double seconds = baseline ? 0 : ( ns - counters->lastNs ) / 1e9;
+
+    for ( index = 0; index < counters->numCounters; index ++ ) {
+        unsigned short count = counters->readings[ counters->select[ index ] ];
+        if ( baseline ) {
+            counters->previous[ index ] = count;
+            counters->totals[ index ] = 0;
+        }
+        counters->row[ index ].scan = scan;
+        AIOCounterSampleUpdate( &counters->row[ index ].sample, counters->select[ index ], count,
+                                &counters->previous[ index ], &counters->totals[ index ], ns, seconds );
+    }
+    counters->lastNs = ns;
+
+    size_t rowBytes = counters->numCounters * sizeof(AIOContinuousBufCounterSample);
+    AIOContinuousBufLock( buf );
+    if ( counters->fifo->delta( counters->fifo ) >= rowBytes )
+        AIOFifoWrite( counters->fifo, counters->row, rowBytes );
+    else
+        counters->overruns ++;
+    AIOContinuousBufUnlock( buf );
+}
+
 /*----------------------------------------------------------------------------*/
 void *RawCountsWorkFunction( void *object )
 {
@@ -966,6 +1183,7 @@ void *RawCountsWorkFunction( void *object )
     unsigned char *data  = (unsigned char *)malloc( buf->block_size );
     int64_t bytes_remaining = 0;
     buf->start_scanning = AIOUSB_TRUE;
+    _aiocontbuf_read_counters( buf, 0, AIOUSB_TRUE );
 
     while ( buf->status & RUNNING  ) {
         int bytes;
@@ -992,6 +1210,7 @@ void *RawCountsWorkFunction( void *object )
                 }                
             }
             buf->bytes_processed += bytes_remaining;
+            _aiocontbuf_read_counters( buf, count / AIOContinuousBufGetNumberSamplesPerScan( buf ), AIOUSB_FALSE );
 
             AIOUSB_DEVEL("Tmpcount=%d,count=%d,Bytes=%lu, Write=%d,Read=%d,max=%d\n", tmp,count,bytes_remaining,AIOFifoWritePosition(buf->fifo) , AIOFifoReadPosition(buf->fifo), AIOFifoGetSize(buf->fifo));
 
@@ -1068,10 +1287,17 @@ void *ConvertCountsToVoltsFunction( void *object )
     cc = NewAIOCountsConverterWithScanLimiter( (unsigned short*)data, num_scans, num_channels, ranges, num_oversamples , sizeof(unsigned short)  );
     AIO_ERROR_VALID_DATA_W_CODE( &retval, free(data); retval = AIOUSB_ERROR_INVALID_COUNTS_CONVERTER, cc );
 
+    AIOUSBDeviceReadLock( dev );
+    if ( dev->hostCal )
+        retval = AIOCountsConverterSetHostCal( cc, dev->hostCal, AIOUSBDeviceGetADCConfigBlock( dev ) );
+    AIOUSBDeviceUnlock( dev );
+    AIO_ERROR_VALID_DATA_W_CODE( &retval, free(data); DeleteAIOCountsConverter( cc ), retval == AIOUSB_SUCCESS );
+
 
     /**
      * @brief create temporary buffer and then Load the fifo with values
      */
+    _aiocontbuf_read_counters( buf, 0, AIOUSB_TRUE );
    
     while ( buf->status & RUNNING  ) {
         int bytes;
@@ -1093,6 +1319,7 @@ void *ConvertCountsToVoltsFunction( void *object )
                 AIOContinuousBufForceTerminateAcqusitionOverrun(buf);
                 break;
             }
+            _aiocontbuf_read_counters( buf, count / num_channels, AIOUSB_FALSE );
 
             AIOUSB_DEVEL("Pushed %d, size: %d\n", bytes / 2 , buf->fifo->size );
             AIOUSB_DEVEL("Tmpcount=%d,count=%d,Bytes=%d, Write=%d,Read=%d,max=%d\n", retval,count,bytes,AIOFifoWritePosition(buf) , AIOFifoReadPosition(buf), AIOFifoGetSize(buf->fifo));
@@ -1177,7 +1404,9 @@ AIORET_TYPE SetConfig( AIOContinuousBuf *buf )
 
     ADCConfigBlock *config = AIOUSBDeviceGetADCConfigBlock( deviceDesc );
 
-    usb->usb_put_config( usb, config );
+    AIOUSBDeviceWriteLock( deviceDesc );
+    AIOUSBDevicePutADCConfigBlock( deviceDesc, config );
+    AIOUSBDeviceUnlock( deviceDesc );
 
     return retval;
 }
@@ -2100,8 +2329,7 @@ char *AIOContinuousBufToJSON( AIOContinuousBuf *buf )
 
 
 
-#include "AIOUSBDevice.h"
-#include "gtest/gtest.h"
+#include "mocks/mock_fake_device.h"
 
 #include <iostream>
 using namespace AIOUSB;
@@ -2634,6 +2862,63 @@ TEST(AIOContinuousBuf,CorrectCountScansAvailable)
 }
 
 
+static int contbuf_blocks = 0;
+static int fake_contbuf_control( USBDevice *usb, uint8_t request_type, uint8_t bRequest, uint16_t wValue, uint16_t wIndex,
+                                 unsigned char *data, uint16_t wLength, unsigned int timeout )
+{
+    if ( bRequest == AUR_CTR_READALL ) {
+        unsigned short *counts = (unsigned short *)data;
+        for ( int i = 0; i < wLength / 2; i ++ )
+            counts[i] = (unsigned short)( 60000 - contbuf_blocks * 700 * ( i + 1 ) );
+    }
+    return wLength;
+}
+
+static int fake_contbuf_bulk( USBDevice *usb, unsigned char endpoint, unsigned char *data, int length, int *actual_length, unsigned int timeout )
+{
+    memset( data, 0, length );
+    contbuf_blocks ++;
+    *actual_length = length;
+    return LIBUSB_SUCCESS;
+}
+
+class AIOContinuousBufFakeBoard : public MockFakeDeviceTest {};
+
+TEST_F(AIOContinuousBufFakeBoard, PolledCountersAreTaggedWithScans )
+{
+    contbuf_blocks = 0;
+    ASSERT_TRUE( AddFakeDevice( USB_AIO16_16A, fake_contbuf_control, fake_contbuf_bulk ) );
+
+    /* 4 channels, 1024 scans per 8K block, 4 blocks */
+    AIOContinuousBuf *buf = NewAIOContinuousBufForCounts( 0, 4096, 4 );
+    AIOContinuousBufSetStreamingBlockSize( buf, 8192 );
+    unsigned short counters[] = { 2, 0 };
+    unsigned short missing[] = { 3 };
+    EXPECT_EQ( -AIOUSB_ERROR_INVALID_PARAMETER, AIOContinuousBufSetPolledCounters( buf, missing, 1, 16 ) ) << "one 8254, counters 0 to 2";
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOContinuousBufSetPolledCounters( buf, counters, 2, 16 ) );
+
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOContinuousBufStart( buf ) );
+    pthread_join( buf->worker, NULL );
+    EXPECT_EQ( 4, contbuf_blocks );
+
+    AIOContinuousBufCounterSample samples[ 32 ];
+    EXPECT_EQ( 10, AIOContinuousBufCounterSamplesAvailable( buf ) );
+    ASSERT_EQ( 10, AIOContinuousBufReadCounterSamples( buf, samples, 31 ) );
+    for ( int row = 0; row < 5; row ++ ) {
+        for ( int i = 0; i < 2; i ++ ) {
+            AIOContinuousBufCounterSample *s = &samples[ row * 2 + i ];
+            unsigned long step = 700ul * ( counters[i] + 1 );
+            EXPECT_EQ( row * 1024, s->scan );
+            EXPECT_EQ( counters[i], s->sample.counter );
+            EXPECT_EQ( row ? step : 0, s->sample.delta );
+            EXPECT_EQ( step * row, s->sample.total );
+        }
+    }
+    EXPECT_EQ( 0, AIOContinuousBufReadCounterSamples( buf, samples, 32 ) );
+    EXPECT_EQ( 0, AIOContinuousBufGetCounterOverruns( buf ) );
+
+    DeleteAIOContinuousBuf( buf );
+}
 
 #include <unistd.h>
 #include <stdio.h>
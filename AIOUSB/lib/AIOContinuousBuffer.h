@@ -18,6 +18,7 @@
 #include "AIOUSB_Core.h"
 #include "AIOBuf.h"
 #include "AIOCmd.h"
+#include "AIOCounterStream.h"
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -35,6 +36,17 @@ namespace AIOUSB
 
 typedef void *(*AIOUSB_WorkFn)( void *obj );
 
+/**
+ * @brief One counter reading polled by the host during an acquisition,
+ * see AIOContinuousBufSetPolledCounters()
+ */
+typedef struct AIOContinuousBufCounterSample {
+    int64_t scan;                       /**< scans that had reached the host when the counters were read, best effort */
+    AIOCounterSample sample;
+} AIOContinuousBufCounterSample;
+
+struct aio_contbuf_counters;
+
  typedef enum {
      AIO_CONT_BUF_TYPE_COUNTS = 2,
      AIO_CONT_BUF_TYPE_VOLTS = 8,
@@ -91,6 +103,7 @@ typedef struct AIOContinuousBuf {
     AIOUSB_BOOL testing;
     AIOUSB_BOOL debug;
     AIOChannelMask *mask;               /**< Used for keeping track of channels */
+    struct aio_contbuf_counters *counters; /**< counters read between bulk blocks, NULL for none */
 
     volatile THREAD_STATUS status; /* Are we running, paused ..etc; */
     AIO_CONT_BUF_TYPE type;
@@ -246,6 +259,11 @@ PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufSetVoltsBuffer( AIOContinuousBuf *buf
 
 PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufCountScansAvailable(AIOContinuousBuf *buf);
 
+PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufSetPolledCounters( AIOContinuousBuf *buf, const unsigned short *counters, unsigned numCounters, unsigned bufferReadings );
+PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufReadCounterSamples( AIOContinuousBuf *buf, AIOContinuousBufCounterSample *samples, unsigned maxSamples );
+PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufCounterSamplesAvailable( AIOContinuousBuf *buf );
+PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufGetCounterOverruns( AIOContinuousBuf *buf );
+
 PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufSetClock( AIOContinuousBuf *buf, unsigned int hz );
 PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufGetClock( AIOContinuousBuf *buf );
 PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufEnd( AIOContinuousBuf *buf );
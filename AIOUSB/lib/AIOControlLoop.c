@@ -0,0 +1,466 @@
+/**
+ * @file   AIOControlLoop.c
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  Fixed-rate A/D read, compute, D/A write loops
+ *
+ * A PID loop built from ADC_GetScanV() and DACDirect() fetches and
+ * restores the A/D configuration on every pass and runs on whatever
+ * thread and timing the caller manages, so both its latency and its
+ * jitter are hard to bound. AIOControlLoop keeps an AIOPreparedScan and
+ * an AIODACPreparedUpdate for the whole run and paces the iterations
+ * against absolute CLOCK_MONOTONIC deadlines, so a late iteration
+ * doesn't push all the later ones back.
+ */
+
+#include "AIOControlLoop.h"
+#include "AIOUSB_Core.h"
+#include "AIODeviceTable.h"
+#include "AIOUSBDevice.h"
+#include "AIOTime.h"
+
+#include <errno.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __cplusplus
+namespace AIOUSB {
+#endif
+
+/*----------------------------------------------------------------------------*/
+static unsigned _aio_control_loop_bin( uint64_t latencyNs )
+{
+    uint64_t us = latencyNs / 1000;
+    unsigned bin = 0;
+    while ( us >= 2 && bin < AIO_CONTROL_LOOP_HISTOGRAM_BINS - 1 ) {
+        us >>= 1;
+        bin ++;
+    }
+    return bin;
+}
+
+/*----------------------------------------------------------------------------*/
+static void *_aio_control_loop_thread( void *arg )
+{
+    AIOControlLoop *loop = (AIOControlLoop *)arg;
+    AIORESULT result = AIOUSB_SUCCESS;
+    uint64_t next;
+
+    if ( loop->priority > 0 ) {
+        struct sched_param param;
+        memset( &param, 0, sizeof(param) );
+        param.sched_priority = loop->priority;
+        if ( pthread_setschedparam( pthread_self(), SCHED_FIFO, &param ) == 0 ) {
+            pthread_mutex_lock( &loop->lock );
+            loop->realtime = AIOUSB_TRUE;
+            pthread_mutex_unlock( &loop->lock );
+        }
+    }
+
+    next = AIOTimeNowNs();
+    while ( !__atomic_load_n( &loop->quit, __ATOMIC_ACQUIRE ) ) {
+        struct timespec deadline;
+        AIOTimeToTimespec( &deadline, next );
+        while ( clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL ) == EINTR )
+            ;
+
+        uint64_t start = AIOTimeNowNs();
+        AIORET_TYPE retval = AIOPreparedScanGetScanV( loop->scan, loop->volts );
+        if ( retval >= AIOUSB_SUCCESS )
+            retval = loop->callback( loop->volts, loop->counts, loop->userdata );
+        if ( retval >= AIOUSB_SUCCESS )
+            retval = AIODACPreparedUpdateWrite( loop->update, loop->counts );
+        if ( retval < AIOUSB_SUCCESS ) {
+            result = (AIORESULT)-retval;
+            break;
+        }
+        uint64_t end = AIOTimeNowNs();
+
+        uint64_t missed = 0;
+        next += loop->periodNs;
+        if ( end > next ) {
+            missed = ( end - next ) / loop->periodNs + 1;
+            next += missed * loop->periodNs;
+        }
+
+        pthread_mutex_lock( &loop->lock );
+        loop->iterations ++;
+        loop->missedDeadlines += missed;
+        loop->histogram[ _aio_control_loop_bin( end - start ) ] ++;
+        if ( end - start > loop->maxLatencyNs )
+            loop->maxLatencyNs = end - start;
+        pthread_mutex_unlock( &loop->lock );
+    }
+
+    pthread_mutex_lock( &loop->lock );
+    loop->result = result;
+    pthread_mutex_unlock( &loop->lock );
+
+    return NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Prepares a loop that scans the board's current A/D channel range
+ * and drives dacChannels from callback
+ * @param DeviceIndex
+ * @param dacChannels DAC numbers, each at most once
+ * @param numDACs
+ * @param callback
+ * @param userdata passed to callback
+ * @return the new loop, or NULL with aio_errno set
+ */
+AIOControlLoop *NewAIOControlLoop( unsigned long DeviceIndex,
+                                   const unsigned short *dacChannels,
+                                   unsigned numDACs,
+                                   AIOControlLoopCallback callback,
+                                   void *userdata )
+{
+    AIORESULT result = AIOUSB_SUCCESS;
+    AIOControlLoop *loop = NULL;
+    AIOUSBDevice *deviceDesc = AIODeviceTableGetDeviceAtIndex( DeviceIndex, &result );
+    if ( result != AIOUSB_SUCCESS )
+        goto err_NewAIOControlLoop;
+    if ( !callback ) {
+        result = AIOUSB_ERROR_INVALID_PARAMETER;
+        goto err_NewAIOControlLoop;
+    }
+
+    loop = (AIOControlLoop *)calloc( 1, sizeof(AIOControlLoop) );
+    if ( !loop ) {
+        result = AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+        goto err_NewAIOControlLoop;
+    }
+    loop->DeviceIndex = DeviceIndex;
+    loop->callback    = callback;
+    loop->userdata    = userdata;
+    loop->result      = AIOUSB_SUCCESS;
+
+    loop->update = NewAIODACPreparedUpdate( DeviceIndex, dacChannels, numDACs );
+    if ( !loop->update ) {
+        result = (AIORESULT)-aio_errno;
+        goto err_NewAIOControlLoop;
+    }
+    loop->scan = NewAIOPreparedScan( DeviceIndex );
+    if ( !loop->scan ) {
+        result = (AIORESULT)-aio_errno;
+        goto err_NewAIOControlLoop;
+    }
+    loop->volts  = (double *)calloc( deviceDesc->ADCMUXChannels, sizeof(double) );
+    loop->counts = (unsigned short *)calloc( numDACs, sizeof(unsigned short) );
+    if ( !loop->volts || !loop->counts ) {
+        result = AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+        goto err_NewAIOControlLoop;
+    }
+    pthread_mutex_init( &loop->lock, NULL );
+
+    return loop;
+
+ err_NewAIOControlLoop:
+    if ( loop ) {
+        if ( loop->scan )
+            DeleteAIOPreparedScan( loop->scan );
+        if ( loop->update )
+            DeleteAIODACPreparedUpdate( loop->update );
+        free( loop->volts );
+        free( loop->counts );
+        free( loop );
+    }
+    aio_errno = -result;
+    return NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Stops the loop, puts the board's A/D configuration back and frees
+ * the loop
+ */
+AIORET_TYPE DeleteAIOControlLoop( AIOControlLoop *loop )
+{
+    AIO_ASSERT( loop );
+
+    AIOControlLoopStop( loop );
+    AIORET_TYPE retval = DeleteAIOPreparedScan( loop->scan );
+    DeleteAIODACPreparedUpdate( loop->update );
+    pthread_mutex_destroy( &loop->lock );
+    free( loop->volts );
+    free( loop->counts );
+    free( loop );
+
+    return retval;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Starts iterating every periodUs microseconds, beginning at once.
+ * Statistics start over.
+ * @param loop
+ * @param periodUs
+ * @param priority SCHED_FIFO priority for the loop's thread, or 0 for the
+ * normal scheduler. If the process may not use SCHED_FIFO the loop runs
+ * anyway; AIOControlLoopIsRealtime() tells.
+ */
+AIORET_TYPE AIOControlLoopStart( AIOControlLoop *loop, unsigned long periodUs, int priority )
+{
+    AIO_ASSERT( loop );
+    AIO_ASSERT( periodUs );
+    AIO_ERROR_VALID_AIORET_TYPE( AIOUSB_ERROR_INVALID_THREAD, !loop->started );
+
+    loop->periodNs        = (uint64_t)periodUs * 1000;
+    loop->priority        = priority;
+    loop->realtime        = AIOUSB_FALSE;
+    loop->iterations      = 0;
+    loop->missedDeadlines = 0;
+    loop->maxLatencyNs    = 0;
+    memset( loop->histogram, 0, sizeof(loop->histogram) );
+    loop->result = AIOUSB_SUCCESS;
+    loop->quit   = AIOUSB_FALSE;
+    if ( pthread_create( &loop->thread, NULL, _aio_control_loop_thread, loop ) != 0 )
+        return -AIOUSB_ERROR_INVALID_THREAD;
+    loop->started = AIOUSB_TRUE;
+
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Stops after the iteration in progress
+ * @return AIOUSB_SUCCESS, or the negated error that stopped the loop early,
+ * including a callback's own
+ */
+AIORET_TYPE AIOControlLoopStop( AIOControlLoop *loop )
+{
+    AIO_ASSERT( loop );
+    if ( !loop->started )
+        return AIOUSB_SUCCESS;
+
+    __atomic_store_n( &loop->quit, AIOUSB_TRUE, __ATOMIC_RELEASE );
+    pthread_join( loop->thread, NULL );
+    loop->started = AIOUSB_FALSE;
+
+    return -(AIORET_TYPE)loop->result;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIOControlLoopGetIterations( AIOControlLoop *loop )
+{
+    AIO_ASSERT( loop );
+    AIORET_TYPE retval;
+
+    pthread_mutex_lock( &loop->lock );
+    retval = (AIORET_TYPE)loop->iterations;
+    pthread_mutex_unlock( &loop->lock );
+
+    return retval;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIOControlLoopGetMissedDeadlines( AIOControlLoop *loop )
+{
+    AIO_ASSERT( loop );
+    AIORET_TYPE retval;
+
+    pthread_mutex_lock( &loop->lock );
+    retval = (AIORET_TYPE)loop->missedDeadlines;
+    pthread_mutex_unlock( &loop->lock );
+
+    return retval;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @return the longest iteration so far, in nanoseconds
+ */
+AIORET_TYPE AIOControlLoopGetMaxLatency( AIOControlLoop *loop )
+{
+    AIO_ASSERT( loop );
+    AIORET_TYPE retval;
+
+    pthread_mutex_lock( &loop->lock );
+    retval = (AIORET_TYPE)loop->maxLatencyNs;
+    pthread_mutex_unlock( &loop->lock );
+
+    return retval;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Copies the first numBins bins of the latency histogram
+ * @return bins copied
+ */
+AIORET_TYPE AIOControlLoopGetHistogram( AIOControlLoop *loop, uint64_t *bins, unsigned numBins )
+{
+    AIO_ASSERT( loop );
+    AIO_ASSERT( bins );
+    if ( numBins > AIO_CONTROL_LOOP_HISTOGRAM_BINS )
+        numBins = AIO_CONTROL_LOOP_HISTOGRAM_BINS;
+
+    pthread_mutex_lock( &loop->lock );
+    memcpy( bins, loop->histogram, numBins * sizeof(uint64_t) );
+    pthread_mutex_unlock( &loop->lock );
+
+    return numBins;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIOControlLoopIsRealtime( AIOControlLoop *loop )
+{
+    AIO_ASSERT( loop );
+    AIORET_TYPE retval;
+
+    pthread_mutex_lock( &loop->lock );
+    retval = loop->realtime ? AIOUSB_TRUE : AIOUSB_FALSE;
+    pthread_mutex_unlock( &loop->lock );
+
+    return retval;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+/*****************************************************************************
+ * Self-test
+ ****************************************************************************/
+
+#ifdef SELF_TEST
+
+#include "AIOUSB_ADC.h"
+#include "mocks/mock_fake_device.h"
+#include <unistd.h>
+
+using namespace AIOUSB;
+
+static volatile int dac_writes = 0;
+static volatile unsigned short last_dac_count = 0;
+static volatile int slow_every = 0;
+
+static int fake_control( USBDevice *usb, uint8_t request_type, uint8_t bRequest, uint16_t wValue, uint16_t wIndex,
+                         unsigned char *data, uint16_t wLength, unsigned int timeout )
+{
+    if ( bRequest == AUR_DAC_IMMEDIATE ) {
+        last_dac_count = (unsigned short)( data[1] | ( data[2] << 8 ) );
+        dac_writes ++;
+        if ( slow_every && dac_writes % slow_every == 0 )
+            usleep( 5000 );
+    }
+    return wLength;
+}
+
+static int fake_bulk( USBDevice *usb, unsigned char endpoint, unsigned char *data, int length, int *actual_length, unsigned int timeout )
+{
+    unsigned short *samples = (unsigned short *)data;
+    for ( int i = 0; i < length / (int)sizeof(unsigned short); i ++ )
+        samples[i] = 0x8000;
+    *actual_length = length;
+    return LIBUSB_SUCCESS;
+}
+
+static AIORET_TYPE follow_input( const double *volts, unsigned short *counts, void *userdata )
+{
+    int *calls = (int *)userdata;
+    (*calls) ++;
+    counts[0] = (unsigned short)( volts[0] >= 0 ? 1234 : 4321 );
+    return AIOUSB_SUCCESS;
+}
+
+static AIORET_TYPE give_up( const double *volts, unsigned short *counts, void *userdata )
+{
+    return -AIOUSB_ERROR_INVALID_DATA;
+}
+
+class ControlLoopSetup : public MockFakeDeviceTest
+{
+ protected:
+    virtual void SetUp() {
+        MockFakeDeviceTest::SetUp();
+        dac_writes = 0;
+        slow_every = 0;
+        dev = AddFakeDevice( USB_AIO16_16A, fake_control, fake_bulk );
+        dev->discardFirstSample = AIOUSB_FALSE;
+        ASSERT_EQ( AIOUSB_SUCCESS, (int)ReadConfigBlock( 0, AIOUSB_FALSE ));
+        ADCConfigBlockSetScanRange( &dev->cachedConfigBlock, 0, 3 );
+        ADCConfigBlockSetOversample( &dev->cachedConfigBlock, 0 );
+    }
+    AIOUSBDevice *dev;
+};
+
+TEST_F(ControlLoopSetup,ReadsComputesAndWritesEachPeriod)
+{
+    int calls = 0;
+    unsigned short dacs[] = { 0 };
+    AIOControlLoop *loop = NewAIOControlLoop( 0, dacs, 1, follow_input, &calls );
+    ASSERT_TRUE( loop );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOControlLoopStart( loop, 1000, 0 ) );
+    while ( AIOControlLoopGetIterations( loop ) < 50 )
+        usleep( 1000 );
+    EXPECT_EQ( AIOUSB_SUCCESS, AIOControlLoopStop( loop ) );
+
+    AIORET_TYPE iterations = AIOControlLoopGetIterations( loop );
+    EXPECT_EQ( iterations, calls );
+    EXPECT_EQ( iterations, dac_writes );
+    EXPECT_EQ( 1234, last_dac_count );
+    EXPECT_FALSE( AIOControlLoopIsRealtime( loop ) );
+
+    uint64_t bins[ AIO_CONTROL_LOOP_HISTOGRAM_BINS ];
+    EXPECT_EQ( AIO_CONTROL_LOOP_HISTOGRAM_BINS, AIOControlLoopGetHistogram( loop, bins, 100 ) );
+    uint64_t total = 0;
+    for ( int i = 0; i < AIO_CONTROL_LOOP_HISTOGRAM_BINS; i ++ )
+        total += bins[i];
+    EXPECT_EQ( (uint64_t)iterations, total );
+    EXPECT_GT( AIOControlLoopGetMaxLatency( loop ), 0 );
+
+    EXPECT_EQ( AIOUSB_SUCCESS, DeleteAIOControlLoop( loop ) );
+}
+
+TEST_F(ControlLoopSetup,CountsMissedDeadlines)
+{
+    int calls = 0;
+    unsigned short dacs[] = { 1 };
+    slow_every = 10;
+    AIOControlLoop *loop = NewAIOControlLoop( 0, dacs, 1, follow_input, &calls );
+    ASSERT_TRUE( loop );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOControlLoopStart( loop, 1000, 0 ) );
+    while ( AIOControlLoopGetIterations( loop ) < 40 )
+        usleep( 1000 );
+    EXPECT_EQ( AIOUSB_SUCCESS, AIOControlLoopStop( loop ) );
+
+    EXPECT_GE( AIOControlLoopGetMissedDeadlines( loop ), 3 * 4 ) << "each 5 ms stall skips at least four 1 ms periods";
+    EXPECT_GE( AIOControlLoopGetMaxLatency( loop ), 5000000 );
+    uint64_t bins[ AIO_CONTROL_LOOP_HISTOGRAM_BINS ];
+    AIOControlLoopGetHistogram( loop, bins, AIO_CONTROL_LOOP_HISTOGRAM_BINS );
+    EXPECT_GE( bins[12], 3u ) << "5 ms lands in the 4096-8191 us bin";
+
+    DeleteAIOControlLoop( loop );
+}
+
+TEST_F(ControlLoopSetup,CallbackErrorStopsTheLoop)
+{
+    unsigned short dacs[] = { 0, 1 };
+    AIOControlLoop *loop = NewAIOControlLoop( 0, dacs, 2, give_up, NULL );
+    ASSERT_TRUE( loop );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOControlLoopStart( loop, 500, 0 ) );
+    usleep( 20000 );
+    EXPECT_EQ( -AIOUSB_ERROR_INVALID_DATA, AIOControlLoopStop( loop ) );
+    EXPECT_EQ( 0, AIOControlLoopGetIterations( loop ) );
+    EXPECT_EQ( 0, dac_writes );
+    DeleteAIOControlLoop( loop );
+
+    unsigned short bad[] = { 2 };
+    EXPECT_FALSE( NewAIOControlLoop( 0, bad, 1, give_up, NULL ) ) << "USB-AIO16-16A has two DACs";
+}
+
+int main(int argc, char *argv[] )
+{
+    testing::InitGoogleTest(&argc, argv);
+    testing::TestEventListeners & listeners = testing::UnitTest::GetInstance()->listeners();
+#ifdef GTEST_TAP_PRINT_TO_STDOUT
+    delete listeners.Release(listeners.default_result_printer());
+#endif
+
+    return RUN_ALL_TESTS();
+}
+
+#endif
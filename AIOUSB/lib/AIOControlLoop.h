@@ -0,0 +1,84 @@
+/**
+ * @file   AIOControlLoop.h
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  Fixed-rate A/D read, compute, D/A write loops
+ *
+ */
+
+#ifndef _AIO_CONTROL_LOOP_H
+#define _AIO_CONTROL_LOOP_H
+
+#include "AIOTypes.h"
+#include "AIOPreparedScan.h"
+#include "AIODACPreparedUpdate.h"
+#include <pthread.h>
+#include <stdint.h>
+
+#ifdef __aiousb_cplusplus
+namespace AIOUSB
+{
+#endif
+
+#define AIO_CONTROL_LOOP_HISTOGRAM_BINS 32
+
+/**
+ * @brief Called once per iteration with the fresh scan. volts is indexed
+ * by A/D channel; fill counts, one per DAC given to NewAIOControlLoop()
+ * and in that order. A negative return stops the loop with that error.
+ */
+typedef AIORET_TYPE (*AIOControlLoopCallback)( const double *volts, unsigned short *counts, void *userdata );
+
+/**
+ * @brief AIOControlLoop runs read, callback, write at a fixed period from
+ * its own thread, optionally under SCHED_FIFO. The scan and the DAC write
+ * are prepared once, so an iteration is only the USB transfers and the
+ * caller's arithmetic.
+ *
+ * Latency, from the start of the read to the end of the write, is kept
+ * in a histogram of power-of-two microsecond bins: bin 0 counts
+ * iterations under 2 us, bin n those from 2^n up to 2^(n+1) us. An
+ * iteration that ends after the next one should have started is a
+ * missed deadline; periods that went by entirely are skipped, not made
+ * up, and counted as missed too.
+ */
+typedef struct AIOControlLoop {
+    unsigned long DeviceIndex;
+    AIOPreparedScan *scan;
+    AIODACPreparedUpdate *update;
+    AIOControlLoopCallback callback;
+    void *userdata;
+    double *volts;                      /**< one per A/D channel of the board */
+    unsigned short *counts;             /**< one per DAC */
+    uint64_t periodNs;
+    int priority;                       /**< SCHED_FIFO priority asked for, 0 for none */
+    AIOUSB_BOOL realtime;               /**< the thread got it */
+    pthread_t thread;
+    pthread_mutex_t lock;               /**< guards the statistics below */
+    AIOUSB_BOOL started;
+    AIOUSB_BOOL quit;                   /**< atomic; the thread polls it between iterations */
+    AIORESULT result;                   /**< why the thread stopped early */
+    uint64_t iterations;
+    uint64_t missedDeadlines;
+    uint64_t maxLatencyNs;
+    uint64_t histogram[ AIO_CONTROL_LOOP_HISTOGRAM_BINS ];
+} AIOControlLoop;
+
+/* BEGIN AIOUSB_API */
+PUBLIC_EXTERN AIOControlLoop *NewAIOControlLoop( unsigned long DeviceIndex, const unsigned short *dacChannels, unsigned numDACs, AIOControlLoopCallback callback, void *userdata );
+PUBLIC_EXTERN AIORET_TYPE DeleteAIOControlLoop( AIOControlLoop *loop );
+PUBLIC_EXTERN AIORET_TYPE AIOControlLoopStart( AIOControlLoop *loop, unsigned long periodUs, int priority );
+PUBLIC_EXTERN AIORET_TYPE AIOControlLoopStop( AIOControlLoop *loop );
+PUBLIC_EXTERN AIORET_TYPE AIOControlLoopGetIterations( AIOControlLoop *loop );
+PUBLIC_EXTERN AIORET_TYPE AIOControlLoopGetMissedDeadlines( AIOControlLoop *loop );
+PUBLIC_EXTERN AIORET_TYPE AIOControlLoopGetMaxLatency( AIOControlLoop *loop );
+PUBLIC_EXTERN AIORET_TYPE AIOControlLoopGetHistogram( AIOControlLoop *loop, uint64_t *bins, unsigned numBins );
+PUBLIC_EXTERN AIORET_TYPE AIOControlLoopIsRealtime( AIOControlLoop *loop );
+/* END AIOUSB_API */
+
+#ifdef __aiousb_cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,502 @@
+/**
+ * @file   AIOCounterStream.c
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  Fixed-rate 8254 counter sampling through a ring buffer
+ *
+ * Monitoring counters meant a caller loop around CTR_8254ReadAll(), one
+ * control transfer a poll at whatever rate the loop managed, and
+ * working out rates and rollovers by hand. AIOCounterStream does the
+ * polling from a thread paced against absolute CLOCK_MONOTONIC
+ * deadlines and hands back timestamped deltas, totals and frequencies
+ * for all the selected counters through one ring.
+ */
+
+#include "AIOCounterStream.h"
+#include "AIOUSB_CTR.h"
+#include "AIODeviceTable.h"
+#include "AIOUSB_Core.h"
+#include "AIOTime.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __cplusplus
+namespace AIOUSB {
+#endif
+
+/*----------------------------------------------------------------------------*/
+static size_t _aio_counter_stream_row_bytes( AIOCounterStream *stream )
+{
+    return stream->numCounters * sizeof(AIOCounterSample);
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Fills in one counter's sample from a fresh reading and advances
+ * its previous reading and running total. The 8254 counts down, so the
+ * delta is previous minus count, modulo 65536.
+ * @param sample
+ * @param counter counter number counting across blocks
+ * @param count what the 8254 read
+ * @param previous the counter's last reading, updated to count
+ * @param total the counter's running total, updated by the delta
+ * @param timestampNs CLOCK_MONOTONIC when the counters were read
+ * @param seconds since the previous reading, 0 leaves hz at 0
+ */
+void AIOCounterSampleUpdate( AIOCounterSample *sample, unsigned counter, unsigned short count,
+                             unsigned short *previous, uint64_t *total, uint64_t timestampNs, double seconds )
+{
+    unsigned short delta = (unsigned short)( *previous - count );
+    *previous = count;
+    *total += delta;
+
+    sample->timestampNs = timestampNs;
+    sample->counter     = counter;
+    sample->count       = count;
+    sample->delta       = delta;
+    sample->total       = *total;
+    sample->hz          = seconds > 0 ? delta / seconds : 0;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Reads the board once a period and queues a row. The read runs
+ * without the lock so readers are never held up by the bus.
+ */
+static void *_aio_counter_stream_sampler( void *arg )
+{
+    AIOCounterStream *stream = (AIOCounterStream *)arg;
+    AIORESULT result;
+    uint64_t next, last;
+    unsigned index;
+
+    result = CTR_8254ReadAll( stream->DeviceIndex, stream->readings );
+    last = AIOTimeNowNs();
+    for ( index = 0; index < stream->numCounters; index ++ ) {
+        stream->previous[ index ] = stream->readings[ stream->counters[ index ] ];
+        stream->totals[ index ] = 0;
+    }
+
+    next = last;
+    while ( result == AIOUSB_SUCCESS && !stream->quit ) {
+        struct timespec deadline;
+        next += stream->periodNs;
+        AIOTimeToTimespec( &deadline, next );
+        while ( clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL ) == EINTR )
+            ;
+        if ( stream->quit )
+            break;
+
+        result = CTR_8254ReadAll( stream->DeviceIndex, stream->readings );
+        if ( result != AIOUSB_SUCCESS )
+            break;
+        uint64_t now = AIOTimeNowNs();
+        double seconds = ( now - last ) / 1e9;
+
+        for ( index = 0; index < stream->numCounters; index ++ )
+            AIOCounterSampleUpdate( &stream->row[ index ], stream->counters[ index ],
+                                    stream->readings[ stream->counters[ index ] ],
+                                    &stream->previous[ index ], &stream->totals[ index ], now, seconds );
+        last = now;
+
+        uint64_t missed = 0;
+        if ( now > next + stream->periodNs ) {
+            missed = ( now - next ) / stream->periodNs;
+            next += missed * stream->periodNs;
+        }
+
+        pthread_mutex_lock( &stream->lock );
+        if ( (size_t)stream->fifo->delta( stream->fifo ) >= _aio_counter_stream_row_bytes( stream ) )
+            AIOFifoWrite( stream->fifo, stream->row, _aio_counter_stream_row_bytes( stream ) );
+        else
+            stream->overruns ++;
+        stream->rows ++;
+        stream->missedPeriods += missed;
+        pthread_cond_broadcast( &stream->changed );
+        pthread_mutex_unlock( &stream->lock );
+    }
+
+    pthread_mutex_lock( &stream->lock );
+    stream->result  = result;
+    stream->running = AIOUSB_FALSE;
+    pthread_cond_broadcast( &stream->changed );
+    pthread_mutex_unlock( &stream->lock );
+
+    return NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Prepares a stream of the given counters
+ * @param DeviceIndex
+ * @param counters counter numbers counting across blocks, e.g. 0 to 14 on
+ * a USB-CTR-15, each at most once
+ * @param numCounters
+ * @param bufferRows how many samplings the ring holds
+ * @return the new stream, or NULL with aio_errno set
+ */
+AIOCounterStream *NewAIOCounterStream( unsigned long DeviceIndex,
+                                       const unsigned short *counters,
+                                       unsigned numCounters,
+                                       unsigned long bufferRows )
+{
+    AIORESULT result = AIOUSB_SUCCESS;
+    AIOCounterStream *stream = NULL;
+    pthread_condattr_t attr;
+    unsigned index, other;
+    AIOUSBDevice *deviceDesc = AIODeviceTableGetDeviceAtIndex( DeviceIndex, &result );
+    if ( result != AIOUSB_SUCCESS )
+        goto err_NewAIOCounterStream;
+    if ( deviceDesc->Counters == 0 ) {
+        result = AIOUSB_ERROR_NOT_SUPPORTED;
+        goto err_NewAIOCounterStream;
+    }
+    if ( !counters || numCounters == 0 || bufferRows == 0 ) {
+        result = AIOUSB_ERROR_INVALID_PARAMETER;
+        goto err_NewAIOCounterStream;
+    }
+    for ( index = 0; index < numCounters; index ++ ) {
+        if ( counters[ index ] >= deviceDesc->Counters * COUNTERS_PER_BLOCK ) {
+            result = AIOUSB_ERROR_INVALID_PARAMETER;
+            goto err_NewAIOCounterStream;
+        }
+        for ( other = 0; other < index; other ++ ) {
+            if ( counters[ other ] == counters[ index ] ) {
+                result = AIOUSB_ERROR_INVALID_PARAMETER;
+                goto err_NewAIOCounterStream;
+            }
+        }
+    }
+
+    stream = (AIOCounterStream *)calloc( 1, sizeof(AIOCounterStream) );
+    if ( !stream ) {
+        result = AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+        goto err_NewAIOCounterStream;
+    }
+    stream->DeviceIndex   = DeviceIndex;
+    stream->numCounters   = numCounters;
+    stream->boardCounters = deviceDesc->Counters * COUNTERS_PER_BLOCK;
+    stream->bufferRows    = bufferRows;
+    stream->result        = AIOUSB_SUCCESS;
+    stream->counters = (unsigned short *)malloc( numCounters * sizeof(unsigned short) );
+    stream->readings = (unsigned short *)calloc( stream->boardCounters, sizeof(unsigned short) );
+    stream->previous = (unsigned short *)calloc( numCounters, sizeof(unsigned short) );
+    stream->totals   = (uint64_t *)calloc( numCounters, sizeof(uint64_t) );
+    stream->row      = (AIOCounterSample *)calloc( numCounters, sizeof(AIOCounterSample) );
+    stream->fifo     = NewAIOFifo( ( bufferRows + 1 ) * _aio_counter_stream_row_bytes( stream ), sizeof(AIOCounterSample) );
+    if ( !stream->counters || !stream->readings || !stream->previous || !stream->totals ||
+         !stream->row || !stream->fifo || !stream->fifo->data ) {
+        result = AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+        goto err_NewAIOCounterStream;
+    }
+    memcpy( stream->counters, counters, numCounters * sizeof(unsigned short) );
+
+    pthread_mutex_init( &stream->lock, NULL );
+    pthread_condattr_init( &attr );
+    pthread_condattr_setclock( &attr, CLOCK_MONOTONIC );
+    pthread_cond_init( &stream->changed, &attr );
+    pthread_condattr_destroy( &attr );
+
+    return stream;
+
+ err_NewAIOCounterStream:
+    if ( stream ) {
+        if ( stream->fifo )
+            DeleteAIOFifo( stream->fifo );
+        free( stream->counters );
+        free( stream->readings );
+        free( stream->previous );
+        free( stream->totals );
+        free( stream->row );
+        free( stream );
+    }
+    aio_errno = -result;
+    return NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE DeleteAIOCounterStream( AIOCounterStream *stream )
+{
+    AIO_ASSERT( stream );
+
+    AIOCounterStreamStop( stream );
+    DeleteAIOFifo( stream->fifo );
+    free( stream->counters );
+    free( stream->readings );
+    free( stream->previous );
+    free( stream->totals );
+    free( stream->row );
+    pthread_mutex_destroy( &stream->lock );
+    pthread_cond_destroy( &stream->changed );
+    free( stream );
+
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Takes a baseline reading and starts sampling every periodUs
+ * microseconds. The ring and the statistics start over; totals count from
+ * the baseline.
+ */
+AIORET_TYPE AIOCounterStreamStart( AIOCounterStream *stream, unsigned long periodUs )
+{
+    AIO_ASSERT( stream );
+    AIO_ASSERT( periodUs );
+    AIO_ERROR_VALID_AIORET_TYPE( AIOUSB_ERROR_INVALID_THREAD, !stream->started );
+
+    AIOFifoReset( stream->fifo );
+    stream->periodNs      = (uint64_t)periodUs * 1000;
+    stream->rows          = 0;
+    stream->overruns      = 0;
+    stream->missedPeriods = 0;
+    stream->result  = AIOUSB_SUCCESS;
+    stream->quit    = AIOUSB_FALSE;
+    stream->running = AIOUSB_TRUE;
+    if ( pthread_create( &stream->thread, NULL, _aio_counter_stream_sampler, stream ) != 0 ) {
+        stream->running = AIOUSB_FALSE;
+        return -AIOUSB_ERROR_INVALID_THREAD;
+    }
+    stream->started = AIOUSB_TRUE;
+
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Stops sampling. Rows already queued stay readable.
+ * @return AIOUSB_SUCCESS, or the negated error that stopped the thread early
+ */
+AIORET_TYPE AIOCounterStreamStop( AIOCounterStream *stream )
+{
+    AIO_ASSERT( stream );
+    if ( !stream->started )
+        return AIOUSB_SUCCESS;
+
+    pthread_mutex_lock( &stream->lock );
+    stream->quit = AIOUSB_TRUE;
+    pthread_mutex_unlock( &stream->lock );
+
+    pthread_join( stream->thread, NULL );
+    stream->started = AIOUSB_FALSE;
+
+    return -(AIORET_TYPE)stream->result;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Takes as many whole rows as fit in maxSamples out of the ring,
+ * waiting for one if the ring is empty
+ * @param stream
+ * @param samples
+ * @param maxSamples at least the number of selected counters
+ * @param timeout milliseconds to wait, 0 waits for as long as it takes
+ * @return samples copied, a multiple of the number of counters; 0 once a
+ * stopped stream is drained, or a negative error; -AIOUSB_ERROR_TIMEOUT
+ * if nothing arrived in time
+ */
+AIORET_TYPE AIOCounterStreamRead( AIOCounterStream *stream, AIOCounterSample *samples, unsigned long maxSamples, unsigned timeout )
+{
+    AIO_ASSERT( stream );
+    AIO_ASSERT( samples );
+    AIO_ASSERT( maxSamples >= stream->numCounters );
+
+    AIORET_TYPE retval = 0;
+    struct timespec deadline;
+    int waitResult = 0;
+    size_t rowBytes = _aio_counter_stream_row_bytes( stream );
+    unsigned long rows;
+
+    AIOTimeDeadline( &deadline, CLOCK_MONOTONIC, timeout );
+    pthread_mutex_lock( &stream->lock );
+    while ( (rows = AIOFifoReadSize( stream->fifo ) / rowBytes) == 0 && stream->running && waitResult != ETIMEDOUT ) {
+        if ( timeout == 0 )
+            pthread_cond_wait( &stream->changed, &stream->lock );
+        else
+            waitResult = pthread_cond_timedwait( &stream->changed, &stream->lock, &deadline );
+    }
+
+    if ( rows > maxSamples / stream->numCounters )
+        rows = maxSamples / stream->numCounters;
+    if ( rows ) {
+        AIOFifoRead( stream->fifo, samples, rows * rowBytes );
+        retval = rows * stream->numCounters;
+    } else if ( stream->running ) {
+        retval = -AIOUSB_ERROR_TIMEOUT;
+    } else {
+        retval = -(AIORET_TYPE)stream->result;
+    }
+    pthread_mutex_unlock( &stream->lock );
+
+    return retval;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIOCounterStreamRowsAvailable( AIOCounterStream *stream )
+{
+    AIO_ASSERT( stream );
+    AIORET_TYPE retval;
+    pthread_mutex_lock( &stream->lock );
+    retval = AIOFifoReadSize( stream->fifo ) / _aio_counter_stream_row_bytes( stream );
+    pthread_mutex_unlock( &stream->lock );
+    return retval;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIOCounterStreamGetRows( AIOCounterStream *stream )
+{
+    AIO_ASSERT( stream );
+    AIORET_TYPE retval;
+    pthread_mutex_lock( &stream->lock );
+    retval = (AIORET_TYPE)stream->rows;
+    pthread_mutex_unlock( &stream->lock );
+    return retval;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIOCounterStreamGetOverruns( AIOCounterStream *stream )
+{
+    AIO_ASSERT( stream );
+    AIORET_TYPE retval;
+    pthread_mutex_lock( &stream->lock );
+    retval = (AIORET_TYPE)stream->overruns;
+    pthread_mutex_unlock( &stream->lock );
+    return retval;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIOCounterStreamGetMissedPeriods( AIOCounterStream *stream )
+{
+    AIO_ASSERT( stream );
+    AIORET_TYPE retval;
+    pthread_mutex_lock( &stream->lock );
+    retval = (AIORET_TYPE)stream->missedPeriods;
+    pthread_mutex_unlock( &stream->lock );
+    return retval;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+/*****************************************************************************
+ * Self-test
+ ****************************************************************************/
+
+#ifdef SELF_TEST
+
+#include "mocks/mock_fake_device.h"
+#include <unistd.h>
+
+using namespace AIOUSB;
+
+static volatile int reads = 0;
+static volatile int fail_after = 0;
+
+/* counter i falls by 1000 * (i + 1) between reads, rolling over often */
+static int fake_read_all( USBDevice *usb, uint8_t request_type, uint8_t bRequest, uint16_t wValue, uint16_t wIndex,
+                          unsigned char *data, uint16_t wLength, unsigned int timeout )
+{
+    if ( bRequest != AUR_CTR_READALL )
+        return wLength;
+    if ( fail_after && reads >= fail_after )
+        return LIBUSB_ERROR_PIPE;
+    unsigned short *counts = (unsigned short *)data;
+    for ( int i = 0; i < wLength / 2; i ++ )
+        counts[i] = (unsigned short)( 0 - reads * 1000 * ( i + 1 ) );
+    reads ++;
+    return wLength;
+}
+
+class CounterStreamSetup : public MockFakeDeviceTest
+{
+ protected:
+    virtual void SetUp() {
+        MockFakeDeviceTest::SetUp();
+        reads = 0;
+        fail_after = 0;
+        dev = AddFakeDevice( USB_CTR_15, fake_read_all );
+    }
+    AIOUSBDevice *dev;
+};
+
+TEST_F(CounterStreamSetup,DeltasTotalsAndRatesPerRow)
+{
+    unsigned short counters[] = { 14, 0, 7 };
+    AIOCounterStream *stream = NewAIOCounterStream( 0, counters, 3, 64 );
+    ASSERT_TRUE( stream );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOCounterStreamStart( stream, 2000 ) );
+
+    AIOCounterSample samples[ 3 * 10 ];
+    int got = 0;
+    while ( got < 3 * 10 ) {
+        AIORET_TYPE retval = AIOCounterStreamRead( stream, samples + got, 3 * 10 - got, 1000 );
+        ASSERT_GT( retval, 0 );
+        ASSERT_EQ( 0, retval % 3 );
+        got += retval;
+    }
+    EXPECT_EQ( AIOUSB_SUCCESS, AIOCounterStreamStop( stream ) );
+
+    for ( int row = 0; row < 10; row ++ ) {
+        for ( int i = 0; i < 3; i ++ ) {
+            AIOCounterSample *s = &samples[ row * 3 + i ];
+            unsigned long step = 1000ul * ( counters[i] + 1 );
+            EXPECT_EQ( counters[i], s->counter );
+            EXPECT_EQ( step, s->delta ) << "rolled over " << s->total / 65536 << " times";
+            EXPECT_EQ( step * ( row + 1 ), s->total );
+            EXPECT_GT( s->hz, 0 );
+            EXPECT_EQ( samples[ row * 3 ].timestampNs, s->timestampNs ) << "one read per row";
+        }
+        if ( row )
+            EXPECT_GT( samples[ row * 3 ].timestampNs, samples[ row * 3 - 3 ].timestampNs );
+    }
+    EXPECT_GE( AIOCounterStreamGetRows( stream ), 10 );
+
+    DeleteAIOCounterStream( stream );
+}
+
+TEST_F(CounterStreamSetup,FullRingDropsRowsAndErrorsStopTheThread)
+{
+    unsigned short counters[] = { 1 };
+    AIOCounterStream *stream = NewAIOCounterStream( 0, counters, 1, 4 );
+    ASSERT_TRUE( stream );
+    fail_after = 20;
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOCounterStreamStart( stream, 500 ) );
+    while ( AIOCounterStreamGetRows( stream ) < 19 )
+        usleep( 1000 );
+    usleep( 20000 );
+    EXPECT_EQ( 4, AIOCounterStreamRowsAvailable( stream ) );
+    EXPECT_EQ( 15, AIOCounterStreamGetOverruns( stream ) );
+
+    AIOCounterSample samples[ 8 ];
+    EXPECT_EQ( 4, AIOCounterStreamRead( stream, samples, 8, 100 ) );
+    EXPECT_EQ( 2000u, samples[0].delta );
+    EXPECT_EQ( -(AIORET_TYPE)LIBUSB_RESULT_TO_AIOUSB_RESULT( LIBUSB_ERROR_PIPE ), AIOCounterStreamRead( stream, samples, 8, 100 ) );
+    EXPECT_EQ( -(AIORET_TYPE)LIBUSB_RESULT_TO_AIOUSB_RESULT( LIBUSB_ERROR_PIPE ), AIOCounterStreamStop( stream ) );
+
+    DeleteAIOCounterStream( stream );
+}
+
+TEST_F(CounterStreamSetup,RejectsBadCounters)
+{
+    unsigned short tooHigh[] = { 15 };
+    unsigned short twice[] = { 3, 3 };
+    EXPECT_FALSE( NewAIOCounterStream( 0, tooHigh, 1, 8 ) ) << "USB-CTR-15 has counters 0 to 14";
+    EXPECT_FALSE( NewAIOCounterStream( 0, twice, 2, 8 ) );
+}
+
+int main(int argc, char *argv[] )
+{
+    testing::InitGoogleTest(&argc, argv);
+    testing::TestEventListeners & listeners = testing::UnitTest::GetInstance()->listeners();
+#ifdef GTEST_TAP_PRINT_TO_STDOUT
+    delete listeners.Release(listeners.default_result_printer());
+#endif
+
+    return RUN_ALL_TESTS();
+}
+
+#endif
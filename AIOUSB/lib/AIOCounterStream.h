@@ -0,0 +1,91 @@
+/**
+ * @file   AIOCounterStream.h
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  Fixed-rate 8254 counter sampling through a ring buffer
+ *
+ */
+
+#ifndef _AIO_COUNTER_STREAM_H
+#define _AIO_COUNTER_STREAM_H
+
+#include "AIOTypes.h"
+#include "AIOFifo.h"
+#include <pthread.h>
+#include <stdint.h>
+
+#ifdef __aiousb_cplusplus
+namespace AIOUSB
+{
+#endif
+
+/**
+ * @brief One counter's share of one sampling interval
+ */
+typedef struct AIOCounterSample {
+    uint64_t timestampNs;               /**< CLOCK_MONOTONIC when the counters were read */
+    unsigned counter;                   /**< counting across blocks, 3 per block */
+    unsigned short count;               /**< what the 8254 read */
+    unsigned long delta;                /**< counts since the previous sample */
+    uint64_t total;                     /**< counts since the stream started */
+    double hz;                          /**< delta over the time since the previous sample */
+} AIOCounterSample;
+
+/**
+ * @brief AIOCounterStream reads every counter on the board with one
+ * CTR_8254ReadAll() per period, from its own thread, and queues one
+ * AIOCounterSample per selected counter. The samples of one read are
+ * queued, and read back, together as a row.
+ *
+ * The 8254 counts down, so a delta is the previous reading minus the
+ * current one, modulo 65536. That is right as long as a counter is
+ * reloaded with 0 (65536) and wraps at most once per period; pick the
+ * period for the fastest input. If the caller falls behind and the ring
+ * fills, new rows are dropped and counted as overruns, but the totals
+ * keep counting.
+ */
+typedef struct AIOCounterStream {
+    unsigned long DeviceIndex;
+    unsigned numCounters;
+    unsigned short *counters;           /**< selected counters */
+    unsigned boardCounters;             /**< counters on the board */
+    unsigned short *readings;           /**< one CTR_8254ReadAll(), owned by the thread */
+    unsigned short *previous;           /**< last reading of each selected counter */
+    uint64_t *totals;
+    AIOCounterSample *row;              /**< one row being built, owned by the thread */
+    AIOFifo *fifo;
+    unsigned long bufferRows;
+    uint64_t periodNs;
+    pthread_t thread;
+    pthread_mutex_t lock;               /**< guards the fifo and everything below */
+    pthread_cond_t changed;             /**< a row arrived, or the thread stopped */
+    AIOUSB_BOOL running;
+    AIOUSB_BOOL started;
+    AIOUSB_BOOL quit;
+    AIORESULT result;                   /**< why the thread stopped early */
+    uint64_t rows;                      /**< rows sampled, queued or not */
+    uint64_t overruns;                  /**< rows dropped because the ring was full */
+    uint64_t missedPeriods;             /**< periods skipped because a read ran late */
+} AIOCounterStream;
+
+/* BEGIN AIOUSB_API */
+PUBLIC_EXTERN AIOCounterStream *NewAIOCounterStream( unsigned long DeviceIndex, const unsigned short *counters, unsigned numCounters, unsigned long bufferRows );
+PUBLIC_EXTERN AIORET_TYPE DeleteAIOCounterStream( AIOCounterStream *stream );
+PUBLIC_EXTERN AIORET_TYPE AIOCounterStreamStart( AIOCounterStream *stream, unsigned long periodUs );
+PUBLIC_EXTERN AIORET_TYPE AIOCounterStreamStop( AIOCounterStream *stream );
+PUBLIC_EXTERN AIORET_TYPE AIOCounterStreamRead( AIOCounterStream *stream, AIOCounterSample *samples, unsigned long maxSamples, unsigned timeout );
+PUBLIC_EXTERN AIORET_TYPE AIOCounterStreamRowsAvailable( AIOCounterStream *stream );
+PUBLIC_EXTERN AIORET_TYPE AIOCounterStreamGetRows( AIOCounterStream *stream );
+PUBLIC_EXTERN AIORET_TYPE AIOCounterStreamGetOverruns( AIOCounterStream *stream );
+PUBLIC_EXTERN AIORET_TYPE AIOCounterStreamGetMissedPeriods( AIOCounterStream *stream );
+/* END AIOUSB_API */
+
+void AIOCounterSampleUpdate( AIOCounterSample *sample, unsigned counter, unsigned short count,
+                             unsigned short *previous, uint64_t *total, uint64_t timestampNs, double seconds );
+
+#ifdef __aiousb_cplusplus
+}
+#endif
+
+#endif
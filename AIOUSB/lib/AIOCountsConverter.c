@@ -82,6 +82,8 @@ AIOCountsConverter *NewAIOCountsConverter( unsigned num_channels, AIOGainRange *
 /*----------------------------------------------------------------------------*/
 void DeleteAIOCountsConverter( AIOCountsConverter *ccv )
 {
+    if ( ccv )
+        free( ccv->host_cal );
     free(ccv);
 }
 
@@ -113,6 +115,47 @@ double Convert( AIOGainRange range, unsigned short sum )
 
 
 
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Converts through a host calibration instead of the nominal
+ *        gain_ranges. Each channel is resolved against the gain codes
+ *        in config once, here, so the conversion itself only does a
+ *        table lookup or a multiply-add per sample.
+ * @param cal the calibration, which must outlive the converter, or NULL
+ *        to go back to gain_ranges
+ * @param config the configuration being scanned; its start channel is
+ *        the converter's channel 0
+ */
+AIORET_TYPE AIOCountsConverterSetHostCal( AIOCountsConverter *cc, AIOHostCal *cal, ADCConfigBlock *config )
+{
+    AIO_ASSERT_RET( AIOUSB_ERROR_INVALID_PARAMETER, cc );
+    AIORET_TYPE retval;
+    AIOHostCalChannel *channels;
+
+    if ( !cal ) {
+        free( cc->host_cal );
+        cc->host_cal = NULL;
+        return AIOUSB_SUCCESS;
+    }
+    AIO_ASSERT_RET( AIOUSB_ERROR_INVALID_PARAMETER, config );
+    AIORET_TYPE startChannel = ADCConfigBlockGetStartChannel( config );
+    if ( startChannel < AIOUSB_SUCCESS )
+        return startChannel;
+
+    channels = (AIOHostCalChannel *)malloc( cc->num_channels * sizeof(AIOHostCalChannel) );
+    if ( !channels )
+        return -AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+
+    retval = AIOHostCalResolve( cal, config, (unsigned)startChannel, cc->num_channels, channels );
+    if ( retval != AIOUSB_SUCCESS ) {
+        free( channels );
+        return retval;
+    }
+    free( cc->host_cal );
+    cc->host_cal = channels;
+    return AIOUSB_SUCCESS;
+}
+
 /*----------------------------------------------------------------------------*/
 /**
  * @param cc Counts converter object
@@ -155,7 +198,10 @@ AIORET_TYPE AIOCountsConverterConvertFifo( AIOCountsConverter *cc, void *tobufpt
             if ( cc->os_count >= (cc->num_oversamples + 1) ) { 
                 cc->os_count = 0;
                 cc->sum /= (cc->num_oversamples + 1);
-                tmpvolt = (double)Convert( cc->gain_ranges[cc->channel_count], cc->sum );
+                if ( cc->host_cal )
+                    tmpvolt = AIOHostCalChannelToVolts( &cc->host_cal[cc->channel_count], cc->sum );
+                else
+                    tmpvolt = (double)Convert( cc->gain_ranges[cc->channel_count], cc->sum );
                 tofifo->Push( tofifo, tmpvolt );
                 num_converted ++;
                 cc->sum = 0;
@@ -191,7 +237,10 @@ AIORET_TYPE AIOCountsConverterConvert( AIOCountsConverter *cc, void *to_buf, voi
                 count += sizeof(unsigned short);
             }
             sum /= (cc->num_oversamples + 1);
-            ((double *)to_buf)[tobuf_pos] = Convert( cc->gain_ranges[ch], sum );
+            if ( cc->host_cal )
+                ((double *)to_buf)[tobuf_pos] = AIOHostCalChannelToVolts( &cc->host_cal[ch], sum );
+            else
+                ((double *)to_buf)[tobuf_pos] = Convert( cc->gain_ranges[ch], sum );
         }
     }
 
@@ -461,6 +510,64 @@ TEST(Composite,FifoWriting )
     }
 }
 
+TEST(Composite,HostCalAppliedToFifo )
+{
+    static double table[ AIO_HOST_CAL_TABLE_WORDS ];
+    int num_channels     = 4;
+    int num_oversamples  = 3;
+    int num_scans        = 10;
+    int total_size       = num_channels * (num_oversamples+1) * num_scans;
+    ADCConfigBlock cb;
+    AIOGainRange ranges[4];
+    unsigned short from_buf[ 4 * 4 * 10 ];
+    double to_buf[ 4 * 10 ];
+
+    ADCConfigBlockInitializeDefault( &cb );
+    ASSERT_EQ( AIOUSB_SUCCESS, ADCConfigBlockSetScanRange( &cb, 2, 5 ) );
+    for ( int i = 0; i < num_channels; i ++ ) {
+        ranges[i].min = 0.0;
+        ranges[i].max = 10.0;
+    }
+    for ( int i = 0; i < AIO_HOST_CAL_TABLE_WORDS; i ++ )
+        table[i] = 100.0 + i;
+
+    AIOHostCal *cal = NewAIOHostCal( 16 );
+    ASSERT_TRUE( cal );
+    /* scan channels 2 and 3 are the converter's 0 and 1 */
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOHostCalSetLinear( cal, 2, ADCConfigBlockGetGainCode( &cb, 2 ), 0.5, 1.0 ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOHostCalSetTable( cal, 3, ADCConfigBlockGetGainCode( &cb, 3 ), table, AIO_HOST_CAL_TABLE_WORDS ) );
+
+    AIOCountsConverter *cc = NewAIOCountsConverterWithScanLimiter( from_buf, num_scans, num_channels, ranges, num_oversamples, sizeof(unsigned short) );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOCountsConverterSetHostCal( cc, cal, &cb ) );
+
+    for ( int i = 0; i < total_size; i ++ )
+        from_buf[i] = 1000 * ( i / (num_oversamples+1) % num_channels ) + 10;
+
+    AIOFifoCounts *infifo = NewAIOFifoCounts( total_size );
+    AIOFifoVolts *outfifo = NewAIOFifoVolts( total_size );
+    /* split mid-oversample so the running sum carries across calls */
+    infifo->PushN( infifo, from_buf, 7 );
+    EXPECT_EQ( 1, cc->ConvertFifo( cc, outfifo, infifo, 7 ) );
+    infifo->PushN( infifo, from_buf + 7, total_size - 7 );
+    EXPECT_EQ( num_scans*num_channels - 1, cc->ConvertFifo( cc, outfifo, infifo, total_size - 7 ) );
+
+    outfifo->PopN( outfifo, to_buf, num_scans*num_channels );
+    for ( int scan = 0; scan < num_scans; scan ++ ) {
+        EXPECT_DOUBLE_EQ( 0.5 * 10 + 1.0, to_buf[scan*num_channels + 0] );
+        EXPECT_DOUBLE_EQ( 100.0 + 1010, to_buf[scan*num_channels + 1] );
+        EXPECT_DOUBLE_EQ( 2010 * adRanges[ ADCConfigBlockGetGainCode( &cb, 4 ) ].range / AI_16_MAX_COUNTS +
+                          adRanges[ ADCConfigBlockGetGainCode( &cb, 4 ) ].minVolts, to_buf[scan*num_channels + 2] ) << "uncalibrated channels stay nominal";
+    }
+
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOCountsConverterSetHostCal( cc, NULL, NULL ) );
+    EXPECT_FALSE( cc->host_cal );
+
+    DeleteAIOFifoCounts( infifo );
+    DeleteAIOFifoVolts( outfifo );
+    DeleteAIOCountsConverter( cc );
+    DeleteAIOHostCal( cal );
+}
+
 class AllGainCode : public ::testing::TestWithParam<ADGainCode> {};
 TEST_P( AllGainCode, FromADCConfigBlock )
 {
@@ -15,6 +15,7 @@
 #include "AIOContinuousBuffer.h"
 #include "AIOFifo.h"
 #include "ADCConfigBlock.h"
+#include "AIOHostCal.h"
 
 
 #ifdef __aiousb_cplusplus
@@ -44,6 +45,7 @@ typedef struct aio_counts_converter {
     AIORET_TYPE (*Convert)( struct aio_counts_converter *cc, void *tobuf, void *frombuf, unsigned num_bytes );
     AIORET_TYPE (*ConvertFifo)( struct aio_counts_converter *cc, void *tobuf, void *frombuf , unsigned num_bytes );
     AIOUSB_BOOL discardFirstSample;
+    AIOHostCalChannel *host_cal; /* one per channel, replaces gain_ranges when set */
 } AIOCountsConverter;
 
 
@@ -60,6 +62,7 @@ PUBLIC_EXTERN AIORET_TYPE AIOCountsConverterConvertNScans( AIOCountsConverter *c
 PUBLIC_EXTERN AIORET_TYPE AIOCountsConverterConvertAllAvailableScans( AIOCountsConverter *cc );
 PUBLIC_EXTERN AIORET_TYPE AIOCountsConverterConvert( AIOCountsConverter *cc, void *tobuf, void *frombuf, unsigned num_bytes );
 PUBLIC_EXTERN AIORET_TYPE AIOCountsConverterConvertFifo( AIOCountsConverter *cc, void *tobuf, void *frombuf , unsigned num_bytes );
+PUBLIC_EXTERN AIORET_TYPE AIOCountsConverterSetHostCal( AIOCountsConverter *cc, AIOHostCal *cal, ADCConfigBlock *config );
 
 PUBLIC_EXTERN AIOGainRange* NewAIOGainRangeFromADCConfigBlock( ADCConfigBlock *adc );
 PUBLIC_EXTERN void  DeleteAIOGainRange( AIOGainRange* );
@@ -0,0 +1,366 @@
+/**
+ * @file   AIODACPreparedUpdate.c
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  Repeated DACMultiDirect() writes to a fixed set of channels
+ *
+ * DACMultiDirect() works out the highest channel, allocates the
+ * configuration blocks and places every channel/count pair in them on
+ * each call. When the same channels are written over and over, all of
+ * that but the counts is the same every time. A prepared update builds
+ * the blocks, masks included, once. It also records where each run of
+ * consecutive channels lands, so a write is a handful of memcpy()s of
+ * the caller's row followed by the control transfer.
+ *
+ * AIODACPreparedUpdateWriteBatch() packs a whole matrix of updates into
+ * a buffer kept between calls before sending the first one, so the
+ * transfers then go out back to back with nothing to do in between.
+ */
+
+#include "AIODACPreparedUpdate.h"
+#include "AIOUSB_Core.h"
+#include "AIODeviceTable.h"
+#include "AIOUSBDevice.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __cplusplus
+namespace AIOUSB {
+#endif
+
+#define DACS_PER_BLOCK      8
+#define CONFIG_BLOCK_BYTES  ( 1 /* mask */ + DACS_PER_BLOCK * sizeof(unsigned short) )
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Sets up writes of channels[0] .. channels[numChannels - 1], in
+ * that order, for each row of counts later passed in
+ * @param DeviceIndex
+ * @param channels DAC numbers, each at most once
+ * @param numChannels
+ * @return new prepared update, or NULL with aio_errno set
+ */
+AIODACPreparedUpdate *NewAIODACPreparedUpdate( unsigned long DeviceIndex, const unsigned short *channels, unsigned numChannels )
+{
+    AIORESULT result = AIOUSB_SUCCESS;
+    AIODACPreparedUpdate *update = NULL;
+    unsigned index, highestChannel = 0;
+    AIOUSBDevice *deviceDesc = AIODeviceTableGetDeviceAtIndex( DeviceIndex, &result );
+    if ( result != AIOUSB_SUCCESS )
+        goto err_NewAIODACPreparedUpdate;
+
+    if ( !deviceDesc->ImmDACs ) {
+        result = AIOUSB_ERROR_NOT_SUPPORTED;
+        goto err_NewAIODACPreparedUpdate;
+    }
+    if ( !channels || !numChannels ) {
+        result = AIOUSB_ERROR_INVALID_PARAMETER;
+        goto err_NewAIODACPreparedUpdate;
+    }
+    for ( index = 0; index < numChannels; index ++ ) {
+        if ( channels[ index ] >= deviceDesc->ImmDACs ) {
+            result = AIOUSB_ERROR_INVALID_PARAMETER;
+            goto err_NewAIODACPreparedUpdate;
+        }
+        if ( channels[ index ] > highestChannel )
+            highestChannel = channels[ index ];
+    }
+
+    update = (AIODACPreparedUpdate *)calloc( 1, sizeof(AIODACPreparedUpdate) );
+    if ( !update ) {
+        result = AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+        goto err_NewAIODACPreparedUpdate;
+    }
+    update->DeviceIndex = DeviceIndex;
+    update->numChannels = numChannels;
+    update->configBytes = CONFIG_BLOCK_BYTES * ( highestChannel / DACS_PER_BLOCK + 1 );
+    update->channels    = (unsigned short *)malloc( numChannels * sizeof(unsigned short) );
+    update->image       = (unsigned char *)calloc( 1, update->configBytes );
+    update->runs        = (struct aio_dac_run *)calloc( numChannels, sizeof(struct aio_dac_run) );
+    if ( !update->channels || !update->image || !update->runs ) {
+        result = AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+        goto err_NewAIODACPreparedUpdate;
+    }
+    memcpy( update->channels, channels, numChannels * sizeof(unsigned short) );
+
+    for ( index = 0; index < numChannels; index ++ ) {
+        unsigned channel = channels[ index ];
+        unsigned maskOffset = ( channel / DACS_PER_BLOCK ) * CONFIG_BLOCK_BYTES;
+        unsigned countOffset = maskOffset + 1 + ( channel % DACS_PER_BLOCK ) * sizeof(unsigned short);
+        unsigned char bit = (unsigned char)( 1u << ( channel % DACS_PER_BLOCK ) );
+
+        if ( update->image[ maskOffset ] & bit ) {
+            result = AIOUSB_ERROR_INVALID_PARAMETER;  /* same channel twice */
+            goto err_NewAIODACPreparedUpdate;
+        }
+        update->image[ maskOffset ] |= bit;
+
+        struct aio_dac_run *run = update->numRuns ? &update->runs[ update->numRuns - 1 ] : NULL;
+        if ( run && channel == channels[ index - 1 ] + 1u && channel % DACS_PER_BLOCK != 0 ) {
+            run->length ++;
+        } else {
+            run = &update->runs[ update->numRuns ++ ];
+            run->column = index;
+            run->offset = countOffset;
+            run->length = 1;
+        }
+    }
+
+    return update;
+
+ err_NewAIODACPreparedUpdate:
+    if ( update ) {
+        free( update->channels );
+        free( update->image );
+        free( update->runs );
+        free( update );
+    }
+    aio_errno = -result;
+    return NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE DeleteAIODACPreparedUpdate( AIODACPreparedUpdate *update )
+{
+    AIO_ASSERT( update );
+
+    free( update->channels );
+    free( update->image );
+    free( update->runs );
+    free( update->batch );
+    free( update );
+
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Copies one row of counts into an update whose masks are already
+ * in place
+ */
+static void _dac_prepared_pack( const AIODACPreparedUpdate *update, unsigned char *dest, const unsigned short *row )
+{
+    unsigned index;
+    for ( index = 0; index < update->numRuns; index ++ ) {
+        const struct aio_dac_run *run = &update->runs[ index ];
+        memcpy( dest + run->offset, row + run->column, run->length * sizeof(unsigned short) );
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+static USBDevice *_dac_prepared_usb( AIODACPreparedUpdate *update, AIOUSBDevice **deviceDesc, AIORESULT *result )
+{
+    *deviceDesc = AIODeviceTableGetDeviceAtIndex( update->DeviceIndex, result );
+    AIO_ERROR_VALID_DATA( NULL, *result == AIOUSB_SUCCESS );
+    AIO_ERROR_VALID_DATA_W_CODE( NULL, *result = AIOUSB_ERROR_OPEN_FAILED,
+                                 !(
+                                   ( (*deviceDesc)->bDACDIOStream || (*deviceDesc)->bDACSlowWaveStream || (*deviceDesc)->bDACStream ) &&
+                                   ( (*deviceDesc)->bDACOpen || (*deviceDesc)->bDACClosing )
+                                   )
+                                 );
+    return AIODeviceTableGetUSBDeviceAtIndex( update->DeviceIndex, result );
+}
+
+/*----------------------------------------------------------------------------*/
+static AIORESULT _dac_prepared_send( AIODACPreparedUpdate *update, AIOUSBDevice *deviceDesc, USBDevice *usb, unsigned char *data )
+{
+    int bytesTransferred = usb->usb_control_transfer( usb,
+                                                      USB_WRITE_TO_DEVICE,
+                                                      AUR_DAC_IMMEDIATE,
+                                                      0,
+                                                      0,
+                                                      data,
+                                                      update->configBytes,
+                                                      deviceDesc->commTimeout
+                                                      );
+    if ( bytesTransferred != (int)update->configBytes )
+        return LIBUSB_RESULT_TO_AIOUSB_RESULT( bytesTransferred );
+    update->updates ++;
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Sets every prepared channel at once
+ * @param update
+ * @param counts one count per prepared channel, in the order they were given
+ */
+AIORET_TYPE AIODACPreparedUpdateWrite( AIODACPreparedUpdate *update, const unsigned short *counts )
+{
+    AIO_ASSERT( update );
+    AIO_ASSERT( counts );
+
+    AIORESULT result = AIOUSB_SUCCESS;
+    AIOUSBDevice *deviceDesc = NULL;
+    USBDevice *usb = _dac_prepared_usb( update, &deviceDesc, &result );
+    AIO_ERROR_VALID_DATA( -(AIORET_TYPE)result, result == AIOUSB_SUCCESS && usb );
+
+    _dac_prepared_pack( update, update->image, counts );
+
+    return -(AIORET_TYPE)_dac_prepared_send( update, deviceDesc, usb, update->image );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Sends numUpdates updates, one after the other, as fast as the
+ * board takes them
+ * @param update
+ * @param counts numUpdates rows of one count per prepared channel
+ * @param numUpdates
+ * @return updates sent, or a negative error if none could be
+ */
+AIORET_TYPE AIODACPreparedUpdateWriteBatch( AIODACPreparedUpdate *update, const unsigned short *counts, unsigned long numUpdates )
+{
+    AIO_ASSERT( update );
+    AIO_ASSERT( counts );
+
+    AIORESULT result = AIOUSB_SUCCESS;
+    unsigned long index;
+    AIOUSBDevice *deviceDesc = NULL;
+    USBDevice *usb = _dac_prepared_usb( update, &deviceDesc, &result );
+    AIO_ERROR_VALID_DATA( -(AIORET_TYPE)result, result == AIOUSB_SUCCESS && usb );
+
+    if ( numUpdates > update->batchCapacity ) {
+        unsigned char *batch = (unsigned char *)realloc( update->batch, numUpdates * update->configBytes );
+        AIO_ERROR_VALID_AIORET_TYPE( AIOUSB_ERROR_NOT_ENOUGH_MEMORY, batch );
+        for ( index = update->batchCapacity; index < numUpdates; index ++ )
+            memcpy( batch + index * update->configBytes, update->image, update->configBytes );
+        update->batch = batch;
+        update->batchCapacity = numUpdates;
+    }
+
+    for ( index = 0; index < numUpdates; index ++ )
+        _dac_prepared_pack( update, update->batch + index * update->configBytes, counts + index * update->numChannels );
+
+    for ( index = 0; index < numUpdates; index ++ ) {
+        result = _dac_prepared_send( update, deviceDesc, usb, update->batch + index * update->configBytes );
+        if ( result != AIOUSB_SUCCESS )
+            break;
+    }
+    if ( index == 0 && result != AIOUSB_SUCCESS )
+        return -(AIORET_TYPE)result;
+
+    return (AIORET_TYPE)index;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIODACPreparedUpdateGetUpdates( AIODACPreparedUpdate *update )
+{
+    AIO_ASSERT( update );
+    return (AIORET_TYPE)update->updates;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+/*****************************************************************************
+ * Self-test
+ ****************************************************************************/
+
+#ifdef SELF_TEST
+
+#include "AIOUSB_DAC.h"
+#include "mocks/mock_fake_device.h"
+#include <vector>
+
+using namespace AIOUSB;
+
+static std::vector< std::vector<unsigned char> > sent;
+static int fake_dac_immediate( USBDevice *usb, uint8_t request_type, uint8_t bRequest, uint16_t wValue, uint16_t wIndex,
+                               unsigned char *data, uint16_t wLength, unsigned int timeout )
+{
+    if ( bRequest == AUR_DAC_IMMEDIATE )
+        sent.push_back( std::vector<unsigned char>( data, data + wLength ) );
+    return wLength;
+}
+
+class DACPreparedUpdateSetup : public MockFakeDeviceTest
+{
+ protected:
+    virtual void SetUp() {
+        MockFakeDeviceTest::SetUp();
+        sent.clear();
+        device = AddFakeDevice( USB_AO16_16A, fake_dac_immediate );
+    }
+    AIOUSBDevice *device;
+};
+
+TEST_F(DACPreparedUpdateSetup,MatchesDACMultiDirect)
+{
+    unsigned short channels[] = { 6, 7, 8, 9, 2, 15 };
+    unsigned short counts[] = { 0x1111, 0x2222, 0x3333, 0x4444, 0x5555, 0x6666 };
+    unsigned short pairs[ 12 ];
+    for ( int i = 0; i < 6; i ++ ) {
+        pairs[ i * 2 ] = channels[i];
+        pairs[ i * 2 + 1 ] = counts[i];
+    }
+
+    AIODACPreparedUpdate *update = NewAIODACPreparedUpdate( 0, channels, 6 );
+    ASSERT_TRUE( update );
+    EXPECT_EQ( 4u, update->numRuns ) << "6-7, 8-9 (next block), 2, 15";
+    EXPECT_EQ( AIOUSB_SUCCESS, AIODACPreparedUpdateWrite( update, counts ) );
+    EXPECT_EQ( AIOUSB_SUCCESS, DACMultiDirect( 0, pairs, 6 ) );
+    ASSERT_EQ( 2u, sent.size() );
+    EXPECT_EQ( 34u, sent[0].size() );
+    EXPECT_TRUE( sent[0] == sent[1] );
+    EXPECT_EQ( 1, AIODACPreparedUpdateGetUpdates( update ) );
+
+    DeleteAIODACPreparedUpdate( update );
+}
+
+TEST_F(DACPreparedUpdateSetup,BatchSendsEveryRow)
+{
+    unsigned short channels[] = { 0, 1, 2, 3 };
+    std::vector<unsigned short> counts( 20000 * 4 );
+    for ( size_t i = 0; i < counts.size(); i ++ )
+        counts[i] = (unsigned short)i;
+
+    AIODACPreparedUpdate *update = NewAIODACPreparedUpdate( 0, channels, 4 );
+    ASSERT_TRUE( update );
+    EXPECT_EQ( 1u, update->numRuns );
+    EXPECT_EQ( 20000, AIODACPreparedUpdateWriteBatch( update, &counts[0], 20000 ) );
+    ASSERT_EQ( 20000u, sent.size() );
+    for ( size_t u = 0; u < sent.size(); u += 997 ) {
+        ASSERT_EQ( 17u, sent[u].size() );
+        EXPECT_EQ( 0x0f, sent[u][0] );
+        for ( int c = 0; c < 4; c ++ )
+            EXPECT_EQ( counts[ u * 4 + c ], sent[u][1 + c * 2] | ( sent[u][2 + c * 2] << 8 ) );
+        EXPECT_EQ( 0, sent[u][9] );
+    }
+
+    sent.clear();
+    EXPECT_EQ( 2, AIODACPreparedUpdateWriteBatch( update, &counts[8], 2 ) ) << "buffer reused";
+    EXPECT_EQ( counts[8], sent[0][1] | ( sent[0][2] << 8 ) );
+
+    device->bDACOpen = AIOUSB_TRUE;
+    device->bDACStream = AIOUSB_TRUE;
+    EXPECT_EQ( -AIOUSB_ERROR_OPEN_FAILED, AIODACPreparedUpdateWriteBatch( update, &counts[0], 1 ) );
+    device->bDACOpen = AIOUSB_FALSE;
+
+    DeleteAIODACPreparedUpdate( update );
+}
+
+TEST_F(DACPreparedUpdateSetup,RejectsBadChannelSets)
+{
+    unsigned short twice[] = { 3, 3 };
+    unsigned short tooHigh[] = { 16 };
+    EXPECT_FALSE( NewAIODACPreparedUpdate( 0, twice, 2 ) );
+    EXPECT_EQ( -AIOUSB_ERROR_INVALID_PARAMETER, aio_errno );
+    EXPECT_FALSE( NewAIODACPreparedUpdate( 0, tooHigh, 1 ) );
+}
+
+int main(int argc, char *argv[] )
+{
+    testing::InitGoogleTest(&argc, argv);
+    testing::TestEventListeners & listeners = testing::UnitTest::GetInstance()->listeners();
+#ifdef GTEST_TAP_PRINT_TO_STDOUT
+    delete listeners.Release(listeners.default_result_printer());
+#endif
+
+    return RUN_ALL_TESTS();
+}
+
+#endif
@@ -0,0 +1,56 @@
+/**
+ * @file   AIODACPreparedUpdate.h
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  Repeated DACMultiDirect() writes to a fixed set of channels
+ *
+ */
+
+#ifndef _AIO_DAC_PREPARED_UPDATE_H
+#define _AIO_DAC_PREPARED_UPDATE_H
+
+#include "AIOTypes.h"
+
+#ifdef __aiousb_cplusplus
+namespace AIOUSB
+{
+#endif
+
+/**
+ * @brief A stretch of consecutive channels in one configuration block;
+ * their counts sit next to each other in both the caller's row and the
+ * block, so they are copied in one go
+ */
+struct aio_dac_run {
+    unsigned column;            /**< first of them in the caller's row */
+    unsigned offset;            /**< byte offset of its count in the update */
+    unsigned length;            /**< channels */
+};
+
+/* BEGIN AIOUSB_API */
+typedef struct aio_dac_prepared_update {
+    unsigned long DeviceIndex;
+    unsigned numChannels;
+    unsigned short *channels;
+    unsigned configBytes;               /**< bytes per update, blocks 0 to the highest channel's */
+    unsigned char *image;               /**< one update: channel masks set, counts zero */
+    struct aio_dac_run *runs;
+    unsigned numRuns;
+    unsigned char *batch;               /**< packed updates, each starting as a copy of image */
+    unsigned long batchCapacity;        /**< updates batch has room for */
+    unsigned long updates;              /**< updates sent so far */
+} AIODACPreparedUpdate;
+
+PUBLIC_EXTERN AIODACPreparedUpdate *NewAIODACPreparedUpdate( unsigned long DeviceIndex, const unsigned short *channels, unsigned numChannels );
+PUBLIC_EXTERN AIORET_TYPE DeleteAIODACPreparedUpdate( AIODACPreparedUpdate *update );
+PUBLIC_EXTERN AIORET_TYPE AIODACPreparedUpdateWrite( AIODACPreparedUpdate *update, const unsigned short *counts );
+PUBLIC_EXTERN AIORET_TYPE AIODACPreparedUpdateWriteBatch( AIODACPreparedUpdate *update, const unsigned short *counts, unsigned long numUpdates );
+PUBLIC_EXTERN AIORET_TYPE AIODACPreparedUpdateGetUpdates( AIODACPreparedUpdate *update );
+/* END AIOUSB_API */
+
+#ifdef __aiousb_cplusplus
+}
+#endif
+
+#endif
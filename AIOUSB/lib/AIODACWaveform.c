@@ -0,0 +1,534 @@
+/**
+ * @file   AIODACWaveform.c
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  Precomputed DAC waveforms played over and over
+ *
+ * A rig that puts out the same sine or ramp for hours shouldn't convert
+ * volts and build DAC stream samples for every period. AIODACWaveform
+ * does that once; after that a period is a single DACOutputFrameRaw() of
+ * the same buffer, and a waveform small enough for the board's SRAM
+ * needn't involve the host at all (AIODACWaveformLoopOnBoard()).
+ */
+
+#include "AIODACWaveform.h"
+#include "AIOUSB_DAC.h"
+#include "AIODeviceTable.h"
+#include "AIOUSB_Core.h"
+#include "AIOTime.h"
+
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+
+#ifdef __cplusplus
+namespace AIOUSB {
+#endif
+
+#define DAC_WAVEFORM_BOARD_BYTES ( 128 * 1024 ) /* one SRAM bank */
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Creates a waveform of numPoints points for DACs 0 to
+ * numChannels - 1, all at 0 V on DAC_RANGE_0_5V
+ * @param numChannels 1 to 8
+ * @param numPoints points in one period
+ * @return the new waveform, or NULL
+ */
+AIODACWaveform *NewAIODACWaveform( unsigned numChannels, unsigned long numPoints )
+{
+    AIO_ASSERT_RET( NULL, numChannels >= 1 && numChannels <= 8 );
+    AIO_ASSERT_RET( NULL, numPoints );
+    unsigned channel;
+    AIODACWaveform *waveform = (AIODACWaveform *)calloc( 1, sizeof(AIODACWaveform) );
+    if ( !waveform )
+        return NULL;
+
+    waveform->numChannels = numChannels;
+    waveform->numPoints   = numPoints;
+    waveform->samples     = (unsigned short *)calloc( numPoints * numChannels, sizeof(unsigned short) );
+    waveform->minVolts    = (double *)calloc( numChannels, sizeof(double) );
+    waveform->spanVolts   = (double *)calloc( numChannels, sizeof(double) );
+    if ( !waveform->samples || !waveform->minVolts || !waveform->spanVolts ) {
+        DeleteAIODACWaveform( waveform );
+        return NULL;
+    }
+    for ( channel = 0; channel < numChannels; channel ++ )
+        AIODACWaveformSetRange( waveform, channel, DAC_RANGE_0_5V );
+    AIODACWaveformSetCounts( waveform, waveform->samples );
+
+    return waveform;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE DeleteAIODACWaveform( AIODACWaveform *waveform )
+{
+    AIO_ASSERT( waveform );
+
+    free( waveform->samples );
+    free( waveform->minVolts );
+    free( waveform->spanVolts );
+    free( waveform );
+
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Sets the output range a channel's DAC is jumpered for, used by
+ * later AIODACWaveformSetVolts() calls
+ */
+AIORET_TYPE AIODACWaveformSetRange( AIODACWaveform *waveform, unsigned channel, DACRange range )
+{
+    AIO_ASSERT( waveform );
+    AIO_ASSERT( channel < waveform->numChannels );
+
+    switch ( range ) {
+    case DAC_RANGE_0_5V:
+        waveform->minVolts[ channel ] = 0;
+        waveform->spanVolts[ channel ] = 5;
+        break;
+    case DAC_RANGE_5V:
+        waveform->minVolts[ channel ] = -5;
+        waveform->spanVolts[ channel ] = 10;
+        break;
+    case DAC_RANGE_0_10V:
+        waveform->minVolts[ channel ] = 0;
+        waveform->spanVolts[ channel ] = 10;
+        break;
+    case DAC_RANGE_10V:
+        waveform->minVolts[ channel ] = -10;
+        waveform->spanVolts[ channel ] = 20;
+        break;
+    default:
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+    }
+
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Flags the samples the way DACOutputFrame() would: EOD closes every
+ * point and EOF marks the end of the period
+ */
+static void _aio_dac_waveform_flag( AIODACWaveform *waveform )
+{
+    unsigned long point;
+    for ( point = 0; point < waveform->numPoints; point ++ )
+        waveform->samples[ ( point + 1 ) * waveform->numChannels - 1 ] |= DAC_STREAM_EOD;
+    waveform->samples[ waveform->numPoints * waveform->numChannels - 1 ] |= DAC_STREAM_EOF;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Loads a period from volts, numPoints points of numChannels
+ * values each. Values outside a channel's range are clipped.
+ */
+AIORET_TYPE AIODACWaveformSetVolts( AIODACWaveform *waveform, const double *volts )
+{
+    AIO_ASSERT( waveform );
+    AIO_ASSERT( volts );
+    unsigned long index, total = waveform->numPoints * waveform->numChannels;
+
+    for ( index = 0; index < total; index ++ ) {
+        unsigned channel = index % waveform->numChannels;
+        double counts = round( DAC_STREAM_COUNTS_MASK * ( volts[ index ] - waveform->minVolts[ channel ] ) /
+                               waveform->spanVolts[ channel ] );
+        if ( counts < 0 )
+            counts = 0;
+        else if ( counts > DAC_STREAM_COUNTS_MASK )
+            counts = DAC_STREAM_COUNTS_MASK;
+        waveform->samples[ index ] = (unsigned short)counts;
+    }
+    _aio_dac_waveform_flag( waveform );
+
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Loads a period from D/A counts, numPoints points of numChannels
+ * values each
+ */
+AIORET_TYPE AIODACWaveformSetCounts( AIODACWaveform *waveform, const unsigned short *counts )
+{
+    AIO_ASSERT( waveform );
+    AIO_ASSERT( counts );
+    unsigned long index, total = waveform->numPoints * waveform->numChannels;
+
+    for ( index = 0; index < total; index ++ )
+        waveform->samples[ index ] = counts[ index ] & DAC_STREAM_COUNTS_MASK;
+    _aio_dac_waveform_flag( waveform );
+
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Sends one period to the board with LOOP on its last sample and
+ * leaves the board playing it from its own memory; the USB cable can
+ * even be pulled. The period has to fit in one 128K byte SRAM bank.
+ * DACDirect() and another DACOutputOpen() are refused until the board
+ * is reset.
+ * @param DeviceIndex
+ * @param waveform
+ * @param clockHz points per second, set to the rate the board can make
+ */
+AIORET_TYPE AIODACWaveformLoopOnBoard( unsigned long DeviceIndex, AIODACWaveform *waveform, double *clockHz )
+{
+    AIO_ASSERT( waveform );
+    AIO_ASSERT( clockHz );
+    AIO_ERROR_VALID_AIORET_TYPE( AIOUSB_ERROR_INVALID_PARAMETER,
+                                 waveform->numPoints * waveform->numChannels * sizeof(unsigned short) <= DAC_WAVEFORM_BOARD_BYTES );
+
+    unsigned short last[ 8 ];
+    unsigned long lastPoint = waveform->numPoints - 1;
+    AIORESULT result = DACOutputOpen( DeviceIndex, clockHz );
+    AIO_ERROR_VALID_DATA( -(AIORET_TYPE)result, result == AIOUSB_SUCCESS );
+
+    result = DACOutputSetCount( DeviceIndex, waveform->numChannels );
+    if ( result == AIOUSB_SUCCESS && lastPoint )
+        result = DACOutputFrameRaw( DeviceIndex, lastPoint, waveform->samples );
+    if ( result == AIOUSB_SUCCESS ) {
+        memcpy( last, waveform->samples + lastPoint * waveform->numChannels,
+                waveform->numChannels * sizeof(unsigned short) );
+        last[ waveform->numChannels - 1 ] |= DAC_STREAM_LOOP;
+        result = DACOutputFrameRaw( DeviceIndex, 1, last );
+    }
+    if ( result == AIOUSB_SUCCESS )
+        result = DACOutputCloseNoEnd( DeviceIndex, AIOUSB_TRUE );
+    else
+        DACOutputClose( DeviceIndex, AIOUSB_TRUE );
+
+    return -(AIORET_TYPE)result;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Hands one period after another to the DAC stream, which blocks
+ * whenever its buffers are ahead of the bus. A swapped-in waveform is
+ * picked up only here, between periods.
+ */
+static void *_aio_dac_waveform_player( void *arg )
+{
+    AIODACWaveformPlayer *player = (AIODACWaveformPlayer *)arg;
+    AIORESULT result = AIOUSB_SUCCESS;
+
+    pthread_mutex_lock( &player->lock );
+    while ( !player->quit ) {
+        if ( player->next ) {
+            player->current = player->next;
+            player->next = NULL;
+            pthread_cond_broadcast( &player->changed );
+        }
+        AIODACWaveform *waveform = player->current;
+        pthread_mutex_unlock( &player->lock );
+
+        result = DACOutputFrameRaw( player->DeviceIndex, waveform->numPoints, waveform->samples );
+
+        pthread_mutex_lock( &player->lock );
+        if ( result != AIOUSB_SUCCESS )
+            break;
+        player->cycles ++;
+    }
+    player->result  = result;
+    player->running = AIOUSB_FALSE;
+    pthread_cond_broadcast( &player->changed );
+    pthread_mutex_unlock( &player->lock );
+
+    return NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+AIODACWaveformPlayer *NewAIODACWaveformPlayer( unsigned long DeviceIndex )
+{
+    pthread_condattr_t attr;
+    AIODACWaveformPlayer *player = (AIODACWaveformPlayer *)calloc( 1, sizeof(AIODACWaveformPlayer) );
+    if ( !player )
+        return NULL;
+
+    player->DeviceIndex = DeviceIndex;
+    player->result      = AIOUSB_SUCCESS;
+    pthread_mutex_init( &player->lock, NULL );
+    pthread_condattr_init( &attr );
+    pthread_condattr_setclock( &attr, CLOCK_MONOTONIC );
+    pthread_cond_init( &player->changed, &attr );
+    pthread_condattr_destroy( &attr );
+
+    return player;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE DeleteAIODACWaveformPlayer( AIODACWaveformPlayer *player )
+{
+    AIO_ASSERT( player );
+
+    AIODACWaveformPlayerStop( player );
+    pthread_mutex_destroy( &player->lock );
+    pthread_cond_destroy( &player->changed );
+    free( player );
+
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Opens the device's DAC stream at *clockHz and starts playing
+ * waveform. The waveform must stay put until it has been swapped out or
+ * the player stopped.
+ * @param player
+ * @param waveform
+ * @param clockHz points per second, set to the rate the board can make
+ */
+AIORET_TYPE AIODACWaveformPlayerStart( AIODACWaveformPlayer *player, AIODACWaveform *waveform, double *clockHz )
+{
+    AIO_ASSERT( player );
+    AIO_ASSERT( waveform );
+    AIO_ASSERT( clockHz );
+    AIO_ERROR_VALID_AIORET_TYPE( AIOUSB_ERROR_INVALID_THREAD, !player->started );
+
+    AIORESULT result = DACOutputOpen( player->DeviceIndex, clockHz );
+    AIO_ERROR_VALID_DATA( -(AIORET_TYPE)result, result == AIOUSB_SUCCESS );
+    result = DACOutputSetCount( player->DeviceIndex, waveform->numChannels );
+    if ( result != AIOUSB_SUCCESS ) {
+        DACOutputClose( player->DeviceIndex, AIOUSB_TRUE );
+        return -(AIORET_TYPE)result;
+    }
+
+    player->current = waveform;
+    player->next    = NULL;
+    player->cycles  = 0;
+    player->result  = AIOUSB_SUCCESS;
+    player->quit    = AIOUSB_FALSE;
+    player->running = AIOUSB_TRUE;
+    if ( pthread_create( &player->thread, NULL, _aio_dac_waveform_player, player ) != 0 ) {
+        player->running = AIOUSB_FALSE;
+        DACOutputClose( player->DeviceIndex, AIOUSB_TRUE );
+        return -AIOUSB_ERROR_INVALID_THREAD;
+    }
+    player->started = AIOUSB_TRUE;
+
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Makes waveform follow the period now playing, and waits until it
+ * has taken over, after which the previous waveform is free to change or
+ * delete
+ * @param player
+ * @param waveform same number of channels as the one playing
+ * @param timeout milliseconds to wait, 0 waits for as long as it takes
+ * @return AIOUSB_SUCCESS, -AIOUSB_ERROR_TIMEOUT if the swap is still
+ * pending, or the negated error that stopped the player
+ */
+AIORET_TYPE AIODACWaveformPlayerSwap( AIODACWaveformPlayer *player, AIODACWaveform *waveform, unsigned timeout )
+{
+    AIO_ASSERT( player );
+    AIO_ASSERT( waveform );
+    AIO_ERROR_VALID_AIORET_TYPE( AIOUSB_ERROR_INVALID_THREAD, player->started );
+
+    AIORET_TYPE retval = AIOUSB_SUCCESS;
+    struct timespec deadline;
+    int waitResult = 0;
+    AIOTimeDeadline( &deadline, CLOCK_MONOTONIC, timeout );
+
+    pthread_mutex_lock( &player->lock );
+    if ( waveform->numChannels != player->current->numChannels ) {
+        retval = -AIOUSB_ERROR_INVALID_PARAMETER;
+        goto out_AIODACWaveformPlayerSwap;
+    }
+    if ( waveform != player->current )
+        player->next = waveform;
+    while ( player->running && player->current != waveform && waitResult != ETIMEDOUT ) {
+        if ( timeout == 0 )
+            pthread_cond_wait( &player->changed, &player->lock );
+        else
+            waitResult = pthread_cond_timedwait( &player->changed, &player->lock, &deadline );
+    }
+    if ( !player->running )
+        retval = -(AIORET_TYPE)player->result;
+    else if ( player->current != waveform )
+        retval = -AIOUSB_ERROR_TIMEOUT;
+
+ out_AIODACWaveformPlayerSwap:
+    pthread_mutex_unlock( &player->lock );
+    return retval;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Stops after the period being handed over and closes the DAC
+ * stream; the board stops once it has played that period
+ * @return AIOUSB_SUCCESS, or the negated error that stopped the player
+ */
+AIORET_TYPE AIODACWaveformPlayerStop( AIODACWaveformPlayer *player )
+{
+    AIO_ASSERT( player );
+    if ( !player->started )
+        return AIOUSB_SUCCESS;
+
+    pthread_mutex_lock( &player->lock );
+    player->quit = AIOUSB_TRUE;
+    pthread_mutex_unlock( &player->lock );
+
+    pthread_join( player->thread, NULL );
+    player->started = AIOUSB_FALSE;
+    AIORESULT result = DACOutputClose( player->DeviceIndex, AIOUSB_TRUE );
+    if ( player->result == AIOUSB_SUCCESS )
+        player->result = result;
+
+    return -(AIORET_TYPE)player->result;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIODACWaveformPlayerGetCycles( AIODACWaveformPlayer *player )
+{
+    AIO_ASSERT( player );
+    AIORET_TYPE cycles;
+
+    pthread_mutex_lock( &player->lock );
+    cycles = (AIORET_TYPE)player->cycles;
+    pthread_mutex_unlock( &player->lock );
+
+    return cycles;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+/*****************************************************************************
+ * Self-test
+ ****************************************************************************/
+
+#ifdef SELF_TEST
+
+#include "mocks/mock_fake_device.h"
+#include <unistd.h>
+#include <vector>
+
+using namespace AIOUSB;
+
+static std::vector<unsigned short> streamed;
+static std::vector<int> requests;
+
+static int fake_control( USBDevice *usb, uint8_t request_type, uint8_t bRequest, uint16_t wValue, uint16_t wIndex,
+                         unsigned char *data, uint16_t wLength, unsigned int timeout )
+{
+    requests.push_back( bRequest );
+    return wLength;
+}
+
+static int fake_bulk( USBDevice *usb, unsigned char endpoint, unsigned char *data, int length, int *actual_length, unsigned int timeout )
+{
+    const unsigned short *samples = (const unsigned short *)data;
+    streamed.insert( streamed.end(), samples, samples + length / 2 );
+    *actual_length = length;
+    usleep( 200 );
+    return LIBUSB_SUCCESS;
+}
+
+class DACWaveformSetup : public MockFakeDeviceTest
+{
+ protected:
+    virtual void SetUp() {
+        MockFakeDeviceTest::SetUp();
+        streamed.clear();
+        requests.clear();
+        device = AddFakeDevice( USB_DA12_8A, fake_control, fake_bulk );
+    }
+    AIOUSBDevice *device;
+};
+
+TEST(DACWaveform,VoltsBecomeFlaggedCountsPerChannelRange)
+{
+    AIODACWaveform *waveform = NewAIODACWaveform( 2, 3 );
+    ASSERT_TRUE( waveform );
+    EXPECT_EQ( AIOUSB_SUCCESS, AIODACWaveformSetRange( waveform, 1, DAC_RANGE_10V ) );
+    EXPECT_EQ( -AIOUSB_ERROR_INVALID_PARAMETER, AIODACWaveformSetRange( waveform, 0, (DACRange)17 ) );
+
+    double volts[] = { 0.0, -10.0, 2.5, 0.0, 7.0, 10.0 };
+    EXPECT_EQ( AIOUSB_SUCCESS, AIODACWaveformSetVolts( waveform, volts ) );
+    EXPECT_EQ( 0, waveform->samples[0] );
+    EXPECT_EQ( 0 | DAC_STREAM_EOD, waveform->samples[1] );
+    EXPECT_EQ( 2048, waveform->samples[2] );
+    EXPECT_EQ( 2048 | DAC_STREAM_EOD, waveform->samples[3] );
+    EXPECT_EQ( 4095, waveform->samples[4] ) << "clipped to the channel's range";
+    EXPECT_EQ( 4095 | DAC_STREAM_EOD | DAC_STREAM_EOF, waveform->samples[5] );
+
+    DeleteAIODACWaveform( waveform );
+}
+
+TEST_F(DACWaveformSetup,SwapsOnlyBetweenPeriods)
+{
+    unsigned short rampA[] = { 1, 2, 3, 4, 5 };
+    unsigned short rampB[] = { 100, 200, 300 };
+    AIODACWaveform *a = NewAIODACWaveform( 1, 5 );
+    AIODACWaveform *b = NewAIODACWaveform( 1, 3 );
+    AIODACWaveform *wide = NewAIODACWaveform( 2, 3 );
+    AIODACWaveformSetCounts( a, rampA );
+    AIODACWaveformSetCounts( b, rampB );
+
+    AIODACWaveformPlayer *player = NewAIODACWaveformPlayer( 0 );
+    double hz = 10000;
+    ASSERT_EQ( AIOUSB_SUCCESS, AIODACWaveformPlayerStart( player, a, &hz ) );
+    while ( AIODACWaveformPlayerGetCycles( player ) < 20000 )
+        usleep( 1000 );
+    EXPECT_EQ( -AIOUSB_ERROR_INVALID_PARAMETER, AIODACWaveformPlayerSwap( player, wide, 0 ) );
+    EXPECT_EQ( AIOUSB_SUCCESS, AIODACWaveformPlayerSwap( player, b, 0 ) );
+    AIORET_TYPE swappedAt = AIODACWaveformPlayerGetCycles( player );
+    while ( AIODACWaveformPlayerGetCycles( player ) < swappedAt + 20000 )
+        usleep( 1000 );
+    EXPECT_EQ( AIOUSB_SUCCESS, AIODACWaveformPlayerStop( player ) );
+    EXPECT_FALSE( device->bDACOpen );
+
+    /* whole periods of a, then whole periods of b, then the end */
+    size_t i = 0, periodsA = 0, periodsB = 0;
+    for ( ; i + 5 <= streamed.size() && ( streamed[i] & DAC_STREAM_COUNTS_MASK ) == 1; i += 5, periodsA ++ )
+        for ( int j = 0; j < 5; j ++ )
+            ASSERT_EQ( rampA[j], streamed[i + j] & DAC_STREAM_COUNTS_MASK );
+    for ( ; i + 3 <= streamed.size(); i += 3, periodsB ++ )
+        for ( int j = 0; j < 3; j ++ )
+            ASSERT_EQ( rampB[j], streamed[i + j] & DAC_STREAM_COUNTS_MASK );
+    EXPECT_EQ( streamed.size(), i );
+    EXPECT_GE( periodsA, 20000u );
+    EXPECT_GE( periodsB, 20000u );
+    EXPECT_EQ( 300 | DAC_STREAM_EOD | DAC_STREAM_EOF | DAC_STREAM_EOM, streamed.back() );
+
+    DeleteAIODACWaveformPlayer( player );
+    DeleteAIODACWaveform( a );
+    DeleteAIODACWaveform( b );
+    DeleteAIODACWaveform( wide );
+}
+
+TEST_F(DACWaveformSetup,LoopsOnTheBoardWithoutTheHost)
+{
+    AIODACWaveform *waveform = NewAIODACWaveform( 2, 100 );
+    double hz = 1000;
+    ASSERT_EQ( AIOUSB_SUCCESS, AIODACWaveformLoopOnBoard( 0, waveform, &hz ) );
+    ASSERT_EQ( 200u, streamed.size() );
+    EXPECT_EQ( DAC_STREAM_EOD | DAC_STREAM_EOF | DAC_STREAM_LOOP, streamed.back() );
+    EXPECT_EQ( 0, streamed.back() & DAC_STREAM_EOM );
+    EXPECT_EQ( AUR_DAC_CONTROL, requests.back() ) << "started, since it is too short to start itself";
+    DeleteAIODACWaveform( waveform );
+
+    waveform = NewAIODACWaveform( 8, 10000 );
+    EXPECT_EQ( -AIOUSB_ERROR_INVALID_PARAMETER, AIODACWaveformLoopOnBoard( 0, waveform, &hz ) );
+    DeleteAIODACWaveform( waveform );
+}
+
+int main(int argc, char *argv[] )
+{
+    testing::InitGoogleTest(&argc, argv);
+    testing::TestEventListeners & listeners = testing::UnitTest::GetInstance()->listeners();
+#ifdef GTEST_TAP_PRINT_TO_STDOUT
+    delete listeners.Release(listeners.default_result_printer());
+#endif
+
+    return RUN_ALL_TESTS();
+}
+
+#endif
@@ -0,0 +1,76 @@
+/**
+ * @file   AIODACWaveform.h
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  Precomputed DAC waveforms played over and over
+ *
+ */
+
+#ifndef _AIO_DAC_WAVEFORM_H
+#define _AIO_DAC_WAVEFORM_H
+
+#include "AIOTypes.h"
+#include <pthread.h>
+#include <stdint.h>
+
+#ifdef __aiousb_cplusplus
+namespace AIOUSB
+{
+#endif
+
+/**
+ * @brief One period of a multi-channel DAC waveform, held in the form the
+ * board's DAC stream takes, so playing it costs a copy and nothing else.
+ * Volts are turned into counts once, through each channel's DACRange,
+ * when the waveform is loaded.
+ */
+typedef struct AIODACWaveform {
+    unsigned numChannels;
+    unsigned long numPoints;
+    unsigned short *samples;    /**< numPoints * numChannels, flagged as DACOutputFrameRaw() takes them */
+    double *minVolts;           /**< per channel */
+    double *spanVolts;          /**< per channel */
+} AIODACWaveform;
+
+/**
+ * @brief AIODACWaveformPlayer streams an AIODACWaveform to a board's DACs
+ * from its own thread, one period after another, until stopped. Another
+ * waveform with the same channel count can be swapped in while it plays;
+ * it takes over at the end of a period, so the output never skips or
+ * repeats a point.
+ */
+typedef struct AIODACWaveformPlayer {
+    unsigned long DeviceIndex;
+    AIODACWaveform *current;
+    AIODACWaveform *next;       /**< waiting for current's period to end */
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;     /**< a waveform was swapped in, or the thread stopped */
+    AIOUSB_BOOL running;
+    AIOUSB_BOOL started;
+    AIOUSB_BOOL quit;
+    AIORESULT result;           /**< why the thread stopped early */
+    uint64_t cycles;            /**< periods handed to the DAC stream */
+} AIODACWaveformPlayer;
+
+/* BEGIN AIOUSB_API */
+PUBLIC_EXTERN AIODACWaveform *NewAIODACWaveform( unsigned numChannels, unsigned long numPoints );
+PUBLIC_EXTERN AIORET_TYPE DeleteAIODACWaveform( AIODACWaveform *waveform );
+PUBLIC_EXTERN AIORET_TYPE AIODACWaveformSetRange( AIODACWaveform *waveform, unsigned channel, DACRange range );
+PUBLIC_EXTERN AIORET_TYPE AIODACWaveformSetVolts( AIODACWaveform *waveform, const double *volts );
+PUBLIC_EXTERN AIORET_TYPE AIODACWaveformSetCounts( AIODACWaveform *waveform, const unsigned short *counts );
+PUBLIC_EXTERN AIORET_TYPE AIODACWaveformLoopOnBoard( unsigned long DeviceIndex, AIODACWaveform *waveform, double *clockHz );
+PUBLIC_EXTERN AIODACWaveformPlayer *NewAIODACWaveformPlayer( unsigned long DeviceIndex );
+PUBLIC_EXTERN AIORET_TYPE DeleteAIODACWaveformPlayer( AIODACWaveformPlayer *player );
+PUBLIC_EXTERN AIORET_TYPE AIODACWaveformPlayerStart( AIODACWaveformPlayer *player, AIODACWaveform *waveform, double *clockHz );
+PUBLIC_EXTERN AIORET_TYPE AIODACWaveformPlayerSwap( AIODACWaveformPlayer *player, AIODACWaveform *waveform, unsigned timeout );
+PUBLIC_EXTERN AIORET_TYPE AIODACWaveformPlayerStop( AIODACWaveformPlayer *player );
+PUBLIC_EXTERN AIORET_TYPE AIODACWaveformPlayerGetCycles( AIODACWaveformPlayer *player );
+/* END AIOUSB_API */
+
+#ifdef __aiousb_cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,709 @@
+/**
+ * @file   AIODIOEvents.c
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  Debounced change-of-state events from the digital inputs
+ *
+ * Watching inputs for transitions used to mean calling DIO_ReadAll() in a
+ * loop and comparing buffers in user code. AIODIOEventEngine does the
+ * sampling on its own thread and publishes each debounced edge once,
+ * with the time it was first seen, for as many readers as want it.
+ *
+ * The event ring is a single writer, many reader sequence ring: every
+ * slot carries the sequence number of the event in it, written last by
+ * the engine and checked before and after the copy by a reader, so a
+ * reader notices when the engine has lapped it instead of returning a
+ * torn event. Readers never take a lock unless they have to sleep.
+ */
+
+#include "AIODIOEvents.h"
+#include "AIOUSB_DIO.h"
+#include "AIODeviceTable.h"
+#include "AIOTime.h"
+
+#include <errno.h>
+#include <string.h>
+
+#ifdef __cplusplus
+namespace AIOUSB {
+#endif
+
+#define DIO_EVENT_DEFAULT_QUEUE 1024
+#define DIO_EVENT_STREAM_CHUNK  256
+
+/*----------------------------------------------------------------------------*/
+static void _aio_dio_events_publish( AIODIOEventEngine *engine, unsigned long BitIndex, unsigned char value, uint64_t timestamp )
+{
+    uint64_t seq = engine->head;    /* only this thread writes head */
+    struct aio_dio_event_slot *slot = &engine->slots[ seq & engine->slotMask ];
+
+    __atomic_store_n( &slot->seq, 0, __ATOMIC_RELAXED );
+    __atomic_thread_fence( __ATOMIC_RELEASE );
+    slot->event.timestamp = timestamp;
+    slot->event.BitIndex  = BitIndex;
+    slot->event.value     = value;
+    __atomic_store_n( &slot->seq, seq + 1, __ATOMIC_RELEASE );
+    __atomic_store_n( &engine->head, seq + 1, __ATOMIC_SEQ_CST );
+}
+
+/*----------------------------------------------------------------------------*/
+static void _aio_dio_events_wake( AIODIOEventEngine *engine )
+{
+    if ( __atomic_load_n( &engine->waiters, __ATOMIC_SEQ_CST ) ) {
+        pthread_mutex_lock( &engine->lock );
+        pthread_cond_broadcast( &engine->changed );
+        pthread_mutex_unlock( &engine->lock );
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Folds one sample into the debounce state and publishes the
+ * edges that have settled
+ * @param raw the sample, numWords words, bit n of the board in bit n%64 of word n/64
+ * @param now when the sample was taken
+ * @return number of events published
+ */
+static int _aio_dio_events_sample( AIODIOEventEngine *engine, const uint64_t *raw, uint64_t now )
+{
+    int published = 0;
+
+    engine->samples ++;
+    if ( !engine->primed ) {
+        memcpy( engine->stable, raw, engine->numWords * sizeof(uint64_t) );
+        engine->primed = AIOUSB_TRUE;
+        return 0;
+    }
+
+    for ( unsigned w = 0; w < engine->numWords; w ++ ) {
+        uint64_t diff  = raw[w] ^ engine->stable[w];
+        uint64_t fresh = diff & ~engine->pending[w];
+        uint64_t bits;
+
+        if ( !diff && !engine->pending[w] )
+            continue;
+        engine->pending[w] = diff;      /* bits that bounced back drop out */
+        for ( bits = fresh; bits; bits &= bits - 1 )
+            engine->pendingSince[ w * 64 + __builtin_ctzll( bits ) ] = now;
+
+        for ( bits = engine->pending[w]; bits; bits &= bits - 1 ) {
+            unsigned bit = w * 64 + __builtin_ctzll( bits );
+            uint64_t mask = bits & -bits;
+            if ( now - engine->pendingSince[bit] < __atomic_load_n( &engine->debounce[bit], __ATOMIC_RELAXED ) )
+                continue;
+            engine->stable[w]  ^= mask;
+            engine->pending[w] &= ~mask;
+            _aio_dio_events_publish( engine, bit, (raw[w] & mask) ? 1 : 0, engine->pendingSince[bit] );
+            published ++;
+        }
+    }
+
+    return published;
+}
+
+/*----------------------------------------------------------------------------*/
+static void _aio_dio_events_finish( AIODIOEventEngine *engine, AIORESULT result )
+{
+    pthread_mutex_lock( &engine->lock );
+    engine->result = result;
+    __atomic_store_n( &engine->running, AIOUSB_FALSE, __ATOMIC_SEQ_CST );
+    pthread_cond_broadcast( &engine->changed );
+    pthread_mutex_unlock( &engine->lock );
+}
+
+/*----------------------------------------------------------------------------*/
+static void *_aio_dio_events_poller( void *arg )
+{
+    AIODIOEventEngine *engine = (AIODIOEventEngine *)arg;
+    AIORESULT result = AIOUSB_SUCCESS;
+    uint64_t period = (uint64_t)(1e9 / engine->pollHz);
+    uint64_t next = AIOTimeNowNs();
+    uint64_t *raw = (uint64_t *)calloc( engine->numWords, sizeof(uint64_t) );
+
+    if ( !raw )
+        result = AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+
+    while ( result == AIOUSB_SUCCESS ) {
+        struct timespec deadline;
+        uint64_t now;
+
+        result = DIO_ReadAll( engine->DeviceIndex, raw );
+        if ( result != AIOUSB_SUCCESS )
+            break;
+        now = AIOTimeNowNs();
+        if ( _aio_dio_events_sample( engine, raw, now ) )
+            _aio_dio_events_wake( engine );
+
+        next += period;
+        if ( next <= now ) {
+            engine->lateSamples ++;
+            next = now + period;
+        }
+        AIOTimeToTimespec( &deadline, next );
+        pthread_mutex_lock( &engine->lock );
+        while ( !engine->quit && pthread_cond_timedwait( &engine->changed, &engine->lock, &deadline ) != ETIMEDOUT )
+            ;
+        if ( engine->quit ) {
+            pthread_mutex_unlock( &engine->lock );
+            break;
+        }
+        pthread_mutex_unlock( &engine->lock );
+    }
+
+    free( raw );
+    _aio_dio_events_finish( engine, result );
+    return NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Stream source: every point is a sample of bits 0-15. A chunk of
+ * points is read at once, so each point's time is worked back from when
+ * the chunk arrived using the stream clock.
+ */
+static void *_aio_dio_events_streamer( void *arg )
+{
+    AIODIOEventEngine *engine = (AIODIOEventEngine *)arg;
+    AIORESULT result = AIOUSB_SUCCESS;
+    unsigned short points[ DIO_EVENT_STREAM_CHUNK ];
+    uint64_t spacing = engine->pollHz > 0 ? (uint64_t)(1e9 / engine->pollHz) : 0;
+    uint64_t *raw = (uint64_t *)calloc( engine->numWords, sizeof(uint64_t) );
+
+    if ( !raw )
+        result = AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+
+    while ( result == AIOUSB_SUCCESS && !__atomic_load_n( &engine->quit, __ATOMIC_RELAXED ) ) {
+        AIORET_TYPE got = AIODIOStreamRead( engine->stream, points, DIO_EVENT_STREAM_CHUNK, 100 );
+        uint64_t now = AIOTimeNowNs();
+        int published = 0;
+
+        if ( got == -AIOUSB_ERROR_TIMEOUT )
+            continue;
+        if ( got <= 0 ) {
+            result = got < 0 ? (AIORESULT)-got : (AIORESULT)AIOUSB_SUCCESS;
+            break;
+        }
+        for ( AIORET_TYPE i = 0; i < got; i ++ ) {
+            raw[0] = points[i];
+            published += _aio_dio_events_sample( engine, raw, now - (got - 1 - i) * spacing );
+        }
+        if ( published )
+            _aio_dio_events_wake( engine );
+    }
+
+    free( raw );
+    _aio_dio_events_finish( engine, result );
+    return NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Creates an event engine for a device's digital inputs. All bits
+ * start without debounce.
+ * @param DeviceIndex
+ * @param pollHz how often AIODIOEventEngineStart() samples the inputs
+ * @param queueSize events kept for readers, rounded up to a power of
+ * two; 0 for a default of 1024
+ * @return the new engine, or NULL
+ */
+AIODIOEventEngine *NewAIODIOEventEngine( unsigned long DeviceIndex, double pollHz, unsigned queueSize )
+{
+    AIO_ASSERT_RET( NULL, pollHz > 0 );
+    AIORESULT result = AIOUSB_SUCCESS;
+    AIOUSBDevice *device = AIODeviceTableGetDeviceAtIndex( DeviceIndex, &result );
+    AIODIOEventEngine *engine;
+    pthread_condattr_t attr;
+    uint64_t slots = 1;
+
+    if ( result != AIOUSB_SUCCESS || device->DIOBytes == 0 )
+        return NULL;
+    if ( queueSize == 0 )
+        queueSize = DIO_EVENT_DEFAULT_QUEUE;
+    while ( slots < queueSize )
+        slots <<= 1;
+
+    engine = (AIODIOEventEngine *)calloc( 1, sizeof(AIODIOEventEngine) );
+    if ( !engine )
+        return NULL;
+    engine->DeviceIndex  = DeviceIndex;
+    engine->pollHz       = pollHz;
+    engine->numBits      = device->DIOBytes * BITS_PER_BYTE;
+    engine->numWords     = (engine->numBits + 63) / 64;
+    engine->stable       = (uint64_t *)calloc( engine->numWords, sizeof(uint64_t) );
+    engine->pending      = (uint64_t *)calloc( engine->numWords, sizeof(uint64_t) );
+    engine->pendingSince = (uint64_t *)calloc( engine->numWords * 64, sizeof(uint64_t) );
+    engine->debounce     = (uint64_t *)calloc( engine->numWords * 64, sizeof(uint64_t) );
+    engine->slots        = (struct aio_dio_event_slot *)calloc( slots, sizeof(struct aio_dio_event_slot) );
+    engine->slotMask     = slots - 1;
+    engine->result       = AIOUSB_SUCCESS;
+    if ( !engine->stable || !engine->pending || !engine->pendingSince || !engine->debounce || !engine->slots )
+        goto err_NewAIODIOEventEngine;
+
+    pthread_mutex_init( &engine->lock, NULL );
+    pthread_condattr_init( &attr );
+    pthread_condattr_setclock( &attr, CLOCK_MONOTONIC );
+    pthread_cond_init( &engine->changed, &attr );
+    pthread_condattr_destroy( &attr );
+
+    return engine;
+
+ err_NewAIODIOEventEngine:
+    free( engine->stable );
+    free( engine->pending );
+    free( engine->pendingSince );
+    free( engine->debounce );
+    free( engine->slots );
+    free( engine );
+    return NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Stops the engine and frees it. Delete its cursors first.
+ */
+AIORET_TYPE DeleteAIODIOEventEngine( AIODIOEventEngine *engine )
+{
+    AIO_ASSERT( engine );
+
+    AIODIOEventEngineStop( engine );
+    pthread_mutex_destroy( &engine->lock );
+    pthread_cond_destroy( &engine->changed );
+    free( engine->stable );
+    free( engine->pending );
+    free( engine->pendingSince );
+    free( engine->debounce );
+    free( engine->slots );
+    free( engine );
+
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Sets how long a bit has to hold a new level before the change is
+ * reported. A level that reverts within that time is ignored. May be
+ * called while the engine runs.
+ * @param engine
+ * @param BitIndex
+ * @param debounceUs microseconds, 0 reports every change the next sample sees
+ */
+AIORET_TYPE AIODIOEventEngineSetDebounce( AIODIOEventEngine *engine, unsigned long BitIndex, unsigned debounceUs )
+{
+    AIO_ASSERT( engine );
+    AIO_ERROR_VALID_AIORET_TYPE( AIOUSB_ERROR_INVALID_PARAMETER, BitIndex < engine->numBits );
+
+    __atomic_store_n( &engine->debounce[ BitIndex ], (uint64_t)debounceUs * 1000, __ATOMIC_RELAXED );
+
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+static AIORET_TYPE _aio_dio_events_start( AIODIOEventEngine *engine, void *(*source)(void *) )
+{
+    AIO_ERROR_VALID_AIORET_TYPE( AIOUSB_ERROR_INVALID_THREAD, !engine->started );
+
+    engine->primed  = AIOUSB_FALSE;
+    engine->quit    = AIOUSB_FALSE;
+    engine->result  = AIOUSB_SUCCESS;
+    engine->running = AIOUSB_TRUE;
+    memset( engine->pending, 0, engine->numWords * sizeof(uint64_t) );
+    if ( pthread_create( &engine->thread, NULL, source, engine ) != 0 ) {
+        engine->running = AIOUSB_FALSE;
+        return -AIOUSB_ERROR_INVALID_THREAD;
+    }
+    engine->started = AIOUSB_TRUE;
+
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Starts sampling the inputs with DIO_ReadAll() at the engine's
+ * poll rate. The first sample sets the reference levels; events start
+ * with the first change after it.
+ */
+AIORET_TYPE AIODIOEventEngineStart( AIODIOEventEngine *engine )
+{
+    AIO_ASSERT( engine );
+    AIORESULT result = AIOUSB_SUCCESS;
+    AIODeviceTableGetDeviceAtIndex( engine->DeviceIndex, &result );
+    AIO_ERROR_VALID_DATA( -(AIORET_TYPE)result, result == AIOUSB_SUCCESS );
+
+    engine->stream = NULL;
+    return _aio_dio_events_start( engine, _aio_dio_events_poller );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Takes samples from a started input AIODIOStream instead of
+ * polling, so every clocked point is examined without a control transfer
+ * per sample. The stream carries bits 0-15 only. The engine reads the
+ * stream, so nothing else should while the engine runs.
+ * @param engine
+ * @param stream
+ * @param clockHz the read clock set with DIO_StreamSetClocks(), used to
+ * time stamp each point; 0 stamps a whole chunk with its arrival time
+ */
+AIORET_TYPE AIODIOEventEngineStartFromStream( AIODIOEventEngine *engine, AIODIOStream *stream, double clockHz )
+{
+    AIO_ASSERT( engine );
+    AIO_ASSERT( stream );
+    AIO_ERROR_VALID_AIORET_TYPE( AIOUSB_ERROR_NOT_SUPPORTED, stream->isRead );
+
+    engine->stream = stream;
+    engine->pollHz = clockHz;
+    return _aio_dio_events_start( engine, _aio_dio_events_streamer );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Stops sampling. Events already published stay readable.
+ * @return AIOUSB_SUCCESS, or the negated error that stopped the engine early
+ */
+AIORET_TYPE AIODIOEventEngineStop( AIODIOEventEngine *engine )
+{
+    AIO_ASSERT( engine );
+    if ( !engine->started )
+        return AIOUSB_SUCCESS;
+
+    pthread_mutex_lock( &engine->lock );
+    __atomic_store_n( &engine->quit, AIOUSB_TRUE, __ATOMIC_RELAXED );
+    pthread_cond_broadcast( &engine->changed );
+    pthread_mutex_unlock( &engine->lock );
+
+    pthread_join( engine->thread, NULL );
+    engine->started = AIOUSB_FALSE;
+
+    return -(AIORET_TYPE)engine->result;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIODIOEventEngineGetSamples( AIODIOEventEngine *engine )
+{
+    AIO_ASSERT( engine );
+    return (AIORET_TYPE)engine->samples;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIODIOEventEngineGetLateSamples( AIODIOEventEngine *engine )
+{
+    AIO_ASSERT( engine );
+    return (AIORET_TYPE)engine->lateSamples;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Creates a reader that starts with the next event published
+ * @param engine
+ * @param bitMask DIOBytes bytes, bit n set for each bit the reader wants,
+ * in the same layout as DIO_ReadAll(); NULL for every bit
+ */
+AIODIOEventCursor *NewAIODIOEventCursor( AIODIOEventEngine *engine, const unsigned char *bitMask )
+{
+    AIO_ASSERT_RET( NULL, engine );
+    AIODIOEventCursor *cursor = (AIODIOEventCursor *)calloc( 1, sizeof(AIODIOEventCursor) );
+    if ( !cursor )
+        return NULL;
+    cursor->bits = (uint64_t *)calloc( engine->numWords, sizeof(uint64_t) );
+    if ( !cursor->bits ) {
+        free( cursor );
+        return NULL;
+    }
+
+    if ( bitMask )
+        memcpy( cursor->bits, bitMask, engine->numBits / BITS_PER_BYTE );
+    else
+        memset( cursor->bits, 0xff, engine->numWords * sizeof(uint64_t) );
+    cursor->engine = engine;
+    cursor->next   = __atomic_load_n( &engine->head, __ATOMIC_ACQUIRE );
+
+    return cursor;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE DeleteAIODIOEventCursor( AIODIOEventCursor *cursor )
+{
+    AIO_ASSERT( cursor );
+    free( cursor->bits );
+    free( cursor );
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Takes the reader's next wanted event without waiting
+ * @return 1 with *event filled in, or 0 if there is none yet
+ */
+AIORET_TYPE AIODIOEventCursorNext( AIODIOEventCursor *cursor, AIODIOEvent *event )
+{
+    AIO_ASSERT( cursor );
+    AIO_ASSERT( event );
+    AIODIOEventEngine *engine = cursor->engine;
+    uint64_t size = engine->slotMask + 1;
+    uint64_t head = __atomic_load_n( &engine->head, __ATOMIC_ACQUIRE );
+
+    while ( cursor->next < head ) {
+        struct aio_dio_event_slot *slot;
+        uint64_t before, after;
+        AIODIOEvent copy;
+
+        if ( head - cursor->next > size ) {
+            cursor->dropped += head - size - cursor->next;
+            cursor->next = head - size;
+        }
+        slot   = &engine->slots[ cursor->next & engine->slotMask ];
+        before = __atomic_load_n( &slot->seq, __ATOMIC_ACQUIRE );
+        copy   = slot->event;
+        __atomic_thread_fence( __ATOMIC_ACQUIRE );
+        after  = __atomic_load_n( &slot->seq, __ATOMIC_RELAXED );
+        if ( before != cursor->next + 1 || after != before ) {
+            /* lapped while copying; the engine is about to move head past us */
+            head = __atomic_load_n( &engine->head, __ATOMIC_ACQUIRE );
+            continue;
+        }
+
+        cursor->next ++;
+        if ( cursor->bits[ copy.BitIndex / 64 ] & (1ull << (copy.BitIndex % 64)) ) {
+            *event = copy;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Takes the reader's next wanted event, waiting for one if needed
+ * @param cursor
+ * @param event
+ * @param timeout milliseconds to wait, 0 waits for as long as it takes
+ * @return 1 with *event filled in; 0 once a stopped engine has nothing
+ * more for this reader; -AIOUSB_ERROR_TIMEOUT; or the negated error
+ * that stopped the engine
+ */
+AIORET_TYPE AIODIOEventWait( AIODIOEventCursor *cursor, AIODIOEvent *event, unsigned timeout )
+{
+    AIO_ASSERT( cursor );
+    AIO_ASSERT( event );
+    AIODIOEventEngine *engine = cursor->engine;
+    AIORET_TYPE retval;
+    struct timespec deadline;
+    int waitResult = 0;
+
+    AIOTimeToTimespec( &deadline, AIOTimeNowNs() + (uint64_t)timeout * 1000000 );
+
+    for (;;) {
+        if ( (retval = AIODIOEventCursorNext( cursor, event )) != 0 )
+            return retval;
+        if ( !__atomic_load_n( &engine->running, __ATOMIC_SEQ_CST ) ) {
+            /* one more look, events published just before the engine stopped */
+            if ( (retval = AIODIOEventCursorNext( cursor, event )) != 0 )
+                return retval;
+            return -(AIORET_TYPE)engine->result;
+        }
+        if ( waitResult == ETIMEDOUT )
+            return -AIOUSB_ERROR_TIMEOUT;
+
+        pthread_mutex_lock( &engine->lock );
+        __atomic_add_fetch( &engine->waiters, 1, __ATOMIC_SEQ_CST );
+        if ( __atomic_load_n( &engine->head, __ATOMIC_SEQ_CST ) == cursor->next &&
+             __atomic_load_n( &engine->running, __ATOMIC_SEQ_CST ) ) {
+            if ( timeout == 0 )
+                pthread_cond_wait( &engine->changed, &engine->lock );
+            else
+                waitResult = pthread_cond_timedwait( &engine->changed, &engine->lock, &deadline );
+        }
+        __atomic_sub_fetch( &engine->waiters, 1, __ATOMIC_SEQ_CST );
+        pthread_mutex_unlock( &engine->lock );
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIODIOEventCursorGetDropped( AIODIOEventCursor *cursor )
+{
+    AIO_ASSERT( cursor );
+    return (AIORET_TYPE)cursor->dropped;
+}
+
+
+#ifdef __cplusplus
+}
+#endif
+
+/*****************************************************************************
+ * Self-test
+ * @note This section is for stress testing the DIO event engine without
+ * using the USB features
+ *
+ ****************************************************************************/
+
+#ifdef SELF_TEST
+
+#include "mocks/mock_fake_device.h"
+#include <unistd.h>
+
+using namespace AIOUSB;
+
+/* inputs as the fake board reports them, changed by the test between polls */
+static volatile uint32_t board_inputs = 0;
+
+static int fake_read_inputs( USBDevice *usb, uint8_t request_type, uint8_t bRequest, uint16_t wValue, uint16_t wIndex,
+                             unsigned char *data, uint16_t wLength, unsigned int timeout )
+{
+    uint32_t inputs = board_inputs;
+    if ( bRequest != AUR_DIO_READ )
+        return wLength;
+    memcpy( data, &inputs, MIN( wLength, sizeof(inputs) ) );
+    return wLength;
+}
+
+class DIOEventsSetup : public MockFakeDeviceTest
+{
+ protected:
+    virtual void SetUp() {
+        MockFakeDeviceTest::SetUp();
+        board_inputs = 0;
+        device = AddFakeDevice( USB_IDIO_16, fake_read_inputs );
+    }
+    AIOUSBDevice *device;
+};
+
+TEST_F(DIOEventsSetup,SampleReportsEdgesAfterDebounce)
+{
+    AIODIOEventEngine *engine = NewAIODIOEventEngine( 0, 1000, 16 );
+    ASSERT_TRUE( engine );
+    EXPECT_EQ( 32u, engine->numBits );
+    AIODIOEventCursor *all = NewAIODIOEventCursor( engine, NULL );
+    AIODIOEvent ev;
+    uint64_t raw = 0;
+
+    EXPECT_EQ( AIOUSB_SUCCESS, AIODIOEventEngineSetDebounce( engine, 3, 5 ) );
+    EXPECT_EQ( -AIOUSB_ERROR_INVALID_PARAMETER, AIODIOEventEngineSetDebounce( engine, 32, 5 ) );
+
+    EXPECT_EQ( 0, _aio_dio_events_sample( engine, &raw, 0 ) ) << "the first sample is the reference";
+
+    raw = 0x9;                  /* bit 0 immediate, bit 3 debounced 5us */
+    EXPECT_EQ( 1, _aio_dio_events_sample( engine, &raw, 1000 ) );
+    ASSERT_EQ( 1, AIODIOEventCursorNext( all, &ev ) );
+    EXPECT_EQ( 0ul, ev.BitIndex );
+    EXPECT_EQ( 1, ev.value );
+    EXPECT_EQ( 1000u, ev.timestamp );
+
+    raw = 0x1;                  /* bit 3 bounces back */
+    EXPECT_EQ( 0, _aio_dio_events_sample( engine, &raw, 2000 ) );
+    raw = 0x9;
+    EXPECT_EQ( 0, _aio_dio_events_sample( engine, &raw, 3000 ) );
+    EXPECT_EQ( 0, _aio_dio_events_sample( engine, &raw, 7000 ) );
+    EXPECT_EQ( 1, _aio_dio_events_sample( engine, &raw, 8000 ) );
+    ASSERT_EQ( 1, AIODIOEventCursorNext( all, &ev ) );
+    EXPECT_EQ( 3ul, ev.BitIndex );
+    EXPECT_EQ( 3000u, ev.timestamp ) << "stamped when the level was first seen";
+    EXPECT_EQ( 0, AIODIOEventCursorNext( all, &ev ) );
+
+    raw = 0x9 | (1ull << 31);
+    EXPECT_EQ( 1, _aio_dio_events_sample( engine, &raw, 9000 ) );
+    ASSERT_EQ( 1, AIODIOEventCursorNext( all, &ev ) );
+    EXPECT_EQ( 31ul, ev.BitIndex );
+
+    DeleteAIODIOEventCursor( all );
+    DeleteAIODIOEventEngine( engine );
+}
+
+TEST_F(DIOEventsSetup,CursorsFilterBitsAndCountWhatTheyMissed)
+{
+    AIODIOEventEngine *engine = NewAIODIOEventEngine( 0, 1000, 4 );
+    unsigned char mask[4] = { 0x02, 0, 0, 0 };
+    AIODIOEventCursor *bit1 = NewAIODIOEventCursor( engine, mask );
+    AIODIOEventCursor *all  = NewAIODIOEventCursor( engine, NULL );
+    AIODIOEvent ev;
+    uint64_t raw = 0;
+
+    _aio_dio_events_sample( engine, &raw, 0 );
+    for ( int i = 1; i <= 6; i ++ ) {
+        raw ^= 0x3;             /* bits 0 and 1 toggle together */
+        _aio_dio_events_sample( engine, &raw, i );
+    }
+    /* 12 events through a 4 slot ring */
+    int seen = 0;
+    while ( AIODIOEventCursorNext( all, &ev ) == 1 )
+        seen ++;
+    EXPECT_EQ( 4, seen );
+    EXPECT_EQ( 8, AIODIOEventCursorGetDropped( all ) );
+
+    seen = 0;
+    while ( AIODIOEventCursorNext( bit1, &ev ) == 1 ) {
+        EXPECT_EQ( 1ul, ev.BitIndex );
+        seen ++;
+    }
+    EXPECT_EQ( 2, seen );
+
+    DeleteAIODIOEventCursor( bit1 );
+    DeleteAIODIOEventCursor( all );
+    DeleteAIODIOEventEngine( engine );
+}
+
+struct waiter_args {
+    AIODIOEventCursor *cursor;
+    AIODIOEvent event;
+    AIORET_TYPE retval;
+};
+
+static void *wait_for_event( void *arg )
+{
+    struct waiter_args *args = (struct waiter_args *)arg;
+    args->retval = AIODIOEventWait( args->cursor, &args->event, 2000 );
+    return NULL;
+}
+
+TEST_F(DIOEventsSetup,PollingThreadWakesWaitersOnTheirBits)
+{
+    AIODIOEventEngine *engine = NewAIODIOEventEngine( 0, 2000, 0 );
+    unsigned char mask5[4]  = { 0x20, 0, 0, 0 };
+    unsigned char mask17[4] = { 0, 0, 0x02, 0 };
+    struct waiter_args a, b;
+    pthread_t ta, tb;
+    AIODIOEvent ev;
+
+    a.cursor = NewAIODIOEventCursor( engine, mask5 );
+    b.cursor = NewAIODIOEventCursor( engine, mask17 );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIODIOEventEngineStart( engine ) );
+    EXPECT_EQ( -AIOUSB_ERROR_TIMEOUT, AIODIOEventWait( a.cursor, &ev, 10 ) );
+
+    pthread_create( &ta, NULL, wait_for_event, &a );
+    pthread_create( &tb, NULL, wait_for_event, &b );
+    usleep( 5000 );
+    board_inputs = 1u << 17;
+    usleep( 5000 );
+    board_inputs |= 1u << 5;
+    pthread_join( ta, NULL );
+    pthread_join( tb, NULL );
+
+    EXPECT_EQ( 1, a.retval );
+    EXPECT_EQ( 5ul, a.event.BitIndex );
+    EXPECT_EQ( 1, b.retval );
+    EXPECT_EQ( 17ul, b.event.BitIndex );
+    EXPECT_LT( b.event.timestamp, a.event.timestamp );
+
+    EXPECT_EQ( AIOUSB_SUCCESS, AIODIOEventEngineStop( engine ) );
+    EXPECT_GT( AIODIOEventEngineGetSamples( engine ), 10 );
+    EXPECT_EQ( 0, AIODIOEventWait( a.cursor, &ev, 0 ) ) << "a stopped engine doesn't block";
+
+    DeleteAIODIOEventCursor( a.cursor );
+    DeleteAIODIOEventCursor( b.cursor );
+    DeleteAIODIOEventEngine( engine );
+}
+
+int main(int argc, char *argv[] )
+{
+    testing::InitGoogleTest(&argc, argv);
+    testing::TestEventListeners & listeners = testing::UnitTest::GetInstance()->listeners();
+#ifdef GTEST_TAP_PRINT_TO_STDOUT
+    delete listeners.Release(listeners.default_result_printer());
+#endif
+
+    return RUN_ALL_TESTS();
+}
+
+#endif
@@ -0,0 +1,112 @@
+/**
+ * @file   AIODIOEvents.h
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  Debounced change-of-state events from the digital inputs
+ *
+ */
+
+#ifndef _AIO_DIO_EVENTS_H
+#define _AIO_DIO_EVENTS_H
+
+#include "AIOTypes.h"
+#include "AIODIOStream.h"
+#include <pthread.h>
+#include <stdint.h>
+
+#ifdef __aiousb_cplusplus
+namespace AIOUSB
+{
+#endif
+
+/**
+ * @brief One debounced edge on one DIO bit
+ */
+typedef struct AIODIOEvent {
+    uint64_t timestamp;         /**< CLOCK_MONOTONIC ns when the new level was first seen */
+    unsigned long BitIndex;
+    unsigned char value;        /**< level the bit settled at */
+} AIODIOEvent;
+
+struct aio_dio_event_slot {
+    uint64_t seq;               /**< sequence number + 1 of the event held, 0 while being rewritten */
+    AIODIOEvent event;
+};
+
+/**
+ * @brief AIODIOEventEngine watches a device's digital inputs from its own
+ * thread and turns level changes into AIODIOEvent records. Each sample is
+ * compared against the last reported state 64 bits at a time, so the
+ * per-sample cost doesn't grow with the number of quiet bits. A change
+ * is only reported once it has held for the bit's debounce time.
+ *
+ * Events go into a ring that the thread never waits on. Any number of
+ * AIODIOEventCursor readers follow it, each at its own pace and each
+ * seeing only the bits it asked for; a reader that falls a whole ring
+ * behind skips ahead and counts what it missed.
+ *
+ * Samples come either from polling DIO_ReadAll() at a fixed rate
+ * (AIODIOEventEngineStart()) or, on boards that stream, from the points
+ * of an input AIODIOStream (AIODIOEventEngineStartFromStream()).
+ */
+typedef struct AIODIOEventEngine {
+    unsigned long DeviceIndex;
+    double pollHz;
+    unsigned numBits;
+    unsigned numWords;
+    uint64_t *stable;           /**< last reported level of every bit */
+    uint64_t *pending;          /**< bits that differ from stable and are being debounced */
+    uint64_t *pendingSince;     /**< per bit, ns */
+    uint64_t *debounce;         /**< per bit, ns */
+    AIOUSB_BOOL primed;         /**< stable holds a real sample */
+
+    struct aio_dio_event_slot *slots;
+    uint64_t slotMask;          /**< number of slots - 1, a power of two less one */
+    uint64_t head;              /**< events published so far */
+    int waiters;
+
+    AIODIOStream *stream;       /**< sample source, or NULL to poll */
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;     /**< events published, or the thread stopped */
+    AIOUSB_BOOL running;
+    AIOUSB_BOOL started;
+    AIOUSB_BOOL quit;
+    AIORESULT result;           /**< why the thread stopped early */
+    uint64_t samples;
+    uint64_t lateSamples;       /**< polls that started after their slot had passed */
+} AIODIOEventEngine;
+
+/**
+ * @brief One reader's position in an AIODIOEventEngine's events. A cursor
+ * belongs to one thread at a time; make one per consumer.
+ */
+typedef struct AIODIOEventCursor {
+    AIODIOEventEngine *engine;
+    uint64_t next;
+    uint64_t *bits;             /**< bits this reader wants */
+    uint64_t dropped;           /**< events overwritten before this reader got to them */
+} AIODIOEventCursor;
+
+/* BEGIN AIOUSB_API */
+PUBLIC_EXTERN AIODIOEventEngine *NewAIODIOEventEngine( unsigned long DeviceIndex, double pollHz, unsigned queueSize );
+PUBLIC_EXTERN AIORET_TYPE DeleteAIODIOEventEngine( AIODIOEventEngine *engine );
+PUBLIC_EXTERN AIORET_TYPE AIODIOEventEngineSetDebounce( AIODIOEventEngine *engine, unsigned long BitIndex, unsigned debounceUs );
+PUBLIC_EXTERN AIORET_TYPE AIODIOEventEngineStart( AIODIOEventEngine *engine );
+PUBLIC_EXTERN AIORET_TYPE AIODIOEventEngineStartFromStream( AIODIOEventEngine *engine, AIODIOStream *stream, double clockHz );
+PUBLIC_EXTERN AIORET_TYPE AIODIOEventEngineStop( AIODIOEventEngine *engine );
+PUBLIC_EXTERN AIORET_TYPE AIODIOEventEngineGetSamples( AIODIOEventEngine *engine );
+PUBLIC_EXTERN AIORET_TYPE AIODIOEventEngineGetLateSamples( AIODIOEventEngine *engine );
+PUBLIC_EXTERN AIODIOEventCursor *NewAIODIOEventCursor( AIODIOEventEngine *engine, const unsigned char *bitMask );
+PUBLIC_EXTERN AIORET_TYPE DeleteAIODIOEventCursor( AIODIOEventCursor *cursor );
+PUBLIC_EXTERN AIORET_TYPE AIODIOEventCursorNext( AIODIOEventCursor *cursor, AIODIOEvent *event );
+PUBLIC_EXTERN AIORET_TYPE AIODIOEventWait( AIODIOEventCursor *cursor, AIODIOEvent *event, unsigned timeout );
+PUBLIC_EXTERN AIORET_TYPE AIODIOEventCursorGetDropped( AIODIOEventCursor *cursor );
+/* END AIOUSB_API */
+
+#ifdef __aiousb_cplusplus
+}
+#endif
+
+#endif
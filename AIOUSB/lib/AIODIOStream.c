@@ -0,0 +1,612 @@
+/**
+ * @file   AIODIOStream.c
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  Continuous digital streaming through a ring buffer
+ *
+ * DIO_StreamFrame() moves one frame and returns, so a caller that wants
+ * an unbounded capture has to loop and loses points whenever it stops to
+ * look at them. AIODIOStream puts an AIOFifoCounts ring between the
+ * caller and a thread that does nothing but issue bulk transfers of
+ * StreamingBlockSize bytes for as long as the stream runs.
+ */
+
+#include "AIODIOStream.h"
+#include "AIOUSB_DIO.h"
+#include "AIODeviceTable.h"
+#include "AIOUSB_Core.h"
+#include "AIOTime.h"
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#ifdef __cplusplus
+namespace AIOUSB {
+#endif
+
+#define DIO_STREAM_PACKET_POINTS 256 /* one 512 byte bulk packet */
+
+/*----------------------------------------------------------------------------*/
+static void _aio_dio_stream_signal( AIODIOStream *stream )
+{
+    uint64_t one = 1;
+    pthread_cond_broadcast( &stream->changed );
+    if ( stream->eventFd >= 0 ) {
+        ssize_t written = write( stream->eventFd, &one, sizeof(one) );
+        (void)written;          /* only fails with the counter already pending, nothing lost */
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+static void _aio_dio_stream_clear_event( AIODIOStream *stream )
+{
+    uint64_t count;
+    if ( stream->eventFd >= 0 ) {
+        ssize_t got = read( stream->eventFd, &count, sizeof(count) );
+        (void)got;              /* EAGAIN just means it wasn't signalled */
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+static void _aio_dio_stream_finish( AIODIOStream *stream, AIORESULT result )
+{
+    pthread_mutex_lock( &stream->lock );
+    stream->result  = result;
+    stream->running = AIOUSB_FALSE;
+    _aio_dio_stream_signal( stream );
+    pthread_mutex_unlock( &stream->lock );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Input side: reads a block from the board, then keeps what fits
+ * in the ring. The transfer runs without the lock so readers are never
+ * held up by the bus.
+ */
+static void *_aio_dio_stream_reader( void *arg )
+{
+    AIODIOStream *stream = (AIODIOStream *)arg;
+    AIORESULT result = AIOUSB_SUCCESS;
+    AIOUSBDevice *device = AIODeviceTableGetDeviceAtIndex( stream->DeviceIndex, &result );
+
+    while ( result == AIOUSB_SUCCESS && !stream->quit ) {
+        unsigned long total = 0, points, room;
+        USBDevice *usb = AIOUSBDeviceGetUSBHandle( device );
+        if ( !usb ) {
+            result = AIOUSB_ERROR_DEVICE_NOT_CONNECTED;
+            break;
+        }
+        result = dio_stream_transfer( device, usb, AIOUSB_TRUE, (unsigned char *)stream->block,
+                                      stream->blockPoints * sizeof(unsigned short), &total );
+        if ( result != AIOUSB_SUCCESS )
+            break;
+        points = total / sizeof(unsigned short);
+
+        pthread_mutex_lock( &stream->lock );
+        room = stream->fifo->delta( (AIOFifo *)stream->fifo ) / sizeof(unsigned short);
+        if ( room > points )
+            room = points;
+        if ( room )
+            stream->fifo->PushN( stream->fifo, stream->block, room );
+        stream->overruns += points - room;
+        stream->pointsTransferred += points;
+        _aio_dio_stream_signal( stream );
+        pthread_mutex_unlock( &stream->lock );
+    }
+
+    _aio_dio_stream_finish( stream, result );
+    return NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Output side: waits for a whole block in the ring and sends it.
+ * Once asked to quit, whatever is left is sent as a short last block.
+ */
+static void *_aio_dio_stream_writer( void *arg )
+{
+    AIODIOStream *stream = (AIODIOStream *)arg;
+    AIORESULT result = AIOUSB_SUCCESS;
+    AIOUSBDevice *device = AIODeviceTableGetDeviceAtIndex( stream->DeviceIndex, &result );
+
+    while ( result == AIOUSB_SUCCESS ) {
+        unsigned long total = 0, points;
+        USBDevice *usb;
+
+        pthread_mutex_lock( &stream->lock );
+        points = AIOFifoReadSizeNumElements( stream->fifo );
+        if ( points < stream->blockPoints && !stream->quit && stream->pointsTransferred )
+            stream->underruns ++;
+        while ( points < stream->blockPoints && !stream->quit ) {
+            pthread_cond_wait( &stream->changed, &stream->lock );
+            points = AIOFifoReadSizeNumElements( stream->fifo );
+        }
+        if ( points > stream->blockPoints )
+            points = stream->blockPoints;
+        if ( points )
+            stream->fifo->PopN( stream->fifo, stream->block, points );
+        pthread_mutex_unlock( &stream->lock );
+        if ( !points )
+            break;
+
+        usb = AIOUSBDeviceGetUSBHandle( device );
+        if ( !usb ) {
+            result = AIOUSB_ERROR_DEVICE_NOT_CONNECTED;
+            break;
+        }
+        result = dio_stream_transfer( device, usb, AIOUSB_FALSE, (unsigned char *)stream->block,
+                                      points * sizeof(unsigned short), &total );
+
+        pthread_mutex_lock( &stream->lock );
+        stream->pointsTransferred += total / sizeof(unsigned short);
+        _aio_dio_stream_signal( stream );
+        pthread_mutex_unlock( &stream->lock );
+    }
+
+    _aio_dio_stream_finish( stream, result );
+    return NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Creates a stream for one direction of a device's DIO stream
+ * @param DeviceIndex
+ * @param bIsRead AIOUSB_TRUE to capture from the board, AIOUSB_FALSE to
+ * play out to it
+ * @param bufferPoints how many 16 bit points the ring holds; at least one
+ * 512 byte packet's worth
+ * @return the new stream, or NULL
+ */
+AIODIOStream *NewAIODIOStream( unsigned long DeviceIndex, AIOUSB_BOOL bIsRead, unsigned long bufferPoints )
+{
+    AIO_ASSERT_RET( NULL, bufferPoints >= DIO_STREAM_PACKET_POINTS );
+    pthread_condattr_t attr;
+    AIODIOStream *stream = (AIODIOStream *)calloc( 1, sizeof(AIODIOStream) );
+    if ( !stream )
+        return NULL;
+
+    stream->fifo = NewAIOFifoCounts( bufferPoints );
+    if ( !stream->fifo || !stream->fifo->data ) {
+        if ( stream->fifo )
+            DeleteAIOFifoCounts( stream->fifo );
+        free( stream );
+        return NULL;
+    }
+    stream->DeviceIndex  = DeviceIndex;
+    stream->isRead       = bIsRead ? AIOUSB_TRUE : AIOUSB_FALSE;
+    stream->bufferPoints = bufferPoints;
+    stream->eventFd      = -1;
+    stream->result       = AIOUSB_SUCCESS;
+    pthread_mutex_init( &stream->lock, NULL );
+    pthread_condattr_init( &attr );
+    pthread_condattr_setclock( &attr, CLOCK_MONOTONIC );
+    pthread_cond_init( &stream->changed, &attr );
+    pthread_condattr_destroy( &attr );
+
+    return stream;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE DeleteAIODIOStream( AIODIOStream *stream )
+{
+    AIO_ASSERT( stream );
+
+    AIODIOStreamStop( stream );
+    DeleteAIOFifoCounts( stream->fifo );
+    free( stream->block );
+    if ( stream->eventFd >= 0 )
+        close( stream->eventFd );
+    pthread_mutex_destroy( &stream->lock );
+    pthread_cond_destroy( &stream->changed );
+    free( stream );
+
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Opens the device's DIO stream in the stream's direction and
+ * starts the thread. Set the clocks with DIO_StreamSetClocks() first.
+ * Each bulk transfer is StreamingBlockSize bytes, capped by the ring.
+ */
+AIORET_TYPE AIODIOStreamStart( AIODIOStream *stream )
+{
+    AIO_ASSERT( stream );
+    AIO_ERROR_VALID_AIORET_TYPE( AIOUSB_ERROR_INVALID_THREAD, !stream->started );
+
+    AIORESULT result = AIOUSB_SUCCESS;
+    AIOUSBDevice *device = AIODeviceTableGetDeviceAtIndex( stream->DeviceIndex, &result );
+    AIO_ERROR_VALID_DATA( -(AIORET_TYPE)result, result == AIOUSB_SUCCESS );
+    AIO_ERROR_VALID_AIORET_TYPE( AIOUSB_ERROR_NOT_SUPPORTED, device->bDIOStream );
+
+    unsigned long blockPoints = device->StreamingBlockSize / sizeof(unsigned short);
+    if ( blockPoints > stream->bufferPoints )
+        blockPoints = stream->bufferPoints;
+    blockPoints -= blockPoints % DIO_STREAM_PACKET_POINTS;
+    if ( blockPoints == 0 )
+        blockPoints = DIO_STREAM_PACKET_POINTS;
+
+    if ( blockPoints != stream->blockPoints ) {
+        unsigned short *block = (unsigned short *)realloc( stream->block, blockPoints * sizeof(unsigned short) );
+        AIO_ERROR_VALID_AIORET_TYPE( AIOUSB_ERROR_NOT_ENOUGH_MEMORY, block );
+        stream->block       = block;
+        stream->blockPoints = blockPoints;
+    }
+
+    result = DIO_StreamOpen( stream->DeviceIndex, stream->isRead );
+    AIO_ERROR_VALID_DATA( -(AIORET_TYPE)result, result == AIOUSB_SUCCESS );
+
+    stream->fifo->Reset( stream->fifo );
+    stream->pointsTransferred = stream->overruns = stream->underruns = 0;
+    stream->result  = AIOUSB_SUCCESS;
+    stream->quit    = AIOUSB_FALSE;
+    stream->running = AIOUSB_TRUE;
+    if ( pthread_create( &stream->thread, NULL,
+                         stream->isRead ? _aio_dio_stream_reader : _aio_dio_stream_writer, stream ) != 0 ) {
+        stream->running = AIOUSB_FALSE;
+        DIO_StreamClose( stream->DeviceIndex );
+        return -AIOUSB_ERROR_INVALID_THREAD;
+    }
+    stream->started = AIOUSB_TRUE;
+
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Stops the thread and closes the device's DIO stream. An output
+ * stream sends what is still in the ring first. Points already captured
+ * by an input stream stay readable.
+ * @return AIOUSB_SUCCESS, or the negated error that stopped the thread early
+ */
+AIORET_TYPE AIODIOStreamStop( AIODIOStream *stream )
+{
+    AIO_ASSERT( stream );
+    if ( !stream->started )
+        return AIOUSB_SUCCESS;
+
+    pthread_mutex_lock( &stream->lock );
+    stream->quit = AIOUSB_TRUE;
+    pthread_cond_broadcast( &stream->changed );
+    pthread_mutex_unlock( &stream->lock );
+
+    pthread_join( stream->thread, NULL );
+    stream->started = AIOUSB_FALSE;
+    DIO_StreamClose( stream->DeviceIndex );
+
+    return -(AIORET_TYPE)stream->result;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Takes up to maxPoints captured points out of the ring, waiting
+ * for at least one if the ring is empty
+ * @param stream
+ * @param data
+ * @param maxPoints
+ * @param timeout milliseconds to wait, 0 waits for as long as it takes
+ * @return points copied, 0 once a stopped stream is drained, or a
+ * negative error; -AIOUSB_ERROR_TIMEOUT if nothing arrived in time
+ */
+AIORET_TYPE AIODIOStreamRead( AIODIOStream *stream, unsigned short *data, unsigned long maxPoints, unsigned timeout )
+{
+    AIO_ASSERT( stream );
+    AIO_ASSERT( data );
+    AIO_ERROR_VALID_AIORET_TYPE( AIOUSB_ERROR_NOT_SUPPORTED, stream->isRead );
+
+    AIORET_TYPE retval = 0;
+    struct timespec deadline;
+    int waitResult = 0;
+    unsigned long points;
+
+    AIOTimeDeadline( &deadline, CLOCK_MONOTONIC, timeout );
+    pthread_mutex_lock( &stream->lock );
+    while ( (points = AIOFifoReadSizeNumElements( stream->fifo )) == 0 && stream->running && waitResult != ETIMEDOUT ) {
+        if ( timeout == 0 )
+            pthread_cond_wait( &stream->changed, &stream->lock );
+        else
+            waitResult = pthread_cond_timedwait( &stream->changed, &stream->lock, &deadline );
+    }
+
+    if ( points > maxPoints )
+        points = maxPoints;
+    if ( points ) {
+        stream->fifo->PopN( stream->fifo, data, points );
+        retval = points;
+    } else if ( stream->running ) {
+        retval = -AIOUSB_ERROR_TIMEOUT;
+    } else {
+        retval = -(AIORET_TYPE)stream->result;
+    }
+    if ( AIOFifoReadSizeNumElements( stream->fifo ) == 0 )
+        _aio_dio_stream_clear_event( stream );
+    pthread_mutex_unlock( &stream->lock );
+
+    return retval;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Queues numPoints points for output, waiting for room in the
+ * ring as the thread sends earlier ones
+ * @param stream
+ * @param data
+ * @param numPoints
+ * @param timeout milliseconds to wait for room, 0 waits for as long as it takes
+ * @return points queued, which is less than numPoints only if the wait
+ * timed out or the stream stopped, or a negative error if none were
+ */
+AIORET_TYPE AIODIOStreamWrite( AIODIOStream *stream, unsigned short *data, unsigned long numPoints, unsigned timeout )
+{
+    AIO_ASSERT( stream );
+    AIO_ASSERT( data );
+    AIO_ERROR_VALID_AIORET_TYPE( AIOUSB_ERROR_NOT_SUPPORTED, !stream->isRead );
+
+    struct timespec deadline;
+    int waitResult = 0;
+    unsigned long queued = 0;
+
+    AIOTimeDeadline( &deadline, CLOCK_MONOTONIC, timeout );
+    pthread_mutex_lock( &stream->lock );
+    while ( queued < numPoints && stream->running && !stream->quit ) {
+        unsigned long room = stream->fifo->delta( (AIOFifo *)stream->fifo ) / sizeof(unsigned short);
+        if ( room > numPoints - queued )
+            room = numPoints - queued;
+        if ( room ) {
+            stream->fifo->PushN( stream->fifo, data + queued, room );
+            queued += room;
+            pthread_cond_broadcast( &stream->changed );
+            continue;
+        }
+        if ( waitResult == ETIMEDOUT )
+            break;
+        _aio_dio_stream_clear_event( stream );
+        if ( timeout == 0 )
+            pthread_cond_wait( &stream->changed, &stream->lock );
+        else
+            waitResult = pthread_cond_timedwait( &stream->changed, &stream->lock, &deadline );
+    }
+    pthread_mutex_unlock( &stream->lock );
+
+    if ( queued )
+        return queued;
+    if ( numPoints == 0 )
+        return 0;
+    if ( !stream->running )
+        return stream->result == AIOUSB_SUCCESS ? -AIOUSB_ERROR_INVALID_THREAD : -(AIORET_TYPE)stream->result;
+    return -AIOUSB_ERROR_TIMEOUT;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Returns a file descriptor for poll(), select() or an event loop.
+ * For an input stream it is readable while captured points are waiting;
+ * AIODIOStreamRead() resets it when it empties the ring. For an output
+ * stream it becomes readable each time the thread frees room in the
+ * ring. It also becomes readable when the thread stops. The descriptor
+ * belongs to the stream; don't close it.
+ */
+AIORET_TYPE AIODIOStreamGetEventFd( AIODIOStream *stream )
+{
+    AIO_ASSERT( stream );
+    AIORET_TYPE retval;
+
+    pthread_mutex_lock( &stream->lock );
+    if ( stream->eventFd < 0 ) {
+        stream->eventFd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+        if ( stream->eventFd >= 0 && ( AIOFifoReadSizeNumElements( stream->fifo ) || !stream->isRead ) )
+            _aio_dio_stream_signal( stream );
+    }
+    retval = stream->eventFd >= 0 ? stream->eventFd : -AIOUSB_ERROR_OPEN_FAILED;
+    pthread_mutex_unlock( &stream->lock );
+
+    return retval;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Points waiting in the ring: captured and unread for input,
+ * queued and unsent for output
+ */
+AIORET_TYPE AIODIOStreamPointsAvailable( AIODIOStream *stream )
+{
+    AIO_ASSERT( stream );
+    AIORET_TYPE retval;
+    pthread_mutex_lock( &stream->lock );
+    retval = AIOFifoReadSizeNumElements( stream->fifo );
+    pthread_mutex_unlock( &stream->lock );
+    return retval;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIODIOStreamGetPointsTransferred( AIODIOStream *stream )
+{
+    AIO_ASSERT( stream );
+    AIORET_TYPE retval;
+    pthread_mutex_lock( &stream->lock );
+    retval = (AIORET_TYPE)stream->pointsTransferred;
+    pthread_mutex_unlock( &stream->lock );
+    return retval;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIODIOStreamGetOverruns( AIODIOStream *stream )
+{
+    AIO_ASSERT( stream );
+    AIORET_TYPE retval;
+    pthread_mutex_lock( &stream->lock );
+    retval = (AIORET_TYPE)stream->overruns;
+    pthread_mutex_unlock( &stream->lock );
+    return retval;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIODIOStreamGetUnderruns( AIODIOStream *stream )
+{
+    AIO_ASSERT( stream );
+    AIORET_TYPE retval;
+    pthread_mutex_lock( &stream->lock );
+    retval = (AIORET_TYPE)stream->underruns;
+    pthread_mutex_unlock( &stream->lock );
+    return retval;
+}
+
+
+#ifdef __cplusplus
+}
+#endif
+
+/*****************************************************************************
+ * Self-test
+ * @note This section is for stress testing the DIO stream without using
+ * the USB features
+ *
+ ****************************************************************************/
+
+#ifdef SELF_TEST
+
+#include "mocks/mock_fake_device.h"
+#include <poll.h>
+
+using namespace AIOUSB;
+
+static volatile unsigned short next_point = 0;
+static volatile int bulk_calls = 0;
+static volatile int fail_after = 0;
+
+static int fake_read_bulk( USBDevice *usb, unsigned char endpoint, unsigned char *data, int length, int *actual_length, unsigned int timeout )
+{
+    unsigned short *points = (unsigned short *)data;
+    if ( fail_after && bulk_calls >= fail_after )
+        return LIBUSB_ERROR_IO;
+    for ( int i = 0; i < length / 2; i ++ )
+        points[i] = next_point ++;
+    *actual_length = length;
+    bulk_calls ++;
+    usleep( 100 );
+    return LIBUSB_SUCCESS;
+}
+
+static unsigned short written[ 8192 ];
+static volatile int written_points = 0;
+static int fake_write_bulk( USBDevice *usb, unsigned char endpoint, unsigned char *data, int length, int *actual_length, unsigned int timeout )
+{
+    int n = length / 2;
+    if ( written_points + n > (int)(sizeof(written) / sizeof(written[0])) )
+        n = sizeof(written) / sizeof(written[0]) - written_points;
+    memcpy( &written[ written_points ], data, n * 2 );
+    written_points += n;
+    *actual_length = length;
+    bulk_calls ++;
+    return LIBUSB_SUCCESS;
+}
+
+class DIOStreamSetup : public MockFakeDeviceTest
+{
+ protected:
+    virtual void SetUp() {
+        MockFakeDeviceTest::SetUp();
+        next_point = 0;
+        bulk_calls = 0;
+        fail_after = 0;
+        written_points = 0;
+        device = AddFakeDevice( USB_DIO_16A );
+        device->StreamingBlockSize = 1024;
+    }
+    AIOUSBDevice *device;
+};
+
+TEST_F(DIOStreamSetup,ReadsAnUnbrokenSequence)
+{
+    unsigned short buf[ 700 ];
+    unsigned short expect = 0;
+    usb[0].usb_bulk_transfer = fake_read_bulk;
+
+    AIODIOStream *stream = NewAIODIOStream( 0, AIOUSB_TRUE, 8192 );
+    ASSERT_TRUE( stream );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIODIOStreamStart( stream ) );
+    EXPECT_TRUE( device->bDIOOpen );
+    EXPECT_TRUE( device->bDIORead );
+    EXPECT_EQ( 512u, stream->blockPoints );
+
+    struct pollfd pfd;
+    pfd.fd = AIODIOStreamGetEventFd( stream );
+    pfd.events = POLLIN;
+    ASSERT_GE( pfd.fd, 0 );
+    EXPECT_EQ( 1, poll( &pfd, 1, 1000 ) ) << "readable once points arrive";
+
+    for ( int total = 0; total < 5000; ) {
+        AIORET_TYPE got = AIODIOStreamRead( stream, buf, 700, 1000 );
+        ASSERT_GT( got, 0 );
+        for ( int i = 0; i < got; i ++ )
+            ASSERT_EQ( expect ++, buf[i] );
+        total += got;
+    }
+    EXPECT_EQ( AIOUSB_SUCCESS, AIODIOStreamStop( stream ) );
+    EXPECT_FALSE( device->bDIOOpen );
+    EXPECT_EQ( 0, AIODIOStreamGetOverruns( stream ) );
+    EXPECT_EQ( AIODIOStreamGetPointsTransferred( stream ), expect + AIODIOStreamPointsAvailable( stream ) );
+
+    DeleteAIODIOStream( stream );
+}
+
+TEST_F(DIOStreamSetup,CountsOverrunsWhenTheRingIsFull)
+{
+    usb[0].usb_bulk_transfer = fake_read_bulk;
+    fail_after = 10;
+
+    AIODIOStream *stream = NewAIODIOStream( 0, AIOUSB_TRUE, 1024 );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIODIOStreamStart( stream ) );
+
+    unsigned short buf[ 2048 ];
+    AIORET_TYPE got, total = 0;
+    AIORET_TYPE ioError = -(AIORET_TYPE)LIBUSB_RESULT_TO_AIOUSB_RESULT( LIBUSB_ERROR_IO );
+    usleep( 20000 );            /* let the ring fill up */
+    while ( (got = AIODIOStreamRead( stream, buf, 2048, 1000 )) > 0 )
+        total += got;
+    EXPECT_EQ( ioError, got ) << "the error that stopped the thread is reported once the ring is empty";
+    EXPECT_EQ( 10 * 512, AIODIOStreamGetPointsTransferred( stream ) );
+    EXPECT_GT( AIODIOStreamGetOverruns( stream ), 0 );
+    EXPECT_EQ( AIODIOStreamGetPointsTransferred( stream ), total + AIODIOStreamGetOverruns( stream ) );
+    EXPECT_EQ( ioError, AIODIOStreamStop( stream ) );
+
+    DeleteAIODIOStream( stream );
+}
+
+TEST_F(DIOStreamSetup,WritesEverythingQueued)
+{
+    unsigned short out[ 3000 ];
+    usb[0].usb_bulk_transfer = fake_write_bulk;
+    for ( int i = 0; i < 3000; i ++ )
+        out[i] = (unsigned short)(i * 7);
+
+    AIODIOStream *stream = NewAIODIOStream( 0, AIOUSB_FALSE, 1024 );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIODIOStreamStart( stream ) );
+    EXPECT_FALSE( device->bDIORead );
+    unsigned short dummy;
+    EXPECT_EQ( -AIOUSB_ERROR_NOT_SUPPORTED, AIODIOStreamRead( stream, &dummy, 1, 0 ) );
+
+    EXPECT_EQ( 3000, AIODIOStreamWrite( stream, out, 3000, 0 ) ) << "blocks until the thread makes room";
+    EXPECT_EQ( AIOUSB_SUCCESS, AIODIOStreamStop( stream ) );
+
+    EXPECT_EQ( 3000, AIODIOStreamGetPointsTransferred( stream ) );
+    EXPECT_GE( written_points, 3000 ) << "the short last block is padded to a packet";
+    EXPECT_EQ( 0, memcmp( written, out, sizeof(out) ) );
+
+    DeleteAIODIOStream( stream );
+}
+
+int main(int argc, char *argv[] )
+{
+    testing::InitGoogleTest(&argc, argv);
+    testing::TestEventListeners & listeners = testing::UnitTest::GetInstance()->listeners();
+#ifdef GTEST_TAP_PRINT_TO_STDOUT
+    delete listeners.Release(listeners.default_result_printer());
+#endif
+
+    return RUN_ALL_TESTS();
+}
+
+#endif
@@ -0,0 +1,81 @@
+/**
+ * @file   AIODIOStream.h
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  Continuous digital streaming through a ring buffer
+ *
+ */
+
+#ifndef _AIO_DIO_STREAM_H
+#define _AIO_DIO_STREAM_H
+
+#include "AIOTypes.h"
+#include "AIOFifo.h"
+#include <pthread.h>
+#include <stdint.h>
+
+#ifdef __aiousb_cplusplus
+namespace AIOUSB
+{
+#endif
+
+/**
+ * @brief AIODIOStream keeps a DIO stream running without the caller
+ * issuing frames. A background thread moves blocks between the board
+ * and a ring of 16 bit points, at the rate set beforehand with
+ * DIO_StreamSetClocks(). The flow is:
+ *
+ * - NewAIODIOStream() for a direction and a ring size
+ *
+ * - AIODIOStreamStart() opens the stream and starts the thread
+ *
+ * - AIODIOStreamRead() (input) or AIODIOStreamWrite() (output) as often
+ *   as needed, or wait on AIODIOStreamGetEventFd() from an event loop
+ *
+ * - AIODIOStreamStop() and DeleteAIODIOStream()
+ *
+ * If the caller falls behind on input the ring fills and the points
+ * that don't fit are dropped and counted as overruns. If the caller
+ * falls behind on output the thread has to wait for a whole block and
+ * counts an underrun; the board's output stalls meanwhile.
+ */
+typedef struct AIODIOStream {
+    unsigned long DeviceIndex;
+    AIOUSB_BOOL isRead;
+    AIOFifoCounts *fifo;
+    unsigned long bufferPoints;
+    unsigned short *block;              /**< one bulk transfer's worth, owned by the thread */
+    unsigned long blockPoints;
+    pthread_t thread;
+    pthread_mutex_t lock;               /**< guards the fifo and everything below */
+    pthread_cond_t changed;             /**< points moved, or the thread stopped */
+    int eventFd;                        /**< -1 until AIODIOStreamGetEventFd() */
+    AIOUSB_BOOL running;                /**< thread is moving data */
+    AIOUSB_BOOL started;                /**< thread exists and has to be joined */
+    AIOUSB_BOOL quit;
+    AIORESULT result;                   /**< why the thread stopped early, AIOUSB_SUCCESS otherwise */
+    uint64_t pointsTransferred;
+    uint64_t overruns;                  /**< input points dropped because the ring was full */
+    uint64_t underruns;                 /**< times the output thread found less than a block queued */
+} AIODIOStream;
+
+/* BEGIN AIOUSB_API */
+PUBLIC_EXTERN AIODIOStream *NewAIODIOStream( unsigned long DeviceIndex, AIOUSB_BOOL bIsRead, unsigned long bufferPoints );
+PUBLIC_EXTERN AIORET_TYPE DeleteAIODIOStream( AIODIOStream *stream );
+PUBLIC_EXTERN AIORET_TYPE AIODIOStreamStart( AIODIOStream *stream );
+PUBLIC_EXTERN AIORET_TYPE AIODIOStreamStop( AIODIOStream *stream );
+PUBLIC_EXTERN AIORET_TYPE AIODIOStreamRead( AIODIOStream *stream, unsigned short *data, unsigned long maxPoints, unsigned timeout );
+PUBLIC_EXTERN AIORET_TYPE AIODIOStreamWrite( AIODIOStream *stream, unsigned short *data, unsigned long numPoints, unsigned timeout );
+PUBLIC_EXTERN AIORET_TYPE AIODIOStreamGetEventFd( AIODIOStream *stream );
+PUBLIC_EXTERN AIORET_TYPE AIODIOStreamPointsAvailable( AIODIOStream *stream );
+PUBLIC_EXTERN AIORET_TYPE AIODIOStreamGetPointsTransferred( AIODIOStream *stream );
+PUBLIC_EXTERN AIORET_TYPE AIODIOStreamGetOverruns( AIODIOStream *stream );
+PUBLIC_EXTERN AIORET_TYPE AIODIOStreamGetUnderruns( AIODIOStream *stream );
+/* END AIOUSB_API */
+
+#ifdef __aiousb_cplusplus
+}
+#endif
+
+#endif
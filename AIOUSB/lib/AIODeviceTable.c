@@ -1,13 +1,46 @@
 #include "AIODeviceTable.h" 
 #include "AIOPlugNPlay.h"
+#include "AIOHotplug.h"
+#include "AIOPropertyCache.h"
 #include <string.h>
 #include <errno.h>
+#include <limits.h>
 
 #ifdef __cplusplus
 namespace AIOUSB {
 #endif
 
+/**
+ * @brief The device table grows in chunks of MAX_USB_DEVICES entries. The
+ * first chunk is deviceTable[] itself so existing code indexing it directly
+ * keeps working; later chunks are allocated as more boards are found and
+ * are never moved, since each AIOUSBDevice owns locks and worker threads.
+ */
+#define DEVICE_TABLE_MAX_CHUNKS 64
+
 AIOUSBDevice deviceTable[ MAX_USB_DEVICES ];
+static AIOUSBDevice *deviceTableChunks[ DEVICE_TABLE_MAX_CHUNKS ] = { deviceTable };
+static volatile unsigned long deviceTableCapacity = MAX_USB_DEVICES;
+
+/**
+ * @brief Open addressed hash from a 64 bit key (serial number or product
+ * ID) to device indices. Entries are checked against the device when
+ * they are looked up, so stale entries left behind by re-adding a slot
+ * are harmless; the whole index is dropped by AIODeviceTableInit().
+ */
+typedef struct aio_device_index_entry {
+    uint64_t key;
+    long index;                 /**< device index, -1 == empty */
+} AIODeviceIndexEntry;
+
+typedef struct aio_device_index {
+    AIODeviceIndexEntry *entries;
+    unsigned long size;         /**< always a power of two */
+    unsigned long used;
+} AIODeviceIndex;
+
+static AIODeviceIndex serialNumberIndex;
+static AIODeviceIndex productIDIndex;
 
 
 static ProductIDName productIDNameTable[] = {
@@ -129,6 +162,116 @@ const int NUM_PROD_NAMES = sizeof(productIDNameTable) / sizeof(productIDNameTabl
 #endif
 
 
+/*
+ * Capabilities of every product, sorted by product ID. Columns are the
+ * fields of AIOProductDescriptor in order:
+ *
+ *   first, last, flags,
+ *   DIOBytes, DIOConfigBits, Tristates, Counters, RootClock, WDGBytes,
+ *   ADCChannels, ADCMUXChannels, ADCChannelsPerGroup, ConfigBytes, RangeShift,
+ *   ImmADCs, ImmDACs, DACsUsed, FlashSectors
+ */
+#define CAP_DIO_HS      ( AIO_CAP_GET_NAME | AIO_CAP_DIO_STREAM | AIO_CAP_DIO_SPI | AIO_CAP_CLEAR_FIFO )
+#define CAP_AI          ( AIO_CAP_GET_NAME | AIO_CAP_ADC_STREAM | AIO_CAP_CLEAR_FIFO )
+#define CAP_AIO         ( CAP_AI | AIO_CAP_DAC_BOARD_RANGE )
+#define CAP_AO          ( AIO_CAP_GET_NAME | AIO_CAP_DAC_BOARD_RANGE | AIO_CAP_DAC_CHANNEL_CAL )
+
+static const AIOProductDescriptor productDescriptorTable[] = {
+    { USB_DIO_32       , USB_DIO_32       , AIO_CAP_GET_NAME | AIO_CAP_CUSTOM_CLOCKS | AIO_CAP_DIO_DEBOUNCE,
+                                            4,  0, 1, 3,  3000000, 0,   0,   0, 0,  0, 0,  0,  0, 0,  0 },
+    { USB_DIO_48       , USB_DIO_48       , AIO_CAP_GET_NAME,
+                                            6,  0, 0, 0,        0, 0,   0,   0, 0,  0, 0,  0,  0, 0,  0 },
+    { USB_DIO_96       , USB_DIO_96       , AIO_CAP_GET_NAME,
+                                           12,  0, 0, 0,        0, 0,   0,   0, 0,  0, 0,  0,  0, 0,  0 },
+    { USB_DIO_32I      , USB_DIO_32I      , AIO_CAP_GET_NAME | AIO_CAP_CUSTOM_CLOCKS,
+                                            4, 32, 1, 3,        0, 0,   0,   0, 0,  0, 0,  0,  0, 0,  0 },
+    { USB_DIO_24       , USB_DIO_24       , AIO_CAP_GET_NAME | AIO_CAP_DIO_DEBOUNCE,
+                                            3,  4, 1, 0,        0, 0,   0,   0, 0,  0, 0,  0,  0, 0,  0 },
+    { USB_DIO24_CTR6   , USB_DIO24_CTR6   , AIO_CAP_GET_NAME | AIO_CAP_DIO_DEBOUNCE | AIO_CAP_CUSTOM_CLOCKS,
+                                            3,  4, 1, 2, 10000000, 0,   0,   0, 0,  0, 0,  0,  0, 0,  0 },
+    { USB_DI16A_REV_A1 , USB_DI16A_REV_A2 , CAP_DIO_HS,
+                                            1,  0, 0, 0,        0, 0,   0,   0, 0,  0, 0,  0,  0, 0,  0 },
+    { USB_DIO_16H      , USB_DIO_16A      , CAP_DIO_HS,
+                                            4,  0, 2, 0,        0, 0,   0,   0, 0,  0, 0,  0,  0, 0,  0 },
+    { USB_IIRO_16      , USB_RO_16        , AIO_CAP_GET_NAME,
+                                            4,  0, 0, 0,        0, 2,   0,   0, 0,  0, 0,  0,  0, 0,  0 },
+    { USB_IIRO_8       , USB_IIRO_4       , AIO_CAP_GET_NAME,
+                                            4,  0, 0, 0,        0, 2,   0,   0, 0,  0, 0,  0,  0, 0,  0 },
+    { USB_IDIO_16      , USB_IDO_16       , AIO_CAP_GET_NAME,
+                                            4,  0, 0, 0,        0, 2,   0,   0, 0,  0, 0,  0,  0, 0,  0 },
+    { USB_IDIO_8       , USB_IDIO_4       , AIO_CAP_GET_NAME,
+                                            4,  0, 0, 0,        0, 2,   0,   0, 0,  0, 0,  0,  0, 0,  0 },
+    { USB_CTR_15       , USB_CTR_15       , AIO_CAP_GET_NAME | AIO_CAP_GATE_SELECTABLE,
+                                            0,  0, 0, 5, 10000000, 0,   0,   0, 0,  0, 0,  0,  0, 0,  0 },
+    { USB_IIRO4_2SM    , USB_IIRO4_COM    , AIO_CAP_GET_NAME,
+                                            2,  0, 0, 0,        0, 0,   0,   0, 0,  0, 0,  0,  0, 0,  0 },
+    { USB_DIO16RO8     , PICO_DIO16RO8    , AIO_CAP_GET_NAME,
+                                            3,  0, 0, 0,        0, 0,   0,   0, 0,  0, 0,  0,  0, 0,  0 },
+    { USBP_II8IDO4A    , USBP_II8IDO4A    , AIO_CAP_GET_NAME,
+                                            2,  0, 0, 0,        0, 0,   0,   0, 0,  0, 0,  2,  0, 0,  0 },
+    { USB_AI16_16A     , USB_AI12_16E     , CAP_AI,
+                                            2,  0, 0, 1, 10000000, 0,  16,  16, 1, AD_CONFIG_REGISTERS,     0,  1,  0, 0,  0 },
+    { USB_AI16_64MA    , USB_AI12_64ME    , CAP_AI,
+                                            2,  0, 0, 1, 10000000, 0,  16,  64, 4, AD_MUX_CONFIG_REGISTERS, 2,  1,  0, 0,  0 },
+    { USB_AI16_32A     , USB_AI12_32E     , CAP_AI,
+                                            2,  0, 0, 1, 10000000, 0,  16,  32, 8, AD_MUX_CONFIG_REGISTERS, 3,  1,  0, 0,  0 },
+    { USB_AI16_64A     , USB_AI12_64E     , CAP_AI,
+                                            2,  0, 0, 1, 10000000, 0,  16,  64, 8, AD_MUX_CONFIG_REGISTERS, 3,  1,  0, 0,  0 },
+    { USB_AI16_96A     , USB_AI12_96E     , CAP_AI,
+                                            2,  0, 0, 1, 10000000, 0,  16,  96, 8, AD_MUX_CONFIG_REGISTERS, 3,  1,  0, 0,  0 },
+    { USB_AI16_128A    , USB_AI12_128E    , CAP_AI,
+                                            2,  0, 0, 1, 10000000, 0,  16, 128, 8, AD_MUX_CONFIG_REGISTERS, 3,  1,  0, 0,  0 },
+    { USB_AO_ARB1      , USB_AO_ARB1      , AIO_CAP_GET_NAME | AIO_CAP_DIO_STREAM | AIO_CAP_CLEAR_FIFO | AIO_CAP_DAC_DIO_CLOCK | AIO_CAP_DAC_BOARD_RANGE,
+                                            4,  0, 1, 0,        0, 0,   0,   0, 0,  0, 0,  0,  0, 0,  0 },
+    /* bits 1-2 of the product ID give the number of DACs, bit 0 clear means the board has ADCs too */
+    { USB_AO16_16A     , USB_AO16_16A     , CAP_AO, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  2, 16, 0, 32 },
+    { USB_AO16_16      , USB_AO16_16      , CAP_AO, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  0, 16, 0, 32 },
+    { USB_AO16_12A     , USB_AO16_12A     , CAP_AO, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  2, 12, 0, 32 },
+    { USB_AO16_12      , USB_AO16_12      , CAP_AO, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  0, 12, 0, 32 },
+    { USB_AO16_8A      , USB_AO16_8A      , CAP_AO, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  2,  8, 0, 32 },
+    { USB_AO16_8       , USB_AO16_8       , CAP_AO, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  0,  8, 0, 32 },
+    { USB_AO16_4A      , USB_AO16_4A      , CAP_AO, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  2,  4, 0, 32 },
+    { USB_AO16_4       , USB_AO16_4       , CAP_AO, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  0,  4, 0, 32 },
+    { USB_AO12_16A     , USB_AO12_16A     , CAP_AO, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  2, 16, 0, 32 },
+    { USB_AO12_16      , USB_AO12_16      , CAP_AO, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  0, 16, 0, 32 },
+    { USB_AO12_12A     , USB_AO12_12A     , CAP_AO, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  2, 12, 0, 32 },
+    { USB_AO12_12      , USB_AO12_12      , CAP_AO, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  0, 12, 0, 32 },
+    { USB_AO12_8A      , USB_AO12_8A      , CAP_AO, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  2,  8, 0, 32 },
+    { USB_AO12_8       , USB_AO12_8       , CAP_AO, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  0,  8, 0, 32 },
+    { USB_AO12_4A      , USB_AO12_4A      , CAP_AO, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  2,  4, 0, 32 },
+    { USB_AO12_4       , USB_AO12_4       , CAP_AO, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  0,  4, 0, 32 },
+    /* USB-AIO boards are USB-AI boards plus two DACs */
+    { USB_AIO16_16A    , USB_AIO12_16E    , CAP_AIO,
+                                            2,  0, 0, 1, 10000000, 0,  16,  16, 1, AD_CONFIG_REGISTERS,     0,  1,  2, 0,  0 },
+    { USB_AIO16_64MA   , USB_AIO12_64ME   , CAP_AIO,
+                                            2,  0, 0, 1, 10000000, 0,  16,  64, 4, AD_MUX_CONFIG_REGISTERS, 2,  1,  2, 0,  0 },
+    { USB_AIO16_32A    , USB_AIO12_32E    , CAP_AIO,
+                                            2,  0, 0, 1, 10000000, 0,  16,  32, 8, AD_MUX_CONFIG_REGISTERS, 3,  1,  2, 0,  0 },
+    { USB_AIO16_64A    , USB_AIO12_64E    , CAP_AIO,
+                                            2,  0, 0, 1, 10000000, 0,  16,  64, 8, AD_MUX_CONFIG_REGISTERS, 3,  1,  2, 0,  0 },
+    { USB_AIO16_96A    , USB_AIO12_96E    , CAP_AIO,
+                                            2,  0, 0, 1, 10000000, 0,  16,  96, 8, AD_MUX_CONFIG_REGISTERS, 3,  1,  2, 0,  0 },
+    { USB_AIO16_128A   , USB_AIO12_128E   , CAP_AIO,
+                                            2,  0, 0, 1, 10000000, 0,  16, 128, 8, AD_MUX_CONFIG_REGISTERS, 3,  1,  2, 0,  0 },
+    { USB_DA12_8A_REV_A, USB_DA12_8A      , AIO_CAP_DAC_STREAM,
+                                            0,  0, 0, 0, 12000000, 0,   0,   0, 0,  0, 0,  0,  8, 5,  0 },
+    { USB_DA12_8E      , USB_DA12_8E      , 0,
+                                            0,  0, 0, 0,        0, 0,   0,   0, 0,  0, 0,  0,  8, 0,  0 }
+};
+
+/** anything not in productDescriptorTable[], e.g. boards newer than this library */
+static const AIOProductDescriptor unknownProductDescriptor = {
+    0, 0, AIO_CAP_GET_NAME, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+};
+
+#undef CAP_DIO_HS
+#undef CAP_AI
+#undef CAP_AIO
+#undef CAP_AO
+
+#define NUM_PRODUCT_DESCRIPTORS (sizeof(productDescriptorTable) / sizeof(productDescriptorTable[ 0 ]))
+
+
 unsigned long AIOUSB_INIT_PATTERN = 0x9b6773adul;  /* random pattern */
 unsigned long aiousbInit = 0;                    /* == AIOUSB_INIT_PATTERN if AIOUSB module is initialized */
 
@@ -136,15 +279,10 @@ unsigned long aiousbInit = 0;                    /* == AIOUSB_INIT_PATTERN if AI
 /*----------------------------------------------------------------------------*/
 AIOUSBDevice *_get_device( unsigned long index , AIORESULT *result )
 {
-    AIOUSBDevice *dev = NULL;
-    if ( index > MAX_USB_DEVICES ) { 
-        *result = AIOUSB_ERROR_INVALID_INDEX;
-        return NULL;
-    }
-    dev = (AIOUSBDevice*)&deviceTable[index];
+    AIOUSBDevice *dev = _get_device_no_error( index );
     if ( !dev ) {
         if ( result )
-            *result = AIOUSB_ERROR_INVALID_DATA;
+            *result = AIOUSB_ERROR_INVALID_INDEX;
         return NULL;
     } else if ( result ) 
         *result = AIOUSB_SUCCESS;
@@ -161,91 +299,404 @@ AIOUSBDevice *_verified_device( AIOUSBDevice *dev, AIORESULT *result )
     }   
 }
 
+/**
+ * @return the device slot at index, or NULL if the table has not grown
+ * that far
+ */
 AIOUSBDevice *_get_device_no_error( unsigned long index )
 {
-    return (AIOUSBDevice *)&deviceTable[ index ];
+    if ( index >= deviceTableCapacity )
+        return NULL;
+    return &deviceTableChunks[ index / MAX_USB_DEVICES ][ index % MAX_USB_DEVICES ];
 }
 
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Number of device slots currently allocated; every index below
+ * this can be passed to AIODeviceTableGetDeviceAtIndex()
+ */
+AIORET_TYPE AIODeviceTableGetCapacity(void)
+{
+    return (AIORET_TYPE)deviceTableCapacity;
+}
 
-AIOUSB_BOOL AIOUSB_SetInit()
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Frees the USBDevices a reattach left behind. Only safe once no
+ * thread can still be holding a pointer it got from this slot.
+ */
+static void _free_retired_usb_devices( AIOUSBDevice *device )
 {
-    aiousbInit = AIOUSB_INIT_PATTERN;
-    return AIOUSB_TRUE;
+    for ( unsigned i = 0; i < device->numRetiredUsbDevices; i ++ )
+        DeleteUSBDevice( device->retiredUsbDevices[i] );
+    free( device->retiredUsbDevices );
+    device->retiredUsbDevices = NULL;
+    device->numRetiredUsbDevices = 0;
 }
 
 /*----------------------------------------------------------------------------*/
-void AIODeviceTableInit(void)
+/**
+ * @brief Stops every thread the library runs for a device. They use its
+ * USB handle, LastDIOData and locks, so this comes before any of those
+ * is closed, freed or reset.
+ */
+static void _stop_device_threads( AIOUSBDevice *device )
+{
+    if ( !device->locksInitialized )
+        return;                 /* never set up, so never ran anything */
+    adc_bulk_worker_stop( device );
+    dio_stream_worker_stop( device );
+    dio_batch_stop( device );
+    dac_stream_stop( device );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Sets up the slot's locks the first time it is used. They are
+ * kept across AIODeviceTableInit(), since the slot's threads may be
+ * waiting on them until _stop_device_threads() has returned.
+ */
+static void _init_device_locks( AIOUSBDevice *device )
+{
+    pthread_condattr_t condattr;
+    if ( device->locksInitialized )
+        return;
+    pthread_rwlock_init( &device->lock, NULL );
+    pthread_mutex_init( &device->workerLock, NULL );
+    pthread_condattr_init( &condattr );
+    pthread_condattr_setclock( &condattr, CLOCK_MONOTONIC );
+    pthread_cond_init( &device->workerDone, &condattr );
+    pthread_condattr_destroy( &condattr );
+    device->locksInitialized = AIOUSB_TRUE;
+}
+
+/*----------------------------------------------------------------------------*/
+static void _destroy_device_locks( AIOUSBDevice *device )
+{
+    if ( !device->locksInitialized )
+        return;
+    pthread_rwlock_destroy( &device->lock );
+    pthread_mutex_destroy( &device->workerLock );
+    pthread_cond_destroy( &device->workerDone );
+    device->locksInitialized = AIOUSB_FALSE;
+}
+
+/*----------------------------------------------------------------------------*/
+static void _init_device_slot( AIOUSBDevice *device, unsigned long index )
+{
+    _init_device_locks( device );
+    _stop_device_threads( device );
+
+    /* libusb handles */
+    if ( index == 0 ) {
+        if ( device->usb_device ) {
+            DeleteUSBDevice( device->usb_device );
+            device->usb_device = NULL;
+        }
+    } else {
+        device->usb_device = NULL;
+    }
+    _free_retired_usb_devices( device );
+    device->deviceIndex = (int)index;
+
+    /* run-time settings */
+    device->discardFirstSample = AIOUSB_FALSE;
+    device->commTimeout = 5000;
+    device->miscClockHz = 1;
+
+    /* device-specific properties */
+    device->ProductID = 0;
+    device->product = &unknownProductDescriptor;
+    device->DIOBytes
+        = device->Counters
+        = device->Tristates
+        = device->ConfigBytes
+        = device->ImmDACs
+        = device->DACsUsed
+        = device->ADCChannels
+        = device->ADCMUXChannels
+        = device->ADCChannelsPerGroup
+        = device->WDGBytes
+        = device->ImmADCs
+        = device->FlashSectors
+        = 0;
+    device->RootClock
+        = device->StreamingBlockSize
+        = 0;
+    device->bGateSelectable
+        = device->bGetName
+        = device->bDACStream
+        = device->bADCStream
+        = device->bDIOStream
+        = device->bDIOSPI
+        = device->bClearFIFO
+        = device->bDACBoardRange
+        = device->bDACChannelCal
+        = AIOUSB_FALSE;
+
+    /* device state */
+    device->bDACOpen
+        = device->bDACClosing
+        = device->bDACAborting
+        = device->bDACStarted
+        = device->bDIOOpen
+        = device->bDIORead
+        = AIOUSB_FALSE;
+    device->DACData = NULL;
+    device->PendingDACData = NULL;
+    device->LastDIOData = NULL;
+    device->cachedName = NULL;
+    device->cachedSerialNumber = 0;
+    device->bFirmware20 = AIOUSB_FALSE;
+    device->PNPProbed = AIOUSB_FALSE;
+    device->cachedConfigBlock.size = 0;       // .size == 0 == uninitialized
+    device->deviceConfigBlock.size = 0;
+    device->configTransfersAvoided = 0;
+    device->calTableHash = 0;
+    device->calTableMode = -1;
+    device->calAutoHash = 0;
+    device->calUploadsAvoided = 0;
+    device->hostCal = NULL;
+    device->lockContention = 0;
+
+    /* worker thread state */
+    device->workerBusy = AIOUSB_FALSE;
+    device->workerStatus = 0;
+    device->workerResult = AIOUSB_SUCCESS;
+    device->workerCallback = NULL;
+    device->workerCallbackData = NULL;
+    if ( device->workerEventFdOpen ) {
+        close( device->workerEventFd );
+        device->workerEventFdOpen = AIOUSB_FALSE;
+    }
+    device->workerLockContention = 0;
+    device->valid = AIOUSB_FALSE;
+    device->bDeviceWasHere = AIOUSB_FALSE;
+    device->testing = AIOUSB_FALSE;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Makes sure a slot exists for index, allocating new chunks as
+ * needed. Must be called with AIOUSB_Lock() held.
+ */
+static AIORESULT _grow_device_table( unsigned long index )
+{
+    while ( index >= deviceTableCapacity ) {
+        unsigned long chunk = deviceTableCapacity / MAX_USB_DEVICES;
+        if ( chunk >= DEVICE_TABLE_MAX_CHUNKS )
+            return AIOUSB_ERROR_INVALID_INDEX;
+
+        AIOUSBDevice *devices = (AIOUSBDevice *)calloc( MAX_USB_DEVICES, sizeof(AIOUSBDevice) );
+        if ( !devices )
+            return AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+        for ( int i = 0; i < MAX_USB_DEVICES; i ++ )
+            _init_device_slot( &devices[i], chunk * MAX_USB_DEVICES + i );
+
+        deviceTableChunks[chunk] = devices;
+        __sync_synchronize();   /* publish the chunk before the new capacity */
+        deviceTableCapacity += MAX_USB_DEVICES;
+    }
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+static unsigned long _device_index_hash( uint64_t key )
+{
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    return (unsigned long)key;
+}
+
+static void _device_index_clear( AIODeviceIndex *idx )
+{
+    free( idx->entries );
+    idx->entries = NULL;
+    idx->size = idx->used = 0;
+}
+
+static AIORESULT _device_index_insert( AIODeviceIndex *idx, uint64_t key, long index, AIOUSB_BOOL unique );
+
+static AIORESULT _device_index_rehash( AIODeviceIndex *idx, unsigned long size )
+{
+    AIODeviceIndex bigger = { NULL, size, 0 };
+    bigger.entries = (AIODeviceIndexEntry *)malloc( size * sizeof(AIODeviceIndexEntry) );
+    if ( !bigger.entries )
+        return AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+    for ( unsigned long i = 0; i < size; i ++ )
+        bigger.entries[i].index = -1;
+
+    for ( unsigned long i = 0; i < idx->size; i ++ ) {
+        if ( idx->entries[i].index >= 0 )
+            _device_index_insert( &bigger, idx->entries[i].key, idx->entries[i].index, AIOUSB_FALSE );
+    }
+    free( idx->entries );
+    *idx = bigger;
+    return AIOUSB_SUCCESS;
+}
+
+/**
+ * @brief Adds key -> index. With unique set an existing entry for key is
+ * overwritten, otherwise the same key may map to several indices.
+ */
+static AIORESULT _device_index_insert( AIODeviceIndex *idx, uint64_t key, long index, AIOUSB_BOOL unique )
 {
-    int index;
     AIORESULT result;
-    for(index = 0; index < MAX_USB_DEVICES; index++) {
-        AIOUSBDevice *device = _get_device( index , &result );
-        /* libusb handles */
-        if ( index == 0 ) {
-            if ( device->usb_device ) {
-                DeleteUSBDevice( device->usb_device );
-                device->usb_device = NULL;
+    if ( ( idx->used + 1 ) * 2 > idx->size ) {
+        if ( ( result = _device_index_rehash( idx, idx->size ? idx->size * 2 : 2 * MAX_USB_DEVICES ) ) != AIOUSB_SUCCESS )
+            return result;
+    }
+
+    unsigned long mask = idx->size - 1;
+    for ( unsigned long pos = _device_index_hash( key ) & mask; ; pos = ( pos + 1 ) & mask ) {
+        AIODeviceIndexEntry *entry = &idx->entries[pos];
+        if ( entry->index < 0 ) {
+            entry->key = key;
+            entry->index = index;
+            idx->used ++;
+            return AIOUSB_SUCCESS;
+        }
+        if ( entry->key == key && ( unique || entry->index == index ) ) {
+            entry->index = index;
+            return AIOUSB_SUCCESS;
+        }
+    }
+}
+
+/**
+ * @brief Walks the entries for key; start with *pos == ULONG_MAX
+ * @return next device index stored under key, or -1 when there are no more
+ */
+static long _device_index_next( const AIODeviceIndex *idx, uint64_t key, unsigned long *pos )
+{
+    if ( !idx->size )
+        return -1;
+    unsigned long mask = idx->size - 1;
+    unsigned long i = ( *pos == ULONG_MAX ? _device_index_hash( key ) & mask : ( *pos + 1 ) & mask );
+    for ( ; idx->entries[i].index >= 0; i = ( i + 1 ) & mask ) {
+        if ( idx->entries[i].key == key ) {
+            *pos = i;
+            return idx->entries[i].index;
+        }
+    }
+    return -1;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Records the serial number read from a device so later lookups by
+ * serial number are a memory lookup
+ */
+AIORESULT AIODeviceTableSetSerialNumber( unsigned long DeviceIndex, uint64_t serialNumber )
+{
+    AIORESULT result = AIOUSB_SUCCESS;
+    AIOUSBDevice *device = _get_device( DeviceIndex, &result );
+    if ( !device )
+        return result;
+
+    AIOUSB_Lock();
+    device->cachedSerialNumber = serialNumber;
+    if ( serialNumber != 0 )
+        result = _device_index_insert( &serialNumberIndex, serialNumber, (long)DeviceIndex, AIOUSB_TRUE );
+    AIOUSB_UnLock();
+    return result;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Resolves a serial number that has already been read from a board
+ * @return device index, or -AIOUSB_ERROR_DEVICE_NOT_FOUND if no attached
+ *         device is known to carry serialNumber
+ */
+AIORET_TYPE AIODeviceTableLookupSerialNumber( uint64_t serialNumber )
+{
+    AIORET_TYPE retval = -AIOUSB_ERROR_DEVICE_NOT_FOUND;
+    unsigned long pos = ULONG_MAX;
+    long index;
+    if ( serialNumber == 0 || !AIOUSB_IsInit() )
+        return retval;
+
+    AIOUSB_Lock();
+    while ( ( index = _device_index_next( &serialNumberIndex, serialNumber, &pos ) ) >= 0 ) {
+        AIOUSBDevice *device = _get_device_no_error( index );
+        if ( device && device->usb_device != NULL && !device->bDeviceWasHere && device->cachedSerialNumber == serialNumber ) {
+            retval = (AIORET_TYPE)index;
+            break;
+        }
+    }
+    AIOUSB_UnLock();
+    return retval;
+}
+
+/*----------------------------------------------------------------------------*/
+static int _compare_indices( const void *p1, const void *p2 )
+{
+    return *(const int *)p1 - *(const int *)p2;
+}
+
+/**
+ * @brief Collects the indices of valid devices whose product ID lies in
+ * [minProductID,maxProductID], in ascending index order
+ * @param indices receives up to maxIndices device indices
+ * @return number of indices stored
+ */
+AIORET_TYPE AIODeviceTableGetIndicesByProductID( unsigned long minProductID, unsigned long maxProductID, int *indices, int maxIndices )
+{
+    AIO_ASSERT( indices );
+    int found = 0;
+    if ( !AIOUSB_IsInit() )
+        return 0;
+
+    AIOUSB_Lock();
+    /* probe each product ID in a narrow range, otherwise walk the index */
+    AIOUSB_BOOL probe = ( maxProductID >= minProductID && maxProductID - minProductID < productIDIndex.size );
+    unsigned long productID = minProductID;
+    unsigned long slot = 0;
+    while ( found < maxIndices ) {
+        long index;
+        if ( probe ) {
+            if ( productID > maxProductID )
+                break;
+            unsigned long pos = ULONG_MAX;
+            while ( found < maxIndices && ( index = _device_index_next( &productIDIndex, productID, &pos ) ) >= 0 ) {
+                AIOUSBDevice *device = _get_device_no_error( index );
+                if ( device && device->valid == AIOUSB_TRUE && device->ProductID == productID )
+                    indices[found++] = (int)index;
             }
+            productID ++;
         } else {
-            device->usb_device = NULL;
+            if ( slot >= productIDIndex.size )
+                break;
+            AIODeviceIndexEntry *entry = &productIDIndex.entries[slot++];
+            if ( entry->index < 0 || entry->key < minProductID || entry->key > maxProductID )
+                continue;
+            AIOUSBDevice *device = _get_device_no_error( entry->index );
+            if ( device && device->valid == AIOUSB_TRUE && device->ProductID == entry->key )
+                indices[found++] = (int)entry->index;
         }
-
-        /* run-time settings */
-        device->discardFirstSample = AIOUSB_FALSE;
-        device->commTimeout = 5000;
-        device->miscClockHz = 1;
-
-        /* device-specific properties */
-        device->ProductID = 0;
-        device->DIOBytes
-            = device->Counters
-            = device->Tristates
-            = device->ConfigBytes
-            = device->ImmDACs
-            = device->DACsUsed
-            = device->ADCChannels
-            = device->ADCMUXChannels
-            = device->ADCChannelsPerGroup
-            = device->WDGBytes
-            = device->ImmADCs
-            = device->FlashSectors
-            = 0;
-        device->RootClock
-            = device->StreamingBlockSize
-            = 0;
-        device->bGateSelectable
-            = device->bGetName
-            = device->bDACStream
-            = device->bADCStream
-            = device->bDIOStream
-            = device->bDIOSPI
-            = device->bClearFIFO
-            = device->bDACBoardRange
-            = device->bDACChannelCal
-            = AIOUSB_FALSE;
-
-        /* device state */
-        device->bDACOpen
-            = device->bDACClosing
-            = device->bDACAborting
-            = device->bDACStarted
-            = device->bDIOOpen
-            = device->bDIORead
-            = AIOUSB_FALSE;
-        device->DACData = NULL;
-        device->PendingDACData = NULL;
-        device->LastDIOData = NULL;
-        device->cachedName = NULL;
-        device->cachedSerialNumber = 0;
-        device->cachedConfigBlock.size = 0;       // .size == 0 == uninitialized
-
-        /* worker thread state */
-        device->workerBusy = AIOUSB_FALSE;
-        device->workerStatus = 0;
-        device->workerResult = AIOUSB_SUCCESS;
-        device->valid = AIOUSB_FALSE;
-        device->testing = AIOUSB_FALSE;
     }
+    AIOUSB_UnLock();
+
+    qsort( indices, found, sizeof(int), _compare_indices );
+    return (AIORET_TYPE)found;
+}
+
+/*----------------------------------------------------------------------------*/
+AIOUSB_BOOL AIOUSB_SetInit()
+{
+    aiousbInit = AIOUSB_INIT_PATTERN;
+    return AIOUSB_TRUE;
+}
+
+/*----------------------------------------------------------------------------*/
+void AIODeviceTableInit(void)
+{
+    unsigned long index;
+    for(index = 0; index < deviceTableCapacity; index++)
+        _init_device_slot( _get_device_no_error( index ), index );
+    _device_index_clear( &serialNumberIndex );
+    _device_index_clear( &productIDIndex );
     AIOUSB_SetInit();
 }
 
@@ -266,7 +717,16 @@ unsigned long AIOUSB_InitTest(void) {
 AIOUSB_BOOL AIOUSB_Cleanup()
 {
     aiousbInit = ~ AIOUSB_INIT_PATTERN;
-    memset( &deviceTable[0], 0, MAX_USB_DEVICES * AIOUSBDeviceSize() );
+    for ( unsigned long index = 0; index < deviceTableCapacity; index ++ ) {
+        AIOUSBDevice *device = _get_device_no_error( index );
+        _stop_device_threads( device );
+        _free_retired_usb_devices( device );
+        _destroy_device_locks( device );
+    }
+    for ( unsigned long chunk = 0; chunk < deviceTableCapacity / MAX_USB_DEVICES; chunk ++ )
+        memset( deviceTableChunks[chunk], 0, MAX_USB_DEVICES * AIOUSBDeviceSize() );
+    _device_index_clear( &serialNumberIndex );
+    _device_index_clear( &productIDIndex );
     return AIOUSB_TRUE;
 }
 
@@ -485,8 +945,9 @@ AIORET_TYPE GetDevices(void)
      * _should_ still be valid
      */
 
-    for(index = 0; index < MAX_USB_DEVICES; index++) {
-        if ( deviceTable[index].usb_device != NULL && deviceTable[index].valid == AIOUSB_TRUE )
+    for(index = 0; index < (int)deviceTableCapacity; index++) {
+        AIOUSBDevice *device = _get_device_no_error( index );
+        if ( device->usb_device != NULL && device->valid == AIOUSB_TRUE )
             deviceMask =  (deviceMask << 1) | 1;
     }
 
@@ -593,6 +1054,8 @@ static unsigned long GetDeviceName(unsigned long DeviceIndex, char **name)
     
     AIO_ERROR_VALID_DATA( AIOUSB_ERROR_DEVICE_NOT_FOUND, result == AIOUSB_SUCCESS );
 
+    if ( !deviceDesc->cachedName )
+        AIOPropertyCacheApply( DeviceIndex );
     if ( deviceDesc->cachedName ) {
         *name = deviceDesc->cachedName;
         goto out_GetDeviceName;
@@ -617,7 +1080,7 @@ static unsigned long GetDeviceName(unsigned long DeviceIndex, char **name)
     /* SEE Note 1 */
     srcLength = ( int )((descData[ 0 ] - 2) / 2);
 
-    deviceDesc->cachedName = ( char* )malloc(CYPRESS_MAX_DESC_SIZE + 2);
+    deviceDesc->cachedName = ( char* )calloc(CYPRESS_MAX_DESC_SIZE + 2, 1);
     AIO_ERROR_VALID_DATA( AIOUSB_ERROR_NOT_ENOUGH_MEMORY, deviceDesc->cachedName  );
 
 
@@ -626,7 +1089,7 @@ static unsigned long GetDeviceName(unsigned long DeviceIndex, char **name)
     }
 
     *name = deviceDesc->cachedName;
-
+    AIOPropertyCacheStore( DeviceIndex );
 
  out_GetDeviceName:
 
@@ -663,339 +1126,85 @@ char *GetSafeDeviceName(unsigned long DeviceIndex)
     return deviceName;
 }
 
-/*----------------------------------------------------------------------------*/ 
-AIORESULT _Initialize_Device_Desc(unsigned long DeviceIndex) 
+/*----------------------------------------------------------------------------*/
+static int _compare_product_descriptor( const void *key, const void *row )
 {
-    AIORESULT result = AIOUSB_SUCCESS;
-    AIOUSBDevice * device = _get_device( DeviceIndex , &result );
-    if ( result != AIOUSB_SUCCESS )
-        return result;
+    unsigned long productID = *(const unsigned long *)key;
+    const AIOProductDescriptor *desc = (const AIOProductDescriptor *)row;
+    if ( productID < desc->firstProductID )
+        return -1;
+    return productID > desc->lastProductID ? 1 : 0;
+}
 
-    device->DIOBytes = 0;
-    device->DIOConfigBits = 0;
-    device->Counters = 0;
-    device->RootClock = 0;
-    device->Tristates = 0;
-    device->bGetName = AIOUSB_FALSE;
-    device->ConfigBytes = 0;
-    device->bGateSelectable = AIOUSB_FALSE;
-    device->bDACBoardRange = AIOUSB_FALSE;
-    device->bDACChannelCal = AIOUSB_FALSE;
-    device->ImmDACs = 0;
-    device->ImmADCs = 0;
-    device->ADCChannels = 0;
-    device->ADCMUXChannels = 0;
-    device->bDACStream = AIOUSB_FALSE;
-    device->bADCStream = AIOUSB_FALSE;
-    device->RangeShift = 0;
-    device->bDIOStream = AIOUSB_FALSE;
-    device->StreamingBlockSize = 31 * 1024;
-    device->bDIODebounce = AIOUSB_FALSE;
-    device->bDIOSPI = AIOUSB_FALSE;
-    device->bClearFIFO = AIOUSB_FALSE;
-    device->FlashSectors = 0;
-    device->WDGBytes = 0;
-    device->bSetCustomClocks = AIOUSB_FALSE;
-
-    CheckPNPData(DeviceIndex );
+/**
+ * @brief Looks up the capabilities of a product
+ * @param productID
+ * @return the product's descriptor, or a descriptor with no capabilities
+ *         beyond reporting its own name if the product isn't known; never
+ *         NULL
+ */
+const AIOProductDescriptor *AIOProductDescriptorForProductID( unsigned long productID )
+{
+    const AIOProductDescriptor *desc = (const AIOProductDescriptor *)bsearch( &productID,
+                                                                              productDescriptorTable,
+                                                                              NUM_PRODUCT_DESCRIPTORS,
+                                                                              sizeof(AIOProductDescriptor),
+                                                                              _compare_product_descriptor
+                                                                              );
+    return desc ? desc : &unknownProductDescriptor;
+}
 
-    return result;
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Points device at its product descriptor and resets the
+ * device-specific properties from it
+ */
+static void _apply_product_descriptor( AIOUSBDevice *device, const AIOProductDescriptor *desc )
+{
+    device->product             = desc;
+    device->DIOBytes            = desc->DIOBytes;
+    device->DIOConfigBits       = desc->DIOConfigBits;
+    device->Tristates           = desc->Tristates;
+    device->Counters            = desc->Counters;
+    device->RootClock           = desc->RootClock;
+    device->WDGBytes            = desc->WDGBytes;
+    device->ADCChannels         = desc->ADCChannels;
+    device->ADCMUXChannels      = desc->ADCMUXChannels;
+    device->ADCChannelsPerGroup = desc->ADCChannelsPerGroup;
+    device->ConfigBytes         = desc->ConfigBytes;
+    device->RangeShift          = desc->RangeShift;
+    device->ImmADCs             = desc->ImmADCs;
+    device->ImmDACs             = desc->ImmDACs;
+    device->DACsUsed            = desc->DACsUsed;
+    device->FlashSectors        = desc->FlashSectors;
+    device->StreamingBlockSize  = 31ul * 1024ul;
+
+    device->bGetName         = ( desc->flags & AIO_CAP_GET_NAME        ) ? AIOUSB_TRUE : AIOUSB_FALSE;
+    device->bSetCustomClocks = ( desc->flags & AIO_CAP_CUSTOM_CLOCKS   ) ? AIOUSB_TRUE : AIOUSB_FALSE;
+    device->bDIODebounce     = ( desc->flags & AIO_CAP_DIO_DEBOUNCE    ) ? AIOUSB_TRUE : AIOUSB_FALSE;
+    device->bGateSelectable  = ( desc->flags & AIO_CAP_GATE_SELECTABLE ) ? AIOUSB_TRUE : AIOUSB_FALSE;
+    device->bDACStream       = ( desc->flags & AIO_CAP_DAC_STREAM      ) ? AIOUSB_TRUE : AIOUSB_FALSE;
+    device->bDACDIOClock     = ( desc->flags & AIO_CAP_DAC_DIO_CLOCK   ) ? AIOUSB_TRUE : AIOUSB_FALSE;
+    device->bDACBoardRange   = ( desc->flags & AIO_CAP_DAC_BOARD_RANGE ) ? AIOUSB_TRUE : AIOUSB_FALSE;
+    device->bDACChannelCal   = ( desc->flags & AIO_CAP_DAC_CHANNEL_CAL ) ? AIOUSB_TRUE : AIOUSB_FALSE;
+    device->bADCStream       = ( desc->flags & AIO_CAP_ADC_STREAM      ) ? AIOUSB_TRUE : AIOUSB_FALSE;
+    device->bDIOStream       = ( desc->flags & AIO_CAP_DIO_STREAM      ) ? AIOUSB_TRUE : AIOUSB_FALSE;
+    device->bDIOSPI          = ( desc->flags & AIO_CAP_DIO_SPI         ) ? AIOUSB_TRUE : AIOUSB_FALSE;
+    device->bClearFIFO       = ( desc->flags & AIO_CAP_CLEAR_FIFO      ) ? AIOUSB_TRUE : AIOUSB_FALSE;
 }
 
 /*----------------------------------------------------------------------------*/ 
-AIORESULT  _Card_Specific_Settings(unsigned long DeviceIndex) 
+AIORESULT _Initialize_Device_Desc(unsigned long DeviceIndex) 
 {
     AIORESULT result = AIOUSB_SUCCESS;
-    AIOUSBDevice *device = _get_device( DeviceIndex , &result );
-
-    if ( result != AIOUSB_SUCCESS ) 
+    AIOUSBDevice * device = _get_device( DeviceIndex , &result );
+    if ( result != AIOUSB_SUCCESS )
         return result;
 
-    switch(device->ProductID) {
-      case 0x8001:
-          device->DIOBytes = 4;
-          device->Counters = 3;
-          device->RootClock = 3000000;
-          device->bGetName = AIOUSB_TRUE;
-          device->bSetCustomClocks = AIOUSB_TRUE;
-          device->bDIODebounce = AIOUSB_TRUE;
-          break;
-
-      case 0x8004:
-          device->DIOBytes = 4;
-          device->DIOConfigBits = 32;
-          device->bGetName = AIOUSB_TRUE;
-          device->bSetCustomClocks = AIOUSB_TRUE;
-          break;
-
-      case 0x8002:
-          device->DIOBytes = 6;
-          device->bGetName = AIOUSB_TRUE;
-          break;
-
-      case 0x8003:
-          device->DIOBytes = 12;
-          device->bGetName = AIOUSB_TRUE;
-          break;
-
-      case 0x8068:
-          device->bDACBoardRange = AIOUSB_TRUE;
-      case 0x8008:
-      case 0x8009:
-      case 0x800A:
-          device->DIOBytes = 1;
-          device->bGetName = AIOUSB_TRUE;
-          device->bDIOStream = AIOUSB_TRUE;
-          device->bDIOSPI = AIOUSB_TRUE;
-          device->bClearFIFO = AIOUSB_TRUE;
-          break;
-
-      case 0x800C:
-      case 0x800D:
-      case 0x800E:
-      case 0x800F:
-          device->DIOBytes = 4;
-          device->Tristates = 2;
-          device->bGetName = AIOUSB_TRUE;
-          device->bDIOStream = AIOUSB_TRUE;
-          device->bDIOSPI = AIOUSB_TRUE;
-          device->bClearFIFO = AIOUSB_TRUE;
-          break;
-
-          //USB-IIRO-16 family
-      case 0x8010:
-      case 0x8011:
-      case 0x8012:
-      case 0x8014:
-      case 0x8015:
-      case 0x8016:
-        //USB-IDIO-16 family
-      case 0x8018:
-      case 0x801a:
-      case 0x801c:
-      case 0x801e:
-      case 0x8019:
-      case 0x801d:
-      case 0x801f:
-          device->DIOBytes = 4;
-          device->bGetName = AIOUSB_TRUE;
-          device->WDGBytes = 2;
-          break;
-
-      case 0x4001:
-      case 0x4002:
-          device->bGetName = AIOUSB_FALSE;
-          device->bDACStream = AIOUSB_TRUE;
-          device->ImmDACs = 8;
-          device->DACsUsed = 5;
-          device->bGetName = AIOUSB_TRUE;
-          break;
-
-      case 0x4003:
-          device->bGetName = AIOUSB_FALSE;
-          device->ImmDACs = 8;
-          device->bGetName = AIOUSB_TRUE;
-          break;
-
-      case 0x8020:
-          device->Counters = 5;
-          device->bGateSelectable = AIOUSB_TRUE;
-          device->RootClock = 10000000;
-          device->bGetName = AIOUSB_TRUE;
-          break;
-
-      case 0x8030:
-      case 0x8031:
-          device->DIOBytes = 2;
-          device->bGetName = AIOUSB_TRUE;
-          break;
-
-      case 0x8032:
-          device->DIOBytes = 3;
-          device->bGetName = AIOUSB_TRUE;
-          break;
-
-      case 0x8033:
-          device->DIOBytes = 3;
-          device->bGetName = AIOUSB_TRUE;
-          break;
-
-      case 0x8036:
-          device->DIOBytes = 2;
-          device->bGetName = AIOUSB_TRUE;
-          device->ImmADCs = 2;
-          break;
-
-      case 0x8037:
-          device->DIOBytes = 2;
-          device->bGetName = AIOUSB_TRUE;
-          device->ImmADCs = 2;
-          break;
-
-      case 0x8040:
-      case 0x8041:
-      case 0x8042:
-      case 0x8043:
-      case 0x8044:
-      case 0x8140:
-      case 0x8141:
-      case 0x8142:
-      case 0x8143:
-      case 0x8144:
-          device->DIOBytes = 2;
-          device->Counters = 1;
-          device->RootClock = 10000000;
-          device->bGetName = AIOUSB_TRUE;
-          device->bADCStream = AIOUSB_TRUE;
-          device->ADCChannels = 16;
-          device->ADCMUXChannels = 16;
-          device->ConfigBytes = 20;
-          device->RangeShift = 0;
-          device->bClearFIFO = AIOUSB_TRUE;
-          if ((device->ProductID & 0x0100) != 0) {
-                device->bDACBoardRange = AIOUSB_TRUE;
-                device->ImmDACs = 2;
-            }
-          break;
-
-      case 0x8045:
-      case 0x8046:
-      case 0x8047:
-      case 0x8048:
-      case 0x8049:
-      case 0x8145:
-      case 0x8146:
-      case 0x8147:
-      case 0x8148:
-      case 0x8149:
-          device->DIOBytes = 2;
-          device->Counters = 1;
-          device->RootClock = 10000000;
-          device->bGetName = AIOUSB_TRUE;
-          device->bADCStream = AIOUSB_TRUE;
-          device->ADCChannels = 16;
-          device->ADCMUXChannels = 64;
-          device->ConfigBytes = 21;
-          device->RangeShift = 2;
-          device->bClearFIFO = AIOUSB_TRUE;
-          if ((device->ProductID & 0x0100) != 0) {
-                device->bDACBoardRange = AIOUSB_TRUE;
-                device->ImmDACs = 2;
-            }
-          break;
-
-      case 0x804a:
-      case 0x804b:
-      case 0x804c:
-      case 0x804d:
-      case 0x804e:
-      case 0x804f:
-      case 0x8050:
-      case 0x8051:
-      case 0x8052:
-      case 0x8053:
-      case 0x8054:
-      case 0x8055:
-      case 0x8056:
-      case 0x8057:
-      case 0x8058:
-      case 0x8059:
-      case 0x805a:
-      case 0x805b:
-      case 0x805c:
-      case 0x805d:
-      case 0x805e:
-      case 0x805f:
-      case 0x814a:
-      case 0x814b:
-      case 0x814c:
-      case 0x814d:
-      case 0x814e:
-      case 0x814f:
-      case 0x8150:
-      case 0x8151:
-      case 0x8152:
-      case 0x8153:
-      case 0x8154:
-      case 0x8155:
-      case 0x8156:
-      case 0x8157:
-      case 0x8158:
-      case 0x8159:
-      case 0x815a:
-      case 0x815b:
-      case 0x815c:
-      case 0x815d:
-      case 0x815e:
-      case 0x815f:
-          device->DIOBytes = 2;
-          device->Counters = 1;
-          device->RootClock = 10000000;
-          device->bGetName = AIOUSB_TRUE;
-          device->bADCStream = AIOUSB_TRUE;
-          device->ADCChannels = 16;
-          device->ADCMUXChannels = 32 * ((((device->ProductID - 0x804A) & (~0x0100)) / 5) + 1);
-          device->ConfigBytes = 21;
-          device->RangeShift = 3;
-          device->bClearFIFO = AIOUSB_TRUE;
-          if ((device->ProductID & 0x0100) != 0) {
-                device->bDACBoardRange = AIOUSB_TRUE;
-                device->ImmDACs = 2;
-            }
-          break;
-
-      case 0x8060:
-      case 0x8070:
-      case 0x8071:
-      case 0x8072:
-      case 0x8073:
-      case 0x8074:
-      case 0x8075:
-      case 0x8076:
-      case 0x8077:
-      case 0x8078:
-      case 0x8079:
-      case 0x807a:
-      case 0x807b:
-      case 0x807c:
-      case 0x807d:
-      case 0x807e:
-      case 0x807f:
-          device->DIOBytes = 2;
-          device->bGetName = AIOUSB_TRUE;
-          device->FlashSectors = 32;
-          device->bDACBoardRange = AIOUSB_TRUE;
-          device->bDACChannelCal = AIOUSB_TRUE;
-          //device->bClearFIFO = AIOUSB_TRUE;
-          //Add a new-style DAC streaming
-          switch(device->ProductID & 0x06) {
-            case 0x00:
-                device->ImmDACs = 16;
-                break;
-
-            case 0x02:
-                device->ImmDACs = 12;
-                break;
+    _apply_product_descriptor( device, AIOProductDescriptorForProductID( device->ProductID ) );
 
-            case 0x04:
-                device->ImmDACs = 8;
-                break;
+    EnsurePNPData( DeviceIndex );
 
-            case 0x06:
-                device->ImmDACs = 4;
-                break;
-            }
-          if ((device->ProductID & 1) == 0)
-              device->ImmADCs = 2;
-          break;
-
-      default:
-          device->bADCStream = AIOUSB_TRUE;
-          device->bDIOStream = AIOUSB_TRUE;
-          device->bDIOSPI = AIOUSB_TRUE;
-          result = AIOUSB_SUCCESS;
-          break;
-      }
     return result;
 }
 
@@ -1017,9 +1226,7 @@ AIORESULT  _Card_Specific_Settings(unsigned long DeviceIndex)
      if ( device->bOpen ) 
          return AIOUSB_SUCCESS;
 
-     _Initialize_Device_Desc(DeviceIndex);
-
-     result |= _Card_Specific_Settings(DeviceIndex);
+     result = _Initialize_Device_Desc(DeviceIndex);
      if (result != AIOUSB_SUCCESS)
          goto RETURN_AIOUSB_EnsureOpen;
      if (device->DIOConfigBits == 0)
@@ -1038,7 +1245,7 @@ AIOUSBDevice *AIODeviceTableGetDeviceAtIndex( unsigned long DeviceIndex , AIORES
     if (DeviceIndex == diFirst) { /* find first device on bus */
         *res = AIOUSB_ERROR_FILE_NOT_FOUND;
         int index;
-        for(index = 0; index < MAX_USB_DEVICES; index++) {
+        for(index = 0; index < (int)deviceTableCapacity; index++) {
             if ( (retval = _verified_device(_get_device(index , res ), res )) && *res == AIOUSB_SUCCESS ) {
                 DeviceIndex = index;
                 break;
@@ -1050,7 +1257,7 @@ AIOUSBDevice *AIODeviceTableGetDeviceAtIndex( unsigned long DeviceIndex , AIORES
          */
         *res = AIOUSB_ERROR_FILE_NOT_FOUND;
         int index;
-        for(index = 0; index < MAX_USB_DEVICES; index++) {
+        for(index = 0; index < (int)deviceTableCapacity; index++) {
             if ( (retval = _verified_device(_get_device(index, res ), res )) ) {
                 /* found a device */
                 if ( *res != AIOUSB_SUCCESS) {
@@ -1093,7 +1300,7 @@ AIOUSBDevice *AIODeviceTableGetAIOUSBDeviceAtIndex( unsigned long DeviceIndex )
     if (DeviceIndex == diFirst) { /* find first device on bus */
         errno = AIO_ERROR(AIOUSB_ERROR_DEVICE_NOT_FOUND);
         int index;
-        for(index = 0; index < MAX_USB_DEVICES; index++) {
+        for(index = 0; index < (int)deviceTableCapacity; index++) {
             if ( (retval = _verified_device(_get_device(index , res ), res )) && *res == AIOUSB_SUCCESS ) {
                 errno = AIOUSB_SUCCESS;
                 DeviceIndex = index;
@@ -1106,7 +1313,7 @@ AIOUSBDevice *AIODeviceTableGetAIOUSBDeviceAtIndex( unsigned long DeviceIndex )
          */
         errno = AIO_ERROR(AIOUSB_ERROR_DEVICE_NOT_FOUND);
         int index;
-        for(index = 0; index < MAX_USB_DEVICES; index++) {
+        for(index = 0; index < (int)deviceTableCapacity; index++) {
             if ( (retval = _verified_device(_get_device(index, res ), res )) ) {
                 /* found a device */
                 if ( *res != AIOUSB_SUCCESS) {
@@ -1150,209 +1357,7 @@ AIORET_TYPE AIOUSBGetError()
 void _setup_device_parameters( AIOUSBDevice *device , unsigned long productID ) 
 {
     device->ProductID = productID;
-    device->StreamingBlockSize = 31ul * 1024ul;
-    device->bGetName = AIOUSB_TRUE;             // most boards support this feature
-
-
-    if (productID == USB_DIO_32 || productID == USB_DIO_32I ) {
-        device->DIOBytes = 4;
-        device->Counters = 3;
-
-        device->bGetName = AIOUSB_TRUE;
-        device->bSetCustomClocks = AIOUSB_TRUE;
-        device->Tristates = 1;
-        if ( productID == USB_DIO_32 ) {
-            device->RootClock = 3000000;
-            device->bDIODebounce = AIOUSB_TRUE;
-        } else {
-            device->DIOConfigBits = 32;
-        } 
-
-    } else if ( productID == USB_DIO24_CTR6 || productID == USB_DIO_24 ) {
-      device->DIOBytes = 3;
-      device->DIOConfigBits = 4;
-      device->Tristates = 1;
-      device->bGetName = AIOUSB_TRUE;
-      device->bDIODebounce = AIOUSB_TRUE;
-      if (productID == USB_DIO24_CTR6 ) { 
-          device->Counters = 2;
-          device->bSetCustomClocks = AIOUSB_TRUE;
-          device->RootClock = 10000000;
-      }
-
-    } else if (productID == USB_DIO_48) {
-        device->DIOBytes = 6;
-    } else if (productID == USB_DIO_96) {
-        device->DIOBytes = 12;
-    } else if ( productID >= USB_DI16A_REV_A1 && productID <= USB_DI16A_REV_A2 ) {
-        device->DIOBytes = 1;
-        device->bDIOStream = AIOUSB_TRUE;
-        device->bDIOSPI = AIOUSB_TRUE;
-        device->bClearFIFO = AIOUSB_TRUE;
-    } else if (
-              productID >= USB_DIO_16H &&
-              productID <= USB_DIO_16A
-              ) {
-        device->DIOBytes = 4;
-        device->Tristates = 2;
-        device->bDIOStream = AIOUSB_TRUE;
-        device->bDIOSPI = AIOUSB_TRUE;
-        device->bClearFIFO = AIOUSB_TRUE;
-    } else if (
-              productID == USB_IIRO_16 ||
-              productID == USB_II_16 ||
-              productID == USB_RO_16 ||
-              productID == USB_IIRO_8 ||
-              productID == USB_II_8 ||
-              productID == USB_IIRO_4
-              ) {
-        device->DIOBytes = 4;
-        device->WDGBytes = 2;
-    } else if (
-              productID == USB_IDIO_16 ||
-              productID == USB_II_16_OLD ||
-              productID == USB_IDO_16 ||
-              productID == USB_IDIO_8 ||
-              productID == USB_II_8_OLD ||
-              productID == USB_IDIO_4
-              ) {
-        device->DIOBytes = 4;
-        device->WDGBytes = 2;
-    } else if (
-              productID >= USB_DA12_8A_REV_A &&
-              productID <= USB_DA12_8A
-              ) {
-        device->bDACStream = AIOUSB_TRUE;
-        device->ImmDACs = 8;
-        device->DACsUsed = 5;
-        device->bGetName = AIOUSB_FALSE;
-        device->RootClock = 12000000;
-    } else if (productID == USB_DA12_8E) {
-        device->ImmDACs = 8;
-        device->bGetName = AIOUSB_FALSE;
-    } else if (productID == USB_CTR_15) {
-        device->Counters = 5;
-        device->bGateSelectable = AIOUSB_TRUE;
-        device->RootClock = 10000000;
-    } else if (
-              productID == USB_IIRO4_2SM ||
-              productID == USB_IIRO4_COM
-              ) {
-        device->DIOBytes = 2;
-    } else if (productID == USB_DIO16RO8) {
-        device->DIOBytes = 3;
-    } else if (productID == PICO_DIO16RO8) {
-        device->DIOBytes = 3;
-    } else if (
-              (productID >= USB_AI16_16A && productID <= USB_AI12_16E) ||
-              (productID >= USB_AIO16_16A && productID <= USB_AIO12_16E)
-              ) {
-        device->DIOBytes = 2;
-        device->Counters = 1;
-        device->RootClock = 10000000;
-        device->bADCStream = AIOUSB_TRUE;
-        device->ImmADCs = 1;
-        device->ADCChannels = device->ADCMUXChannels = 16;
-        device->ADCChannelsPerGroup = 1;
-        device->ConfigBytes = AD_CONFIG_REGISTERS;
-        device->bClearFIFO = AIOUSB_TRUE;
-        if (productID & 0x0100) {
-            device->ImmDACs = 2;
-            device->bDACBoardRange = AIOUSB_TRUE;
-        }
-    } else if (
-              (productID >= USB_AI16_64MA && productID <= USB_AI12_64ME) ||
-              (productID >= USB_AIO16_64MA && productID <= USB_AIO12_64ME)
-              ) {
-        device->DIOBytes = 2;
-        device->Counters = 1;
-        device->RootClock = 10000000;
-        device->bADCStream = AIOUSB_TRUE;
-        device->ImmADCs = 1;
-        device->ADCChannels = 16;
-        device->ADCMUXChannels = 64;
-        device->ADCChannelsPerGroup = 4;
-        device->ConfigBytes = AD_MUX_CONFIG_REGISTERS;
-        device->bClearFIFO = AIOUSB_TRUE;
-        if (productID & 0x0100) {
-            device->ImmDACs = 2;
-            device->bDACBoardRange = AIOUSB_TRUE;
-        }
-    } else if (
-              (productID >= USB_AI16_32A && productID <= USB_AI12_128E) ||
-              (productID >= USB_AIO16_32A && productID <= USB_AIO12_128E)
-              ) {
-        device->DIOBytes = 2;
-        device->Counters = 1;
-        device->RootClock = 10000000;
-        device->bADCStream = AIOUSB_TRUE;
-        device->ImmADCs = 1;
-        device->ADCChannels = 16;
-
-        /*
-         * there are four groups of five
-         * products each in this family;
-         * each group of five products has
-         * 32 more MUX channels than the
-         * preceding group; so we calculate
-         * the number of MUX channels by
-         * doing some arithmetic on the
-         * product ID
-         */
-
-        int I = (productID - USB_AI16_32A) & ~0x0100;
-        I /= 5;               /* products per group */
-        device->ADCMUXChannels = 32 * (I + 1);
-        device->ADCChannelsPerGroup = 8;
-        device->ConfigBytes = AD_MUX_CONFIG_REGISTERS;
-        device->bClearFIFO = AIOUSB_TRUE;
-        if (productID & 0x0100) {
-            device->ImmDACs = 2;
-            device->bDACBoardRange = AIOUSB_TRUE;
-        }
-    } else if ( productID == USB_AO_ARB1 ) { 
-      device->DIOBytes      = 4;
-      device->Tristates     = 1;
-      device->bGetName      = AIOUSB_TRUE;
-      device->bDIOStream    = AIOUSB_TRUE;
-      device->bClearFIFO    = AIOUSB_TRUE;
-      device->bDACDIOClock  = AIOUSB_TRUE;
-      device->bDACBoardRange = AIOUSB_TRUE;
-    } else if (
-              productID >= USB_AO16_16A &&
-              productID <= USB_AO12_4
-              ) {
-        device->DIOBytes = 2;
-        device->FlashSectors = 32;
-        device->bDACBoardRange = AIOUSB_TRUE;
-        device->bDACChannelCal = AIOUSB_TRUE;
-
-        /*
-         * we use a few bits within the
-         * product ID to determine the
-         * number of DACs and whether or not
-         * the product has ADCs
-         */
-        switch(productID & 0x0006) {
-        case 0x0000:
-            device->ImmDACs = 16;
-            break;
-
-        case 0x0002:
-            device->ImmDACs = 12;
-            break;
-
-        case 0x0004:
-            device->ImmDACs = 8;
-            break;
-
-        case 0x0006:
-            device->ImmDACs = 4;
-            break;
-        }
-        if ((productID & 0x0001) == 0)
-            device->ImmADCs = 2;
-    }
+    _apply_product_descriptor( device, AIOProductDescriptorForProductID( productID ) );
 
     /* allocate I/O image buffers */
     if (device->DIOBytes > 0) {
@@ -1385,6 +1390,12 @@ AIORESULT AIODeviceTableAddDeviceToDeviceTable( int *numAccesDevices, unsigned l
 AIORESULT AIODeviceTableAddDeviceToDeviceTableWithUSBDevice( int *numAccesDevices, unsigned long productID , USBDevice *usb_dev ) 
 {
     AIORESULT result = AIOUSB_SUCCESS;
+    AIOUSB_Lock();
+    result = _grow_device_table( *numAccesDevices );
+    if ( result != AIOUSB_SUCCESS ) {
+        AIOUSB_UnLock();
+        return result;
+    }
     AIOUSBDevice *device  = _get_device( *numAccesDevices , &result );
 
     device->usb_device    = usb_dev;
@@ -1392,15 +1403,149 @@ AIORESULT AIODeviceTableAddDeviceToDeviceTableWithUSBDevice( int *numAccesDevice
     device->isInit        = AIOUSB_TRUE;
     device->valid         = AIOUSB_TRUE;
     _setup_device_parameters( device , productID );
-
-    CheckPNPData( *numAccesDevices );
+    device->PNPProbed     = AIOUSB_FALSE; /* read on first use, see EnsurePNPData() */
 
     ADCConfigBlockSetDevice( AIOUSBDeviceGetADCConfigBlock( device ), device );
+    _device_index_insert( &productIDIndex, productID, *numAccesDevices, AIOUSB_FALSE );
 
     *numAccesDevices += 1;
+    AIOUSB_UnLock();
     return result;
 }
 
+/*----------------------------------------------------------------------------*/
+static AIORESULT _read_usb_serial_number( USBDevice *usb, uint64_t *serialNumber )
+{
+    uint64_t buffer_data = 0;
+    int bytesTransferred = usb->usb_control_transfer( usb,
+                                                      USB_READ_FROM_DEVICE,
+                                                      AUR_EEPROM_READ,
+                                                      EEPROM_SERIAL_NUMBER_ADDRESS,
+                                                      0,
+                                                      (unsigned char *)&buffer_data,
+                                                      sizeof(buffer_data),
+                                                      1000
+                                                      );
+    if ( bytesTransferred != (int)sizeof(buffer_data) )
+        return bytesTransferred < 0 ? LIBUSB_RESULT_TO_AIOUSB_RESULT( bytesTransferred ) : (AIORESULT)AIOUSB_ERROR_INVALID_DATA;
+    *serialNumber = buffer_data;
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Puts a newly enumerated board into the table without disturbing
+ * any other entry. A board whose serial number matches one that was
+ * detached gets its old index back; anything else takes the first unused
+ * slot, growing the table if needed.
+ * @param usb an initialized USBDevice, owned by the table from here on
+ * @param[out] reattached AIOUSB_TRUE if an earlier index was reused
+ * @return device index, or < 0 on error
+ */
+AIORET_TYPE AIODeviceTableAttachUSBDevice( USBDevice *usb, AIOUSB_BOOL *reattached )
+{
+    AIO_ASSERT( usb );
+    AIO_ASSERT( reattached );
+    AIORESULT result;
+    uint64_t serialNumber = 0;
+    unsigned long productID = USBDeviceGetIdProduct( usb );
+    long index = -1;
+    unsigned long pos = ULONG_MAX;
+    *reattached = AIOUSB_FALSE;
+
+    _read_usb_serial_number( usb, &serialNumber );
+
+    AIOUSB_Lock();
+    if ( serialNumber != 0 ) {
+        while ( ( index = _device_index_next( &serialNumberIndex, serialNumber, &pos ) ) >= 0 ) {
+            AIOUSBDevice *device = _get_device_no_error( index );
+            if ( device && device->bDeviceWasHere && device->cachedSerialNumber == serialNumber && device->ProductID == productID )
+                break;
+        }
+    }
+
+    if ( index >= 0 ) {
+        AIOUSBDevice *device = _get_device_no_error( index );
+        USBDevice *stale = device->usb_device;
+        device->usb_device = usb;
+        device->bDeviceWasHere = AIOUSB_FALSE;
+        device->bOpen = AIOUSB_FALSE;
+        device->valid = AIOUSB_TRUE;
+        /* the board lost power, so nothing it held can be trusted */
+        AIOUSBDeviceWriteLock( device );
+        AIOUSBDeviceInvalidateADCConfigCache( device );
+        AIOUSBDeviceUnlock( device );
+        device->bFirmware20 = AIOUSB_FALSE;
+        device->PNPProbed = AIOUSB_FALSE;
+        if ( stale ) {
+            /**
+             * other threads may still be using the pointer they looked
+             * up before the brownout, so the handle is closed here but
+             * only freed when the slot is cleared
+             */
+            USBDeviceClose( stale );
+            USBDevice **retired = (USBDevice **)realloc( device->retiredUsbDevices, ( device->numRetiredUsbDevices + 1 ) * sizeof(USBDevice *) );
+            if ( retired ) {
+                retired[ device->numRetiredUsbDevices ++ ] = stale;
+                device->retiredUsbDevices = retired;
+            }
+        }
+        *reattached = AIOUSB_TRUE;
+    } else {
+        int slot;
+        for ( slot = 0; slot < (int)deviceTableCapacity; slot ++ ) {
+            AIOUSBDevice *device = _get_device_no_error( slot );
+            if ( device->usb_device == NULL && device->valid != AIOUSB_TRUE && !device->bDeviceWasHere )
+                break;
+        }
+        index = slot;
+        result = AIODeviceTableAddDeviceToDeviceTableWithUSBDevice( &slot, productID, usb );
+        if ( result != AIOUSB_SUCCESS ) {
+            AIOUSB_UnLock();
+            return -(AIORET_TYPE)result;
+        }
+    }
+
+    if ( serialNumber != 0 )
+        AIODeviceTableSetSerialNumber( index, serialNumber );
+    AIOUSB_UnLock();
+
+    return (AIORET_TYPE)index;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Marks the entry for a board that has left the bus as detached.
+ * Its index stays reserved so AIODeviceTableAttachUSBDevice() can hand it
+ * back when the same serial number returns. The USBDevice is kept until
+ * then so a thread still holding it sees transfer errors rather than
+ * freed memory; the bulk acquire worker is stopped.
+ * @return device index that was detached, or -AIOUSB_ERROR_DEVICE_NOT_FOUND
+ */
+AIORET_TYPE AIODeviceTableDetachUSBDevice( libusb_device *dev )
+{
+    AIOUSBDevice *device = NULL;
+    unsigned long index;
+
+    AIOUSB_Lock();
+    for ( index = 0; index < deviceTableCapacity; index ++ ) {
+        device = _get_device_no_error( index );
+        if ( device->usb_device && device->usb_device->device == dev && !device->bDeviceWasHere )
+            break;
+    }
+    if ( index == deviceTableCapacity ) {
+        AIOUSB_UnLock();
+        return -AIOUSB_ERROR_DEVICE_NOT_FOUND;
+    }
+    device->valid = AIOUSB_FALSE;
+    device->bDeviceWasHere = AIOUSB_TRUE;
+    AIOUSB_UnLock();
+
+    _stop_device_threads( device );
+
+    return (AIORET_TYPE)index;
+}
+
 /*----------------------------------------------------------------------------*/
 
 /**
@@ -1412,9 +1557,17 @@ AIORET_TYPE ClearAIODeviceTable( int numDevices )
 {
     AIORESULT result = AIOUSB_SUCCESS;
     for ( int i = 0; i < numDevices ; i ++ ) {
-        AIOUSBDevice *device = &deviceTable[i];
+        AIOUSBDevice *device = _get_device_no_error( i );
+        if ( !device )
+            break;
+        _stop_device_threads( device );
         if ( device->LastDIOData )
             free(device->LastDIOData );
+        if ( device->workerEventFdOpen ) {
+            close( device->workerEventFd );
+            device->workerEventFdOpen = AIOUSB_FALSE;
+        }
+        _free_retired_usb_devices( device );
     }
 
     return result;
@@ -1435,7 +1588,7 @@ AIORESULT AIOUSB_GetAllDevices()
     
     if (AIOUSB_IsInit()) {
         int index;
-        for (index = 0; index < MAX_USB_DEVICES; index++) {
+        for (index = 0; index < (int)deviceTableCapacity; index++) {
             AIORESULT res = AIOUSB_SUCCESS;
             AIODeviceTableGetDeviceAtIndex( index , &res );
             if ( res == AIOUSB_SUCCESS ) { 
@@ -1467,7 +1620,7 @@ AIORET_TYPE AIODeviceTablePopulateTableTest(unsigned long *products, int length
     for( int i = 0; i < length ; i ++  ) {
         result = AIODeviceTableAddDeviceToDeviceTable( &numAccesDevices, products[i] );
         if ( result != AIOUSB_SUCCESS ) {
-            deviceTable[numAccesDevices-1].usb_device = (USBDevice *)0x42; 
+            _get_device_no_error( numAccesDevices-1 )->usb_device = (USBDevice *)0x42; 
         }
     }
     return AIOUSB_SUCCESS;
@@ -1480,10 +1633,11 @@ void CloseAllDevices(void)
         return;
     int index;
     AIORESULT result = AIOUSB_SUCCESS;
-    for(index = 0; index < MAX_USB_DEVICES; index++) {
+    for(index = 0; index < (int)deviceTableCapacity; index++) {
         result = AIOUSB_SUCCESS;
         AIOUSBDevice *device = AIODeviceTableGetDeviceAtIndex( index, &result );
         if ( result == AIOUSB_SUCCESS )  {
+            _stop_device_threads( device );
             USBDevice *usb = AIOUSBDeviceGetUSBHandle( device );
             if ( usb ) 
                 USBDeviceClose( usb );
@@ -1542,15 +1696,18 @@ AIORET_TYPE AIODeviceTablePopulateTable(void)
     if ( result < AIOUSB_SUCCESS ) 
         return result;
 
+    AIOUSB_Lock();
     for ( int i = 0; i < size ; i ++ ) {
-        AIOUSBDevice *device = (AIOUSBDevice *)&deviceTable[ numAccesDevices++ ];
+        if ( _grow_device_table( numAccesDevices ) != AIOUSB_SUCCESS )
+            break;
+        AIOUSBDevice *device = _get_device_no_error( numAccesDevices++ );
 
         unsigned productID = USBDeviceGetIdProduct( &usbdevices[i] );
         _setup_device_parameters( device, productID );
         device->usb_device = CopyUSBDevice( &usbdevices[i] );
-        CheckPNPData( i );
-
+        _device_index_insert( &productIDIndex, productID, numAccesDevices - 1, AIOUSB_FALSE );
     }
+    AIOUSB_UnLock();
 
     libusb_free_device_list(deviceList, AIOUSB_TRUE);    
 
@@ -1608,6 +1765,7 @@ AIORET_TYPE AIOUSB_Exit()
     AIORET_TYPE retval = AIOUSB_SUCCESS;
     AIO_ERROR_VALID_DATA( AIOUSB_ERROR_NOT_INIT, AIOUSB_IsInit() );
 
+    AIOUSB_DisableHotplug();
     CloseAllDevices();
     libusb_exit(NULL);
 #if defined(AIOUSB_ENABLE_MUTEX)
@@ -1632,6 +1790,9 @@ AIORET_TYPE AIOUSB_Reset( unsigned long DeviceIndex )
     libusbResult = usb->usb_reset_device(usb);
     if (libusbResult != LIBUSB_SUCCESS )
         retval = LIBUSB_RESULT_TO_AIOUSB_RESULT(libusbResult);
+    AIOUSBDeviceWriteLock( deviceDesc );
+    AIOUSBDeviceInvalidateADCConfigCache( deviceDesc );
+    AIOUSBDeviceUnlock( deviceDesc );
     usleep(250000);
 
     return retval;
@@ -1645,6 +1806,7 @@ AIORET_TYPE AIOUSB_Reset( unsigned long DeviceIndex )
 
 #ifdef SELF_TEST
 #include "gtest/gtest.h"
+#include "AIOUSB_Properties.h"
 
 #include <stdlib.h>
 
@@ -1658,6 +1820,20 @@ TEST(AIODeviceTable,Cleanup) {
 
 }
 
+TEST(AIODeviceTable,LocksLiveAsLongAsTheSlot) {
+    AIODeviceTableInit();
+    AIOUSBDevice *dev = (AIOUSBDevice *)&deviceTable[0];
+    EXPECT_TRUE( dev->locksInitialized );
+    AIOUSBDeviceWriteLock( dev );
+    AIOUSBDeviceUnlock( dev );
+    AIODeviceTableInit();
+    EXPECT_TRUE( dev->locksInitialized ) << "Reinitializing the table keeps the slot's locks";
+    AIOUSB_Cleanup();
+    EXPECT_FALSE( dev->locksInitialized );
+    AIODeviceTableInit();
+    EXPECT_TRUE( dev->locksInitialized );
+}
+
 TEST(AIOUSB_Core,MockObjects) {
     int numDevices = 0;
     AIODeviceTableInit();    
@@ -1775,6 +1951,50 @@ TEST(AIODeviceTable, SetsUpDefaults )
     ClearAIODeviceTable( numDevices );
 }
 
+TEST(AIODeviceTable, ProductDescriptorsAreSortedAndDisjoint )
+{
+    for ( unsigned i = 0; i < NUM_PRODUCT_DESCRIPTORS; i ++ ) {
+        EXPECT_LE( productDescriptorTable[i].firstProductID, productDescriptorTable[i].lastProductID );
+        if ( i > 0 )
+            EXPECT_LT( productDescriptorTable[i-1].lastProductID, productDescriptorTable[i].firstProductID ) << "row " << i;
+    }
+}
+
+TEST(AIODeviceTable, DescriptorMatchesProductFamilies )
+{
+    EXPECT_EQ( 128u, AIOProductDescriptorForProductID( USB_AI12_128E )->ADCMUXChannels );
+    EXPECT_EQ( 96u, AIOProductDescriptorForProductID( USB_AIO16_96A )->ADCMUXChannels );
+    EXPECT_EQ( 2u, AIOProductDescriptorForProductID( USB_AIO16_96A )->ImmDACs );
+    EXPECT_EQ( 0u, AIOProductDescriptorForProductID( USB_AI16_96A )->ImmDACs );
+    EXPECT_EQ( 12u, AIOProductDescriptorForProductID( USB_AO16_12 )->ImmDACs );
+    EXPECT_EQ( 0u, AIOProductDescriptorForProductID( USB_AO16_12 )->ImmADCs );
+    EXPECT_EQ( 2u, AIOProductDescriptorForProductID( USB_AO12_4A )->ImmADCs );
+    EXPECT_EQ( &unknownProductDescriptor, AIOProductDescriptorForProductID( USB_DO24 ) );
+    EXPECT_EQ( &unknownProductDescriptor, AIOProductDescriptorForProductID( 0x1234 ) );
+}
+
+TEST(AIODeviceTable, EnsureOpenKeepsEnumeratedCapabilities )
+{
+    int numDevices = 0;
+    AIORESULT result;
+    AIODeviceTableInit();
+    AIODeviceTableAddDeviceToDeviceTableWithUSBDevice( &numDevices, USB_AI16_64MA, NULL );
+    AIOUSBDevice *dev = AIODeviceTableGetDeviceAtIndex( 0, &result );
+    ASSERT_TRUE( dev );
+    EXPECT_EQ( AIOProductDescriptorForProductID( USB_AI16_64MA ), AIOUSBDeviceGetProductDescriptor( dev ) );
+    EXPECT_EQ( 4u, dev->ADCChannelsPerGroup );
+    EXPECT_EQ( 2, dev->RangeShift );
+    EXPECT_TRUE( dev->bADCStream );
+
+    _Initialize_Device_Desc( 0 );
+    EXPECT_EQ( 4u, dev->ADCChannelsPerGroup );
+    EXPECT_EQ( 2, dev->RangeShift );
+    EXPECT_EQ( 1u, dev->ImmADCs );
+    EXPECT_EQ( (unsigned long)AD_MUX_CONFIG_REGISTERS, dev->ConfigBytes );
+
+    ClearAIODeviceTable( numDevices );
+}
+
 TEST(AIODeviceTable,IncorrectIndices)
 {
     int numDevices = 0;
@@ -1796,6 +2016,57 @@ TEST(AIODeviceTable,IncorrectIndices)
     ClearAIODeviceTable( numDevices );
 }
 
+#define NUM_RACK_DEVICES 40
+static USBDevice rack_usb[ NUM_RACK_DEVICES ];
+static int serial_reads = 0;
+static int fake_serial_transfer( USBDevice *usb, uint8_t request_type, uint8_t bRequest, uint16_t wValue, uint16_t wIndex, unsigned char *data, uint16_t wLength, unsigned int timeout )
+{
+    if ( bRequest != AUR_EEPROM_READ || wValue != EEPROM_SERIAL_NUMBER_ADDRESS )
+        return LIBUSB_ERROR_IO;
+    uint64_t serial = 0xacce5000 + ( usb - rack_usb );
+    memcpy( data, &serial, sizeof(serial) );
+    serial_reads ++;
+    return wLength;
+}
+
+TEST(AIODeviceTable, GrowsPastThirtyTwoDevices )
+{
+    int numDevices = 0;
+    AIORESULT result;
+    int indices[ NUM_RACK_DEVICES ];
+
+    AIODeviceTableInit();
+    for ( int i = 0; i < NUM_RACK_DEVICES; i ++ ) {
+        memset( &rack_usb[i], 0, sizeof(USBDevice) );
+        rack_usb[i].usb_control_transfer = fake_serial_transfer;
+        result = AIODeviceTableAddDeviceToDeviceTableWithUSBDevice( &numDevices, ( i % 2 ? USB_DIO_32 : USB_AI16_16E ), &rack_usb[i] );
+        ASSERT_EQ( AIOUSB_SUCCESS, result );
+    }
+    EXPECT_GE( AIODeviceTableGetCapacity(), NUM_RACK_DEVICES );
+    EXPECT_EQ( &deviceTable[0], AIODeviceTableGetDeviceAtIndex( 0, &result ) ) << "First chunk is deviceTable[]";
+
+    AIOUSBDevice *last = AIODeviceTableGetDeviceAtIndex( NUM_RACK_DEVICES - 1, &result );
+    ASSERT_TRUE( last );
+    EXPECT_EQ( USB_DIO_32, last->ProductID );
+    EXPECT_EQ( NUM_RACK_DEVICES - 1, last->deviceIndex );
+    EXPECT_FALSE( AIODeviceTableGetDeviceAtIndex( AIODeviceTableGetCapacity(), &result ) );
+
+    EXPECT_EQ( NUM_RACK_DEVICES / 2, AIODeviceTableGetIndicesByProductID( USB_DIO_32, USB_DIO_32, indices, NUM_RACK_DEVICES ) );
+    EXPECT_EQ( 1, indices[0] );
+    EXPECT_EQ( NUM_RACK_DEVICES - 1, indices[NUM_RACK_DEVICES / 2 - 1] );
+    EXPECT_EQ( NUM_RACK_DEVICES, AIODeviceTableGetIndicesByProductID( 0, 0xffff, indices, NUM_RACK_DEVICES ) );
+
+    serial_reads = 0;
+    EXPECT_EQ( 35, GetDeviceBySerialNumber( 0xacce5000 + 35 ) );
+    EXPECT_EQ( NUM_RACK_DEVICES, serial_reads );
+    EXPECT_EQ( 3, GetDeviceBySerialNumber( 0xacce5000 + 3 ) );
+    EXPECT_EQ( diNone, GetDeviceBySerialNumber( 0xdeadbeef ) );
+    EXPECT_EQ( NUM_RACK_DEVICES, serial_reads ) << "Serial numbers are only read once";
+
+    for ( int i = 0; i < NUM_RACK_DEVICES; i ++ )
+        AIODeviceTableGetDeviceAtIndex( i, &result )->usb_device = NULL;
+    ClearAIODeviceTable( numDevices );
+}
 
 int 
 main(int argc, char *argv[] )
@@ -20,6 +20,8 @@ PUBLIC_EXTERN AIOUSBDevice deviceTable[ MAX_USB_DEVICES ];
 PUBLIC_EXTERN AIORESULT AIODeviceTableAddDeviceToDeviceTable( int *numAccesDevices, unsigned long productID ) ;
 PUBLIC_EXTERN AIORESULT AIODeviceTableAddDeviceToDeviceTableWithUSBDevice( int *numAccesDevices, unsigned long productID , USBDevice *usb_dev );
 PUBLIC_EXTERN AIORET_TYPE AIODeviceTablePopulateTable(void);
+PUBLIC_EXTERN AIORET_TYPE AIODeviceTableAttachUSBDevice( USBDevice *usb, AIOUSB_BOOL *reattached );
+PUBLIC_EXTERN AIORET_TYPE AIODeviceTableDetachUSBDevice( libusb_device *dev );
 PUBLIC_EXTERN AIORET_TYPE AIODeviceTablePopulateTableTest(unsigned long *products, int length );
 PUBLIC_EXTERN AIORESULT AIODeviceTableClearDevices( void );
 PUBLIC_EXTERN AIORESULT ClearDevices( void );
@@ -27,6 +29,12 @@ PUBLIC_EXTERN AIOUSBDevice *AIODeviceTableGetDeviceAtIndex( unsigned long Device
 PUBLIC_EXTERN AIOUSBDevice *AIODeviceTableGetAIOUSBDeviceAtIndex( unsigned long DeviceIndex );
 PUBLIC_EXTERN USBDevice *AIODeviceTableGetUSBDeviceAtIndex( unsigned long DeviceIndex, AIORESULT *res );
 void _setup_device_parameters( AIOUSBDevice *device , unsigned long productID );
+AIOUSBDevice *_get_device_no_error( unsigned long index );
+PUBLIC_EXTERN AIORET_TYPE AIODeviceTableGetCapacity(void);
+PUBLIC_EXTERN const AIOProductDescriptor *AIOProductDescriptorForProductID( unsigned long productID );
+PUBLIC_EXTERN AIORESULT AIODeviceTableSetSerialNumber( unsigned long DeviceIndex, uint64_t serialNumber );
+PUBLIC_EXTERN AIORET_TYPE AIODeviceTableLookupSerialNumber( uint64_t serialNumber );
+PUBLIC_EXTERN AIORET_TYPE AIODeviceTableGetIndicesByProductID( unsigned long minProductID, unsigned long maxProductID, int *indices, int maxIndices );
 
 PUBLIC_EXTERN unsigned long QueryDeviceInfo( unsigned long DeviceIndex, unsigned long *pPID, unsigned long *pNameSize, char *pName, unsigned long *pDIOBytes, unsigned long *pCounters );
 PUBLIC_EXTERN AIORET_TYPE GetDevices(void);
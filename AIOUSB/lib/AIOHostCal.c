@@ -0,0 +1,336 @@
+/**
+ * @file   AIOHostCal.c
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  Host-side A/D calibration applied while converting counts to volts
+ *
+ * The hardware calibration table lives in the board's SRAM, and boards
+ * for which ADC_CanCalibrate() is false have none, so everything they
+ * return goes through the nominal adRanges scaling. An AIOHostCal holds
+ * a correction for each channel and gain code instead, either a straight
+ * line or a complete table of 65536 volts, and the counts converters and
+ * ADC_GetScanV() use it once it is attached with ADC_SetHostCal() or
+ * AIOCountsConverterSetHostCal().
+ *
+ * Tables are kept as float: 256K per table rather than 512K, which
+ * keeps a table hot in the L2 cache of most hosts, and a float still
+ * resolves far below one count of the widest range. Each table is
+ * allocated once for its channel and gain and overwritten in place when
+ * it is set again, so anything resolved from the calibration stays
+ * valid until DeleteAIOHostCal().
+ */
+
+#include "AIOHostCal.h"
+#include "AIOUSB_Core.h"
+
+#include <stdlib.h>
+
+#ifdef __cplusplus
+namespace AIOUSB {
+#endif
+
+typedef enum {
+    AIO_HOST_CAL_NOMINAL = 0,
+    AIO_HOST_CAL_LINEAR,
+    AIO_HOST_CAL_TABLE
+} AIOHostCalKind;
+
+struct aio_host_cal_entry {
+    AIOHostCalKind kind;
+    float *table;                       /**< kept across AIOHostCalClear() so resolved pointers stay good */
+    double scale;
+    double offset;
+};
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @param numChannels number of A/D channels the calibration covers,
+ *        usually the board's ADCMUXChannels
+ * @return a calibration with every entry nominal, or NULL with
+ *         aio_errno set
+ */
+AIOHostCal *NewAIOHostCal( unsigned numChannels )
+{
+    AIOHostCal *cal;
+    if ( numChannels == 0 ) {
+        aio_errno = -AIOUSB_ERROR_INVALID_PARAMETER;
+        return NULL;
+    }
+    cal = (AIOHostCal *)calloc( 1, sizeof(AIOHostCal) );
+    if ( !cal ) {
+        aio_errno = -AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+        return NULL;
+    }
+    cal->numChannels = numChannels;
+    cal->entries = (struct aio_host_cal_entry *)calloc( (size_t)numChannels * AD_NUM_GAIN_CODES, sizeof(struct aio_host_cal_entry) );
+    if ( !cal->entries ) {
+        free( cal );
+        aio_errno = -AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+        return NULL;
+    }
+    return cal;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Frees the calibration and its tables. Detach it from any device
+ * and converter first.
+ */
+AIORET_TYPE DeleteAIOHostCal( AIOHostCal *cal )
+{
+    AIO_ASSERT_RET( AIOUSB_ERROR_INVALID_PARAMETER, cal );
+    for ( unsigned index = 0; index < cal->numChannels * AD_NUM_GAIN_CODES; index ++ )
+        free( cal->entries[ index ].table );
+    free( cal->entries );
+    free( cal );
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+static struct aio_host_cal_entry *_aio_host_cal_entry( AIOHostCal *cal, unsigned channel, unsigned gainCode )
+{
+    if ( channel >= cal->numChannels || gainCode >= AD_NUM_GAIN_CODES )
+        return NULL;
+    return &cal->entries[ channel * AD_NUM_GAIN_CODES + gainCode ];
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Calibrates channel at gainCode as
+ *        volts = voltsPerCount * counts + offsetVolts
+ */
+AIORET_TYPE AIOHostCalSetLinear( AIOHostCal *cal, unsigned channel, unsigned gainCode, double voltsPerCount, double offsetVolts )
+{
+    AIO_ASSERT_RET( AIOUSB_ERROR_INVALID_PARAMETER, cal );
+    struct aio_host_cal_entry *entry = _aio_host_cal_entry( cal, channel, gainCode );
+    if ( !entry )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+
+    entry->kind = AIO_HOST_CAL_LINEAR;
+    entry->scale = voltsPerCount;
+    entry->offset = offsetVolts;
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Calibrates channel at gainCode with a table giving the volts
+ *        for each of the 65536 counts
+ * @param words must be AIO_HOST_CAL_TABLE_WORDS
+ */
+AIORET_TYPE AIOHostCalSetTable( AIOHostCal *cal, unsigned channel, unsigned gainCode, const double *volts, unsigned long words )
+{
+    AIO_ASSERT_RET( AIOUSB_ERROR_INVALID_PARAMETER, cal );
+    AIO_ASSERT_RET( AIOUSB_ERROR_INVALID_PARAMETER, volts );
+    struct aio_host_cal_entry *entry = _aio_host_cal_entry( cal, channel, gainCode );
+    if ( !entry || words != AIO_HOST_CAL_TABLE_WORDS )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+
+    if ( !entry->table ) {
+        entry->table = (float *)malloc( AIO_HOST_CAL_TABLE_WORDS * sizeof(float) );
+        if ( !entry->table )
+            return -AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+    }
+    for ( unsigned long index = 0; index < words; index ++ )
+        entry->table[ index ] = (float)volts[ index ];
+    entry->kind = AIO_HOST_CAL_TABLE;
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Puts channel at gainCode back to the nominal scaling
+ */
+AIORET_TYPE AIOHostCalClear( AIOHostCal *cal, unsigned channel, unsigned gainCode )
+{
+    AIO_ASSERT_RET( AIOUSB_ERROR_INVALID_PARAMETER, cal );
+    struct aio_host_cal_entry *entry = _aio_host_cal_entry( cal, channel, gainCode );
+    if ( !entry )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+
+    entry->kind = AIO_HOST_CAL_NOMINAL;
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Works out how each of numChannels channels from startChannel
+ *        converts under the gain codes in config
+ * @param cal the calibration, or NULL for nominal scaling throughout
+ * @param channels filled with one entry per channel
+ * @return AIOUSB_SUCCESS or a negated error
+ */
+AIORET_TYPE AIOHostCalResolve( AIOHostCal *cal, const ADCConfigBlock *config, unsigned startChannel, unsigned numChannels, AIOHostCalChannel *channels )
+{
+    AIO_ASSERT_RET( AIOUSB_ERROR_INVALID_PARAMETER, config );
+    AIO_ASSERT_RET( AIOUSB_ERROR_INVALID_PARAMETER, channels );
+
+    for ( unsigned channel = 0; channel < numChannels; channel ++ ) {
+        AIORET_TYPE gainCode = ADCConfigBlockGetGainCode( config, startChannel + channel );
+        if ( gainCode < AIOUSB_SUCCESS || gainCode >= AD_NUM_GAIN_CODES )
+            return -AIOUSB_ERROR_INVALID_GAINCODE;
+
+        const struct ADRange *range = &adRanges[ gainCode ];
+        struct aio_host_cal_entry *entry = cal ? _aio_host_cal_entry( cal, startChannel + channel, (unsigned)gainCode ) : NULL;
+
+        channels[ channel ].table = NULL;
+        channels[ channel ].scale = range->range / ( double )AI_16_MAX_COUNTS;
+        channels[ channel ].offset = range->minVolts;
+        if ( entry && entry->kind == AIO_HOST_CAL_TABLE ) {
+            channels[ channel ].table = entry->table;
+        } else if ( entry && entry->kind == AIO_HOST_CAL_LINEAR ) {
+            channels[ channel ].scale = entry->scale;
+            channels[ channel ].offset = entry->offset;
+        }
+    }
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Converts numScans whole scans of averaged counts, laid out one
+ *        channel after another as they come off the board
+ *
+ * Goes a channel at a time so that each inner loop is one kind of work
+ * over one table or one pair of coefficients: table channels are plain
+ * indexed loads, and the linear ones a strided multiply-add the compiler
+ * is free to vectorize.
+ */
+AIORET_TYPE AIOHostCalConvertScans( const AIOHostCalChannel *channels, unsigned numChannels, const unsigned short *counts, double *volts, unsigned numScans )
+{
+    AIO_ASSERT_RET( AIOUSB_ERROR_INVALID_PARAMETER, channels );
+    AIO_ASSERT_RET( AIOUSB_ERROR_INVALID_PARAMETER, counts );
+    AIO_ASSERT_RET( AIOUSB_ERROR_INVALID_PARAMETER, volts );
+
+    for ( unsigned channel = 0; channel < numChannels; channel ++ ) {
+        const unsigned short *in = counts + channel;
+        double *out = volts + channel;
+        const float *table = channels[ channel ].table;
+
+        if ( table ) {
+            for ( unsigned scan = 0; scan < numScans; scan ++ )
+                out[ scan * numChannels ] = table[ in[ scan * numChannels ] ];
+        } else {
+            const double scale = channels[ channel ].scale;
+            const double offset = channels[ channel ].offset;
+            for ( unsigned scan = 0; scan < numScans; scan ++ )
+                out[ scan * numChannels ] = scale * in[ scan * numChannels ] + offset;
+        }
+    }
+    return (AIORET_TYPE)numScans * numChannels;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+/*****************************************************************************
+ * Self-test
+ ****************************************************************************/
+
+#ifdef SELF_TEST
+
+#include "gtest/gtest.h"
+
+using namespace AIOUSB;
+
+TEST(AIOHostCal,UncalibratedChannelsAreNominal)
+{
+    ADCConfigBlock config;
+    AIOHostCalChannel channels[4];
+    ADCConfigBlockInitializeDefault( &config );
+    ADCConfigBlockSetGainCode( &config, 1, AD_GAIN_CODE_0_5V );
+
+    AIOHostCal *cal = NewAIOHostCal( 16 );
+    ASSERT_TRUE( cal );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOHostCalResolve( cal, &config, 0, 4, channels ) );
+    EXPECT_FALSE( channels[1].table );
+    EXPECT_DOUBLE_EQ( adRanges[ AD_GAIN_CODE_0_5V ].minVolts, AIOHostCalChannelToVolts( &channels[1], 0 ) );
+    EXPECT_DOUBLE_EQ( adRanges[ AD_GAIN_CODE_0_5V ].minVolts + adRanges[ AD_GAIN_CODE_0_5V ].range,
+                      AIOHostCalChannelToVolts( &channels[1], AI_16_MAX_COUNTS ) );
+
+    EXPECT_FALSE( NewAIOHostCal( 0 ) );
+    EXPECT_EQ( -AIOUSB_ERROR_INVALID_PARAMETER, aio_errno );
+    EXPECT_EQ( -AIOUSB_ERROR_INVALID_PARAMETER, AIOHostCalSetLinear( cal, 16, 0, 1.0, 0.0 ) );
+    EXPECT_EQ( -AIOUSB_ERROR_INVALID_PARAMETER, AIOHostCalSetLinear( cal, 0, AD_NUM_GAIN_CODES, 1.0, 0.0 ) );
+    DeleteAIOHostCal( cal );
+}
+
+TEST(AIOHostCal,EntriesFollowTheChannelsGainCode)
+{
+    static double volts[ AIO_HOST_CAL_TABLE_WORDS ];
+    ADCConfigBlock config;
+    AIOHostCalChannel channels[3];
+    ADCConfigBlockInitializeDefault( &config );
+    for ( unsigned i = 0; i < 3; i ++ )
+        ADCConfigBlockSetGainCode( &config, i, AD_GAIN_CODE_10V );
+    for ( unsigned long i = 0; i < AIO_HOST_CAL_TABLE_WORDS; i ++ )
+        volts[i] = i * 0.001;
+
+    AIOHostCal *cal = NewAIOHostCal( 16 );
+    ASSERT_TRUE( cal );
+    EXPECT_EQ( -AIOUSB_ERROR_INVALID_PARAMETER, AIOHostCalSetTable( cal, 1, AD_GAIN_CODE_10V, volts, 1000 ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOHostCalSetLinear( cal, 0, AD_GAIN_CODE_10V, 2.0, -1.0 ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOHostCalSetTable( cal, 1, AD_GAIN_CODE_10V, volts, AIO_HOST_CAL_TABLE_WORDS ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOHostCalSetLinear( cal, 2, AD_GAIN_CODE_5V, 2.0, -1.0 ) );
+
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOHostCalResolve( cal, &config, 0, 3, channels ) );
+    EXPECT_DOUBLE_EQ( 19.0, AIOHostCalChannelToVolts( &channels[0], 10 ) );
+    ASSERT_TRUE( channels[1].table );
+    EXPECT_FLOAT_EQ( 12.345, AIOHostCalChannelToVolts( &channels[1], 12345 ) );
+    EXPECT_DOUBLE_EQ( -10.0, AIOHostCalChannelToVolts( &channels[2], 0 ) ) << "calibrated at another gain only";
+
+    /* setting a table again reuses it, so what was resolved stays good */
+    const float *table = channels[1].table;
+    for ( unsigned long i = 0; i < AIO_HOST_CAL_TABLE_WORDS; i ++ )
+        volts[i] = -( i * 0.001 );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOHostCalSetTable( cal, 1, AD_GAIN_CODE_10V, volts, AIO_HOST_CAL_TABLE_WORDS ) );
+    EXPECT_FLOAT_EQ( -12.345, AIOHostCalChannelToVolts( &channels[1], 12345 ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOHostCalClear( cal, 1, AD_GAIN_CODE_10V ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOHostCalResolve( cal, &config, 0, 3, channels ) );
+    EXPECT_FALSE( channels[1].table );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOHostCalSetTable( cal, 1, AD_GAIN_CODE_10V, volts, AIO_HOST_CAL_TABLE_WORDS ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOHostCalResolve( cal, &config, 0, 3, channels ) );
+    EXPECT_EQ( table, channels[1].table );
+    DeleteAIOHostCal( cal );
+}
+
+TEST(AIOHostCal,ConvertScansMatchesOneAtATime)
+{
+    static double volts[ AIO_HOST_CAL_TABLE_WORDS ];
+    const unsigned numChannels = 4, numScans = 257;
+    ADCConfigBlock config;
+    AIOHostCalChannel channels[ numChannels ];
+    unsigned short counts[ numChannels * numScans ];
+    double out[ numChannels * numScans ];
+    ADCConfigBlockInitializeDefault( &config );
+    for ( unsigned long i = 0; i < AIO_HOST_CAL_TABLE_WORDS; i ++ )
+        volts[i] = 5.0 - i / 4096.0;
+
+    AIOHostCal *cal = NewAIOHostCal( 16 );
+    ASSERT_TRUE( cal );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOHostCalSetTable( cal, 2, ADCConfigBlockGetGainCode( &config, 2 ), volts, AIO_HOST_CAL_TABLE_WORDS ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOHostCalSetLinear( cal, 3, ADCConfigBlockGetGainCode( &config, 3 ), 0.5, 0.25 ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOHostCalResolve( cal, &config, 0, numChannels, channels ) );
+
+    for ( unsigned i = 0; i < numChannels * numScans; i ++ )
+        counts[i] = (unsigned short)( i * 251 );
+    EXPECT_EQ( numChannels * numScans, AIOHostCalConvertScans( channels, numChannels, counts, out, numScans ) );
+    for ( unsigned i = 0; i < numChannels * numScans; i ++ )
+        ASSERT_DOUBLE_EQ( AIOHostCalChannelToVolts( &channels[ i % numChannels ], counts[i] ), out[i] ) << "at " << i;
+    DeleteAIOHostCal( cal );
+}
+
+int main(int argc, char *argv[] )
+{
+    testing::InitGoogleTest(&argc, argv);
+    testing::TestEventListeners & listeners = testing::UnitTest::GetInstance()->listeners();
+#ifdef GTEST_TAP_PRINT_TO_STDOUT
+    delete listeners.Release(listeners.default_result_printer());
+#endif
+
+    return RUN_ALL_TESTS();
+}
+
+#endif
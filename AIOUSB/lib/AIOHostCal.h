@@ -0,0 +1,68 @@
+/**
+ * @file   AIOHostCal.h
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  Host-side A/D calibration applied while converting counts to volts
+ *
+ */
+
+#ifndef _AIO_HOST_CAL_H
+#define _AIO_HOST_CAL_H
+
+#include "AIOTypes.h"
+#include "ADCConfigBlock.h"
+
+#ifdef __aiousb_cplusplus
+namespace AIOUSB
+{
+#endif
+
+#define AIO_HOST_CAL_TABLE_WORDS 65536
+
+/**
+ * @brief How one channel of a scan turns averaged counts into volts:
+ * through table when it is set, otherwise as scale * counts + offset.
+ * Converters resolve an array of these, one per scanned channel, once
+ * for a given configuration so the per-sample work is a single lookup
+ * or multiply-add.
+ */
+typedef struct AIOHostCalChannel {
+    const float *table;                 /**< AIO_HOST_CAL_TABLE_WORDS volts, or NULL */
+    double scale;                       /**< volts per count */
+    double offset;                      /**< volts at 0 counts */
+} AIOHostCalChannel;
+
+struct aio_host_cal_entry;
+
+/**
+ * @brief Calibration for each channel and gain code of a board, kept on
+ * the host so that it works on boards without calibration SRAM. An entry
+ * is either linear or a full 64K table; channels and gains without one
+ * convert with the nominal adRanges scaling.
+ */
+typedef struct AIOHostCal {
+    unsigned numChannels;
+    struct aio_host_cal_entry *entries; /**< numChannels * AD_NUM_GAIN_CODES, channel-major */
+} AIOHostCal;
+
+/* BEGIN AIOUSB_API */
+PUBLIC_EXTERN AIOHostCal *NewAIOHostCal( unsigned numChannels );
+PUBLIC_EXTERN AIORET_TYPE DeleteAIOHostCal( AIOHostCal *cal );
+PUBLIC_EXTERN AIORET_TYPE AIOHostCalSetLinear( AIOHostCal *cal, unsigned channel, unsigned gainCode, double voltsPerCount, double offsetVolts );
+PUBLIC_EXTERN AIORET_TYPE AIOHostCalSetTable( AIOHostCal *cal, unsigned channel, unsigned gainCode, const double *volts, unsigned long words );
+PUBLIC_EXTERN AIORET_TYPE AIOHostCalClear( AIOHostCal *cal, unsigned channel, unsigned gainCode );
+PUBLIC_EXTERN AIORET_TYPE AIOHostCalResolve( AIOHostCal *cal, const ADCConfigBlock *config, unsigned startChannel, unsigned numChannels, AIOHostCalChannel *channels );
+PUBLIC_EXTERN AIORET_TYPE AIOHostCalConvertScans( const AIOHostCalChannel *channels, unsigned numChannels, const unsigned short *counts, double *volts, unsigned numScans );
+/* END AIOUSB_API */
+
+static inline double AIOHostCalChannelToVolts( const AIOHostCalChannel *channel, unsigned counts )
+{
+    return channel->table ? (double)channel->table[ counts & 0xffff ] : channel->scale * counts + channel->offset;
+}
+
+#ifdef __aiousb_cplusplus
+}
+#endif
+
+#endif
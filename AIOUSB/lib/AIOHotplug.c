@@ -0,0 +1,315 @@
+/**
+ * @file   AIOHotplug.c
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  Keeps the device table in step with boards coming and going
+ *
+ * AIOUSB_Init() enumerates the bus once. With hotplug enabled, a thread
+ * runs libusb's event loop and feeds arrivals and removals of ACCES
+ * boards to AIODeviceTableAttachUSBDevice() and
+ * AIODeviceTableDetachUSBDevice(), which touch only the entry of the
+ * board concerned. A board that browns out and re-enumerates gets its
+ * old device index back (matched by serial number), and acquisitions
+ * running on every other board carry on undisturbed.
+ *
+ * libusb doesn't allow synchronous transfers from inside a hotplug
+ * callback, so the callback only queues the event; the table is updated
+ * and the user callback is called from the hotplug thread once libusb
+ * returns.
+ */
+
+#include "AIOHotplug.h"
+#include "AIODeviceTable.h"
+#include "USBDevice.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#ifdef __cplusplus
+namespace AIOUSB {
+#endif
+
+#define HOTPLUG_POLL_USEC 100000
+
+typedef struct aio_hotplug_event {
+    libusb_device *dev;
+    libusb_hotplug_event event;
+} AIOHotplugQueuedEvent;
+
+static struct {
+    AIOUSB_BOOL enabled;
+    volatile AIOUSB_BOOL quit;
+    pthread_t thread;
+    libusb_hotplug_callback_handle handle;
+    AIOHotplugCallback callback;
+    void *userdata;
+    pthread_mutex_t lock;               /**< guards the queue */
+    AIOHotplugQueuedEvent *queue;
+    int queued;
+    int queueSize;
+} hotplug = { AIOUSB_FALSE, AIOUSB_FALSE, 0, 0, NULL, NULL, PTHREAD_MUTEX_INITIALIZER, NULL, 0, 0 };
+
+/*----------------------------------------------------------------------------*/
+static int _hotplug_queue_event( libusb_context *ctx, libusb_device *dev, libusb_hotplug_event event, void *userdata )
+{
+    (void)ctx;
+    (void)userdata;
+    pthread_mutex_lock( &hotplug.lock );
+    if ( hotplug.queued == hotplug.queueSize ) {
+        int size = hotplug.queueSize ? hotplug.queueSize * 2 : 8;
+        AIOHotplugQueuedEvent *queue = (AIOHotplugQueuedEvent *)realloc( hotplug.queue, size * sizeof(AIOHotplugQueuedEvent) );
+        if ( !queue ) {
+            pthread_mutex_unlock( &hotplug.lock );
+            return 0;
+        }
+        hotplug.queue = queue;
+        hotplug.queueSize = size;
+    }
+    hotplug.queue[hotplug.queued].dev = libusb_ref_device( dev );
+    hotplug.queue[hotplug.queued].event = event;
+    hotplug.queued ++;
+    pthread_mutex_unlock( &hotplug.lock );
+    return 0;                   /* stay registered */
+}
+
+/*----------------------------------------------------------------------------*/
+static void _hotplug_arrived( libusb_device *dev )
+{
+    struct libusb_device_descriptor desc;
+    AIOUSB_BOOL reattached;
+    AIORET_TYPE index;
+
+    if ( libusb_get_device_descriptor( dev, &desc ) != LIBUSB_SUCCESS )
+        return;
+    if ( desc.idVendor != ACCES_VENDOR_ID || !VALID_ENUM( ProductIDS, desc.idProduct ) )
+        return;
+
+    USBDevice *usb = (USBDevice *)calloc( 1, sizeof(USBDevice) );
+    if ( !usb )
+        return;
+    LIBUSBArgs args = { libusb_ref_device( dev ), NULL, &desc };
+    AIOEither usbretval = InitializeUSBDevice( usb, &args );
+    if ( AIOEitherHasError( &usbretval ) ) {
+        libusb_unref_device( dev );
+        free( usb );
+        return;
+    }
+
+    index = AIODeviceTableAttachUSBDevice( usb, &reattached );
+    if ( index < AIOUSB_SUCCESS ) {
+        USBDeviceClose( usb );
+        DeleteUSBDevice( usb );
+        return;
+    }
+    if ( hotplug.callback )
+        hotplug.callback( (unsigned long)index, reattached ? AIO_HOTPLUG_REATTACHED : AIO_HOTPLUG_ARRIVED, hotplug.userdata );
+}
+
+/*----------------------------------------------------------------------------*/
+static void _hotplug_left( libusb_device *dev )
+{
+    AIORET_TYPE index = AIODeviceTableDetachUSBDevice( dev );
+    if ( index >= AIOUSB_SUCCESS && hotplug.callback )
+        hotplug.callback( (unsigned long)index, AIO_HOTPLUG_LEFT, hotplug.userdata );
+}
+
+/*----------------------------------------------------------------------------*/
+static void *HotplugThread( void *arg )
+{
+    (void)arg;
+    while ( !hotplug.quit ) {
+        struct timeval tv = { 0, HOTPLUG_POLL_USEC };
+        libusb_handle_events_timeout_completed( NULL, &tv, NULL );
+
+        for ( ;; ) {
+            AIOHotplugQueuedEvent next;
+            pthread_mutex_lock( &hotplug.lock );
+            if ( hotplug.queued == 0 ) {
+                pthread_mutex_unlock( &hotplug.lock );
+                break;
+            }
+            next = hotplug.queue[0];
+            memmove( &hotplug.queue[0], &hotplug.queue[1], --hotplug.queued * sizeof(AIOHotplugQueuedEvent) );
+            pthread_mutex_unlock( &hotplug.lock );
+
+            if ( next.event == LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED )
+                _hotplug_arrived( next.dev );
+            else
+                _hotplug_left( next.dev );
+            libusb_unref_device( next.dev );
+        }
+    }
+    return NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Starts tracking boards plugged in or removed after AIOUSB_Init()
+ * @param callback called from the hotplug thread after the device table
+ *        has been updated, may be NULL
+ * @param userdata passed to callback
+ * @return AIOUSB_SUCCESS, or < 0 if libusb lacks hotplug support
+ */
+AIORET_TYPE AIOUSB_EnableHotplug( AIOHotplugCallback callback, void *userdata )
+{
+    int libusbResult;
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_NOT_INIT, AIOUSB_IsInit() );
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_OPEN_FAILED, !hotplug.enabled );
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_NOT_SUPPORTED, libusb_has_capability( LIBUSB_CAP_HAS_HOTPLUG ) );
+
+    hotplug.callback = callback;
+    hotplug.userdata = userdata;
+    hotplug.quit = AIOUSB_FALSE;
+
+    libusbResult = libusb_hotplug_register_callback( NULL,
+                                                     (libusb_hotplug_event)( LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED | LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT ),
+                                                     LIBUSB_HOTPLUG_NO_FLAGS,
+                                                     ACCES_VENDOR_ID,
+                                                     LIBUSB_HOTPLUG_MATCH_ANY,
+                                                     LIBUSB_HOTPLUG_MATCH_ANY,
+                                                     _hotplug_queue_event,
+                                                     NULL,
+                                                     &hotplug.handle
+                                                     );
+    if ( libusbResult != LIBUSB_SUCCESS )
+        return -(AIORET_TYPE)LIBUSB_RESULT_TO_AIOUSB_RESULT( libusbResult );
+
+    if ( pthread_create( &hotplug.thread, NULL, HotplugThread, NULL ) != 0 ) {
+        libusb_hotplug_deregister_callback( NULL, hotplug.handle );
+        return -AIOUSB_ERROR_INVALID_THREAD;
+    }
+    hotplug.enabled = AIOUSB_TRUE;
+
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Stops the hotplug thread; the table keeps whatever it holds now
+ */
+AIORET_TYPE AIOUSB_DisableHotplug(void)
+{
+    if ( !hotplug.enabled )
+        return AIOUSB_SUCCESS;
+
+    libusb_hotplug_deregister_callback( NULL, hotplug.handle );
+    hotplug.quit = AIOUSB_TRUE;
+    pthread_join( hotplug.thread, NULL );
+    hotplug.enabled = AIOUSB_FALSE;
+
+    pthread_mutex_lock( &hotplug.lock );
+    for ( int i = 0; i < hotplug.queued; i ++ )
+        libusb_unref_device( hotplug.queue[i].dev );
+    hotplug.queued = 0;
+    pthread_mutex_unlock( &hotplug.lock );
+
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+AIOUSB_BOOL AIOUSB_HotplugEnabled(void)
+{
+    return hotplug.enabled;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+/*****************************************************************************
+ * Self-test 
+ * @note This section is for stress testing the code in the library
+ ****************************************************************************/ 
+
+#ifdef SELF_TEST
+
+#include "AIOUSBDevice.h"
+#include "AIOUSB_Properties.h"
+#include "gtest/gtest.h"
+
+using namespace AIOUSB;
+
+static uint64_t fake_serials[3] = { 0x1111, 0x2222, 0x3333 };
+static int fake_serial_transfer( USBDevice *usb, uint8_t request_type, uint8_t bRequest, uint16_t wValue, uint16_t wIndex, unsigned char *data, uint16_t wLength, unsigned int timeout )
+{
+    if ( bRequest != AUR_EEPROM_READ || wValue != EEPROM_SERIAL_NUMBER_ADDRESS )
+        return LIBUSB_ERROR_IO;
+    memcpy( data, &fake_serials[ (intptr_t)usb->device - 1 ], sizeof(uint64_t) );
+    return wLength;
+}
+
+static USBDevice *fake_usb( int board, unsigned productID )
+{
+    USBDevice *usb = (USBDevice *)calloc( 1, sizeof(USBDevice) );
+    usb->device = (libusb_device *)(intptr_t)board;
+    usb->deviceDesc.idProduct = productID;
+    usb->usb_control_transfer = fake_serial_transfer;
+    return usb;
+}
+
+TEST(Hotplug, ReattachKeepsIndex )
+{
+    AIOUSB_BOOL reattached;
+    AIORESULT result;
+
+    AIODeviceTableInit();
+    EXPECT_EQ( 0, AIODeviceTableAttachUSBDevice( fake_usb( 1, USB_AI16_16E ), &reattached ) );
+    EXPECT_FALSE( reattached );
+    EXPECT_EQ( 1, AIODeviceTableAttachUSBDevice( fake_usb( 2, USB_DIO_32 ), &reattached ) );
+    EXPECT_EQ( 2, AIODeviceTableAttachUSBDevice( fake_usb( 3, USB_AI16_16E ), &reattached ) );
+
+    AIOUSBDevice *other = AIODeviceTableGetDeviceAtIndex( 2, &result );
+    ASSERT_TRUE( other );
+
+    /* board 1 browns out */
+    EXPECT_EQ( 0, AIODeviceTableDetachUSBDevice( (libusb_device *)1 ) );
+    EXPECT_EQ( -AIOUSB_ERROR_DEVICE_NOT_FOUND, AIODeviceTableDetachUSBDevice( (libusb_device *)1 ) );
+    EXPECT_FALSE( AIODeviceTableGetDeviceAtIndex( 0, &result ) );
+    EXPECT_EQ( diNone, GetDeviceBySerialNumber( 0x1111 ) );
+    EXPECT_EQ( other, AIODeviceTableGetDeviceAtIndex( 2, &result ) ) << "Other boards are untouched";
+
+    /* an unknown board doesn't take the reserved index */
+    fake_serials[0] = 0x4444;
+    EXPECT_EQ( 3, AIODeviceTableAttachUSBDevice( fake_usb( 1, USB_AI16_16E ), &reattached ) );
+    EXPECT_FALSE( reattached );
+
+    /* the original board comes back; the stale fake handle must not reach libusb_unref_device() */
+    _get_device_no_error( 0 )->usb_device->device = NULL;
+    fake_serials[0] = 0x1111;
+    EXPECT_EQ( 0, AIODeviceTableAttachUSBDevice( fake_usb( 1, USB_AI16_16E ), &reattached ) );
+    EXPECT_TRUE( reattached );
+    AIOUSBDevice *dev = AIODeviceTableGetDeviceAtIndex( 0, &result );
+    ASSERT_TRUE( dev );
+    EXPECT_EQ( USB_AI16_16E, dev->ProductID );
+    EXPECT_EQ( 0, GetDeviceBySerialNumber( 0x1111 ) );
+    EXPECT_EQ( 0, dev->deviceConfigBlock.size ) << "Register image is re-read after a brownout";
+    EXPECT_EQ( 1u, dev->numRetiredUsbDevices ) << "The stale handle stays allocated until the slot is cleared";
+
+    for ( int i = 0; i < 4; i ++ ) {
+        dev = AIODeviceTableGetDeviceAtIndex( i, &result );
+        free( dev->usb_device );
+        dev->usb_device = NULL;
+    }
+    ClearAIODeviceTable( 4 );
+}
+
+TEST(Hotplug, DisableWithoutEnable )
+{
+    EXPECT_EQ( AIOUSB_SUCCESS, AIOUSB_DisableHotplug() );
+    EXPECT_FALSE( AIOUSB_HotplugEnabled() );
+}
+
+int main(int argc, char *argv[] )
+{
+    testing::InitGoogleTest(&argc, argv);
+    testing::TestEventListeners & listeners = testing::UnitTest::GetInstance()->listeners();
+#ifdef GTEST_TAP_PRINT_TO_STDOUT
+    delete listeners.Release(listeners.default_result_printer());
+#endif
+
+    return RUN_ALL_TESTS();  
+}
+
+#endif
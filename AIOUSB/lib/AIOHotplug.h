@@ -0,0 +1,38 @@
+/**
+ * @file   AIOHotplug.h
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  Keeps the device table in step with boards coming and going
+ *
+ */
+
+#ifndef _AIO_HOTPLUG_H
+#define _AIO_HOTPLUG_H
+
+#include "AIOTypes.h"
+
+#ifdef __aiousb_cplusplus
+namespace AIOUSB
+{
+#endif
+
+/* BEGIN AIOUSB_API */
+typedef enum {
+    AIO_HOTPLUG_ARRIVED     = 1, /**< a board not seen before took a new index */
+    AIO_HOTPLUG_REATTACHED  = 2, /**< a detached board came back at its old index */
+    AIO_HOTPLUG_LEFT        = 3  /**< a board left the bus, its index stays reserved */
+} AIOHotplugEvent;
+
+typedef void (*AIOHotplugCallback)( unsigned long DeviceIndex, AIOHotplugEvent event, void *userdata );
+
+PUBLIC_EXTERN AIORET_TYPE AIOUSB_EnableHotplug( AIOHotplugCallback callback, void *userdata );
+PUBLIC_EXTERN AIORET_TYPE AIOUSB_DisableHotplug(void);
+PUBLIC_EXTERN AIOUSB_BOOL AIOUSB_HotplugEnabled(void);
+/* END AIOUSB_API */
+
+#ifdef __aiousb_cplusplus
+}
+#endif
+
+#endif
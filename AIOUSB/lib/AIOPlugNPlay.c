@@ -1,5 +1,6 @@
 #include "AIOPlugNPlay.h"
 #include "AIODeviceTable.h"
+#include "AIOPropertyCache.h"
 #include <stdio.h>
 
 #ifdef __cplusplus
@@ -23,7 +24,8 @@ AIOUSB_BOOL DeviceHasPNPByte(const AIOPlugNPlay *pnpentry )
 
 AIORET_TYPE CheckPNPData( unsigned long DeviceIndex )
 {
-    AIOUSBDevice *deviceDesc = &deviceTable[DeviceIndex];
+    AIOUSBDevice *deviceDesc = _get_device_no_error( DeviceIndex );
+    AIO_ERROR_VALID_DATA_RETVAL( AIOUSB_ERROR_INVALID_INDEX, deviceDesc );
     USBDevice *usb = AIOUSBDeviceGetUSBHandle( deviceDesc );
     AIORET_TYPE retval = AIOUSB_SUCCESS;
     AIO_ERROR_VALID_DATA_RETVAL( AIOUSB_ERROR_INVALID_USBDEVICE , usb );
@@ -31,6 +33,7 @@ AIORET_TYPE CheckPNPData( unsigned long DeviceIndex )
     deviceDesc->PNPData.PNPSize = 0;
     
     retval = AIOUSB_CheckFirmware20( DeviceIndex );
+    deviceDesc->PNPProbed = AIOUSB_TRUE;
     AIO_ERROR_VALID_DATA_RETVAL( AIOUSB_ERROR_INVALID_DATA,  retval == AIOUSB_SUCCESS );
 
     deviceDesc->PNPData.PNPSize = sizeof(AIOPlugNPlay);
@@ -46,6 +49,33 @@ AIORET_TYPE CheckPNPData( unsigned long DeviceIndex )
     return retval;
 }
 
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Makes sure bFirmware20 and PNPData are filled in, taking them from
+ * the property cache if it holds the board, otherwise reading them from
+ * the board. Enumeration no longer reads them, so anything that looks at
+ * either field should call this first.
+ * @param DeviceIndex 
+ * @return AIOUSB_SUCCESS if the board has plug-and-play data
+ */
+AIORET_TYPE EnsurePNPData( unsigned long DeviceIndex )
+{
+    AIOUSBDevice *deviceDesc = _get_device_no_error( DeviceIndex );
+    AIO_ERROR_VALID_DATA_RETVAL( AIOUSB_ERROR_INVALID_INDEX, deviceDesc );
+    AIORET_TYPE retval;
+
+    if ( !deviceDesc->PNPProbed )
+        AIOPropertyCacheApply( DeviceIndex );
+    if ( deviceDesc->PNPProbed )
+        return deviceDesc->PNPData.PNPSize ? AIOUSB_SUCCESS : -AIOUSB_ERROR_INVALID_DATA;
+
+    retval = CheckPNPData( DeviceIndex );
+    if ( retval == AIOUSB_SUCCESS ) /* don't let a failed transfer outlive this run */
+        AIOPropertyCacheStore( DeviceIndex );
+
+    return retval;
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -33,6 +33,7 @@ struct __attribute__((__packed__)) AIOPlugNPlay {
 
 AIOUSB_BOOL DeviceHasPNPByte(const AIOPlugNPlay *pnpentry );
 AIORET_TYPE CheckPNPData( unsigned long DeviceIndex );
+AIORET_TYPE EnsurePNPData( unsigned long DeviceIndex );
 
 
 #ifdef __aiousb_cplusplus
@@ -0,0 +1,807 @@
+/**
+ * @file   AIOPollScheduler.c
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  Concurrent, rate-grouped polling of many boards into one snapshot
+ *
+ * Monitoring a rack of boards meant one loop calling DIO_ReadAll(),
+ * CTR_8254ReadAll() and ADC_GetScanV() on each board in turn, so a
+ * cycle took the sum of every transfer on every board. Transfers on
+ * different boards don't wait on each other, so AIOPollScheduler gives
+ * each board its own thread and only waits for the slowest.
+ */
+
+#include "AIOPollScheduler.h"
+#include "AIOUSB_ADC.h"
+#include "AIOUSB_CTR.h"
+#include "AIOUSB_DIO.h"
+#include "AIODeviceTable.h"
+#include "AIOUSB_Core.h"
+#include "AIOTime.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __cplusplus
+namespace AIOUSB {
+#endif
+
+/**
+ * @brief The thread that runs every operation on one board
+ */
+struct aio_poll_worker {
+    AIOPollScheduler *sched;
+    unsigned long DeviceIndex;
+    unsigned numOperations;
+    unsigned *operations;               /**< indexes into sched->operations */
+    uint64_t generation;                /**< last generation this worker ran */
+    pthread_t thread;
+    AIOUSB_BOOL created;
+};
+
+/*----------------------------------------------------------------------------*/
+static AIOUSB_BOOL _aio_poll_due( const AIOPollOperation *op, uint64_t cycle )
+{
+    return op->every <= 1 || cycle % op->every == 0 ? AIOUSB_TRUE : AIOUSB_FALSE;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief How many bytes one run of op reads, or 0 with *result set if the
+ * board can't do it
+ */
+static size_t _aio_poll_size( const AIOPollOperation *op, AIORESULT *result )
+{
+    AIOUSBDevice *deviceDesc = AIODeviceTableGetDeviceAtIndex( op->DeviceIndex, result );
+    if ( *result != AIOUSB_SUCCESS )
+        return 0;
+
+    switch ( op->kind ) {
+    case AIO_POLL_DIO_READ_ALL:
+        if ( deviceDesc->DIOBytes )
+            return deviceDesc->DIOBytes;
+        break;
+    case AIO_POLL_CTR_READ_ALL:
+        if ( deviceDesc->Counters )
+            return deviceDesc->Counters * COUNTERS_PER_BLOCK * sizeof(unsigned short);
+        break;
+    case AIO_POLL_ADC_SCAN_V:
+        if ( deviceDesc->bADCStream && deviceDesc->ADCMUXChannels )
+            return deviceDesc->ADCMUXChannels * sizeof(double);
+        break;
+    default:
+        *result = AIOUSB_ERROR_INVALID_PARAMETER;
+        return 0;
+    }
+    *result = AIOUSB_ERROR_NOT_SUPPORTED;
+    return 0;
+}
+
+/*----------------------------------------------------------------------------*/
+static AIORET_TYPE _aio_poll_read( const AIOPollOperation *op, void *data )
+{
+    AIORET_TYPE retval = AIOUSB_ERROR_INVALID_PARAMETER;
+
+    switch ( op->kind ) {
+    case AIO_POLL_DIO_READ_ALL:
+        retval = DIO_ReadAll( op->DeviceIndex, data );
+        break;
+    case AIO_POLL_CTR_READ_ALL:
+        retval = CTR_8254ReadAll( op->DeviceIndex, (unsigned short *)data );
+        break;
+    case AIO_POLL_ADC_SCAN_V:
+        retval = ADC_GetScanV( op->DeviceIndex, (double *)data );
+        break;
+    }
+
+    /* the readers report errors both as AIORESULT codes and negated */
+    return retval > AIOUSB_SUCCESS ? -retval : retval;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Waits for each generation and runs this board's due operations.
+ * The reads run without the lock; the working results they fill are left
+ * alone by everyone else until pending drops to 0.
+ */
+static void *_aio_poll_worker( void *arg )
+{
+    struct aio_poll_worker *worker = (struct aio_poll_worker *)arg;
+    AIOPollScheduler *sched = worker->sched;
+    unsigned index;
+
+    pthread_mutex_lock( &sched->lock );
+    for ( ;; ) {
+        while ( !sched->shutdown && sched->generation == worker->generation )
+            pthread_cond_wait( &sched->dispatch, &sched->lock );
+        if ( sched->shutdown )
+            break;
+        worker->generation = sched->generation;
+        uint64_t cycle = sched->cycle;
+        pthread_mutex_unlock( &sched->lock );
+
+        for ( index = 0; index < worker->numOperations; index ++ ) {
+            unsigned which = worker->operations[ index ];
+            AIOPollResult *res = &sched->working[ which ];
+            if ( !_aio_poll_due( &sched->operations[ which ], cycle ) )
+                continue;
+            res->result      = _aio_poll_read( &sched->operations[ which ], res->data );
+            res->cycle       = cycle;
+            res->timestampNs = AIOTimeNowNs();
+        }
+
+        pthread_mutex_lock( &sched->lock );
+        if ( --sched->pending == 0 )
+            pthread_cond_broadcast( &sched->done );
+    }
+    pthread_mutex_unlock( &sched->lock );
+
+    return NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+static void _aio_poll_copy_results( AIOPollResult *to, const AIOPollResult *from, unsigned numOperations )
+{
+    unsigned index;
+    for ( index = 0; index < numOperations; index ++ ) {
+        void *data = to[ index ].data;
+        to[ index ] = from[ index ];
+        to[ index ].data = data;
+        memcpy( data, from[ index ].data, from[ index ].size );
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+static void _aio_poll_free_results( AIOPollResult *results, unsigned numOperations )
+{
+    unsigned index;
+    if ( !results )
+        return;
+    for ( index = 0; index < numOperations; index ++ )
+        free( results[ index ].data );
+    free( results );
+}
+
+/*----------------------------------------------------------------------------*/
+static AIOPollResult *_aio_poll_new_results( const AIOPollResult *like, unsigned numOperations )
+{
+    unsigned index;
+    AIOPollResult *results = (AIOPollResult *)calloc( numOperations, sizeof(AIOPollResult) );
+    if ( !results )
+        return NULL;
+    for ( index = 0; index < numOperations; index ++ ) {
+        results[ index ].result = AIOUSB_SUCCESS;
+        results[ index ].size   = like[ index ].size;
+        results[ index ].data   = calloc( 1, like[ index ].size );
+        if ( !results[ index ].data ) {
+            _aio_poll_free_results( results, numOperations );
+            return NULL;
+        }
+    }
+    return results;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Dispatches one cycle to every worker, waits for all of them and
+ * publishes the result. Only one thread at a time runs this; the caller
+ * has set sched->cycling.
+ * @return the number of operations that failed this cycle
+ */
+static AIORET_TYPE _aio_poll_run_cycle( AIOPollScheduler *sched )
+{
+    AIORET_TYPE failed = 0;
+    unsigned index;
+    uint64_t start = AIOTimeNowNs();
+
+    pthread_mutex_lock( &sched->lock );
+    uint64_t cycle = sched->cycle;
+    sched->pending = sched->numWorkers;
+    sched->generation ++;
+    pthread_cond_broadcast( &sched->dispatch );
+    while ( sched->pending )
+        pthread_cond_wait( &sched->done, &sched->lock );
+    uint64_t end = AIOTimeNowNs();
+
+    for ( index = 0; index < sched->numOperations; index ++ ) {
+        if ( sched->working[ index ].cycle == cycle && sched->working[ index ].result < 0 )
+            failed ++;
+    }
+    _aio_poll_copy_results( sched->snapshot.results, sched->working, sched->numOperations );
+    sched->snapshot.cycle   = cycle;
+    sched->snapshot.startNs = start;
+    sched->snapshot.endNs   = end;
+    sched->cycle ++;
+    sched->cycles ++;
+    if ( end - start > sched->maxCycleNs )
+        sched->maxCycleNs = end - start;
+    pthread_cond_broadcast( &sched->published );
+    pthread_mutex_unlock( &sched->lock );
+
+    /* only the thread running cycles writes the snapshot, so it is stable here */
+    if ( sched->callback )
+        sched->callback( &sched->snapshot, sched->userdata );
+
+    return failed;
+}
+
+/*----------------------------------------------------------------------------*/
+static void *_aio_poll_pacer( void *arg )
+{
+    AIOPollScheduler *sched = (AIOPollScheduler *)arg;
+    uint64_t next = AIOTimeNowNs();
+
+    while ( !sched->quit ) {
+        struct timespec deadline;
+        _aio_poll_run_cycle( sched );
+
+        next += sched->periodNs;
+        uint64_t now = AIOTimeNowNs();
+        if ( now > next + sched->periodNs ) {
+            uint64_t missed = ( now - next ) / sched->periodNs;
+            next += missed * sched->periodNs;
+            pthread_mutex_lock( &sched->lock );
+            sched->missedCycles += missed;
+            pthread_mutex_unlock( &sched->lock );
+        }
+
+        AIOTimeToTimespec( &deadline, next );
+        while ( !sched->quit && clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL ) == EINTR )
+            ;
+    }
+
+    return NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Checks every operation against its board and starts one worker
+ * thread per board
+ * @param operations what to read, on which board and how often
+ * @param numOperations
+ * @return the new scheduler, or NULL with aio_errno set;
+ * AIOUSB_ERROR_NOT_SUPPORTED if a board lacks what an operation reads
+ */
+AIOPollScheduler *NewAIOPollScheduler( const AIOPollOperation *operations, unsigned numOperations )
+{
+    AIORESULT result = AIOUSB_SUCCESS;
+    AIOPollScheduler *sched = NULL;
+    pthread_condattr_t attr;
+    unsigned index, worker;
+
+    if ( !operations || numOperations == 0 ) {
+        result = AIOUSB_ERROR_INVALID_PARAMETER;
+        goto err_NewAIOPollScheduler;
+    }
+
+    sched = (AIOPollScheduler *)calloc( 1, sizeof(AIOPollScheduler) );
+    if ( !sched ) {
+        result = AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+        goto err_NewAIOPollScheduler;
+    }
+    sched->numOperations = numOperations;
+    sched->operations = (AIOPollOperation *)malloc( numOperations * sizeof(AIOPollOperation) );
+    sched->working    = (AIOPollResult *)calloc( numOperations, sizeof(AIOPollResult) );
+    sched->workers    = (struct aio_poll_worker *)calloc( numOperations, sizeof(struct aio_poll_worker) );
+    if ( !sched->operations || !sched->working || !sched->workers ) {
+        result = AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+        goto err_NewAIOPollScheduler;
+    }
+    memcpy( sched->operations, operations, numOperations * sizeof(AIOPollOperation) );
+
+    for ( index = 0; index < numOperations; index ++ ) {
+        sched->working[ index ].size = _aio_poll_size( &operations[ index ], &result );
+        if ( result != AIOUSB_SUCCESS )
+            goto err_NewAIOPollScheduler;
+        sched->working[ index ].result = AIOUSB_SUCCESS;
+        sched->working[ index ].data   = calloc( 1, sched->working[ index ].size );
+        if ( !sched->working[ index ].data ) {
+            result = AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+            goto err_NewAIOPollScheduler;
+        }
+
+        for ( worker = 0; worker < sched->numWorkers; worker ++ ) {
+            if ( sched->workers[ worker ].DeviceIndex == operations[ index ].DeviceIndex )
+                break;
+        }
+        if ( worker == sched->numWorkers ) {
+            sched->workers[ worker ].sched       = sched;
+            sched->workers[ worker ].DeviceIndex = operations[ index ].DeviceIndex;
+            sched->workers[ worker ].operations  = (unsigned *)malloc( numOperations * sizeof(unsigned) );
+            sched->numWorkers ++;
+            if ( !sched->workers[ worker ].operations ) {
+                result = AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+                goto err_NewAIOPollScheduler;
+            }
+        }
+        sched->workers[ worker ].operations[ sched->workers[ worker ].numOperations ++ ] = index;
+    }
+
+    sched->snapshot.numOperations = numOperations;
+    sched->snapshot.results = _aio_poll_new_results( sched->working, numOperations );
+    if ( !sched->snapshot.results ) {
+        result = AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+        goto err_NewAIOPollScheduler;
+    }
+
+    pthread_mutex_init( &sched->lock, NULL );
+    pthread_condattr_init( &attr );
+    pthread_condattr_setclock( &attr, CLOCK_MONOTONIC );
+    pthread_cond_init( &sched->dispatch, &attr );
+    pthread_cond_init( &sched->done, &attr );
+    pthread_cond_init( &sched->published, &attr );
+    pthread_condattr_destroy( &attr );
+
+    for ( worker = 0; worker < sched->numWorkers; worker ++ ) {
+        if ( pthread_create( &sched->workers[ worker ].thread, NULL, _aio_poll_worker, &sched->workers[ worker ] ) != 0 ) {
+            DeleteAIOPollScheduler( sched );
+            aio_errno = -AIOUSB_ERROR_INVALID_THREAD;
+            return NULL;
+        }
+        sched->workers[ worker ].created = AIOUSB_TRUE;
+    }
+
+    return sched;
+
+ err_NewAIOPollScheduler:
+    if ( sched ) {
+        _aio_poll_free_results( sched->working, numOperations );
+        if ( sched->workers ) {
+            for ( worker = 0; worker < sched->numWorkers; worker ++ )
+                free( sched->workers[ worker ].operations );
+        }
+        free( sched->workers );
+        free( sched->operations );
+        free( sched );
+    }
+    aio_errno = -result;
+    return NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE DeleteAIOPollScheduler( AIOPollScheduler *sched )
+{
+    unsigned worker;
+    AIO_ASSERT( sched );
+
+    AIOPollSchedulerStop( sched );
+
+    pthread_mutex_lock( &sched->lock );
+    sched->shutdown = AIOUSB_TRUE;
+    pthread_cond_broadcast( &sched->dispatch );
+    pthread_mutex_unlock( &sched->lock );
+    for ( worker = 0; worker < sched->numWorkers; worker ++ ) {
+        if ( sched->workers[ worker ].created )
+            pthread_join( sched->workers[ worker ].thread, NULL );
+        free( sched->workers[ worker ].operations );
+    }
+
+    _aio_poll_free_results( sched->working, sched->numOperations );
+    _aio_poll_free_results( sched->snapshot.results, sched->numOperations );
+    free( sched->workers );
+    free( sched->operations );
+    pthread_mutex_destroy( &sched->lock );
+    pthread_cond_destroy( &sched->dispatch );
+    pthread_cond_destroy( &sched->done );
+    pthread_cond_destroy( &sched->published );
+    free( sched );
+
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Runs one cycle from the calling thread and publishes it, for
+ * callers that keep their own time
+ * @return the number of operations that failed this cycle, or
+ * -AIOUSB_ERROR_INVALID_THREAD if cycles are already being run
+ */
+AIORET_TYPE AIOPollSchedulerRunCycle( AIOPollScheduler *sched )
+{
+    AIO_ASSERT( sched );
+    AIORET_TYPE retval;
+
+    pthread_mutex_lock( &sched->lock );
+    if ( sched->started || sched->cycling ) {
+        pthread_mutex_unlock( &sched->lock );
+        return -AIOUSB_ERROR_INVALID_THREAD;
+    }
+    sched->cycling = AIOUSB_TRUE;
+    pthread_mutex_unlock( &sched->lock );
+
+    retval = _aio_poll_run_cycle( sched );
+
+    pthread_mutex_lock( &sched->lock );
+    sched->cycling = AIOUSB_FALSE;
+    pthread_mutex_unlock( &sched->lock );
+
+    return retval;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Runs a cycle every periodUs microseconds from a pacing thread,
+ * the first one straight away
+ * @param sched
+ * @param periodUs
+ * @param callback called from the pacing thread with each snapshot, may
+ * be NULL; it holds up the next cycle for as long as it runs
+ * @param userdata
+ */
+AIORET_TYPE AIOPollSchedulerStart( AIOPollScheduler *sched, unsigned long periodUs, AIOPollSchedulerCallback callback, void *userdata )
+{
+    AIO_ASSERT( sched );
+    AIO_ASSERT( periodUs );
+
+    pthread_mutex_lock( &sched->lock );
+    if ( sched->started || sched->cycling ) {
+        pthread_mutex_unlock( &sched->lock );
+        return -AIOUSB_ERROR_INVALID_THREAD;
+    }
+    sched->cycling      = AIOUSB_TRUE;
+    sched->callback     = callback;
+    sched->userdata     = userdata;
+    sched->periodNs     = (uint64_t)periodUs * 1000;
+    sched->missedCycles = 0;
+    sched->quit         = AIOUSB_FALSE;
+    pthread_mutex_unlock( &sched->lock );
+
+    if ( pthread_create( &sched->pacer, NULL, _aio_poll_pacer, sched ) != 0 ) {
+        pthread_mutex_lock( &sched->lock );
+        sched->cycling = AIOUSB_FALSE;
+        pthread_mutex_unlock( &sched->lock );
+        return -AIOUSB_ERROR_INVALID_THREAD;
+    }
+    sched->started = AIOUSB_TRUE;
+
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Stops the pacing thread after the cycle in progress. The last
+ * snapshot stays readable.
+ */
+AIORET_TYPE AIOPollSchedulerStop( AIOPollScheduler *sched )
+{
+    AIO_ASSERT( sched );
+    if ( !sched->started )
+        return AIOUSB_SUCCESS;
+
+    pthread_mutex_lock( &sched->lock );
+    sched->quit = AIOUSB_TRUE;
+    pthread_mutex_unlock( &sched->lock );
+    pthread_join( sched->pacer, NULL );
+
+    pthread_mutex_lock( &sched->lock );
+    sched->started  = AIOUSB_FALSE;
+    sched->cycling  = AIOUSB_FALSE;
+    sched->callback = NULL;
+    pthread_cond_broadcast( &sched->published );
+    pthread_mutex_unlock( &sched->lock );
+
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Waits until more than seen cycles have been published
+ * @param sched
+ * @param seen what the last call returned, 0 the first time
+ * @param timeout milliseconds to wait, 0 waits for as long as it takes
+ * @return the number of cycles published; -AIOUSB_ERROR_TIMEOUT if no new
+ * one came in time or pacing was stopped
+ */
+AIORET_TYPE AIOPollSchedulerWaitCycle( AIOPollScheduler *sched, uint64_t seen, unsigned timeout )
+{
+    AIO_ASSERT( sched );
+    AIORET_TYPE retval;
+    struct timespec deadline;
+    int waitResult = 0;
+
+    AIOTimeDeadline( &deadline, CLOCK_MONOTONIC, timeout );
+
+    pthread_mutex_lock( &sched->lock );
+    while ( sched->cycles <= seen && !sched->quit && waitResult != ETIMEDOUT ) {
+        if ( timeout == 0 )
+            pthread_cond_wait( &sched->published, &sched->lock );
+        else
+            waitResult = pthread_cond_timedwait( &sched->published, &sched->lock, &deadline );
+    }
+    retval = sched->cycles > seen ? (AIORET_TYPE)sched->cycles : -AIOUSB_ERROR_TIMEOUT;
+    pthread_mutex_unlock( &sched->lock );
+
+    return retval;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Allocates a snapshot shaped for sched's operations, for
+ * AIOPollSchedulerGetSnapshot() to fill
+ */
+AIOPollSnapshot *NewAIOPollSnapshot( AIOPollScheduler *sched )
+{
+    AIOPollSnapshot *snapshot;
+    if ( !sched ) {
+        aio_errno = -AIOUSB_ERROR_INVALID_PARAMETER;
+        return NULL;
+    }
+    snapshot = (AIOPollSnapshot *)calloc( 1, sizeof(AIOPollSnapshot) );
+    if ( snapshot )
+        snapshot->results = _aio_poll_new_results( sched->working, sched->numOperations );
+    if ( !snapshot || !snapshot->results ) {
+        free( snapshot );
+        aio_errno = -AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+        return NULL;
+    }
+    snapshot->numOperations = sched->numOperations;
+    return snapshot;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE DeleteAIOPollSnapshot( AIOPollSnapshot *snapshot )
+{
+    AIO_ASSERT( snapshot );
+    _aio_poll_free_results( snapshot->results, snapshot->numOperations );
+    free( snapshot );
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Copies the latest published snapshot
+ * @return the number of cycles published, 0 if snapshot holds nothing yet
+ */
+AIORET_TYPE AIOPollSchedulerGetSnapshot( AIOPollScheduler *sched, AIOPollSnapshot *snapshot )
+{
+    AIO_ASSERT( sched );
+    AIO_ASSERT( snapshot );
+    AIORET_TYPE retval;
+    if ( snapshot->numOperations != sched->numOperations )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+
+    pthread_mutex_lock( &sched->lock );
+    _aio_poll_copy_results( snapshot->results, sched->snapshot.results, sched->numOperations );
+    snapshot->cycle   = sched->snapshot.cycle;
+    snapshot->startNs = sched->snapshot.startNs;
+    snapshot->endNs   = sched->snapshot.endNs;
+    retval = (AIORET_TYPE)sched->cycles;
+    pthread_mutex_unlock( &sched->lock );
+
+    return retval;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIOPollSchedulerGetCycles( AIOPollScheduler *sched )
+{
+    AIO_ASSERT( sched );
+    AIORET_TYPE retval;
+    pthread_mutex_lock( &sched->lock );
+    retval = (AIORET_TYPE)sched->cycles;
+    pthread_mutex_unlock( &sched->lock );
+    return retval;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIOPollSchedulerGetMissedCycles( AIOPollScheduler *sched )
+{
+    AIO_ASSERT( sched );
+    AIORET_TYPE retval;
+    pthread_mutex_lock( &sched->lock );
+    retval = (AIORET_TYPE)sched->missedCycles;
+    pthread_mutex_unlock( &sched->lock );
+    return retval;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Longest cycle so far, dispatch to last read, in nanoseconds
+ */
+AIORET_TYPE AIOPollSchedulerGetMaxCycleTime( AIOPollScheduler *sched )
+{
+    AIO_ASSERT( sched );
+    AIORET_TYPE retval;
+    pthread_mutex_lock( &sched->lock );
+    retval = (AIORET_TYPE)sched->maxCycleNs;
+    pthread_mutex_unlock( &sched->lock );
+    return retval;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+/*****************************************************************************
+ * Self-test
+ ****************************************************************************/
+
+#ifdef SELF_TEST
+
+#include "mocks/mock_fake_device.h"
+#include <unistd.h>
+
+using namespace AIOUSB;
+
+#define POLL_BOARDS 4
+#define POLL_DELAY_US 40000
+
+static volatile int poll_fail_board = -1;
+
+/* every read takes POLL_DELAY_US and fills in the board's number */
+static int fake_poll_control( USBDevice *usb, uint8_t request_type, uint8_t bRequest, uint16_t wValue, uint16_t wIndex,
+                              unsigned char *data, uint16_t wLength, unsigned int timeout )
+{
+    int board = mock_fake_device_index( usb );
+    if ( bRequest != AUR_DIO_READ && bRequest != AUR_CTR_READALL )
+        return wLength;
+    usleep( POLL_DELAY_US );
+    if ( board == poll_fail_board )
+        return LIBUSB_ERROR_PIPE;
+    memset( data, board + 1, wLength );
+    return wLength;
+}
+
+class PollSchedulerSetup : public MockFakeDeviceTest
+{
+ protected:
+    virtual void SetUp() {
+        MockFakeDeviceTest::SetUp();
+        poll_fail_board = -1;
+        for ( int i = 0; i < POLL_BOARDS; i ++ )
+            AddFakeDevice( USB_DIO_32, fake_poll_control );
+    }
+};
+
+TEST_F(PollSchedulerSetup,CycleTakesTheSlowestBoardNotTheSum)
+{
+    AIOPollOperation ops[ POLL_BOARDS ];
+    for ( int i = 0; i < POLL_BOARDS; i ++ ) {
+        ops[i].DeviceIndex = i;
+        ops[i].kind = AIO_POLL_CTR_READ_ALL;
+        ops[i].every = 1;
+    }
+    AIOPollScheduler *sched = NewAIOPollScheduler( ops, POLL_BOARDS );
+    ASSERT_TRUE( sched );
+    EXPECT_EQ( POLL_BOARDS, (int)sched->numWorkers );
+
+    EXPECT_EQ( 0, AIOPollSchedulerRunCycle( sched ) );
+    EXPECT_GE( AIOPollSchedulerGetMaxCycleTime( sched ), POLL_DELAY_US * 1000 );
+    EXPECT_LT( AIOPollSchedulerGetMaxCycleTime( sched ), POLL_BOARDS * POLL_DELAY_US * 1000 / 2 );
+
+    AIOPollSnapshot *snapshot = NewAIOPollSnapshot( sched );
+    ASSERT_TRUE( snapshot );
+    EXPECT_EQ( 1, AIOPollSchedulerGetSnapshot( sched, snapshot ) );
+    EXPECT_EQ( 0u, snapshot->cycle );
+    for ( int i = 0; i < POLL_BOARDS; i ++ ) {
+        AIOPollResult *res = &snapshot->results[i];
+        EXPECT_EQ( AIOUSB_SUCCESS, res->result );
+        EXPECT_EQ( 3u * 3 * sizeof(unsigned short), res->size );
+        EXPECT_EQ( i + 1, ((unsigned char *)res->data)[0] );
+        EXPECT_GE( res->timestampNs, snapshot->startNs );
+        EXPECT_LE( res->timestampNs, snapshot->endNs );
+    }
+
+    DeleteAIOPollSnapshot( snapshot );
+    DeleteAIOPollScheduler( sched );
+}
+
+TEST_F(PollSchedulerSetup,RateGroupsAndFailuresStayPerOperation)
+{
+    /* board 0 twice, sequentially; board 1 counters every third cycle */
+    AIOPollOperation ops[] = {
+        { 0, AIO_POLL_DIO_READ_ALL, 1 },
+        { 1, AIO_POLL_CTR_READ_ALL, 3 },
+        { 0, AIO_POLL_CTR_READ_ALL, 0 },
+        { 2, AIO_POLL_DIO_READ_ALL, 1 },
+    };
+    AIOPollScheduler *sched = NewAIOPollScheduler( ops, 4 );
+    ASSERT_TRUE( sched );
+    EXPECT_EQ( 3, (int)sched->numWorkers );
+    AIOPollSnapshot *snapshot = NewAIOPollSnapshot( sched );
+
+    for ( int cycle = 0; cycle < 5; cycle ++ ) {
+        poll_fail_board = cycle == 4 ? 2 : -1;
+        EXPECT_EQ( cycle == 4 ? 1 : 0, AIOPollSchedulerRunCycle( sched ) );
+    }
+    EXPECT_EQ( 5, AIOPollSchedulerGetSnapshot( sched, snapshot ) );
+    EXPECT_EQ( 4u, snapshot->cycle );
+    EXPECT_EQ( 4u, snapshot->results[0].cycle );
+    EXPECT_EQ( 3u, snapshot->results[1].cycle );
+    EXPECT_EQ( AIOUSB_SUCCESS, snapshot->results[1].result );
+    EXPECT_EQ( 2, ((unsigned char *)snapshot->results[1].data)[0] );
+    EXPECT_EQ( 4u, snapshot->results[2].cycle );
+    EXPECT_GT( snapshot->results[2].timestampNs, snapshot->results[0].timestampNs );
+    EXPECT_EQ( 4u, snapshot->results[3].cycle );
+    EXPECT_LT( snapshot->results[3].result, 0 );
+    EXPECT_GE( AIOPollSchedulerGetMaxCycleTime( sched ), 2 * POLL_DELAY_US * 1000 );
+
+    DeleteAIOPollSnapshot( snapshot );
+    DeleteAIOPollScheduler( sched );
+}
+
+static void count_snapshots( const AIOPollSnapshot *snapshot, void *userdata )
+{
+    (*(uint64_t *)userdata) ++;
+}
+
+TEST_F(PollSchedulerSetup,PacedCyclesPublishSnapshots)
+{
+    AIOPollOperation ops[] = { { 0, AIO_POLL_DIO_READ_ALL, 1 }, { 3, AIO_POLL_DIO_READ_ALL, 1 } };
+    uint64_t calls = 0;
+    AIOPollScheduler *sched = NewAIOPollScheduler( ops, 2 );
+    ASSERT_TRUE( sched );
+
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOPollSchedulerStart( sched, 50000, count_snapshots, &calls ) );
+    EXPECT_EQ( -AIOUSB_ERROR_INVALID_THREAD, AIOPollSchedulerRunCycle( sched ) );
+    AIORET_TYPE seen = 0;
+    while ( seen < 3 ) {
+        seen = AIOPollSchedulerWaitCycle( sched, seen, 1000 );
+        ASSERT_GT( seen, 0 );
+    }
+    EXPECT_EQ( AIOUSB_SUCCESS, AIOPollSchedulerStop( sched ) );
+    EXPECT_EQ( -AIOUSB_ERROR_TIMEOUT, AIOPollSchedulerWaitCycle( sched, AIOPollSchedulerGetCycles( sched ), 10 ) );
+    EXPECT_EQ( (uint64_t)AIOPollSchedulerGetCycles( sched ), calls );
+    EXPECT_EQ( 0, AIOPollSchedulerGetMissedCycles( sched ) );
+
+    DeleteAIOPollScheduler( sched );
+}
+
+static int fake_adc_bulk( USBDevice *usb, unsigned char endpoint, unsigned char *data, int length, int *actual_length, unsigned int timeout )
+{
+    *actual_length = 0;
+    return LIBUSB_ERROR_PIPE;
+}
+
+TEST_F(PollSchedulerSetup,FailedScansAreReportedAsErrors)
+{
+    AIOUSBDevice *dev = AddFakeDevice( USB_AI16_16A, fake_poll_control, fake_adc_bulk );
+    ASSERT_TRUE( dev );
+
+    /* the bulk read of every scan fails */
+    AIOPollOperation ops[] = { { 0, AIO_POLL_DIO_READ_ALL, 1 }, { POLL_BOARDS, AIO_POLL_ADC_SCAN_V, 1 } };
+    AIOPollScheduler *sched = NewAIOPollScheduler( ops, 2 );
+    ASSERT_TRUE( sched );
+    AIOPollSnapshot *snapshot = NewAIOPollSnapshot( sched );
+    ASSERT_TRUE( snapshot );
+
+    EXPECT_EQ( 1, AIOPollSchedulerRunCycle( sched ) );
+    AIOPollSchedulerGetSnapshot( sched, snapshot );
+    EXPECT_EQ( AIOUSB_SUCCESS, snapshot->results[0].result );
+    EXPECT_LT( snapshot->results[1].result, 0 ) << "A/D failures must not be published as readings";
+
+    /* ADC_GetScanV() reports some failures as positive AIORESULT codes */
+    dev->bADCStream = AIOUSB_FALSE;
+    EXPECT_EQ( 1, AIOPollSchedulerRunCycle( sched ) );
+    AIOPollSchedulerGetSnapshot( sched, snapshot );
+    EXPECT_EQ( -AIOUSB_ERROR_NOT_SUPPORTED, snapshot->results[1].result );
+
+    DeleteAIOPollSnapshot( snapshot );
+    DeleteAIOPollScheduler( sched );
+}
+
+TEST_F(PollSchedulerSetup,RejectsWhatABoardCannotDo)
+{
+    AIOPollOperation adc[] = { { 0, AIO_POLL_ADC_SCAN_V, 1 } };
+    AIOPollOperation missing[] = { { 9, AIO_POLL_DIO_READ_ALL, 1 } };
+
+    EXPECT_FALSE( NewAIOPollScheduler( adc, 1 ) );
+    EXPECT_EQ( -AIOUSB_ERROR_NOT_SUPPORTED, aio_errno );
+    EXPECT_FALSE( NewAIOPollScheduler( missing, 1 ) );
+    EXPECT_FALSE( NewAIOPollScheduler( adc, 0 ) );
+    EXPECT_EQ( -AIOUSB_ERROR_INVALID_PARAMETER, aio_errno );
+}
+
+int main(int argc, char *argv[] )
+{
+    testing::InitGoogleTest(&argc, argv);
+    testing::TestEventListeners & listeners = testing::UnitTest::GetInstance()->listeners();
+#ifdef GTEST_TAP_PRINT_TO_STDOUT
+    delete listeners.Release(listeners.default_result_printer());
+#endif
+
+    return RUN_ALL_TESTS();
+}
+
+#endif
@@ -0,0 +1,128 @@
+/**
+ * @file   AIOPollScheduler.h
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  Concurrent, rate-grouped polling of many boards into one snapshot
+ *
+ */
+
+#ifndef _AIO_POLL_SCHEDULER_H
+#define _AIO_POLL_SCHEDULER_H
+
+#include "AIOTypes.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __aiousb_cplusplus
+namespace AIOUSB
+{
+#endif
+
+typedef enum {
+    AIO_POLL_DIO_READ_ALL = 0,          /**< DIO_ReadAll(), DIOBytes bytes */
+    AIO_POLL_CTR_READ_ALL,              /**< CTR_8254ReadAll(), one unsigned short per counter */
+    AIO_POLL_ADC_SCAN_V                 /**< ADC_GetScanV(), one double per A/D channel */
+} AIOPollKind;
+
+/**
+ * @brief One read the scheduler makes. every puts it in a rate group:
+ * it runs on cycles 0, every, 2 * every and so on; 0 is the same as 1.
+ */
+typedef struct AIOPollOperation {
+    unsigned long DeviceIndex;
+    AIOPollKind kind;
+    unsigned every;
+} AIOPollOperation;
+
+/**
+ * @brief The latest outcome of one operation. Between its runs an
+ * operation keeps the data of its last one; cycle tells which that was.
+ */
+typedef struct AIOPollResult {
+    AIORET_TYPE result;                 /**< AIOUSB_SUCCESS or a negated error */
+    uint64_t cycle;                     /**< cycle the data was read in */
+    uint64_t timestampNs;               /**< CLOCK_MONOTONIC when the read finished */
+    size_t size;                        /**< bytes in data */
+    void *data;
+} AIOPollResult;
+
+/**
+ * @brief Every operation as of the end of one cycle, in the order they
+ * were given to NewAIOPollScheduler()
+ */
+typedef struct AIOPollSnapshot {
+    uint64_t cycle;
+    uint64_t startNs;                   /**< CLOCK_MONOTONIC when the cycle was dispatched */
+    uint64_t endNs;                     /**< and when its last read finished */
+    unsigned numOperations;
+    AIOPollResult *results;
+} AIOPollSnapshot;
+
+typedef void (*AIOPollSchedulerCallback)( const AIOPollSnapshot *snapshot, void *userdata );
+
+struct aio_poll_worker;
+
+/**
+ * @brief AIOPollScheduler keeps one thread per board. A cycle hands each
+ * thread the operations on its board that are due, lets them all run at
+ * once and waits for the last, so a cycle takes as long as the slowest
+ * board rather than the sum of them. Reads on one board still run one
+ * after another, in the order given.
+ *
+ * The threads write into a working set of results; only once every board
+ * is done is it copied to the published snapshot, so a snapshot never
+ * mixes two cycles. Cycles run either one at a time from the caller with
+ * AIOPollSchedulerRunCycle(), or at a fixed period from a pacing thread
+ * started with AIOPollSchedulerStart(). A cycle that overruns the period
+ * pushes the next one back to the next whole period; the skipped ones
+ * are counted as missed.
+ */
+typedef struct AIOPollScheduler {
+    unsigned numOperations;
+    AIOPollOperation *operations;
+    AIOPollResult *working;             /**< written by the workers during a cycle */
+    AIOPollSnapshot snapshot;           /**< published, guarded by lock */
+    unsigned numWorkers;
+    struct aio_poll_worker *workers;
+    pthread_mutex_t lock;               /**< guards everything below and the snapshot */
+    pthread_cond_t dispatch;            /**< a new generation was handed out */
+    pthread_cond_t done;                /**< pending reached 0 */
+    pthread_cond_t published;           /**< a snapshot was published, or pacing stopped */
+    uint64_t generation;
+    uint64_t cycle;                     /**< the next cycle to dispatch */
+    unsigned pending;                   /**< workers still busy with this generation */
+    AIOUSB_BOOL cycling;                /**< a cycle is being run */
+    AIOUSB_BOOL shutdown;
+    AIOPollSchedulerCallback callback;
+    void *userdata;
+    uint64_t periodNs;
+    pthread_t pacer;
+    AIOUSB_BOOL started;
+    AIOUSB_BOOL quit;
+    uint64_t cycles;                    /**< cycles published */
+    uint64_t missedCycles;
+    uint64_t maxCycleNs;
+} AIOPollScheduler;
+
+/* BEGIN AIOUSB_API */
+PUBLIC_EXTERN AIOPollScheduler *NewAIOPollScheduler( const AIOPollOperation *operations, unsigned numOperations );
+PUBLIC_EXTERN AIORET_TYPE DeleteAIOPollScheduler( AIOPollScheduler *sched );
+PUBLIC_EXTERN AIORET_TYPE AIOPollSchedulerRunCycle( AIOPollScheduler *sched );
+PUBLIC_EXTERN AIORET_TYPE AIOPollSchedulerStart( AIOPollScheduler *sched, unsigned long periodUs, AIOPollSchedulerCallback callback, void *userdata );
+PUBLIC_EXTERN AIORET_TYPE AIOPollSchedulerStop( AIOPollScheduler *sched );
+PUBLIC_EXTERN AIORET_TYPE AIOPollSchedulerWaitCycle( AIOPollScheduler *sched, uint64_t seen, unsigned timeout );
+PUBLIC_EXTERN AIOPollSnapshot *NewAIOPollSnapshot( AIOPollScheduler *sched );
+PUBLIC_EXTERN AIORET_TYPE DeleteAIOPollSnapshot( AIOPollSnapshot *snapshot );
+PUBLIC_EXTERN AIORET_TYPE AIOPollSchedulerGetSnapshot( AIOPollScheduler *sched, AIOPollSnapshot *snapshot );
+PUBLIC_EXTERN AIORET_TYPE AIOPollSchedulerGetCycles( AIOPollScheduler *sched );
+PUBLIC_EXTERN AIORET_TYPE AIOPollSchedulerGetMissedCycles( AIOPollScheduler *sched );
+PUBLIC_EXTERN AIORET_TYPE AIOPollSchedulerGetMaxCycleTime( AIOPollScheduler *sched );
+/* END AIOUSB_API */
+
+#ifdef __aiousb_cplusplus
+}
+#endif
+
+#endif
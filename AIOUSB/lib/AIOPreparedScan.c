@@ -0,0 +1,468 @@
+/**
+ * @file   AIOPreparedScan.c
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  Immediate A/D scans with the configuration applied up front
+ *
+ * ADC_GetScan() reads the configuration, rewrites it for an immediate
+ * scan, uploads it, allocates a sample buffer, acquires, and then puts
+ * the original configuration back, on every call. A prepared scan does
+ * the configuration and allocation once in NewAIOPreparedScan(), so
+ * that each AIOPreparedScanGetScan() is only the start, immediate and
+ * bulk transfers followed by the averaging. The original configuration
+ * is restored by DeleteAIOPreparedScan().
+ *
+ * With pipelining turned on, the next scan is triggered as soon as the
+ * current one has been read back, and its data is collected by the
+ * following call. The USB round trip then overlaps with whatever the
+ * caller does between calls, at the price of every reading being one
+ * call old. While a pipelined scan is outstanding the board belongs to
+ * the prepared scan; don't mix it with other A/D calls on the device.
+ */
+
+#include "AIOPreparedScan.h"
+#include "AIOUSB_Core.h"
+#include "AIOUSB_ADC.h"
+#include "AIODeviceTable.h"
+#include "AIOUSBDevice.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __cplusplus
+namespace AIOUSB {
+#endif
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Sets up a device for repeated immediate scans of its current
+ * channel range, gains and oversample setting
+ * @param DeviceIndex
+ * @return new prepared scan, or NULL with aio_errno set
+ */
+AIOPreparedScan *NewAIOPreparedScan( unsigned long DeviceIndex )
+{
+    AIORESULT result = AIOUSB_SUCCESS;
+    int retval;
+    AIOPreparedScan *scan = NULL;
+    AIOUSBDevice *deviceDesc = AIODeviceTableGetDeviceAtIndex( DeviceIndex, &result );
+    if ( result != AIOUSB_SUCCESS )
+        goto err_NewAIOPreparedScan;
+
+    if ( !deviceDesc->bADCStream ) {
+        result = AIOUSB_ERROR_NOT_SUPPORTED;
+        goto err_NewAIOPreparedScan;
+    }
+
+    result = ReadConfigBlock( DeviceIndex, AIOUSB_FALSE );
+    if ( result != AIOUSB_SUCCESS )
+        goto err_NewAIOPreparedScan;
+
+    scan = (AIOPreparedScan *)calloc( 1, sizeof(AIOPreparedScan) );
+    if ( !scan ) {
+        result = AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+        goto err_NewAIOPreparedScan;
+    }
+
+    scan->DeviceIndex = DeviceIndex;
+    AIOUSBDeviceReadLock( deviceDesc );
+    scan->savedConfig = deviceDesc->cachedConfigBlock;
+    scan->scanConfig  = deviceDesc->cachedConfigBlock;
+    AIOUSBDeviceUnlock( deviceDesc );
+
+    adc_prepare_immediate_scan( deviceDesc,
+                                &scan->scanConfig,
+                                &scan->numChannels,
+                                &scan->samplesPerChannel,
+                                &scan->discardFirstSample
+                                );
+
+    scan->startChannel = ADCConfigBlockGetStartChannel( &scan->scanConfig );
+    scan->numSamples   = scan->numChannels * scan->samplesPerChannel;
+    scan->sampleBuffer = (unsigned short *)malloc( scan->numSamples * sizeof(unsigned short) );
+    scan->counts       = (unsigned short *)calloc( scan->numChannels, sizeof(unsigned short) );
+    scan->minVolts     = (double *)calloc( scan->numChannels, sizeof(double) );
+    scan->rangeVolts   = (double *)calloc( scan->numChannels, sizeof(double) );
+    if ( !scan->sampleBuffer || !scan->counts || !scan->minVolts || !scan->rangeVolts ) {
+        result = AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+        goto err_NewAIOPreparedScan;
+    }
+
+    for ( int channel = 0; channel < scan->numChannels; channel ++ ) {
+        int gainCode = ADCConfigBlockGetGainCode( &scan->scanConfig, scan->startChannel + channel );
+        scan->minVolts[channel]   = adRanges[ gainCode ].minVolts;
+        scan->rangeVolts[channel] = adRanges[ gainCode ].range;
+    }
+
+    AIOUSBDeviceReadLock( deviceDesc );
+    if ( deviceDesc->hostCal ) {
+        scan->hostCal = (AIOHostCalChannel *)malloc( scan->numChannels * sizeof(AIOHostCalChannel) );
+        if ( !scan->hostCal )
+            result = AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+        else if ( AIOHostCalResolve( deviceDesc->hostCal, &scan->scanConfig, scan->startChannel, scan->numChannels, scan->hostCal ) != AIOUSB_SUCCESS )
+            result = AIOUSB_ERROR_INVALID_GAINCODE;
+    }
+    AIOUSBDeviceUnlock( deviceDesc );
+    if ( result != AIOUSB_SUCCESS )
+        goto err_NewAIOPreparedScan;
+
+    AIOUSBDeviceWriteLock( deviceDesc );
+    retval = AIOUSBDevicePutADCConfigBlock( deviceDesc, &scan->scanConfig );
+    AIOUSBDeviceUnlock( deviceDesc );
+    if ( retval < 0 ) {
+        result = AIOUSB_ERROR_DEVICE_NOT_CONNECTED;
+        goto err_NewAIOPreparedScan;
+    }
+
+    return scan;
+
+ err_NewAIOPreparedScan:
+    if ( scan ) {
+        free( scan->sampleBuffer );
+        free( scan->counts );
+        free( scan->minVolts );
+        free( scan->rangeVolts );
+        free( scan->hostCal );
+        free( scan );
+    }
+    aio_errno = -result;
+    return NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Collects any outstanding pipelined scan, puts the device's
+ * original configuration back and frees the prepared scan
+ */
+AIORET_TYPE DeleteAIOPreparedScan( AIOPreparedScan *scan )
+{
+    AIORESULT result = AIOUSB_SUCCESS;
+    AIORET_TYPE retval = AIOUSB_SUCCESS;
+    int bytesTransferred;
+    AIO_ASSERT( scan );
+
+    AIOUSBDevice *deviceDesc = AIODeviceTableGetDeviceAtIndex( scan->DeviceIndex, &result );
+    USBDevice *usb = AIODeviceTableGetUSBDeviceAtIndex( scan->DeviceIndex, &result );
+
+    if ( deviceDesc && usb ) {
+        if ( scan->inFlight ) {
+            adc_get_bulk_data( &scan->scanConfig,
+                               usb,
+                               LIBUSB_ENDPOINT_IN | USB_BULK_READ_ENDPOINT,
+                               (unsigned char *)scan->sampleBuffer,
+                               scan->numSamples * sizeof(unsigned short),
+                               &bytesTransferred,
+                               deviceDesc->commTimeout
+                               );
+        }
+        AIOUSBDeviceWriteLock( deviceDesc );
+        if ( AIOUSBDevicePutADCConfigBlock( deviceDesc, &scan->savedConfig ) < 0 )
+            retval = -AIOUSB_ERROR_DEVICE_NOT_CONNECTED;
+        AIOUSBDeviceUnlock( deviceDesc );
+    } else {
+        retval = -result;
+    }
+
+    free( scan->sampleBuffer );
+    free( scan->counts );
+    free( scan->minVolts );
+    free( scan->rangeVolts );
+    free( scan->hostCal );
+    free( scan );
+
+    return retval;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIOPreparedScanSetPipelined( AIOPreparedScan *scan, AIOUSB_BOOL pipelined )
+{
+    AIO_ASSERT( scan );
+    scan->pipelined = pipelined;
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIOPreparedScanGetPipelined( AIOPreparedScan *scan )
+{
+    AIO_ASSERT( scan );
+    return scan->pipelined;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIOPreparedScanGetStartChannel( AIOPreparedScan *scan )
+{
+    AIO_ASSERT( scan );
+    return scan->startChannel;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIOPreparedScanGetNumChannels( AIOPreparedScan *scan )
+{
+    AIO_ASSERT( scan );
+    return scan->numChannels;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Runs one scan into scan->counts
+ */
+static AIORET_TYPE _prepared_scan_acquire( AIOPreparedScan *scan )
+{
+    AIORESULT result = AIOUSB_SUCCESS;
+    AIORET_TYPE retval;
+    int libusbresult, bytesTransferred;
+
+    AIOUSBDevice *deviceDesc = AIODeviceTableGetDeviceAtIndex( scan->DeviceIndex, &result );
+    AIO_ERROR_VALID_DATA( -(AIORET_TYPE)result, result == AIOUSB_SUCCESS );
+    USBDevice *usb = AIODeviceTableGetUSBDeviceAtIndex( scan->DeviceIndex, &result );
+    AIO_ERROR_VALID_DATA( -(AIORET_TYPE)result, result == AIOUSB_SUCCESS );
+
+    if ( !scan->inFlight ) {
+        /**
+         * Costs nothing unless someone has changed the registers
+         * since the last scan
+         */
+        AIOUSBDeviceWriteLock( deviceDesc );
+        int putResult = AIOUSBDevicePutADCConfigBlock( deviceDesc, &scan->scanConfig );
+        AIOUSBDeviceUnlock( deviceDesc );
+        if ( putResult < 0 )
+            return -AIOUSB_ERROR_DEVICE_NOT_CONNECTED;
+
+        retval = adc_start_immediate_scan( deviceDesc, usb, scan->numSamples );
+        if ( retval < AIOUSB_SUCCESS )
+            return retval;
+    }
+    scan->inFlight = AIOUSB_FALSE;
+
+    libusbresult = adc_get_bulk_data( &scan->scanConfig,
+                                      usb,
+                                      LIBUSB_ENDPOINT_IN | USB_BULK_READ_ENDPOINT,
+                                      (unsigned char *)scan->sampleBuffer,
+                                      scan->numSamples * sizeof(unsigned short),
+                                      &bytesTransferred,
+                                      deviceDesc->commTimeout
+                                      );
+    if ( libusbresult != LIBUSB_SUCCESS )
+        return -LIBUSB_RESULT_TO_AIOUSB_RESULT( libusbresult );
+    if ( bytesTransferred != (int)(scan->numSamples * sizeof(unsigned short)) )
+        return -AIOUSB_ERROR_INVALID_DATA;
+
+    if ( scan->pipelined ) {
+        retval = adc_start_immediate_scan( deviceDesc, usb, scan->numSamples );
+        if ( retval < AIOUSB_SUCCESS )
+            return retval;
+        scan->inFlight = AIOUSB_TRUE;
+    }
+
+    retval = adc_average_immediate_scan( scan->sampleBuffer,
+                                         scan->numChannels,
+                                         scan->samplesPerChannel,
+                                         scan->discardFirstSample,
+                                         scan->counts
+                                         );
+    scan->scans ++;
+
+    return retval;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief One scan in counts, laid out like ADC_GetScan(): only
+ * pBuf[startChannel] through pBuf[startChannel+numChannels-1] are written
+ */
+AIORET_TYPE AIOPreparedScanGetScan( AIOPreparedScan *scan, unsigned short *pBuf )
+{
+    AIO_ASSERT( scan );
+    AIO_ASSERT( pBuf );
+
+    AIORET_TYPE retval = _prepared_scan_acquire( scan );
+    if ( retval < AIOUSB_SUCCESS )
+        return retval;
+
+    memcpy( pBuf + scan->startChannel, scan->counts, scan->numChannels * sizeof(unsigned short) );
+
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief One scan in volts, laid out like ADC_GetScanV()
+ */
+AIORET_TYPE AIOPreparedScanGetScanV( AIOPreparedScan *scan, double *pBuf )
+{
+    AIO_ASSERT( scan );
+    AIO_ASSERT( pBuf );
+
+    AIORET_TYPE retval = _prepared_scan_acquire( scan );
+    if ( retval < AIOUSB_SUCCESS )
+        return retval;
+
+    if ( scan->hostCal ) {
+        AIOHostCalConvertScans( scan->hostCal, scan->numChannels, scan->counts, pBuf + scan->startChannel, 1 );
+        return AIOUSB_SUCCESS;
+    }
+
+    for ( int channel = 0; channel < scan->numChannels; channel ++ ) {
+        pBuf[ scan->startChannel + channel ] = ( (( double )scan->counts[ channel ] / ( double )AI_16_MAX_COUNTS) * scan->rangeVolts[channel] ) +
+            scan->minVolts[channel];
+    }
+
+    return AIOUSB_SUCCESS;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#ifdef SELF_TEST
+
+#include "mocks/mock_fake_device.h"
+
+#include <iostream>
+#include <string>
+using namespace AIOUSB;
+
+static std::string transfers;
+static int put_calls = 0;
+
+static int fake_put_config( USBDevice *usb, ADCConfigBlock *config ) { put_calls ++; return (int)config->size; }
+
+static int fake_control_transfer( USBDevice *usb, uint8_t request_type, uint8_t bRequest, uint16_t wValue, uint16_t wIndex, unsigned char *data, uint16_t wLength, unsigned int timeout )
+{
+    if ( bRequest == AUR_START_ACQUIRING_BLOCK ) {
+        transfers += "S";
+        return wLength;
+    } else if ( bRequest == AUR_ADC_IMMEDIATE ) {
+        transfers += "I";
+        return wLength;
+    }
+    return LIBUSB_ERROR_IO;
+}
+
+static int fake_bulk_transfer( USBDevice *usb, unsigned char endpoint, unsigned char *data, int length, int *actual_length, unsigned int timeout )
+{
+    unsigned short *samples = (unsigned short *)data;
+    transfers += "B";
+    for ( int i = 0; i < length / (int)sizeof(unsigned short); i ++ )
+        samples[i] = 1000 + i;
+    *actual_length = length;
+    return LIBUSB_SUCCESS;
+}
+
+class PreparedScanSetup : public MockFakeDeviceTest
+{
+ protected:
+    virtual void SetUp() {
+        MockFakeDeviceTest::SetUp();
+        put_calls  = 0;
+        transfers  = "";
+
+        dev = AddFakeDevice( USB_AIO16_16A, fake_control_transfer, fake_bulk_transfer );
+        ASSERT_TRUE( dev );
+        usb[0].usb_put_config = fake_put_config;
+        dev->discardFirstSample = AIOUSB_FALSE;
+        ASSERT_EQ( AIOUSB_SUCCESS, (int)ReadConfigBlock( numDevices - 1, AIOUSB_FALSE ));
+        ADCConfigBlockSetScanRange( &dev->cachedConfigBlock, 2, 5 );
+        ADCConfigBlockSetOversample( &dev->cachedConfigBlock, 1 );
+        transfers = "";
+    }
+    AIOUSBDevice *dev;
+};
+
+TEST_F(PreparedScanSetup, ConfiguresOnceAndAverages )
+{
+    unsigned short counts[16] = {0};
+    AIOPreparedScan *scan = NewAIOPreparedScan( numDevices - 1 );
+    ASSERT_TRUE( scan );
+    EXPECT_EQ( 2, AIOPreparedScanGetStartChannel( scan ));
+    EXPECT_EQ( 4, AIOPreparedScanGetNumChannels( scan ));
+    EXPECT_EQ( 1, put_calls );
+
+    for ( int i = 0; i < 3; i ++ )
+        ASSERT_EQ( AIOUSB_SUCCESS, AIOPreparedScanGetScan( scan, counts ));
+
+    EXPECT_EQ( "SIBSIBSIB", transfers );
+    EXPECT_EQ( 1, put_calls ) << "Configuration goes out only once";
+
+    EXPECT_EQ( 0, counts[1] );
+    /* two samples per channel, (1000+1001+1)/2 rounds up */
+    EXPECT_EQ( 1001, counts[2] );
+    EXPECT_EQ( 1003, counts[3] );
+    EXPECT_EQ( 1007, counts[5] );
+    EXPECT_EQ( 0, counts[6] );
+
+    EXPECT_EQ( AIOUSB_SUCCESS, DeleteAIOPreparedScan( scan ));
+    EXPECT_EQ( 2, put_calls ) << "Original configuration is put back";
+}
+
+TEST_F(PreparedScanSetup, PipelinedTriggersNextScanEarly )
+{
+    double volts[16] = {0};
+    AIOPreparedScan *scan = NewAIOPreparedScan( numDevices - 1 );
+    ASSERT_TRUE( scan );
+    AIOPreparedScanSetPipelined( scan, AIOUSB_TRUE );
+
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOPreparedScanGetScanV( scan, volts ));
+    EXPECT_EQ( "SIBSI", transfers );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOPreparedScanGetScanV( scan, volts ));
+    EXPECT_EQ( "SIBSIBSI", transfers );
+    EXPECT_NE( 0.0, volts[2] );
+
+    DeleteAIOPreparedScan( scan );
+    EXPECT_EQ( "SIBSIBSIB", transfers ) << "Outstanding scan is drained";
+}
+
+TEST_F(PreparedScanSetup, HostCalCorrectsVolts )
+{
+    static double table[ AIO_HOST_CAL_TABLE_WORDS ];
+    double volts[16] = {0};
+    double plain[16] = {0};
+    for ( int i = 0; i < AIO_HOST_CAL_TABLE_WORDS; i ++ )
+        table[i] = -1.0 * i;
+
+    AIOHostCal *cal = NewAIOHostCal( 16 );
+    ASSERT_TRUE( cal );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOHostCalSetLinear( cal, 3, ADCConfigBlockGetGainCode( &dev->cachedConfigBlock, 3 ), 0.001, 0.5 ));
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOHostCalSetTable( cal, 4, ADCConfigBlockGetGainCode( &dev->cachedConfigBlock, 4 ), table, AIO_HOST_CAL_TABLE_WORDS ));
+
+    AIOPreparedScan *scan = NewAIOPreparedScan( numDevices - 1 );
+    ASSERT_TRUE( scan );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOPreparedScanGetScanV( scan, plain ));
+    DeleteAIOPreparedScan( scan );
+
+    ASSERT_EQ( AIOUSB_SUCCESS, ADC_SetHostCal( numDevices - 1, cal ));
+    scan = NewAIOPreparedScan( numDevices - 1 );
+    ASSERT_TRUE( scan );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOPreparedScanGetScanV( scan, volts ));
+    DeleteAIOPreparedScan( scan );
+
+    EXPECT_DOUBLE_EQ( plain[2], volts[2] ) << "Channels without an entry stay nominal";
+    EXPECT_DOUBLE_EQ( 0.001 * 1003 + 0.5, volts[3] );
+    EXPECT_DOUBLE_EQ( -1005.0, volts[4] );
+    EXPECT_DOUBLE_EQ( plain[5], volts[5] );
+
+    ASSERT_EQ( AIOUSB_SUCCESS, ADC_SetHostCal( numDevices - 1, NULL ));
+    DeleteAIOHostCal( cal );
+}
+
+TEST(PreparedScan, BadDeviceSetsErrno )
+{
+    AIODeviceTableInit();
+    EXPECT_FALSE( NewAIOPreparedScan( 3 ) );
+    EXPECT_LT( aio_errno, 0 );
+}
+
+int main(int argc, char *argv[] )
+{
+    testing::InitGoogleTest(&argc, argv);
+    testing::TestEventListeners & listeners = testing::UnitTest::GetInstance()->listeners();
+#ifdef GTEST_TAP_PRINT_TO_STDOUT
+    delete listeners.Release(listeners.default_result_printer());
+#endif
+
+    return RUN_ALL_TESTS();
+}
+
+#endif
@@ -0,0 +1,58 @@
+/**
+ * @file   AIOPreparedScan.h
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  Immediate A/D scans with the configuration applied up front
+ *
+ */
+
+#ifndef _AIO_PREPARED_SCAN_H
+#define _AIO_PREPARED_SCAN_H
+
+#include "AIOTypes.h"
+#include "ADCConfigBlock.h"
+#include "AIOHostCal.h"
+
+#ifdef __aiousb_cplusplus
+namespace AIOUSB
+{
+#endif
+
+/* BEGIN AIOUSB_API */
+typedef struct aio_prepared_scan {
+    unsigned long DeviceIndex;
+    ADCConfigBlock savedConfig;         /**< registers put back by DeleteAIOPreparedScan() */
+    ADCConfigBlock scanConfig;          /**< registers every scan runs with */
+    unsigned startChannel;
+    int numChannels;
+    int samplesPerChannel;
+    unsigned numSamples;
+    AIOUSB_BOOL discardFirstSample;
+    AIOUSB_BOOL pipelined;
+    AIOUSB_BOOL inFlight;               /**< a scan has been triggered but not read back */
+    unsigned short *sampleBuffer;
+    unsigned short *counts;
+    double *minVolts;
+    double *rangeVolts;
+    AIOHostCalChannel *hostCal;         /**< per channel, when the device had a host calibration attached */
+    unsigned long scans;
+} AIOPreparedScan;
+
+PUBLIC_EXTERN AIOPreparedScan *NewAIOPreparedScan( unsigned long DeviceIndex );
+PUBLIC_EXTERN AIORET_TYPE DeleteAIOPreparedScan( AIOPreparedScan *scan );
+
+PUBLIC_EXTERN AIORET_TYPE AIOPreparedScanSetPipelined( AIOPreparedScan *scan, AIOUSB_BOOL pipelined );
+PUBLIC_EXTERN AIORET_TYPE AIOPreparedScanGetPipelined( AIOPreparedScan *scan );
+PUBLIC_EXTERN AIORET_TYPE AIOPreparedScanGetStartChannel( AIOPreparedScan *scan );
+PUBLIC_EXTERN AIORET_TYPE AIOPreparedScanGetNumChannels( AIOPreparedScan *scan );
+
+PUBLIC_EXTERN AIORET_TYPE AIOPreparedScanGetScan( AIOPreparedScan *scan, unsigned short *pBuf );
+PUBLIC_EXTERN AIORET_TYPE AIOPreparedScanGetScanV( AIOPreparedScan *scan, double *pBuf );
+/* END AIOUSB_API */
+
+#ifdef __aiousb_cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,385 @@
+/**
+ * @file   AIOPropertyCache.c
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  On-disk cache of the static properties read from each board
+ *
+ * The board name, the firmware 2.0 flag and the plug-and-play block never
+ * change for a given board and firmware, yet each costs a control
+ * transfer to read. When AIOUSB_SetPropertyCache() names a file, the
+ * first read of those properties stores them there keyed by serial
+ * number. Later runs answer from the file after a single serial number
+ * read. A record is only used while the board's product ID and
+ * firmware version (bcdDevice) still match; otherwise the board is
+ * probed again and the record replaced.
+ *
+ * The file is JSON: an array of
+ * @verbatim
+ * { "serial":"00000000a1b2c3d4", "product_id":32833, "firmware":512,
+ *   "name":"USB-AI16-16A", "firmware20":true, "pnp":"0e0001..." }
+ * @endverbatim
+ * Serial numbers and the plug-and-play block are hex strings since JSON
+ * numbers can't hold 64 bits.
+ */
+
+#include "AIOPropertyCache.h"
+#include "AIODeviceTable.h"
+#include "AIOUSB_Properties.h"
+#include "cJSON.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#ifdef __cplusplus
+namespace AIOUSB {
+#endif
+
+static pthread_mutex_t propertyCacheLock = PTHREAD_MUTEX_INITIALIZER;
+static char *propertyCachePath = NULL;
+static cJSON *propertyCache = NULL;     /**< array of records, NULL when disabled */
+
+/*----------------------------------------------------------------------------*/
+static char *_read_file( const char *path )
+{
+    FILE *fp = fopen( path, "r" );
+    char *buf = NULL;
+    long size;
+    if ( !fp )
+        return NULL;
+    if ( fseek( fp, 0, SEEK_END ) == 0 && ( size = ftell( fp ) ) >= 0 && fseek( fp, 0, SEEK_SET ) == 0 ) {
+        buf = (char *)calloc( size + 1, 1 );
+        if ( buf && fread( buf, 1, size, fp ) != (size_t)size ) {
+            free( buf );
+            buf = NULL;
+        }
+    }
+    fclose( fp );
+    return buf;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Writes the cache next to its final name and renames it over, so a
+ * crash never leaves a truncated file behind
+ */
+static AIORESULT _write_cache(void)
+{
+    AIORESULT result = AIOUSB_SUCCESS;
+    char *text = cJSON_Print( propertyCache );
+    char *tmppath = NULL;
+    FILE *fp;
+    if ( !text || asprintf( &tmppath, "%s.tmp", propertyCachePath ) < 0 ) {
+        tmppath = NULL;
+        result = AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+        goto out_write_cache;
+    }
+    if ( !( fp = fopen( tmppath, "w" ) ) ) {
+        result = AIOUSB_ERROR_FILE_NOT_FOUND;
+        goto out_write_cache;
+    }
+    if ( fputs( text, fp ) < 0 )
+        result = AIOUSB_ERROR_FILE_NOT_FOUND;
+    if ( fclose( fp ) != 0 )
+        result = AIOUSB_ERROR_FILE_NOT_FOUND;
+    if ( result == AIOUSB_SUCCESS && rename( tmppath, propertyCachePath ) != 0 )
+        result = AIOUSB_ERROR_FILE_NOT_FOUND;
+
+ out_write_cache:
+    free( text );
+    free( tmppath );
+    return result;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Turns the cache on, loading any records already in path
+ * @param path cache file, created on the first store; NULL turns the
+ *        cache off
+ * @return AIOUSB_SUCCESS, or < 0 if path exists but isn't a cache file
+ */
+AIORET_TYPE AIOUSB_SetPropertyCache( const char *path )
+{
+    AIORET_TYPE retval = AIOUSB_SUCCESS;
+    cJSON *records = NULL;
+
+    if ( path ) {
+        char *text = _read_file( path );
+        if ( text ) {
+            records = cJSON_Parse( text );
+            free( text );
+            AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_INVALID_DATA, records && records->type == cJSON_Array );
+        } else {
+            records = cJSON_CreateArray();
+        }
+        AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_NOT_ENOUGH_MEMORY, records );
+    }
+
+    pthread_mutex_lock( &propertyCacheLock );
+    if ( propertyCache )
+        cJSON_Delete( propertyCache );
+    free( propertyCachePath );
+    propertyCache = records;
+    propertyCachePath = path ? strdup( path ) : NULL;
+    pthread_mutex_unlock( &propertyCacheLock );
+
+    return retval;
+}
+
+/*----------------------------------------------------------------------------*/
+const char *AIOUSB_GetPropertyCache(void)
+{
+    return propertyCachePath;
+}
+
+/*----------------------------------------------------------------------------*/
+static int _find_record( uint64_t serialNumber )
+{
+    char serial[17];
+    snprintf( serial, sizeof(serial), "%016llx", (unsigned long long)serialNumber );
+    for ( int i = 0; i < cJSON_GetArraySize( propertyCache ); i ++ ) {
+        cJSON *tmp = cJSON_GetObjectItem( cJSON_GetArrayItem( propertyCache, i ), "serial" );
+        if ( tmp && tmp->valuestring && strcmp( tmp->valuestring, serial ) == 0 )
+            return i;
+    }
+    return -1;
+}
+
+static int _firmware_version( AIOUSBDevice *device )
+{
+    USBDevice *usb = AIOUSBDeviceGetUSBHandle( device );
+    return usb ? usb->deviceDesc.bcdDevice : 0;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Fills in the name, firmware 2.0 flag and plug-and-play block of a
+ * device from its cache record
+ * @return AIOUSB_SUCCESS if a valid record was applied,
+ *         -AIOUSB_ERROR_NOT_SUPPORTED if the cache is off,
+ *         -AIOUSB_ERROR_FILE_NOT_FOUND if there is no record for the
+ *         board, -AIOUSB_ERROR_INVALID_DATA if the record is stale
+ */
+AIORET_TYPE AIOPropertyCacheApply( unsigned long DeviceIndex )
+{
+    AIORET_TYPE retval = AIOUSB_SUCCESS;
+    AIORESULT result = AIOUSB_SUCCESS;
+    uint64_t serialNumber = 0;
+    cJSON *record, *tmp;
+    int i;
+
+    if ( !propertyCache )
+        return -AIOUSB_ERROR_NOT_SUPPORTED;
+    AIOUSBDevice *device = AIODeviceTableGetDeviceAtIndex( DeviceIndex, &result );
+    AIO_ERROR_VALID_DATA( -(AIORET_TYPE)result, result == AIOUSB_SUCCESS );
+    result = GetDeviceSerialNumber( DeviceIndex, &serialNumber );
+    AIO_ERROR_VALID_DATA( -(AIORET_TYPE)result, result == AIOUSB_SUCCESS );
+
+    pthread_mutex_lock( &propertyCacheLock );
+    if ( !propertyCache || ( i = _find_record( serialNumber ) ) < 0 ) {
+        retval = -AIOUSB_ERROR_FILE_NOT_FOUND;
+        goto out_AIOPropertyCacheApply;
+    }
+    record = cJSON_GetArrayItem( propertyCache, i );
+    if ( !( tmp = cJSON_GetObjectItem( record, "product_id" ) ) || (unsigned long)cJSON_AsInteger( tmp ) != device->ProductID ||
+         !( tmp = cJSON_GetObjectItem( record, "firmware" ) ) || cJSON_AsInteger( tmp ) != _firmware_version( device ) ) {
+        retval = -AIOUSB_ERROR_INVALID_DATA;
+        goto out_AIOPropertyCacheApply;
+    }
+
+    if ( !device->cachedName && ( tmp = cJSON_GetObjectItem( record, "name" ) ) && tmp->valuestring ) {
+        char *name = (char *)calloc( CYPRESS_MAX_DESC_SIZE + 2, 1 );
+        if ( name ) {
+            strncpy( name, tmp->valuestring, AIOUSB_MAX_NAME_SIZE );
+            device->cachedName = name;
+        }
+    }
+
+    if ( !device->PNPProbed && ( tmp = cJSON_GetObjectItem( record, "pnp" ) ) && tmp->valuestring &&
+         strlen( tmp->valuestring ) == 2 * sizeof(AIOPlugNPlay) ) {
+        unsigned char *pnp = (unsigned char *)&device->PNPData;
+        for ( size_t j = 0; j < sizeof(AIOPlugNPlay); j ++ ) {
+            unsigned int byte;
+            sscanf( &tmp->valuestring[2*j], "%2x", &byte );
+            pnp[j] = (unsigned char)byte;
+        }
+        tmp = cJSON_GetObjectItem( record, "firmware20" );
+        device->bFirmware20 = ( tmp && tmp->type == cJSON_True ) ? AIOUSB_TRUE : AIOUSB_FALSE;
+        device->PNPProbed = AIOUSB_TRUE;
+    }
+
+ out_AIOPropertyCacheApply:
+    pthread_mutex_unlock( &propertyCacheLock );
+    return retval;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Records whatever static properties have been read from the board
+ * so far, replacing any earlier record for its serial number
+ */
+AIORET_TYPE AIOPropertyCacheStore( unsigned long DeviceIndex )
+{
+    AIORET_TYPE retval = AIOUSB_SUCCESS;
+    AIORESULT result = AIOUSB_SUCCESS;
+    uint64_t serialNumber = 0;
+    char hex[ 2 * sizeof(AIOPlugNPlay) + 1 ];
+    int i;
+
+    if ( !propertyCache )
+        return -AIOUSB_ERROR_NOT_SUPPORTED;
+    AIOUSBDevice *device = AIODeviceTableGetDeviceAtIndex( DeviceIndex, &result );
+    AIO_ERROR_VALID_DATA( -(AIORET_TYPE)result, result == AIOUSB_SUCCESS );
+    result = GetDeviceSerialNumber( DeviceIndex, &serialNumber );
+    AIO_ERROR_VALID_DATA( -(AIORET_TYPE)result, result == AIOUSB_SUCCESS );
+
+    cJSON *record = cJSON_CreateObject();
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_NOT_ENOUGH_MEMORY, record );
+    snprintf( hex, sizeof(hex), "%016llx", (unsigned long long)serialNumber );
+    cJSON_AddItemToObject( record, "serial", cJSON_CreateString( hex ) );
+    cJSON_AddItemToObject( record, "product_id", cJSON_CreateNumber( device->ProductID ) );
+    cJSON_AddItemToObject( record, "firmware", cJSON_CreateNumber( _firmware_version( device ) ) );
+    if ( device->cachedName )
+        cJSON_AddItemToObject( record, "name", cJSON_CreateString( device->cachedName ) );
+    if ( device->PNPProbed ) {
+        const unsigned char *pnp = (const unsigned char *)&device->PNPData;
+        for ( size_t j = 0; j < sizeof(AIOPlugNPlay); j ++ )
+            sprintf( &hex[2*j], "%02x", pnp[j] );
+        cJSON_AddItemToObject( record, "firmware20", cJSON_CreateBool( device->bFirmware20 ) );
+        cJSON_AddItemToObject( record, "pnp", cJSON_CreateString( hex ) );
+    }
+
+    pthread_mutex_lock( &propertyCacheLock );
+    if ( !propertyCache ) {
+        cJSON_Delete( record );
+        retval = -AIOUSB_ERROR_NOT_SUPPORTED;
+    } else {
+        if ( ( i = _find_record( serialNumber ) ) >= 0 )
+            cJSON_ReplaceItemInArray( propertyCache, i, record );
+        else
+            cJSON_AddItemToArray( propertyCache, record );
+        result = _write_cache();
+        if ( result != AIOUSB_SUCCESS )
+            retval = -(AIORET_TYPE)result;
+    }
+    pthread_mutex_unlock( &propertyCacheLock );
+
+    return retval;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#ifdef SELF_TEST
+
+#include "AIOUSBDevice.h"
+#include "gtest/gtest.h"
+#include <unistd.h>
+
+using namespace AIOUSB;
+
+static int serial_reads = 0, name_reads = 0, pnp_reads = 0;
+static int fake_transfer( USBDevice *usb, uint8_t request_type, uint8_t bRequest, uint16_t wValue, uint16_t wIndex, unsigned char *data, uint16_t wLength, unsigned int timeout )
+{
+    if ( bRequest == AUR_EEPROM_READ && wValue == EEPROM_SERIAL_NUMBER_ADDRESS ) {
+        uint64_t serial = 0xa1b2c3d4;
+        memcpy( data, &serial, sizeof(serial) );
+        serial_reads ++;
+        return wLength;
+    } else if ( bRequest == CYPRESS_GET_DESC ) {
+        const char name[] = "USB-AI16-16E";
+        memset( data, 0, wLength );
+        data[0] = 2 + 2 * strlen(name);
+        for ( size_t i = 0; i < strlen(name); i ++ )
+            data[2 + 2*i] = name[i];
+        name_reads ++;
+        return wLength;
+    } else if ( bRequest == CUR_RAM_READ ) {
+        unsigned char memflags[3] = { 3, 0, 2 };
+        memcpy( data, memflags, sizeof(memflags) );
+        pnp_reads ++;
+        return wLength;
+    } else if ( bRequest == 0x3F ) {
+        memset( data, 0, wLength );
+        data[0] = wLength;
+        data[wLength-1] = 1;    /* HasDIOWrite1 */
+        pnp_reads ++;
+        return wLength;
+    }
+    return LIBUSB_ERROR_IO;
+}
+
+TEST(PropertyCache, SecondRunReadsOnlyTheSerialNumber )
+{
+    char path[] = "/tmp/aiousb_property_cacheXXXXXX";
+    int fd = mkstemp( path );
+    ASSERT_GE( fd, 0 );
+    close( fd );
+    unlink( path );
+
+    USBDevice usb;
+    memset( &usb, 0, sizeof(usb) );
+    usb.usb_control_transfer = fake_transfer;
+    usb.deviceDesc.bcdDevice = 0x0200;
+    int numDevices = 0;
+    AIORESULT result;
+
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOUSB_SetPropertyCache( path ) );
+    AIODeviceTableInit();
+    AIODeviceTableAddDeviceToDeviceTableWithUSBDevice( &numDevices, USB_AI16_16E, &usb );
+    EXPECT_EQ( 0, pnp_reads ) << "Plug-and-play data is read on first use";
+
+    EXPECT_STREQ( "USB-AI16-16E", GetSafeDeviceName( 0 ) );
+    EXPECT_EQ( AIOUSB_SUCCESS, EnsurePNPData( 0 ) );
+    EXPECT_EQ( 1, name_reads );
+    EXPECT_EQ( 2, pnp_reads );
+    EXPECT_EQ( 1, serial_reads );
+
+    /* next run */
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOUSB_SetPropertyCache( path ) );
+    AIODeviceTableGetDeviceAtIndex( 0, &result )->usb_device = NULL;
+    AIODeviceTableInit();
+    numDevices = 0;
+    serial_reads = name_reads = pnp_reads = 0;
+    AIODeviceTableAddDeviceToDeviceTableWithUSBDevice( &numDevices, USB_AI16_16E, &usb );
+    EXPECT_STREQ( "USB-AI16-16E", GetSafeDeviceName( 0 ) );
+    EXPECT_EQ( AIOUSB_SUCCESS, EnsurePNPData( 0 ) );
+    AIOUSBDevice *dev = AIODeviceTableGetDeviceAtIndex( 0, &result );
+    EXPECT_TRUE( dev->bFirmware20 );
+    EXPECT_EQ( 1, dev->PNPData.HasDIOWrite1 );
+    EXPECT_EQ( 0, name_reads );
+    EXPECT_EQ( 0, pnp_reads );
+    EXPECT_EQ( 1, serial_reads );
+
+    /* new firmware invalidates the record */
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOUSB_SetPropertyCache( path ) );
+    dev->usb_device = NULL;
+    AIODeviceTableInit();
+    numDevices = 0;
+    usb.deviceDesc.bcdDevice = 0x0201;
+    AIODeviceTableAddDeviceToDeviceTableWithUSBDevice( &numDevices, USB_AI16_16E, &usb );
+    EXPECT_EQ( AIOUSB_SUCCESS, EnsurePNPData( 0 ) );
+    EXPECT_EQ( 2, pnp_reads );
+
+    AIOUSB_SetPropertyCache( NULL );
+    unlink( path );
+    dev = AIODeviceTableGetDeviceAtIndex( 0, &result );
+    dev->usb_device = NULL;
+    ClearAIODeviceTable( numDevices );
+}
+
+int main(int argc, char *argv[] )
+{
+    testing::InitGoogleTest(&argc, argv);
+    testing::TestEventListeners & listeners = testing::UnitTest::GetInstance()->listeners();
+#ifdef GTEST_TAP_PRINT_TO_STDOUT
+    delete listeners.Release(listeners.default_result_printer());
+#endif
+
+    return RUN_ALL_TESTS();  
+}
+
+#endif
@@ -0,0 +1,31 @@
+/**
+ * @file   AIOPropertyCache.h
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  On-disk cache of the static properties read from each board
+ *
+ */
+
+#ifndef _AIO_PROPERTY_CACHE_H
+#define _AIO_PROPERTY_CACHE_H
+
+#include "AIOTypes.h"
+
+#ifdef __aiousb_cplusplus
+namespace AIOUSB
+{
+#endif
+
+/* BEGIN AIOUSB_API */
+PUBLIC_EXTERN AIORET_TYPE AIOUSB_SetPropertyCache( const char *path );
+PUBLIC_EXTERN const char *AIOUSB_GetPropertyCache(void);
+PUBLIC_EXTERN AIORET_TYPE AIOPropertyCacheApply( unsigned long DeviceIndex );
+PUBLIC_EXTERN AIORET_TYPE AIOPropertyCacheStore( unsigned long DeviceIndex );
+/* END AIOUSB_API */
+
+#ifdef __aiousb_cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,62 @@
+/**
+ * @file   AIOTime.h
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  Clock arithmetic shared by the library's worker threads
+ *
+ */
+
+#ifndef _AIO_TIME_H
+#define _AIO_TIME_H
+
+#include <stdint.h>
+#include <time.h>
+
+#ifdef __aiousb_cplusplus
+namespace AIOUSB
+{
+#endif
+
+#define AIO_NSEC_PER_SEC 1000000000ull
+
+/**
+ * @brief CLOCK_MONOTONIC in nanoseconds, for periods and timestamps
+ */
+static inline uint64_t AIOTimeNowNs( void )
+{
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return (uint64_t)now.tv_sec * AIO_NSEC_PER_SEC + now.tv_nsec;
+}
+
+/**
+ * @brief A nanosecond count from AIOTimeNowNs() as a timespec, for
+ * clock_nanosleep() and condition waits on CLOCK_MONOTONIC
+ */
+static inline void AIOTimeToTimespec( struct timespec *ts, uint64_t ns )
+{
+    ts->tv_sec  = (time_t)( ns / AIO_NSEC_PER_SEC );
+    ts->tv_nsec = (long)( ns % AIO_NSEC_PER_SEC );
+}
+
+/**
+ * @brief The absolute time timeout ms from now on clock, for a
+ * pthread_cond_timedwait() on a condition that uses that clock
+ */
+static inline void AIOTimeDeadline( struct timespec *deadline, clockid_t clock, unsigned timeout )
+{
+    clock_gettime( clock, deadline );
+    deadline->tv_sec  += timeout / 1000;
+    deadline->tv_nsec += (long)( timeout % 1000 ) * 1000000;
+    if ( deadline->tv_nsec >= (long)AIO_NSEC_PER_SEC ) {
+        deadline->tv_sec ++;
+        deadline->tv_nsec -= (long)AIO_NSEC_PER_SEC;
+    }
+}
+
+#ifdef __aiousb_cplusplus
+}
+#endif
+
+#endif
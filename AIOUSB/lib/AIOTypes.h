@@ -123,7 +123,7 @@ CREATE_ENUM_W_START( AIOContinuousBufMode, 0 ,
 typedef uint16_t AIOBufferType;
 
 enum {
-    MAX_USB_DEVICES               = 32
+    MAX_USB_DEVICES               = 32  /**< size of deviceTable[], the table grows in chunks of this many */
 };
 
 #define AIO_MAKE_ERROR(N) -1*labs(N)
@@ -390,6 +390,18 @@ CREATE_ENUM_W_START(DACRange,0,
                     DAC_RANGE_10V
                     );
 
+/**
+ * @brief bits of the samples passed to DACOutputFrameRaw(); EOM and LOOP
+ * together are reserved
+ */
+enum {
+    DAC_STREAM_COUNTS_MASK        = 0x0FFF,
+    DAC_STREAM_LOOP               = 0x1000, /**< jump back to the start of the board's buffer after this sample */
+    DAC_STREAM_EOD                = 0x2000, /**< last DAC of the point, the next sample goes to DAC 0 */
+    DAC_STREAM_EOF                = 0x4000, /**< pulse the frame pin */
+    DAC_STREAM_EOM                = 0x8000  /**< stop after this sample */
+};
+
 
 
 /**
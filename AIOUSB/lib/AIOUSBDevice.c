@@ -128,7 +128,7 @@ AIORET_TYPE _verify_device( AIOUSBDevice *dev )
     if ( dev->isInit != AIOUSB_TRUE )
         return AIOUSB_ERROR_INVALID_DATA;
 
-    if ( dev->deviceIndex < 0 || dev->deviceIndex > MAX_USB_DEVICES ) 
+    if ( dev->deviceIndex < 0 || dev->deviceIndex >= AIODeviceTableGetCapacity() ) 
         return AIOUSB_ERROR_INVALID_INDEX;
     /* other checks */
     return result;
@@ -180,6 +180,185 @@ AIORET_TYPE AIOUSBDeviceWriteADCConfig( AIOUSBDevice *device, ADCConfigBlock *co
 
 
 
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Write-through replacement for usb->usb_put_config(). The
+ * upload is skipped when the board already holds exactly these
+ * registers, which is the common case for the save / modify / restore
+ * sequences in the immediate A/D functions. The caller must hold
+ * device->lock for writing.
+ * @return number of bytes written (or that would have been written),
+ * negative on error, like USBDevicePutADCConfigBlock()
+ */
+int AIOUSBDevicePutADCConfigBlock( AIOUSBDevice *device, ADCConfigBlock *config )
+{
+    int retval;
+    AIO_ASSERT_RET( -AIOUSB_ERROR_INVALID_DEVICE, device );
+    AIO_ASSERT_RET( -AIOUSB_ERROR_INVALID_ADCCONFIG, config );
+    USBDevice *usb = AIOUSBDeviceGetUSBHandle( device );
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_INVALID_USBDEVICE, usb );
+
+    if ( device->deviceConfigBlock.size != 0 &&
+         device->deviceConfigBlock.size == config->size &&
+         memcmp( device->deviceConfigBlock.registers, config->registers, config->size ) == 0 ) {
+        device->configTransfersAvoided ++;
+        return (int)config->size;
+    }
+
+    retval = usb->usb_put_config( usb, config );
+    if ( retval >= 0 && config->testing != AIOUSB_TRUE ) {
+        memcpy( device->deviceConfigBlock.registers, config->registers, config->size );
+        device->deviceConfigBlock.size = config->size;
+    } else {
+        device->deviceConfigBlock.size = 0;
+    }
+    return retval;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Replacement for usb->usb_get_config() that answers from the
+ * register image last exchanged with the board, if there is one. The
+ * caller must hold device->lock for writing.
+ * @return AIOUSB_SUCCESS or an error, like USBDeviceFetchADCConfigBlock()
+ */
+int AIOUSBDeviceFetchADCConfigBlock( AIOUSBDevice *device, ADCConfigBlock *config )
+{
+    int retval;
+    AIO_ASSERT_RET( AIOUSB_ERROR_INVALID_DEVICE, device );
+    AIO_ASSERT_RET( AIOUSB_ERROR_INVALID_ADCCONFIG, config );
+    USBDevice *usb = AIOUSBDeviceGetUSBHandle( device );
+    AIO_ERROR_VALID_DATA( AIOUSB_ERROR_INVALID_USBDEVICE, usb );
+
+    if ( device->deviceConfigBlock.size != 0 && device->deviceConfigBlock.size == config->size ) {
+        memcpy( config->registers, device->deviceConfigBlock.registers, config->size );
+        device->configTransfersAvoided ++;
+        return AIOUSB_SUCCESS;
+    }
+
+    retval = usb->usb_get_config( usb, config );
+    if ( retval == AIOUSB_SUCCESS && config->testing != AIOUSB_TRUE ) {
+        memcpy( device->deviceConfigBlock.registers, config->registers, config->size );
+        device->deviceConfigBlock.size = config->size;
+    }
+    return retval;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Forgets what the board's registers and calibration SRAM hold,
+ * so that the next fetch, put or table load goes to the hardware. Needed
+ * after anything that can change them behind the library's back, such
+ * as a reset.
+ */
+AIORET_TYPE AIOUSBDeviceInvalidateADCConfigCache( AIOUSBDevice *device )
+{
+    AIO_ASSERT_RET( AIOUSB_ERROR_INVALID_DEVICE, device );
+    device->deviceConfigBlock.size = 0;
+    device->calTableMode = -1;
+    device->calAutoHash = 0;
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIOUSBDeviceGetConfigTransfersAvoided( AIOUSBDevice *device )
+{
+    AIO_ASSERT_RET( AIOUSB_ERROR_INVALID_DEVICE, device );
+    return (AIORET_TYPE)device->configTransfersAvoided;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIOUSBDeviceGetCalUploadsAvoided( AIOUSBDevice *device )
+{
+    AIO_ASSERT_RET( AIOUSB_ERROR_INVALID_DEVICE, device );
+    return (AIORET_TYPE)device->calUploadsAvoided;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Per-device locking. device->lock is a reader/writer lock over
+ * the A/D register images (cachedConfigBlock, deviceConfigBlock), the
+ * stream open flags and the DIO output image written by DIO_Write1(),
+ * DIO_Write8(), DIO_WriteAll() and the write batch; device->workerLock is the mutex behind the
+ * bulk acquire status. Each acquisition first tries the lock without
+ * blocking and counts a contention when it has to wait, so that
+ * AIOUSBDeviceGetLockContention() shows whether threads are actually
+ * getting in each other's way.
+ */
+AIORET_TYPE AIOUSBDeviceReadLock( AIOUSBDevice *device )
+{
+    AIO_ASSERT_RET( AIOUSB_ERROR_INVALID_DEVICE, device );
+    if ( pthread_rwlock_tryrdlock( &device->lock ) != 0 ) {
+        __sync_fetch_and_add( &device->lockContention, 1 );
+        pthread_rwlock_rdlock( &device->lock );
+    }
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIOUSBDeviceWriteLock( AIOUSBDevice *device )
+{
+    AIO_ASSERT_RET( AIOUSB_ERROR_INVALID_DEVICE, device );
+    if ( pthread_rwlock_trywrlock( &device->lock ) != 0 ) {
+        __sync_fetch_and_add( &device->lockContention, 1 );
+        pthread_rwlock_wrlock( &device->lock );
+    }
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIOUSBDeviceUnlock( AIOUSBDevice *device )
+{
+    AIO_ASSERT_RET( AIOUSB_ERROR_INVALID_DEVICE, device );
+    pthread_rwlock_unlock( &device->lock );
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIOUSBDeviceLockWorker( AIOUSBDevice *device )
+{
+    AIO_ASSERT_RET( AIOUSB_ERROR_INVALID_DEVICE, device );
+    if ( pthread_mutex_trylock( &device->workerLock ) != 0 ) {
+        __sync_fetch_and_add( &device->workerLockContention, 1 );
+        pthread_mutex_lock( &device->workerLock );
+    }
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIOUSBDeviceUnlockWorker( AIOUSBDevice *device )
+{
+    AIO_ASSERT_RET( AIOUSB_ERROR_INVALID_DEVICE, device );
+    pthread_mutex_unlock( &device->workerLock );
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIOUSBDeviceGetLockContention( AIOUSBDevice *device )
+{
+    AIO_ASSERT_RET( AIOUSB_ERROR_INVALID_DEVICE, device );
+    return (AIORET_TYPE)device->lockContention;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIOUSBDeviceGetWorkerLockContention( AIOUSBDevice *device )
+{
+    AIO_ASSERT_RET( AIOUSB_ERROR_INVALID_DEVICE, device );
+    return (AIORET_TYPE)device->workerLockContention;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief The immutable capabilities of the device's product. Devices
+ * built from JSON have no descriptor of their own, so it is looked up by
+ * product ID.
+ */
+const AIOProductDescriptor *AIOUSBDeviceGetProductDescriptor( AIOUSBDevice *device )
+{
+    AIO_ASSERT_RET( NULL, device );
+    return device->product ? device->product : AIOProductDescriptorForProductID( device->ProductID );
+}
+
 /*----------------------------------------------------------------------------*/
 AIORET_TYPE AIOUSBDeviceSetTesting( AIOUSBDevice *dev, AIOUSB_BOOL testing )
 {
@@ -373,6 +552,94 @@ TEST(TestingFeatures, PropogateTesting )
 }
 
 
+static int put_calls = 0, get_calls = 0;
+static int fake_put_config( USBDevice *usb, ADCConfigBlock *config ) { put_calls ++; return (int)config->size; }
+static int fake_get_config( USBDevice *usb, ADCConfigBlock *config ) { get_calls ++; memset(config->registers, 0, config->size ); return AIOUSB_SUCCESS; }
+static int fake_control_transfer( USBDevice *usb, uint8_t request_type, uint8_t bRequest, uint16_t wValue, uint16_t wIndex, unsigned char *data, uint16_t wLength, unsigned int timeout ) { return LIBUSB_ERROR_IO; }
+
+TEST(ConfigCache, SkipsRedundantTransfers )
+{
+    AIOUSBDevice *dev;
+    int numDevices = 0;
+    AIORESULT result;
+    USBDevice usb;
+    ADCConfigBlock config;
+
+    memset(&usb, 0, sizeof(usb));
+    usb.usb_put_config = fake_put_config;
+    usb.usb_get_config = fake_get_config;
+    usb.usb_control_transfer = fake_control_transfer;
+    put_calls = get_calls = 0;
+
+    AIODeviceTableInit();
+    AIODeviceTableAddDeviceToDeviceTableWithUSBDevice( &numDevices, USB_AIO16_16A, &usb );
+    dev = AIODeviceTableGetDeviceAtIndex( numDevices - 1, &result );
+    ASSERT_TRUE( dev );
+    ADCConfigBlockInitializeFromAIOUSBDevice( &config, dev );
+
+    EXPECT_EQ( AIOUSB_SUCCESS, AIOUSBDeviceFetchADCConfigBlock( dev, &config ) );
+    EXPECT_EQ( AIOUSB_SUCCESS, AIOUSBDeviceFetchADCConfigBlock( dev, &config ) );
+    EXPECT_EQ( 1, get_calls );
+
+    EXPECT_EQ( (int)config.size, AIOUSBDevicePutADCConfigBlock( dev, &config ) );
+    EXPECT_EQ( 0, put_calls );
+
+    config.registers[0] = 1;
+    EXPECT_EQ( (int)config.size, AIOUSBDevicePutADCConfigBlock( dev, &config ) );
+    EXPECT_EQ( (int)config.size, AIOUSBDevicePutADCConfigBlock( dev, &config ) );
+    EXPECT_EQ( 1, put_calls );
+    EXPECT_EQ( 3, AIOUSBDeviceGetConfigTransfersAvoided( dev ) );
+
+    AIOUSBDeviceInvalidateADCConfigCache( dev );
+    AIOUSBDeviceFetchADCConfigBlock( dev, &config );
+    EXPECT_EQ( 2, get_calls );
+    EXPECT_EQ( 0, config.registers[0] );
+
+    dev->usb_device = NULL;
+    ClearAIODeviceTable( numDevices );
+}
+
+static void *read_locker( void *arg )
+{
+    AIOUSBDevice *dev = (AIOUSBDevice *)arg;
+    AIOUSBDeviceReadLock( dev );
+    AIOUSBDeviceUnlock( dev );
+    return NULL;
+}
+
+TEST(Locking, CountsContention )
+{
+    AIOUSBDevice *dev;
+    int numDevices = 0;
+    AIORESULT result;
+    pthread_t reader;
+
+    AIODeviceTableInit();
+    AIODeviceTableAddDeviceToDeviceTableWithUSBDevice( &numDevices, USB_AIO16_16A, NULL );
+    dev = AIODeviceTableGetDeviceAtIndex( numDevices - 1, &result );
+    ASSERT_TRUE( dev );
+    EXPECT_EQ( 0, AIOUSBDeviceGetLockContention( dev ) );
+
+    AIOUSBDeviceReadLock( dev );
+    AIOUSBDeviceReadLock( dev );
+    EXPECT_EQ( 0, AIOUSBDeviceGetLockContention( dev ) ) << "Readers share the lock";
+    AIOUSBDeviceUnlock( dev );
+    AIOUSBDeviceUnlock( dev );
+
+    AIOUSBDeviceWriteLock( dev );
+    pthread_create( &reader, NULL, read_locker, dev );
+    while ( AIOUSBDeviceGetLockContention( dev ) == 0 )
+        usleep( 1000 );
+    AIOUSBDeviceUnlock( dev );
+    pthread_join( reader, NULL );
+    EXPECT_EQ( 1, AIOUSBDeviceGetLockContention( dev ) );
+
+    AIOUSBDeviceLockWorker( dev );
+    AIOUSBDeviceUnlockWorker( dev );
+    EXPECT_EQ( 0, AIOUSBDeviceGetWorkerLockContention( dev ) );
+
+    ClearAIODeviceTable( numDevices );
+}
 
 int main(int argc, char *argv[] )
 {
@@ -17,9 +17,55 @@ namespace AIOUSB
 #endif
 
 
+/**
+ * @brief Capability flags of an AIOProductDescriptor
+ */
+enum {
+    AIO_CAP_GET_NAME          = 1 << 0,  /**< board returns its own name */
+    AIO_CAP_CUSTOM_CLOCKS     = 1 << 1,
+    AIO_CAP_DIO_DEBOUNCE      = 1 << 2,
+    AIO_CAP_GATE_SELECTABLE   = 1 << 3,
+    AIO_CAP_DAC_STREAM        = 1 << 4,
+    AIO_CAP_DAC_DIO_CLOCK     = 1 << 5,
+    AIO_CAP_DAC_BOARD_RANGE   = 1 << 6,
+    AIO_CAP_DAC_CHANNEL_CAL   = 1 << 7,
+    AIO_CAP_ADC_STREAM        = 1 << 8,
+    AIO_CAP_DIO_STREAM        = 1 << 9,
+    AIO_CAP_DIO_SPI           = 1 << 10,
+    AIO_CAP_CLEAR_FIFO        = 1 << 11
+};
+
+/**
+ * @brief What a product can do, fixed by its product ID. One row of the
+ * table in AIODeviceTable.c covers a run of product IDs that share every
+ * capability; AIOProductDescriptorForProductID() finds it.
+ */
+typedef struct AIOProductDescriptor {
+    unsigned long firstProductID;
+    unsigned long lastProductID;
+    unsigned flags;             /**< AIO_CAP_* */
+    unsigned DIOBytes;
+    unsigned long DIOConfigBits;
+    unsigned Tristates;
+    unsigned Counters;
+    long RootClock;
+    unsigned WDGBytes;
+    unsigned ADCChannels;
+    unsigned ADCMUXChannels;
+    unsigned ADCChannelsPerGroup;
+    unsigned long ConfigBytes;
+    unsigned char RangeShift;
+    unsigned ImmADCs;
+    unsigned ImmDACs;
+    unsigned DACsUsed;
+    unsigned FlashSectors;
+} AIOProductDescriptor;
 
 struct AIOUSBDevice {
     USBDevice *usb_device;
+    USBDevice **retiredUsbDevices;      /**< handles replaced on reattach; closed, but freed only when the slot is cleared */
+    unsigned numRetiredUsbDevices;
+    const AIOProductDescriptor *product; /**< never NULL once the slot is set up; the fields below start as a copy */
     AIOUSB_BOOL bOpen;
     int deviceIndex;
     AIOUSB_BOOL isInit;
@@ -80,8 +126,17 @@ struct AIOUSBDevice {
     AIOUSB_BOOL bDeviceWasHere;
     unsigned char *LastDIOData;
     char *cachedName;
-    unsigned long cachedSerialNumber;
+    uint64_t cachedSerialNumber;     /**< 0 == not read from the board yet */
     ADCConfigBlock cachedConfigBlock; /**< .size == 0 == uninitialized */
+    ADCConfigBlock deviceConfigBlock; /**< registers last written to / read from the board, .size == 0 == unknown */
+    unsigned long configTransfersAvoided; /**< config control transfers skipped because deviceConfigBlock already matched */
+    uint64_t calTableHash;      /**< AIOCalTableHash() of the table last loaded into the board's SRAM */
+    int calTableMode;           /**< AD_CONFIG_CAL_MODE it was loaded under, -1 == unknown */
+    uint64_t calAutoHash;       /**< hash of the cached :AUTO: tables last loaded as a set, 0 == none */
+    unsigned long calUploadsAvoided; /**< calibration uploads skipped because the board already held the table */
+    struct AIOHostCal *hostCal; /**< host-side calibration used when converting to volts, NULL == nominal */
+    pthread_rwlock_t lock;      /**< guards the config blocks above, the stream open flags and LastDIOData writes */
+    unsigned long lockContention; /**< times a thread had to wait for lock */
 
     /**
      * state of worker thread; these fields are deliberately unspecific so that
@@ -90,6 +145,18 @@ struct AIOUSBDevice {
     AIOUSB_BOOL workerBusy;     /**< AIOUSB_TRUE == worker thread is busy */
     unsigned long workerStatus; /**< thread-defined status information (e.g. bytes remaining to receive or transmit) */
     unsigned long workerResult; /**< standard AIOUSB_* result code from worker thread (if workerBusy == AIOUSB_FALSE) */
+    pthread_mutex_t workerLock; /**< guards the three fields above */
+    unsigned long workerLockContention; /**< times a thread had to wait for workerLock */
+    pthread_cond_t workerDone;  /**< broadcast whenever workerBusy goes AIOUSB_FALSE */
+    AIOUSB_BOOL locksInitialized; /**< lock, workerLock and workerDone are set up; they live as long as the slot */
+    int workerEventFd;          /**< eventfd bumped on completion, valid if workerEventFdOpen */
+    AIOUSB_BOOL workerEventFdOpen;
+    void (*workerCallback)( unsigned long DeviceIndex, unsigned long result, void *userdata );
+    void *workerCallbackData;
+    struct aio_bulk_worker *bulkWorker; /**< ADC_BulkAcquire() threads, NULL until first used */
+    struct aio_dio_stream_worker *dioStreamWorker; /**< DIO_StreamFrameAsync() thread, NULL until first used */
+    struct aio_dio_batch *dioBatch; /**< DIO_Write1/Write8 coalescing, NULL until first used */
+    struct aio_dac_stream *dacStream; /**< DACOutputOpen() thread and blocks, NULL while closed */
 
     /** New entries for the FastIT behavior */
     ADCConfigBlock *FastITConfig;
@@ -104,7 +171,8 @@ struct AIOUSBDevice {
     AIOUSB_BOOL bFirmware20;
     USB_SPEED USBSpeed;
     AIOPlugNPlay PNPData;
-    
+    AIOUSB_BOOL PNPProbed;      /**< AIOUSB_TRUE once bFirmware20 and PNPData are known, see EnsurePNPData() */
+
 };
 /* unsigned long PNPData; */
 /* USBSpeed: TUSBSpeed; */
@@ -137,6 +205,19 @@ PUBLIC_EXTERN AIORET_TYPE AIOUSBDeviceSetDiscardFirstSample( AIOUSBDevice *devic
 PUBLIC_EXTERN AIORET_TYPE AIOUSBDeviceSetTimeout( AIOUSBDevice *device, unsigned timeout );
 PUBLIC_EXTERN AIORET_TYPE AIOUSBDeviceGetTimeout( AIOUSBDevice *device );
 PUBLIC_EXTERN AIORET_TYPE AIOUSBDeviceWriteADCConfig( AIOUSBDevice *device, ADCConfigBlock *config );
+PUBLIC_EXTERN int AIOUSBDevicePutADCConfigBlock( AIOUSBDevice *device, ADCConfigBlock *config );
+PUBLIC_EXTERN int AIOUSBDeviceFetchADCConfigBlock( AIOUSBDevice *device, ADCConfigBlock *config );
+PUBLIC_EXTERN AIORET_TYPE AIOUSBDeviceInvalidateADCConfigCache( AIOUSBDevice *device );
+PUBLIC_EXTERN AIORET_TYPE AIOUSBDeviceGetConfigTransfersAvoided( AIOUSBDevice *device );
+PUBLIC_EXTERN AIORET_TYPE AIOUSBDeviceGetCalUploadsAvoided( AIOUSBDevice *device );
+PUBLIC_EXTERN AIORET_TYPE AIOUSBDeviceReadLock( AIOUSBDevice *device );
+PUBLIC_EXTERN AIORET_TYPE AIOUSBDeviceWriteLock( AIOUSBDevice *device );
+PUBLIC_EXTERN AIORET_TYPE AIOUSBDeviceUnlock( AIOUSBDevice *device );
+PUBLIC_EXTERN AIORET_TYPE AIOUSBDeviceLockWorker( AIOUSBDevice *device );
+PUBLIC_EXTERN AIORET_TYPE AIOUSBDeviceUnlockWorker( AIOUSBDevice *device );
+PUBLIC_EXTERN AIORET_TYPE AIOUSBDeviceGetLockContention( AIOUSBDevice *device );
+PUBLIC_EXTERN AIORET_TYPE AIOUSBDeviceGetWorkerLockContention( AIOUSBDevice *device );
+PUBLIC_EXTERN const AIOProductDescriptor *AIOUSBDeviceGetProductDescriptor( AIOUSBDevice *device );
 /* END AIOUSB_API */
 
 #ifdef __aiousb_cplusplus
@@ -12,12 +12,18 @@
 #include "AIOTypes.h"
 #include "AIODeviceTable.h"
 #include "AIOUSB_Core.h"
+#include "AIOUSB_Properties.h"
+#include "AIOCalCache.h"
+#include "AIOHostCal.h"
+#include "AIOTime.h"
 #include <assert.h>
 #include <math.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <errno.h>
 #include <time.h>
 
 
@@ -37,9 +43,6 @@ struct ADRange adRanges[ AD_NUM_GAIN_CODES ] = {
   { -1  , 2  }                  /* AD_GAIN_CODE_1V     */  
 };
 
-AIORET_TYPE adc_get_bulk_data( ADCConfigBlock *config,USBDevice *usb,  unsigned char endpoint, 
-                               unsigned char *data, int datasize,int *bytes, unsigned timeout  );
-
 
 // formerly public in the API
 static unsigned long ADC_GetImmediate(
@@ -55,6 +58,9 @@ unsigned long ADC_ResetDevice( unsigned long DeviceIndex  )
     int wIndex = 1;
     int timeout = 1000;
     unsigned char data[1];
+    AIOUSBDevice *deviceDesc = AIODeviceTableGetDeviceAtIndex( DeviceIndex, &result );
+    if ( result != AIOUSB_SUCCESS ) 
+        return result ;
     USBDevice *usb = AIODeviceTableGetUSBDeviceAtIndex( DeviceIndex, &result );
     if ( result != AIOUSB_SUCCESS ) 
         return result ;
@@ -72,6 +78,10 @@ unsigned long ADC_ResetDevice( unsigned long DeviceIndex  )
     if ( result <= AIOUSB_SUCCESS )
         goto out_ADC_ResetDevice;
 
+    AIOUSBDeviceWriteLock( deviceDesc );
+    AIOUSBDeviceInvalidateADCConfigCache( deviceDesc );
+    AIOUSBDeviceUnlock( deviceDesc );
+
     data[0] = 0;
     sleep(2);
     result = usb->usb_control_transfer(usb,
@@ -125,6 +135,48 @@ out_ADC_ReadADConfigBlock:
 
 }
 
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Number of A/D configuration control transfers that were
+ * skipped because the board already held the requested registers
+ * @param DeviceIndex
+ * @return count of transfers avoided, or negative error
+ */
+AIORET_TYPE ADC_GetConfigTransfersAvoided( unsigned long DeviceIndex )
+{
+    AIORESULT result = AIOUSB_SUCCESS;
+    AIOUSBDevice *deviceDesc = AIODeviceTableGetDeviceAtIndex( DeviceIndex , &result );
+    AIO_ERROR_VALID_DATA( -(AIORET_TYPE)result, result == AIOUSB_SUCCESS );
+
+    return AIOUSBDeviceGetConfigTransfersAvoided( deviceDesc );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Has ADC_GetScanV(), ADC_GetChannelV(), prepared scans and
+ * continuous acquisitions started afterwards convert this board's counts
+ * through a host-side calibration. Works on boards with or without
+ * calibration SRAM; on those with it, it is applied on top of whatever
+ * ADC_SetCal() loaded.
+ * @param DeviceIndex
+ * @param cal the calibration, which must stay alive while attached, or
+ *        NULL for the nominal scaling
+ * @return AIOUSB_SUCCESS or a negated error
+ */
+AIORET_TYPE ADC_SetHostCal( unsigned long DeviceIndex, AIOHostCal *cal )
+{
+    AIORESULT result = AIOUSB_SUCCESS;
+    AIOUSBDevice *deviceDesc = AIODeviceTableGetDeviceAtIndex( DeviceIndex , &result );
+    AIO_ERROR_VALID_DATA( -(AIORET_TYPE)result, result == AIOUSB_SUCCESS );
+    if ( deviceDesc->ADCMUXChannels == 0 )
+        return -AIOUSB_ERROR_NOT_SUPPORTED;
+
+    AIOUSBDeviceWriteLock( deviceDesc );
+    deviceDesc->hostCal = cal;
+    AIOUSBDeviceUnlock( deviceDesc );
+    return AIOUSB_SUCCESS;
+}
+
 /*----------------------------------------------------------------------------*/
 /**
  * @brief
@@ -141,32 +193,29 @@ unsigned long ReadConfigBlock(unsigned long DeviceIndex,
     if ( result  != AIOUSB_SUCCESS )
         return result;
 
+    AIOUSBDeviceWriteLock( deviceDesc );
     configBlock = *(ADCConfigBlock*)AIOUSBDeviceGetADCConfigBlock( deviceDesc );
     if ( !configBlock.device )
         configBlock.device = deviceDesc;
 
     if (forceRead || deviceDesc->cachedConfigBlock.size == 0) {
-        USBDevice *usb = AIODeviceTableGetUSBDeviceAtIndex( DeviceIndex, &result );
+        AIODeviceTableGetUSBDeviceAtIndex( DeviceIndex, &result );
         if ( result != AIOUSB_SUCCESS )
-            return result;
+            goto out_ReadConfigBlock;
 
         ADCConfigBlockInitializeFromAIOUSBDevice( &configBlock, configBlock.device );
 
         if ( configBlock.testing != AIOUSB_TRUE ) {
-            int bytesTransferred = usb->usb_control_transfer(usb,
-                                                             USB_READ_FROM_DEVICE,
-                                                             AUR_ADC_GET_CONFIG,
-                                                             0,
-                                                             0,
-                                                             configBlock.registers,
-                                                             configBlock.size,
-                                                             deviceDesc->commTimeout
-                                                             );
-
-            if ( bytesTransferred != ( int ) configBlock.size) {
-                result = LIBUSB_RESULT_TO_AIOUSB_RESULT(bytesTransferred);
+            /**
+             * forceRead means the caller wants what is really on the
+             * board, so don't let the register cache answer
+             */
+            if ( forceRead )
+                AIOUSBDeviceInvalidateADCConfigCache( deviceDesc );
+
+            result = AIOUSBDeviceFetchADCConfigBlock( deviceDesc, &configBlock );
+            if ( result != AIOUSB_SUCCESS )
                 goto out_ReadConfigBlock;
-            }
             /*
              * check and correct settings read from device
              */
@@ -175,6 +224,7 @@ unsigned long ReadConfigBlock(unsigned long DeviceIndex,
         }
     }
  out_ReadConfigBlock:
+    AIOUSBDeviceUnlock( deviceDesc );
 
     return result;
 }
@@ -191,37 +241,29 @@ unsigned long WriteConfigBlock(unsigned long DeviceIndex)
     ADConfigBlock *configBlock;
     AIORESULT result = AIOUSB_SUCCESS;
     AIOUSBDevice *deviceDesc =  AIODeviceTableGetDeviceAtIndex( DeviceIndex , &result );
-    USBDevice *usb;
     int bytesTransferred;
     if ( result  != AIOUSB_SUCCESS )
         return result;
 
 
     configBlock = AIOUSB_GetConfigBlock( AIOUSB_GetDevice( DeviceIndex ));
-    if (!configBlock ) {
-        result = AIOUSB_ERROR_INVALID_ADCCONFIG_SETTING;
-        goto out_WriteConfigBlock;
-    }
+    if (!configBlock )
+        return AIOUSB_ERROR_INVALID_ADCCONFIG_SETTING;
+
+    AIOUSBDeviceWriteLock( deviceDesc );
 
     if ( configBlock->testing != AIOUSB_TRUE ) {
-        usb = AIODeviceTableGetUSBDeviceAtIndex( DeviceIndex, &result );
+        AIODeviceTableGetUSBDeviceAtIndex( DeviceIndex, &result );
         if ( result  != AIOUSB_SUCCESS )
             goto out_WriteConfigBlock;
 
-        bytesTransferred = usb->usb_control_transfer(usb,
-                                                     USB_WRITE_TO_DEVICE, 
-                                                     AUR_ADC_SET_CONFIG,
-                                                     0, 
-                                                     0, 
-                                                     configBlock->registers, 
-                                                     configBlock->size, 
-                                                     deviceDesc->commTimeout
-                                                     );
+        bytesTransferred = AIOUSBDevicePutADCConfigBlock( deviceDesc, configBlock );
         if ( bytesTransferred != ( int )configBlock->size )
-            result = LIBUSB_RESULT_TO_AIOUSB_RESULT(bytesTransferred);
+            result = ( bytesTransferred < 0 ? -bytesTransferred : AIOUSB_ERROR_INVALID_DATA );
     }
 
 out_WriteConfigBlock:
+    AIOUSBDeviceUnlock( deviceDesc );
 
     return result;
 }
@@ -340,14 +382,12 @@ PRIVATE AIORET_TYPE AIOUSB_GetScan( unsigned long DeviceIndex, unsigned short co
 {
     ADConfigBlock origConfigBlock;
     AIOUSB_BOOL configChanged, discardFirstSample; 
-    int samplesToAverage = 0, sampleIndex = 0;
     int numChannels, samplesPerChannel, libusbresult;
-    unsigned numSamples, overSample;     
+    unsigned numSamples;
     int bytesTransferred;
 
     unsigned short *sampleBuffer;
     AIORET_TYPE result = AIOUSB_SUCCESS;
-    unsigned char bcdata[] = {0x05,0x00,0x00,0x00 };
 
     AIO_ASSERT( counts );
 
@@ -359,74 +399,157 @@ PRIVATE AIORET_TYPE AIOUSB_GetScan( unsigned long DeviceIndex, unsigned short co
     AIO_ERROR_VALID_DATA( result, result == AIOUSB_SUCCESS );
     AIO_ERROR_VALID_DATA_RETVAL( AIOUSB_ERROR_NOT_SUPPORTED , deviceDesc->bADCStream == AIOUSB_TRUE );
 
+    /**
+     * the scan temporarily replaces cachedConfigBlock, so nobody else
+     * may look at it until it has been put back
+     */
+    AIOUSBDeviceWriteLock( deviceDesc );
     origConfigBlock     = deviceDesc->cachedConfigBlock;
 
-    result = USBDeviceFetchADCConfigBlock( usb, &origConfigBlock );
-    AIO_ASSERT_RET( result, result >= AIOUSB_SUCCESS );
+    result = AIOUSBDeviceFetchADCConfigBlock( deviceDesc, &origConfigBlock );
+    if ( result != AIOUSB_SUCCESS ) {
+        AIOUSBDeviceUnlock( deviceDesc );
+        /* the fetch reports AIORESULT codes as well as negated ones */
+        return result > AIOUSB_SUCCESS ? -result : result;
+    }
+
+    configChanged = adc_prepare_immediate_scan( deviceDesc,
+                                                &deviceDesc->cachedConfigBlock,
+                                                &numChannels,
+                                                &samplesPerChannel,
+                                                &discardFirstSample
+                                                );
+
+    /**
+     * Needs to be the correct values written out ...
+     * Should resemble (04|05) F0 0E
+     */
+    if ( configChanged )
+        result = AIOUSBDevicePutADCConfigBlock( deviceDesc, &deviceDesc->cachedConfigBlock );
+    
+
+    numSamples = numChannels * samplesPerChannel;
+ 
+    sampleBuffer = ( unsigned short* )malloc( numSamples * sizeof(unsigned short) );
+    if (!sampleBuffer ) {
+        result = AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+        goto out_AIOUSB_GetScan;
+    }
+
+    result = adc_start_immediate_scan( deviceDesc, usb, numSamples );
+    if ( result < AIOUSB_SUCCESS )
+        goto out_freebuf_AIOUSB_GetScan;
 
-    configChanged       = AIOUSB_FALSE;
-    discardFirstSample  = deviceDesc->discardFirstSample;
-    overSample          = ADCConfigBlockGetOversample(&deviceDesc->cachedConfigBlock);
+    libusbresult = adc_get_bulk_data( &deviceDesc->cachedConfigBlock,
+                                      usb,
+                                      LIBUSB_ENDPOINT_IN | USB_BULK_READ_ENDPOINT,
+                                      ( unsigned char* )sampleBuffer, 
+                                      numSamples * sizeof(unsigned short), 
+                                      (int*)&bytesTransferred,
+                                      deviceDesc->commTimeout
+                                      );
+
+    if (libusbresult != LIBUSB_SUCCESS) {
+        result = -LIBUSB_RESULT_TO_AIOUSB_RESULT(libusbresult);
+    } else if (bytesTransferred != (int)(numSamples * sizeof(unsigned short)) ) {
+        result = -AIOUSB_ERROR_INVALID_DATA;
+    } else {
+        result = adc_average_immediate_scan( sampleBuffer, numChannels, samplesPerChannel, discardFirstSample, counts );
+    }
 
-    numChannels = ADCConfigBlockGetEndChannel( &deviceDesc->cachedConfigBlock ) - 
-                  ADCConfigBlockGetStartChannel( &deviceDesc->cachedConfigBlock) + 1;
+    out_freebuf_AIOUSB_GetScan:
+        free(sampleBuffer);
+    
+    if (configChanged) {
+        deviceDesc->cachedConfigBlock = origConfigBlock;
+        AIOUSBDevicePutADCConfigBlock( deviceDesc, &deviceDesc->cachedConfigBlock );
+    }
 
-    if ( ADCConfigBlockGetCalMode(&deviceDesc->cachedConfigBlock) == AD_CAL_MODE_GROUND || ADCConfigBlockGetCalMode(&deviceDesc->cachedConfigBlock) == AD_CAL_MODE_REFERENCE) {
-        if (numChannels > 1) {
-            ADCConfigBlockSetScanRange(&deviceDesc->cachedConfigBlock, ADCConfigBlockGetStartChannel(&deviceDesc->cachedConfigBlock), ADCConfigBlockGetStartChannel(&deviceDesc->cachedConfigBlock) );
-            numChannels = 1;
+ out_AIOUSB_GetScan:
+    AIOUSBDeviceUnlock( deviceDesc );
+
+    return result;
+}
+
+/*--------------------------------------------------------------------------*/
+/**
+ * @brief Turns config into the configuration used for an immediate
+ * scan of its current channel range, and works out how the samples
+ * come back; see the notes on AIOUSB_GetScan()
+ * @param deviceDesc
+ * @param config configuration to modify in place
+ * @param numChannels number of channels in the scan
+ * @param samplesPerChannel samples the board returns per channel
+ * @param discardFirstSample whether the first of those is dropped
+ * @return AIOUSB_TRUE if config was modified
+ */
+AIOUSB_BOOL adc_prepare_immediate_scan( AIOUSBDevice *deviceDesc,
+                                        ADCConfigBlock *config,
+                                        int *numChannels,
+                                        int *samplesPerChannel,
+                                        AIOUSB_BOOL *discardFirstSample
+                                        )
+{
+    AIOUSB_BOOL configChanged = AIOUSB_FALSE;
+    unsigned overSample = ADCConfigBlockGetOversample( config );
+
+    *discardFirstSample = deviceDesc->discardFirstSample;
+    *numChannels = ADCConfigBlockGetEndChannel( config ) - ADCConfigBlockGetStartChannel( config ) + 1;
+
+    if ( ADCConfigBlockGetCalMode( config ) == AD_CAL_MODE_GROUND || ADCConfigBlockGetCalMode( config ) == AD_CAL_MODE_REFERENCE) {
+        if (*numChannels > 1) {
+            ADCConfigBlockSetScanRange( config, ADCConfigBlockGetStartChannel( config ), ADCConfigBlockGetStartChannel( config ) );
+            *numChannels = 1;
             configChanged = AIOUSB_TRUE;
         }
         if (overSample > 0) {
-            ADCConfigBlockSetOversample(&deviceDesc->cachedConfigBlock, 0 );
+            ADCConfigBlockSetOversample( config, 0 );
             configChanged = AIOUSB_TRUE;
         }
-        discardFirstSample = AIOUSB_FALSE;           // this feature can't be used in calibration mode either
+        *discardFirstSample = AIOUSB_FALSE;           // this feature can't be used in calibration mode either
     }
 
     /**
      * Turn scan on and turn timer and external trigger off 
      */
-    ADCConfigBlockSetTriggerMode( &deviceDesc->cachedConfigBlock,
-                                  ( ADCConfigBlockGetTriggerMode( &deviceDesc->cachedConfigBlock ) | AD_TRIGGER_SCAN) &
+    ADCConfigBlockSetTriggerMode( config,
+                                  ( ADCConfigBlockGetTriggerMode( config ) | AD_TRIGGER_SCAN) &
                                   (  ~(AD_TRIGGER_TIMER | AD_TRIGGER_EXTERNAL) ) );
     configChanged = AIOUSB_TRUE;
 
-    samplesPerChannel = 1 + ADCConfigBlockGetOversample(&deviceDesc->cachedConfigBlock );
+    *samplesPerChannel = 1 + ADCConfigBlockGetOversample( config );
 
-    if (discardFirstSample)
-        samplesPerChannel++;
-    if (samplesPerChannel > 256)
-        samplesPerChannel = 256;               /* rained by maximum oversample of 255 */
+    if (*discardFirstSample)
+        (*samplesPerChannel)++;
+    if (*samplesPerChannel > 256)
+        *samplesPerChannel = 256;               /* rained by maximum oversample of 255 */
 
     /**
      * make sure device buffer can accommodate this number
      * of samples
      */
-    if ((numChannels * samplesPerChannel) > DEVICE_SAMPLE_BUFFER_SIZE )
-        samplesPerChannel = DEVICE_SAMPLE_BUFFER_SIZE / numChannels;
+    if ((*numChannels * *samplesPerChannel) > DEVICE_SAMPLE_BUFFER_SIZE )
+        *samplesPerChannel = DEVICE_SAMPLE_BUFFER_SIZE / *numChannels;
 
-    overSample = samplesPerChannel - 1;
-    if (overSample != (unsigned)ADCConfigBlockGetOversample(&deviceDesc->cachedConfigBlock ) ) {
-        ADCConfigBlockSetOversample(&deviceDesc->cachedConfigBlock, overSample);
+    overSample = *samplesPerChannel - 1;
+    if (overSample != (unsigned)ADCConfigBlockGetOversample( config ) ) {
+        ADCConfigBlockSetOversample( config, overSample );
         configChanged = AIOUSB_TRUE;
     }
 
-    /**
-     * Needs to be the correct values written out ...
-     * Should resemble (04|05) F0 0E
-     */
-    if ( configChanged )
-        result = USBDevicePutADCConfigBlock( usb, &deviceDesc->cachedConfigBlock );
-    
+    return configChanged;
+}
 
-    numSamples = numChannels * samplesPerChannel;
- 
-    sampleBuffer = ( unsigned short* )malloc( numSamples * sizeof(unsigned short) );
-    if (!sampleBuffer ) {
-        result = AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
-        goto out_AIOUSB_GetScan;
-    }
+/*--------------------------------------------------------------------------*/
+/**
+ * @brief Asks the board for numSamples samples and triggers them;
+ * the data is then waiting on the bulk endpoint
+ * @return AIOUSB_SUCCESS or a negative error
+ */
+AIORET_TYPE adc_start_immediate_scan( AIOUSBDevice *deviceDesc, USBDevice *usb, unsigned numSamples )
+{
+    int bytesTransferred;
+    unsigned char bcdata[] = {0x05,0x00,0x00,0x00 };
 
     /* BC */
     bytesTransferred = usb->usb_control_transfer(usb,
@@ -438,10 +561,8 @@ PRIVATE AIORET_TYPE AIOUSB_GetScan( unsigned long DeviceIndex, unsigned short co
                                                  sizeof(bcdata),
                                                  deviceDesc->commTimeout
                                                  );
-    if ( bytesTransferred != (int)sizeof(bcdata) ) { 
-        result = -LIBUSB_RESULT_TO_AIOUSB_RESULT(bytesTransferred);       
-        goto out_freebuf_AIOUSB_GetScan;
-    }
+    if ( bytesTransferred != (int)sizeof(bcdata) )
+        return -LIBUSB_RESULT_TO_AIOUSB_RESULT(bytesTransferred);
 
     /* BF */
     bytesTransferred = usb->usb_control_transfer(usb,
@@ -449,64 +570,48 @@ PRIVATE AIORET_TYPE AIOUSB_GetScan( unsigned long DeviceIndex, unsigned short co
                                                  AUR_ADC_IMMEDIATE,
                                                  0, 
                                                  0, 
-                                                 ( unsigned char* )sampleBuffer, 
+                                                 bcdata,
                                                  0,
                                                  deviceDesc->commTimeout
                                                  );
-    if (bytesTransferred == 0) {
-        libusbresult = adc_get_bulk_data( &deviceDesc->cachedConfigBlock,
-                                         usb,
-                                         LIBUSB_ENDPOINT_IN | USB_BULK_READ_ENDPOINT,
-                                         ( unsigned char* )sampleBuffer, 
-                                         numSamples * sizeof(unsigned short), 
-                                         (int*)&bytesTransferred,
-                                         deviceDesc->commTimeout
-                                          );
-
-        if (libusbresult != LIBUSB_SUCCESS) {
-            result = -LIBUSB_RESULT_TO_AIOUSB_RESULT(libusbresult);
-        } else if (bytesTransferred != (int)(numSamples * sizeof(unsigned short)) ) {
-            result = -AIOUSB_ERROR_INVALID_DATA;
-        } else {
-            /**
-             * Compute the average of all the samples taken for each channel, discarding
-             * the first sample if that option is enabled; each byte in sampleBuffer[] is
-             * 1 of 2 bytes for each sample, the first byte being the LSB and the second
-             * byte the MSB, in other words, little-endian format; so for convenience we
-             * simply declare sampleBuffer[] to be of type 'unsigned short' and the data
-             * is already in the correct format; the device returns data only for the
-             * channels requested, from startChannel to endChannel; AIOUSB_GetScan()
-             * returns the averaged data readings in counts[], putting the reading for
-             * startChannel in counts[0], and the reading for endChannel in counts[numChannels-1]
-             */
-            result = AIOUSB_SUCCESS;
-            samplesToAverage = discardFirstSample ? samplesPerChannel - 1 : samplesPerChannel;
-            sampleIndex = 0;
-
-            for(int channel = 0; channel < numChannels; channel++) {
-                unsigned long sampleSum = 0;
-                if (discardFirstSample)
-                    sampleIndex++;                 /* skip over first sample */
-                int sample;
-                for(sample = 0; sample < samplesToAverage; sample++)
-                    sampleSum += sampleBuffer[ sampleIndex++ ];
-                counts[ channel ] = ( unsigned short )((sampleSum + samplesToAverage / 2) / samplesToAverage);
-            }
-        }
-    }
-
-        
-    out_freebuf_AIOUSB_GetScan:
-        free(sampleBuffer);
-    
-    if (configChanged) {
-        deviceDesc->cachedConfigBlock = origConfigBlock;
-	USBDevicePutADCConfigBlock( usb, &deviceDesc->cachedConfigBlock );
-    }
+    if ( bytesTransferred != 0 )
+        return -LIBUSB_RESULT_TO_AIOUSB_RESULT(bytesTransferred);
 
- out_AIOUSB_GetScan:
+    return AIOUSB_SUCCESS;
+}
 
-    return result;
+/*--------------------------------------------------------------------------*/
+/**
+ * @brief Compute the average of all the samples taken for each channel, discarding
+ * the first sample if that option is enabled; each byte in sampleBuffer[] is
+ * 1 of 2 bytes for each sample, the first byte being the LSB and the second
+ * byte the MSB, in other words, little-endian format; so for convenience we
+ * simply declare sampleBuffer[] to be of type 'unsigned short' and the data
+ * is already in the correct format; the device returns data only for the
+ * channels requested, from startChannel to endChannel; the averaged
+ * reading for startChannel goes in counts[0], and the reading for
+ * endChannel in counts[numChannels-1]
+ */
+AIORET_TYPE adc_average_immediate_scan( const unsigned short *sampleBuffer,
+                                        int numChannels,
+                                        int samplesPerChannel,
+                                        AIOUSB_BOOL discardFirstSample,
+                                        unsigned short counts[]
+                                        )
+{
+    int samplesToAverage = discardFirstSample ? samplesPerChannel - 1 : samplesPerChannel;
+    int sampleIndex = 0;
+
+    for(int channel = 0; channel < numChannels; channel++) {
+        unsigned long sampleSum = 0;
+        if (discardFirstSample)
+            sampleIndex++;                 /* skip over first sample */
+        int sample;
+        for(sample = 0; sample < samplesToAverage; sample++)
+            sampleSum += sampleBuffer[ sampleIndex++ ];
+        counts[ channel ] = ( unsigned short )((sampleSum + samplesToAverage / 2) / samplesToAverage);
+    }
+    return AIOUSB_SUCCESS;
 }
 
 /*--------------------------------------------------------------------------*/
@@ -560,7 +665,15 @@ PRIVATE unsigned long AIOUSB_ArrayCountsToVolts(
     AIO_ERROR_VALID_DATA( AIOUSB_ERROR_INVALID_PARAMETER, startChannel + numChannels <= ( int )deviceDesc->ADCMUXChannels );
 
     result = ReadConfigBlock(DeviceIndex, AIOUSB_FALSE);
-    if (result == AIOUSB_SUCCESS) {
+    if (result == AIOUSB_SUCCESS && deviceDesc->hostCal) {
+        for(int channel = 0; channel < numChannels; channel++) {
+            AIOHostCalChannel cal;
+            AIORET_TYPE retval = AIOHostCalResolve( deviceDesc->hostCal, &deviceDesc->cachedConfigBlock, startChannel + channel, 1, &cal );
+            if ( retval != AIOUSB_SUCCESS )
+                return (unsigned long)-retval;
+            volts[ channel ] = AIOHostCalChannelToVolts( &cal, counts[ channel ] );
+        }
+    } else if (result == AIOUSB_SUCCESS) {
         for(int channel = 0; channel < numChannels; channel++) {
             int gainCode = ADCConfigBlockGetGainCode( &deviceDesc->cachedConfigBlock , startChannel + channel );
             const struct ADRange *const range = &adRanges[ gainCode ];
@@ -832,8 +945,10 @@ unsigned long ADC_GetConfig(
     AIO_ERROR_VALID_DATA( AIOUSB_ERROR_INVALID_ADCCONFIG_SIZE, deviceDesc->cachedConfigBlock.size > 0 );
     AIO_ERROR_VALID_DATA( AIOUSB_ERROR_INVALID_ADCCONFIG_SIZE, deviceDesc->cachedConfigBlock.size <= AD_MAX_CONFIG_REGISTERS );
 
+    AIOUSBDeviceReadLock( deviceDesc );
     memcpy(ConfigBuf, deviceDesc->cachedConfigBlock.registers, deviceDesc->cachedConfigBlock.size);
     *ConfigBufSize = deviceDesc->cachedConfigBlock.size;
+    AIOUSBDeviceUnlock( deviceDesc );
 
     return result;
 }
@@ -899,8 +1014,8 @@ unsigned long ADC_SetConfig(
      AIOUSBDevice *deviceDesc =  AIODeviceTableGetDeviceAtIndex( DeviceIndex , &result );
      if ( result  != AIOUSB_SUCCESS )
          return result;
-     USBDevice *usb = AIODeviceTableGetUSBDeviceAtIndex( DeviceIndex, &result );
-     if ( result  != AIOUSB_SUCCESS )
+     /* the registers go out through the cache, but only to a connected board */
+     if ( !AIODeviceTableGetUSBDeviceAtIndex( DeviceIndex, &result ) )
          return result;
 
      memcpy( &configBlock.registers, pConfigBuf, *ConfigBufSize );
@@ -939,7 +1054,9 @@ unsigned long ADC_SetConfig(
 
 
 
-     retval = usb->usb_put_config( usb, &configBlock );
+     AIOUSBDeviceWriteLock( deviceDesc );
+     retval = AIOUSBDevicePutADCConfigBlock( deviceDesc, &configBlock );
+     AIOUSBDeviceUnlock( deviceDesc );
      result = retval >= 0 ? AIOUSB_SUCCESS : abs(retval);
 out_ADC_SetConfig:
      return result;
@@ -1142,17 +1259,19 @@ unsigned long ADC_ADMode(
     
     tmpblock.timeout = deviceDesc->commTimeout;
 
+    AIOUSBDeviceWriteLock( deviceDesc );
     ADCConfigBlockCopy( &tmpblock, &deviceDesc->cachedConfigBlock );
-    result = USBDeviceFetchADCConfigBlock( usb , &tmpblock );
+    result = AIOUSBDeviceFetchADCConfigBlock( deviceDesc, &tmpblock );
 
-    AIO_ERROR_VALID_DATA( result, result == AIOUSB_SUCCESS );
-
-    ADCConfigBlockSetCalMode(&tmpblock, (ADCalMode)CalMode);
-    ADCConfigBlockSetTriggerMode(&tmpblock, TriggerMode);
+    if ( result == AIOUSB_SUCCESS ) {
+        ADCConfigBlockSetCalMode(&tmpblock, (ADCalMode)CalMode);
+        ADCConfigBlockSetTriggerMode(&tmpblock, TriggerMode);
 
-    ADCConfigBlockCopy( &deviceDesc->cachedConfigBlock, &tmpblock );
+        ADCConfigBlockCopy( &deviceDesc->cachedConfigBlock, &tmpblock );
 
-    result = USBDevicePutADCConfigBlock( usb, &tmpblock );
+        result = AIOUSBDevicePutADCConfigBlock( deviceDesc, &tmpblock );
+    }
+    AIOUSBDeviceUnlock( deviceDesc );
 
     return result;
 }
@@ -1416,10 +1535,16 @@ unsigned long ADC_SetScanLimits(
     return result;
 }
 
+static unsigned long _adc_internal_cal( unsigned long DeviceIndex, AIOUSB_BOOL autoCal, unsigned short returnCalTable[],
+                                       const char *saveFileName, AIOUSB_BOOL useCache );
+
 /**
- * @brief 
+ * @brief Loads a calibration table into the board
  * @param DeviceIndex
- * @param CalFileName
+ * @param CalFileName a calibration file; ":AUTO:" to calibrate against
+ * the internal references; ":CACHED:" to load the tables of the board's
+ * last ":AUTO:" from AIOCalCache, calibrating only if there are none;
+ * ":NONE:" or ":1TO1:" for no correction
  * @return
  */
 unsigned long ADC_SetCal(
@@ -1433,6 +1558,8 @@ unsigned long ADC_SetCal(
     AIORESULT result;
     if (strcmp(CalFileName, ":AUTO:") == 0)
         result = AIOUSB_ADC_InternalCal(DeviceIndex, AIOUSB_TRUE, 0, 0);
+    else if (strcmp(CalFileName, ":CACHED:") == 0)
+        result = _adc_internal_cal(DeviceIndex, AIOUSB_TRUE, 0, 0, AIOUSB_TRUE);
     else if (
         strcmp(CalFileName, ":NONE:") == 0 ||
         strcmp(CalFileName, ":1TO1:") == 0
@@ -1535,120 +1662,57 @@ unsigned long ADC_Initialize(
     return result;
 }
 
-static void *BulkAcquireWorker(void *params);
+/*----------------------------------------------------------------------------*/
+/**
+ * Each streaming A/D device gets one reader thread and one clock thread,
+ * created by the first ADC_BulkAcquire() and kept until the device
+ * table is cleared. ADC_BulkAcquire() hands the reader a job; the
+ * reader tells the board how much to acquire, arms the clock thread
+ * and then enters the bulk read. The clock thread starts the sample
+ * clock only once it has been armed, so the read is already waiting
+ * when the first samples arrive. All fields are guarded by
+ * deviceDesc->workerLock.
+ */
+struct aio_bulk_worker {
+    unsigned long DeviceIndex;
+    AIOUSBDevice *deviceDesc;
+    pthread_t reader;
+    pthread_t clock;
+    pthread_cond_t jobReady;                /**< job queued, or quit */
+    pthread_cond_t clockChanged;            /**< clock armed, or clock started */
+    struct BulkAcquireWorkerParams *job;    /**< next job for the reader */
+    struct BulkAcquireWorkerParams *clockJob; /**< job whose clock has to be started */
+    AIOUSB_BOOL readerReady;                /**< the reader is entering its first bulk read of clockJob */
+    AIOUSB_BOOL quit;                       /**< the reader exits once its queued job is done */
+    AIOUSB_BOOL clockQuit;                  /**< the clock thread exits; set only after the reader is joined */
+};
 
+/*----------------------------------------------------------------------------*/
 /**
- * @brief Determine inform ation about the device found at a specific DeviceIndex
- * @param DeviceIndex DeviceIndex of the card you wish to control; generally either diOnly or a specific
- *        device’s Device Index.
- * @param BufSize the size, in bytes, of the buffer to receive the data
- * @param pBuf a pointer to the buffer in which to receive data
- * @return AIOUSB_SUCCESS indicates success, failure otherwise
- * 
- * @note This function will return im m ediately. A return value of
- * AIOUSB_SUCCESS indicates that bulk data is being acquired
- * in the background, and the buffer should not be deallocated or m
- * oved. Use ADC_BulkPoll() to query this background operation.
+ * @brief Publishes the end of a bulk acquire to everyone who may be
+ * waiting on it: ADC_BulkWait() callers, the eventfd and the callback
  */
-unsigned long ADC_BulkAcquire(
-                              unsigned long DeviceIndex,
-                              unsigned long BufSize,
-                              void *pBuf
-                              )
+static void _bulk_acquire_complete( unsigned long DeviceIndex, AIOUSBDevice *deviceDesc, unsigned long result )
 {
+    void (*callback)( unsigned long, unsigned long, void * );
+    void *userdata;
+    uint64_t one = 1;
 
-    if ( pBuf == NULL)
-        return AIOUSB_ERROR_INVALID_PARAMETER;
-    AIORESULT result = AIOUSB_SUCCESS;
-    
-    AIOUSBDevice *deviceDesc = AIODeviceTableGetDeviceAtIndex( DeviceIndex, &result );
-    if ( result != AIOUSB_SUCCESS ) 
-        return result;
-    USBDevice *usb = AIODeviceTableGetUSBDeviceAtIndex( DeviceIndex, &result );
-    if ( result != AIOUSB_SUCCESS )
-        return result;
-
-    if (deviceDesc->bADCStream == AIOUSB_FALSE)
-        return AIOUSB_ERROR_NOT_SUPPORTED;
-
-    if (deviceDesc->workerBusy)
-        return AIOUSB_ERROR_OPEN_FAILED;
-
-
-    struct BulkAcquireWorkerParams * acquireParams = ( struct BulkAcquireWorkerParams* )malloc(sizeof(struct BulkAcquireWorkerParams));
-
-
-    if (acquireParams != 0) {
-        /**
-         * we initialize the worker thread status here in case the thread doesn't start for some reason,
-         * such as an improperly locked mutex; this pre-initialization is necessary so that the thread
-         * status doesn't make it appear as though the worker thread has completed successfully
-         */
-
-        deviceDesc->workerStatus  = BufSize;       // deviceDesc->workerStatus == bytes remaining to receive
-        deviceDesc->workerResult  = AIOUSB_ERROR_INVALID_DATA;
-        deviceDesc->workerBusy    = AIOUSB_TRUE;
-
-        acquireParams->DeviceIndex  = DeviceIndex;
-        acquireParams->BufSize      = BufSize;
-        acquireParams->pBuf         = pBuf;
-
-        struct sched_param schedParam = { sched_get_priority_max(SCHED_FIFO) };
-        pthread_attr_t workerThreadAttr;
-        pthread_t workerThreadID;
-
-        pthread_attr_init(&workerThreadAttr);
-        pthread_attr_setschedpolicy(&workerThreadAttr, SCHED_FIFO);
-        pthread_attr_setschedparam(&workerThreadAttr, &schedParam);
-
-        int threadResult = pthread_create( &workerThreadID, NULL, BulkAcquireWorker, acquireParams );
-
-        if (threadResult == 0) {
-            sched_yield();
-            unsigned char startdata[] = {0x05,0x00,0x00,0x00 };
-            usb->usb_control_transfer(usb,
-                                      USB_WRITE_TO_DEVICE,
-                                      AUR_START_ACQUIRING_BLOCK,
-                                      (acquireParams->BufSize >> 17) & 0xffff, /* high */
-                                      (acquireParams->BufSize >> 1) & 0xffff,
-                                      startdata,
-                                      sizeof(startdata),
-                                      deviceDesc->commTimeout
-                                      );
-
-
-
-        } else {
-            /*
-             * failed to create worker thread, clean up
-             */
-            deviceDesc->workerStatus = 0;
-            deviceDesc->workerResult = AIOUSB_SUCCESS;
-            deviceDesc->workerBusy = AIOUSB_FALSE;
-            free(acquireParams);
-            result = AIOUSB_ERROR_INVALID_THREAD;
-        }
-        pthread_attr_destroy(&workerThreadAttr);
-        pthread_detach(workerThreadID);
-    } else {
-        result = AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+    AIOUSBDeviceLockWorker( deviceDesc );
+    deviceDesc->workerStatus = 0;
+    deviceDesc->workerResult = result;
+    deviceDesc->workerBusy   = AIOUSB_FALSE;
+    callback = deviceDesc->workerCallback;
+    userdata = deviceDesc->workerCallbackData;
+    if ( deviceDesc->workerEventFdOpen ) {
+        ssize_t written = write( deviceDesc->workerEventFd, &one, sizeof(one) );
+        (void)written;          /* fails only with the counter saturated; the fd is readable regardless */
     }
+    pthread_cond_broadcast( &deviceDesc->workerDone );
+    AIOUSBDeviceUnlockWorker( deviceDesc );
 
-    return result;
-}
-
-static void *startAcquire(void *params)
-{
-    static AIORESULT result = AIOUSB_SUCCESS;
-    struct BulkAcquireWorkerParams * acquireParams = ( struct BulkAcquireWorkerParams* )params;
-    AIOUSBDevice *deviceDesc = AIODeviceTableGetDeviceAtIndex( acquireParams->DeviceIndex, &result );
-    if ( result != AIOUSB_SUCCESS ) 
-        return &result;
-
-    double clockHz = deviceDesc->miscClockHz;
-    sched_yield();
-    result = CTR_StartOutputFreq( acquireParams->DeviceIndex,  0, &clockHz);
-    return &result;
+    if ( callback )
+        callback( DeviceIndex, result, userdata );
 }
 
 #define STREAMING_PNA_DEFINITIONS                                       \
@@ -1658,57 +1722,51 @@ static void *startAcquire(void *params)
     int tindex = 0;                                                     \
     int num_reads = 0;
 
-
-
 /*----------------------------------------------------------------------------*/
 /**
- * @brief we assume the parameters passed to BulkAcquireWorker() have
- * been validated by ADC_BulkAcquire()
- * @param params
- * @return
+ * @brief Runs one acquire on the reader thread; we assume the
+ * parameters have been validated by ADC_BulkAcquire()
  */
-static void *BulkAcquireWorker(void *params)
+static unsigned long _bulk_acquire_run( struct aio_bulk_worker *worker, struct BulkAcquireWorkerParams *acquireParams )
 {
-    static unsigned long result = AIOUSB_SUCCESS;
-    AIO_ERROR_VALID_DATA_W_CODE( &result, result = AIOUSB_ERROR_INVALID_PARAMETER, params ); 
-    USBDevice *usb;
-        
-    struct BulkAcquireWorkerParams * acquireParams = ( struct BulkAcquireWorkerParams* )params;
-    int libusbResult;
-
-    AIOUSBDevice *deviceDesc = AIODeviceTableGetDeviceAtIndex( acquireParams->DeviceIndex, &result );
-    if ( result != AIOUSB_SUCCESS ) 
-        return &result;
-
-    usb = AIOUSBDeviceGetUSBHandle( deviceDesc );
-    AIO_ERROR_VALID_DATA_W_CODE( &result, result = AIOUSB_ERROR_INVALID_USBDEVICE , usb );
-
-
-    pthread_t startAcquireThread;
+    AIOUSBDevice *deviceDesc = worker->deviceDesc;
+    USBDevice *usb = AIOUSBDeviceGetUSBHandle( deviceDesc );
+    unsigned long result = AIOUSB_SUCCESS;
     unsigned long streamingBlockSize , bytesRemaining;
-    int threadResult;
+    unsigned char startdata[] = {0x05,0x00,0x00,0x00 };
+    int libusbResult;
+    int bytesTransferred;
+    unsigned char *data;
 
 #ifdef PNA_TESTING
     STREAMING_PNA_DEFINITIONS;
 #endif
 
-    int bytesTransferred;
-    unsigned char *data;
+    if ( !usb )
+        return AIOUSB_ERROR_INVALID_USBDEVICE;
 
-    /* Needed to allow us to start bulk acquire waiting before we signal the board to start collecting data */
-    threadResult = pthread_create( &startAcquireThread, NULL, startAcquire , params );
-    if ( threadResult != 0 ) {
-        deviceDesc->workerResult = AIOUSB_ERROR_INVALID_THREAD;
-        goto out_BulkAcquireWorker;
-    } 
-    streamingBlockSize = deviceDesc->StreamingBlockSize; 
+    usb->usb_control_transfer(usb,
+                              USB_WRITE_TO_DEVICE,
+                              AUR_START_ACQUIRING_BLOCK,
+                              (acquireParams->BufSize >> 17) & 0xffff, /* high */
+                              (acquireParams->BufSize >> 1) & 0xffff,
+                              startdata,
+                              sizeof(startdata),
+                              deviceDesc->commTimeout
+                              );
 
+    streamingBlockSize = deviceDesc->StreamingBlockSize; 
     bytesRemaining = acquireParams->BufSize;
+    data = ( unsigned char* )acquireParams->pBuf;
+
+    /* Arm the clock; it is started once we are inside the first read */
+    AIOUSBDeviceLockWorker( deviceDesc );
     deviceDesc->workerStatus = bytesRemaining;       // deviceDesc->workerStatus == bytes remaining to receive
     deviceDesc->workerResult = AIOUSB_SUCCESS;
-    deviceDesc->workerBusy = AIOUSB_TRUE;
-
-    data = ( unsigned char* )acquireParams->pBuf;
+    worker->clockJob = acquireParams;
+    worker->readerReady = AIOUSB_FALSE;
+    pthread_cond_broadcast( &worker->clockChanged );
+    AIOUSBDeviceUnlockWorker( deviceDesc );
 
 #ifdef PNA_TESTING
     clock_gettime( CLOCK_MONOTONIC_RAW, &bar );
@@ -1720,6 +1778,13 @@ static void *BulkAcquireWorker(void *params)
         clock_gettime( CLOCK_MONOTONIC_RAW, &foo );
         deltas[num_reads++] =  ( foo.tv_sec - bar.tv_sec )*1e9 + (foo.tv_nsec - bar.tv_nsec );
 #endif
+        if ( !worker->readerReady ) {
+            /* let the clock thread know the read is about to go out */
+            AIOUSBDeviceLockWorker( deviceDesc );
+            worker->readerReady = AIOUSB_TRUE;
+            pthread_cond_broadcast( &worker->clockChanged );
+            AIOUSBDeviceUnlockWorker( deviceDesc );
+        }
 
         libusbResult = usb->usb_bulk_transfer(usb,
                                               LIBUSB_ENDPOINT_IN | USB_BULK_READ_ENDPOINT,
@@ -1740,7 +1805,9 @@ static void *BulkAcquireWorker(void *params)
         } else {
             data += bytesTransferred;
             bytesRemaining -= bytesToTransfer; /* Actually read in bytes */
+            AIOUSBDeviceLockWorker( deviceDesc );
             deviceDesc->workerStatus = bytesRemaining;
+            AIOUSBDeviceUnlockWorker( deviceDesc );
         }
     }
 #ifdef PNA_TESTING
@@ -1760,17 +1827,240 @@ static void *BulkAcquireWorker(void *params)
         fclose(fp);
     }
 #endif
-    
- out_BulkAcquireWorker:
-    deviceDesc->workerStatus = 0;
-    deviceDesc->workerResult = result;
-    deviceDesc->workerBusy = AIOUSB_FALSE;
 
+    /**
+     * The clock thread may not have got round to starting the clock
+     * if the read failed straight away; wait for it so that the stop
+     * below really is the last word
+     */
+    AIOUSBDeviceLockWorker( deviceDesc );
+    worker->readerReady = AIOUSB_TRUE;
+    pthread_cond_broadcast( &worker->clockChanged );
+    while ( worker->clockJob )
+        pthread_cond_wait( &worker->clockChanged, &deviceDesc->workerLock );
+    AIOUSBDeviceUnlockWorker( deviceDesc );
+
+    /**
+     * stop the clock before announcing completion, so that a waiter
+     * that immediately starts the next acquire doesn't have its clock
+     * stopped underneath it
+     */
     double clockHz = 0;
     CTR_StartOutputFreq(acquireParams->DeviceIndex, 0, &clockHz);
 
-    free(params);
-    return 0;
+    return result;
+}
+
+/*----------------------------------------------------------------------------*/
+static void *BulkAcquireWorker(void *arg)
+{
+    struct aio_bulk_worker *worker = (struct aio_bulk_worker *)arg;
+    AIOUSBDevice *deviceDesc = worker->deviceDesc;
+
+    for (;;) {
+        struct BulkAcquireWorkerParams *job;
+        AIOUSBDeviceLockWorker( deviceDesc );
+        while ( !worker->quit && !worker->job )
+            pthread_cond_wait( &worker->jobReady, &deviceDesc->workerLock );
+        job = worker->job;
+        worker->job = NULL;
+        AIOUSBDeviceUnlockWorker( deviceDesc );
+        if ( !job )
+            break;
+
+        unsigned long result = _bulk_acquire_run( worker, job );
+        free( job );
+        _bulk_acquire_complete( worker->DeviceIndex, deviceDesc, result );
+    }
+    return NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+static void *BulkAcquireClock(void *arg)
+{
+    struct aio_bulk_worker *worker = (struct aio_bulk_worker *)arg;
+    AIOUSBDevice *deviceDesc = worker->deviceDesc;
+
+    for (;;) {
+        AIOUSBDeviceLockWorker( deviceDesc );
+        while ( !worker->clockQuit && !( worker->clockJob && worker->readerReady ) )
+            pthread_cond_wait( &worker->clockChanged, &deviceDesc->workerLock );
+        if ( !worker->clockJob ) {
+            AIOUSBDeviceUnlockWorker( deviceDesc );
+            break;
+        }
+        AIOUSBDeviceUnlockWorker( deviceDesc );
+
+        /**
+         * the reader has reached its first bulk read; let it get the
+         * transfer submitted before the clock produces any samples
+         */
+        sched_yield();
+        double clockHz = deviceDesc->miscClockHz;
+        CTR_StartOutputFreq( worker->DeviceIndex, 0, &clockHz );
+
+        AIOUSBDeviceLockWorker( deviceDesc );
+        worker->clockJob = NULL;
+        pthread_cond_broadcast( &worker->clockChanged );
+        AIOUSBDeviceUnlockWorker( deviceDesc );
+    }
+    return NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Creates the device's bulk acquire threads if they don't exist
+ * yet. The check and the creation happen under the worker lock, so two
+ * callers on one device can't both create a pair; the new threads block
+ * on that lock until we are done.
+ */
+static AIORESULT _bulk_worker_start( unsigned long DeviceIndex, AIOUSBDevice *deviceDesc )
+{
+    struct aio_bulk_worker *worker;
+
+    AIOUSBDeviceLockWorker( deviceDesc );
+    if ( deviceDesc->bulkWorker ) {
+        AIOUSBDeviceUnlockWorker( deviceDesc );
+        return AIOUSB_SUCCESS;
+    }
+
+    worker = (struct aio_bulk_worker *)calloc( 1, sizeof(struct aio_bulk_worker) );
+    if ( !worker ) {
+        AIOUSBDeviceUnlockWorker( deviceDesc );
+        return AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+    }
+
+    worker->DeviceIndex = DeviceIndex;
+    worker->deviceDesc  = deviceDesc;
+    pthread_cond_init( &worker->jobReady, NULL );
+    pthread_cond_init( &worker->clockChanged, NULL );
+
+    if ( pthread_create( &worker->reader, NULL, BulkAcquireWorker, worker ) != 0 ) {
+        AIOUSBDeviceUnlockWorker( deviceDesc );
+        goto err_bulk_worker_start;
+    }
+
+    if ( pthread_create( &worker->clock, NULL, BulkAcquireClock, worker ) != 0 ) {
+        /* nothing has been queued yet, so the reader never waits on a clock */
+        worker->quit = AIOUSB_TRUE;
+        pthread_cond_broadcast( &worker->jobReady );
+        AIOUSBDeviceUnlockWorker( deviceDesc );
+        pthread_join( worker->reader, NULL );
+        goto err_bulk_worker_start;
+    }
+
+    deviceDesc->bulkWorker = worker;
+    AIOUSBDeviceUnlockWorker( deviceDesc );
+    return AIOUSB_SUCCESS;
+
+ err_bulk_worker_start:
+    pthread_cond_destroy( &worker->jobReady );
+    pthread_cond_destroy( &worker->clockChanged );
+    free( worker );
+    return AIOUSB_ERROR_INVALID_THREAD;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Stops the device's bulk acquire threads, after any acquire
+ * in progress or already queued has finished. The clock thread is
+ * stopped only once the reader has been joined, since a job the reader
+ * picks up after quit still needs its clock started.
+ */
+void adc_bulk_worker_stop( AIOUSBDevice *deviceDesc )
+{
+    struct aio_bulk_worker *worker;
+
+    AIOUSBDeviceLockWorker( deviceDesc );
+    worker = deviceDesc->bulkWorker;
+    if ( !worker ) {
+        AIOUSBDeviceUnlockWorker( deviceDesc );
+        return;
+    }
+    worker->quit = AIOUSB_TRUE;
+    pthread_cond_broadcast( &worker->jobReady );
+    AIOUSBDeviceUnlockWorker( deviceDesc );
+    pthread_join( worker->reader, NULL );
+
+    AIOUSBDeviceLockWorker( deviceDesc );
+    worker->clockQuit = AIOUSB_TRUE;
+    pthread_cond_broadcast( &worker->clockChanged );
+    AIOUSBDeviceUnlockWorker( deviceDesc );
+    pthread_join( worker->clock, NULL );
+    pthread_cond_destroy( &worker->jobReady );
+    pthread_cond_destroy( &worker->clockChanged );
+    free( worker->job );
+    free( worker );
+    deviceDesc->bulkWorker = NULL;
+}
+
+/**
+ * @brief Determine inform ation about the device found at a specific DeviceIndex
+ * @param DeviceIndex DeviceIndex of the card you wish to control; generally either diOnly or a specific
+ *        device’s Device Index.
+ * @param BufSize the size, in bytes, of the buffer to receive the data
+ * @param pBuf a pointer to the buffer in which to receive data
+ * @return AIOUSB_SUCCESS indicates success, failure otherwise
+ * 
+ * @note This function will return im m ediately. A return value of
+ * AIOUSB_SUCCESS indicates that bulk data is being acquired
+ * in the background, and the buffer should not be deallocated or m
+ * oved. Use ADC_BulkPoll() to query this background operation, or
+ * ADC_BulkWait(), ADC_BulkGetEventFd() or ADC_BulkSetCallback() to be
+ * told when it is done.
+ */
+unsigned long ADC_BulkAcquire(
+                              unsigned long DeviceIndex,
+                              unsigned long BufSize,
+                              void *pBuf
+                              )
+{
+
+    if ( pBuf == NULL)
+        return AIOUSB_ERROR_INVALID_PARAMETER;
+    AIORESULT result = AIOUSB_SUCCESS;
+    
+    AIOUSBDevice *deviceDesc = AIODeviceTableGetDeviceAtIndex( DeviceIndex, &result );
+    if ( result != AIOUSB_SUCCESS ) 
+        return result;
+    AIODeviceTableGetUSBDeviceAtIndex( DeviceIndex, &result );
+    if ( result != AIOUSB_SUCCESS )
+        return result;
+
+    if (deviceDesc->bADCStream == AIOUSB_FALSE)
+        return AIOUSB_ERROR_NOT_SUPPORTED;
+
+    result = _bulk_worker_start( DeviceIndex, deviceDesc );
+    if ( result != AIOUSB_SUCCESS )
+        return result;
+
+    struct BulkAcquireWorkerParams * acquireParams = ( struct BulkAcquireWorkerParams* )malloc(sizeof(struct BulkAcquireWorkerParams));
+    if ( !acquireParams )
+        return AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+
+    acquireParams->DeviceIndex  = DeviceIndex;
+    acquireParams->BufSize      = BufSize;
+    acquireParams->pBuf         = pBuf;
+
+    /**
+     * we initialize the worker status here, before the reader picks
+     * the job up, so that the status doesn't make it appear as though
+     * the acquire has already completed successfully
+     */
+    AIOUSBDeviceLockWorker( deviceDesc );
+    if (deviceDesc->workerBusy) {
+        AIOUSBDeviceUnlockWorker( deviceDesc );
+        free(acquireParams);
+        return AIOUSB_ERROR_OPEN_FAILED;
+    }
+    deviceDesc->workerStatus  = BufSize;       // deviceDesc->workerStatus == bytes remaining to receive
+    deviceDesc->workerResult  = AIOUSB_ERROR_INVALID_DATA;
+    deviceDesc->workerBusy    = AIOUSB_TRUE;
+    deviceDesc->bulkWorker->job = acquireParams;
+    pthread_cond_signal( &deviceDesc->bulkWorker->jobReady );
+    AIOUSBDeviceUnlockWorker( deviceDesc );
+
+    return result;
 }
 
 /**
@@ -1817,8 +2107,109 @@ unsigned long ADC_BulkPoll(
     if (deviceDesc->bADCStream == AIOUSB_FALSE)
         return AIOUSB_ERROR_NOT_SUPPORTED;
 
+    AIOUSBDeviceLockWorker( deviceDesc );
     *BytesLeft = deviceDesc->workerStatus;
     result = deviceDesc->workerResult;
+    AIOUSBDeviceUnlockWorker( deviceDesc );
+
+    return result;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Blocks until the bulk acquire started by ADC_BulkAcquire() has
+ * finished
+ * @param DeviceIndex
+ * @param timeout milliseconds to wait, 0 waits for as long as it takes
+ * @return the result of the acquire, or AIOUSB_ERROR_TIMEOUT if it is
+ * still running when the timeout expires
+ */
+unsigned long ADC_BulkWait(
+                           unsigned long DeviceIndex,
+                           unsigned long timeout
+                           )
+{
+    AIORESULT result = AIOUSB_SUCCESS;
+    struct timespec deadline;
+    int waitResult = 0;
+    AIOUSBDevice *deviceDesc = AIODeviceTableGetDeviceAtIndex( DeviceIndex, &result );
+    if ( result != AIOUSB_SUCCESS )
+        return result;
+
+    if (deviceDesc->bADCStream == AIOUSB_FALSE)
+        return AIOUSB_ERROR_NOT_SUPPORTED;
+
+    AIOTimeDeadline( &deadline, CLOCK_MONOTONIC, timeout );
+
+    AIOUSBDeviceLockWorker( deviceDesc );
+    while ( deviceDesc->workerBusy && waitResult != ETIMEDOUT ) {
+        if ( timeout == 0 )
+            pthread_cond_wait( &deviceDesc->workerDone, &deviceDesc->workerLock );
+        else
+            waitResult = pthread_cond_timedwait( &deviceDesc->workerDone, &deviceDesc->workerLock, &deadline );
+    }
+    result = deviceDesc->workerBusy ? (AIORESULT)AIOUSB_ERROR_TIMEOUT : deviceDesc->workerResult;
+    AIOUSBDeviceUnlockWorker( deviceDesc );
+
+    return result;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Returns a file descriptor that becomes readable each time a
+ * bulk acquire on this device finishes, for use with poll(), select()
+ * or an event loop. Reading 8 bytes from it resets it. The descriptor
+ * belongs to the library; don't close it.
+ * @param DeviceIndex
+ * @return the descriptor, or a negative error
+ */
+AIORET_TYPE ADC_BulkGetEventFd( unsigned long DeviceIndex )
+{
+    AIORESULT result = AIOUSB_SUCCESS;
+    AIORET_TYPE retval;
+    AIOUSBDevice *deviceDesc = AIODeviceTableGetDeviceAtIndex( DeviceIndex, &result );
+    AIO_ERROR_VALID_DATA( -(AIORET_TYPE)result, result == AIOUSB_SUCCESS );
+    AIO_ERROR_VALID_DATA_RETVAL( AIOUSB_ERROR_NOT_SUPPORTED, deviceDesc->bADCStream );
+
+    AIOUSBDeviceLockWorker( deviceDesc );
+    if ( !deviceDesc->workerEventFdOpen ) {
+        int fd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+        if ( fd >= 0 ) {
+            deviceDesc->workerEventFd = fd;
+            deviceDesc->workerEventFdOpen = AIOUSB_TRUE;
+        }
+    }
+    retval = deviceDesc->workerEventFdOpen ? deviceDesc->workerEventFd : -AIOUSB_ERROR_OPEN_FAILED;
+    AIOUSBDeviceUnlockWorker( deviceDesc );
+
+    return retval;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Registers a function to be called, from the worker thread,
+ * when a bulk acquire on this device finishes. Pass NULL to remove it.
+ * The callback must not start the next ADC_BulkAcquire() itself
+ * unless it is prepared for that acquire to complete re-entrantly.
+ */
+unsigned long ADC_BulkSetCallback(
+                                  unsigned long DeviceIndex,
+                                  void (*callback)( unsigned long DeviceIndex, unsigned long result, void *userdata ),
+                                  void *userdata
+                                  )
+{
+    AIORESULT result = AIOUSB_SUCCESS;
+    AIOUSBDevice *deviceDesc = AIODeviceTableGetDeviceAtIndex( DeviceIndex, &result );
+    if ( result != AIOUSB_SUCCESS )
+        return result;
+
+    if (deviceDesc->bADCStream == AIOUSB_FALSE)
+        return AIOUSB_ERROR_NOT_SUPPORTED;
+
+    AIOUSBDeviceLockWorker( deviceDesc );
+    deviceDesc->workerCallback = callback;
+    deviceDesc->workerCallbackData = userdata;
+    AIOUSBDeviceUnlockWorker( deviceDesc );
 
     return result;
 }
@@ -2317,13 +2708,11 @@ unsigned long ADC_GetFastITScanV(unsigned long DeviceIndex, double *pData)
     int StartChannel;
     int EndChannel;
     int Channels;
-    unsigned long BytesLeft;
     unsigned short *thisDataBuf;
 
     int bufsize;
     double clockHz = 0;
     double *pBuf;
-    int numsleep = 100;
     double CLOCK_SPEED = 100000;
     int i, ch;
 
@@ -2376,22 +2765,7 @@ unsigned long ADC_GetFastITScanV(unsigned long DeviceIndex, double *pData)
     if (result != AIOUSB_SUCCESS)
         goto CLEANUP_ADC_GetFastITScanV;
 
-    BytesLeft = bufsize;
-    numsleep = 0;
-    usleep(0);
-    while(BytesLeft) {
-          result = ADC_BulkPoll(DeviceIndex, &BytesLeft);
-          if (result != AIOUSB_SUCCESS) {
-                break;
-            }else {
-                numsleep++;
-                usleep(10);
-                if (numsleep > 100) {
-                      result = AIOUSB_ERROR_TIMEOUT;
-                      break;
-                  }
-            }
-      }
+    result = ADC_BulkWait(DeviceIndex, deviceDesc->commTimeout);
 
     if (result != AIOUSB_SUCCESS)
         goto CLEANUP_ADC_GetFastITScanV;
@@ -2650,25 +3024,28 @@ AIORET_TYPE ConfigureAndBulkAcquire( unsigned long DeviceIndex, ADConfigBlock *c
 
 /*----------------------------------------------------------------------------*/
 /**
- * @brief Performs automatic calibration of the ADC
- * @param DeviceIndex
- * @param autoCal
- * @param returnCalTable
- * @param saveFileName
- * @return
+ * @brief Performs automatic calibration of the ADC. Every automatic
+ * calibration leaves its two tables in AIOCalCache under the board's
+ * serial number; with useCache, tables found there are loaded in place
+ * of measuring the board, and not even loaded if the board still holds
+ * them.
  */
-unsigned long AIOUSB_ADC_InternalCal(
-                                     unsigned long DeviceIndex,
-                                     AIOUSB_BOOL autoCal,
-                                     unsigned short returnCalTable[],
-                                     const char *saveFileName
-                                     )
+static unsigned long _adc_internal_cal(
+                                       unsigned long DeviceIndex,
+                                       AIOUSB_BOOL autoCal,
+                                       unsigned short returnCalTable[],
+                                       const char *saveFileName,
+                                       AIOUSB_BOOL useCache
+                                       )
 {
     int tmpval, lowRead, hiRead, dRead, dRef;
     int lowRefRef = 0, hiRefRef = 9.9339 * 6553.6;
     double fval;
     ADConfigBlock oConfig,nConfig;
     AIORET_TYPE retval = AIOUSB_SUCCESS;
+    uint64_t serialNumber = 0;
+    AIOCalTable *cached = NULL;
+    unsigned short *tables = NULL;      /* both tables as loaded, for the cache */
     
     AIOUSBDevice *deviceDesc = AIODeviceTableGetDeviceAtIndex( DeviceIndex, (AIORESULT*)&retval );
     if ( retval != AIOUSB_SUCCESS ) 
@@ -2695,6 +3072,28 @@ unsigned long AIOUSB_ADC_InternalCal(
     if ( autoCal ) {
 
         dRef = hiRefRef - lowRefRef;
+
+        if ( GetDeviceSerialNumber( DeviceIndex, &serialNumber ) != AIOUSB_SUCCESS )
+            serialNumber = 0;
+        if ( useCache && serialNumber )
+            cached = AIOCalCacheOpenAuto( serialNumber );
+        if ( cached ) {
+            AIOUSB_BOOL loaded = AIOUSB_FALSE;
+            AIOUSBDeviceWriteLock( deviceDesc );
+            if ( deviceDesc->calAutoHash == cached->hash ) {
+                deviceDesc->calUploadsAvoided += 2;
+                loaded = AIOUSB_TRUE;
+            }
+            AIOUSBDeviceUnlock( deviceDesc );
+            if ( loaded ) {
+                memcpy( calTable, cached->table + CAL_TABLE_WORDS, CAL_TABLE_WORDS * sizeof(unsigned short) );
+                retval = AIOUSB_SUCCESS;
+                goto publish_AIOUSB_ADC_InternalCal;
+            }
+        } else if ( serialNumber ) {
+            tables = ( unsigned short* )malloc( 2 * CAL_TABLE_WORDS * sizeof(unsigned short) );
+        }
+
         /*
          * create calibrated calibration table
          */
@@ -2707,6 +3106,22 @@ unsigned long AIOUSB_ADC_InternalCal(
         for ( int k = 0;  k <= 1 ; k ++ ) {
             ADC_SetConfig( DeviceIndex, nConfig.registers, &deviceDesc->cachedConfigBlock.size );
 
+            if ( cached ) {
+                /* load it under the same registers a measured table goes in with */
+                nConfig.registers[AD_REGISTER_TRIG_COUNT] = 0x04;
+                nConfig.registers[AD_REGISTER_START_END] = 0x00;
+                nConfig.registers[AD_REGISTER_OVERSAMPLE] = 0xff;
+                nConfig.registers[AD_REGISTER_CAL_MODE] &= ~0x02;
+                ADC_SetConfig( DeviceIndex, nConfig.registers, &nConfig.size );
+                memcpy( calTable, cached->table + k * CAL_TABLE_WORDS, CAL_TABLE_WORDS * sizeof(unsigned short) );
+                retval = AIOUSB_ADC_SetCalTable(DeviceIndex, calTable);
+                if ( retval != AIOUSB_SUCCESS )
+                    goto free_AIOUSB_ADC_InternalCal;
+                nConfig.registers[AD_REGISTER_CAL_MODE] = 0x01;
+                nConfig.registers[0x00] = AD_GAIN_CODE_0_10V;
+                continue;
+            }
+
             /* Setup 1-to-1 caltable */
             for(int index = 0; index < CAL_TABLE_WORDS; index++)
                 calTable[ index ] = index;    
@@ -2755,7 +3170,12 @@ unsigned long AIOUSB_ADC_InternalCal(
                     j = 0xffff;
                 calTable[i] = j;
             }
-            AIOUSB_ADC_SetCalTable(DeviceIndex, calTable);
+            if ( AIOUSB_ADC_SetCalTable(DeviceIndex, calTable) != AIOUSB_SUCCESS ) {
+                free( tables );         /* don't cache what didn't load */
+                tables = NULL;
+            } else if ( tables ) {
+                memcpy( tables + k * CAL_TABLE_WORDS, calTable, CAL_TABLE_WORDS * sizeof(unsigned short) );
+            }
             /* Save caltable to file if specified */
             nConfig.registers[AD_REGISTER_CAL_MODE] = 0x01;
             nConfig.registers[0x00] = AD_GAIN_CODE_0_10V;
@@ -2791,6 +3211,16 @@ unsigned long AIOUSB_ADC_InternalCal(
     
 
 
+    if ( retval == AIOUSB_SUCCESS && autoCal && ( cached || tables ) ) {
+        uint64_t hash = cached ? cached->hash : AIOCalTableHash( tables, 2 * CAL_TABLE_WORDS );
+        if ( tables )
+            AIOCalCacheStoreAuto( serialNumber, tables, 2 * CAL_TABLE_WORDS );
+        AIOUSBDeviceWriteLock( deviceDesc );
+        deviceDesc->calAutoHash = hash;
+        AIOUSBDeviceUnlock( deviceDesc );
+    }
+
+ publish_AIOUSB_ADC_InternalCal:
     if (retval == AIOUSB_SUCCESS && autoCal ) {
       /*
        * optionally return calibration table to caller
@@ -2816,6 +3246,9 @@ unsigned long AIOUSB_ADC_InternalCal(
       }
  free_AIOUSB_ADC_InternalCal:
     free(calTable);
+    free(tables);
+    if ( cached )
+        AIOCalCacheRelease( cached );
 
     deviceDesc->cachedConfigBlock = oConfig;
     retval = ADC_SetConfig( DeviceIndex, oConfig.registers, &oConfig.size );
@@ -2825,6 +3258,25 @@ out_AIOUSB_ADC_InternalCal:
     return retval;
 }
 
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Performs automatic calibration of the ADC
+ * @param DeviceIndex
+ * @param autoCal
+ * @param returnCalTable
+ * @param saveFileName
+ * @return
+ */
+unsigned long AIOUSB_ADC_InternalCal(
+                                     unsigned long DeviceIndex,
+                                     AIOUSB_BOOL autoCal,
+                                     unsigned short returnCalTable[],
+                                     const char *saveFileName
+                                     )
+{
+    return _adc_internal_cal( DeviceIndex, autoCal, returnCalTable, saveFileName, AIOUSB_FALSE );
+}
+
 /*----------------------------------------------------------------------------*/
 void AIOUSB_SetRegister(ADConfigBlock *cb, unsigned int Register, unsigned char value)
 {
@@ -4,6 +4,7 @@
 #include "AIOTypes.h"
 #include "AIOBuf.h"
 #include "ADCConfigBlock.h"
+#include "AIOHostCal.h"
 #include "USBDevice.h"
 
 #ifdef __aiousb_cplusplus
@@ -35,6 +36,9 @@ PUBLIC_EXTERN AIOUSB_BOOL ADC_CanCalibrate( unsigned long ProductID );
 PUBLIC_EXTERN AIORESULT ADC_Initialize( unsigned long DeviceIndex, unsigned char *pConfigBuf, unsigned long *ConfigBufSize,     const char *CalFileName );
 PUBLIC_EXTERN AIORESULT ADC_BulkAcquire( unsigned long DeviceIndex, unsigned long BufSize, void *pBuf );
 PUBLIC_EXTERN AIORESULT ADC_BulkPoll( unsigned long DeviceIndex, unsigned long *BytesLeft     );
+PUBLIC_EXTERN AIORESULT ADC_BulkWait( unsigned long DeviceIndex, unsigned long timeout );
+PUBLIC_EXTERN AIORET_TYPE ADC_BulkGetEventFd( unsigned long DeviceIndex );
+PUBLIC_EXTERN AIORESULT ADC_BulkSetCallback( unsigned long DeviceIndex, void (*callback)( unsigned long DeviceIndex, unsigned long result, void *userdata ), void *userdata );
 
 /* FastScan Functions */
 PUBLIC_EXTERN AIORESULT ADC_InitFastITScanV( unsigned long DeviceIndex );
@@ -49,6 +53,8 @@ PUBLIC_EXTERN AIORESULT ADC_SetOversample( unsigned long DeviceIndex, unsigned c
 
 PUBLIC_EXTERN AIORESULT WriteConfigBlock(unsigned long DeviceIndex);
 PUBLIC_EXTERN AIORESULT ReadConfigBlock(unsigned long DeviceIndex,AIOUSB_BOOL forceRead  );
+PUBLIC_EXTERN AIORET_TYPE ADC_GetConfigTransfersAvoided( unsigned long DeviceIndex );
+PUBLIC_EXTERN AIORET_TYPE ADC_SetHostCal( unsigned long DeviceIndex, AIOHostCal *cal );
 
 PUBLIC_EXTERN AIORET_TYPE AIOUSB_SetAllGainCodeAndDiffMode( ADConfigBlock *config, unsigned gainCode, AIOUSB_BOOL differentialMode );
 PUBLIC_EXTERN AIORET_TYPE AIOUSB_GetGainCode( const ADConfigBlock *config, unsigned channel );
@@ -11,6 +11,9 @@
 #include "AIOUSB_Log.h"
 
 #include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
 
 #ifdef __cplusplus
 namespace AIOUSB {
@@ -20,7 +23,6 @@ namespace AIOUSB {
         if( !d )                                                        \
             return (AIORET_TYPE)-AIOUSB_ERROR_INVALID_INDEX;            \
         if( ( r = f ) != AIOUSB_SUCCESS ) {                             \
-            AIOUSB_UnLock();                                            \
             return r;                                                   \
         }                                                               \
     } while (0)
@@ -55,12 +57,10 @@ AIORET_TYPE _check_block_index(AIOUSBDevice *deviceDesc, unsigned long BlockInde
         BlockIndex = CounterIndex / COUNTERS_PER_BLOCK;
         CounterIndex = CounterIndex % COUNTERS_PER_BLOCK;
         if (BlockIndex >= deviceDesc->Counters) {
-            AIOUSB_UnLock();
             return (AIORET_TYPE)-AIOUSB_ERROR_INVALID_PARAMETER;
         }
     } else {
         if ( BlockIndex >= deviceDesc->Counters || CounterIndex >= COUNTERS_PER_BLOCK ) {
-            AIOUSB_UnLock();
             return (AIORET_TYPE)-AIOUSB_ERROR_INVALID_PARAMETER;
         }
     }
@@ -178,7 +178,6 @@ AIORET_TYPE CTR_8254Mode(
         goto out_CTR_8254Mode;
     }
 
-    AIOUSB_UnLock();
     controlValue = (( unsigned short )CounterIndex << (6 + 8))  | (0x3u << (4 + 8))  | 
                    (( unsigned short )Mode << (1 + 8))          | ( unsigned short )BlockIndex;
     bytesTransferred = usb->usb_control_transfer(usb,
@@ -194,7 +193,6 @@ AIORET_TYPE CTR_8254Mode(
         result = LIBUSB_RESULT_TO_AIOUSB_RESULT(bytesTransferred);
 
  out_CTR_8254Mode:
-    AIOUSB_UnLock();
     return result;
 }
 
@@ -233,7 +231,6 @@ AIORET_TYPE CTR_8254Load(
         goto out_CTR_8254Load;
     }
 
-    AIOUSB_UnLock();
     controlValue = (( unsigned short )CounterIndex << (6 + 8)) | ( unsigned short )BlockIndex;
     bytesTransferred = usb->usb_control_transfer(usb,
                                                  USB_WRITE_TO_DEVICE, 
@@ -248,7 +245,6 @@ AIORET_TYPE CTR_8254Load(
         result = LIBUSB_RESULT_TO_AIOUSB_RESULT(bytesTransferred);
 
  out_CTR_8254Load:
-    AIOUSB_UnLock();
     return result;
 }
 /*----------------------------------------------------------------------------*/
@@ -277,7 +273,6 @@ AIORET_TYPE CTR_8254ModeLoad(
         goto out_CTR_8254ModeLoad;
     }
 
-    AIOUSB_UnLock();
     controlValue    = (( unsigned short )CounterIndex << (6 + 8))    | (0x3u << (4 + 8))  | 
                       (( unsigned short )Mode << (1 + 8))  | ( unsigned short )BlockIndex;
     bytesTransferred = usb->usb_control_transfer( usb,
@@ -293,7 +288,6 @@ AIORET_TYPE CTR_8254ModeLoad(
         result = LIBUSB_RESULT_TO_AIOUSB_RESULT(bytesTransferred);
     
  out_CTR_8254ModeLoad:
-    AIOUSB_UnLock();
     return result;
 }
 /*----------------------------------------------------------------------------*/
@@ -316,7 +310,6 @@ AIORET_TYPE CTR_8254ReadModeLoad(
 
     JUMP_IF_NO_VALID_USB( deviceDesc , retval, _check_valid_input_for_modeload( deviceDesc, BlockIndex, CounterIndex, Mode, LoadValue, pReadValue), usb, out_CTR_8254ReadModeLoad );
 
-    AIOUSB_UnLock();
 
     controlValue = (( unsigned short )CounterIndex << (6 + 8)) |  (0x3u << (4 + 8)) | 
                    (( unsigned short )Mode << (1 + 8))         |  ( unsigned short )BlockIndex;
@@ -337,7 +330,6 @@ AIORET_TYPE CTR_8254ReadModeLoad(
         result = -LIBUSB_RESULT_TO_AIOUSB_RESULT(bytesTransferred);
 
  out_CTR_8254ReadModeLoad:
-    AIOUSB_UnLock();
     return retval;
 }
 
@@ -359,7 +351,6 @@ AIORET_TYPE CTR_8254Read(
 
     JUMP_IF_NO_VALID_USB( deviceDesc, retval, _check_valid_counter_device( deviceDesc, BlockIndex, CounterIndex ), usb, out_CTR_8254Read );
 
-    AIOUSB_UnLock();
 
     controlValue = (( unsigned short )CounterIndex << 8) | ( unsigned short )BlockIndex;
     bytesTransferred = usb->usb_control_transfer(usb,
@@ -378,7 +369,6 @@ AIORET_TYPE CTR_8254Read(
         result = LIBUSB_RESULT_TO_AIOUSB_RESULT(bytesTransferred);
 
  out_CTR_8254Read:
-    AIOUSB_UnLock();
     return result;
 }
 
@@ -397,7 +387,6 @@ AIORET_TYPE CTR_8254ReadAll(
     JUMP_IF_NO_VALID_USB( deviceDesc, retval, _check_valid_counter_device_for_read( deviceDesc, pData ) , usb, out_CTR_8254ReadAll);
 
     READ_BYTES = deviceDesc->Counters * COUNTERS_PER_BLOCK * sizeof(unsigned short);
-    AIOUSB_UnLock();
     bytesTransferred = usb->usb_control_transfer(usb,
                                                  USB_READ_FROM_DEVICE, 
                                                  AUR_CTR_READALL,
@@ -411,7 +400,6 @@ AIORET_TYPE CTR_8254ReadAll(
         result = LIBUSB_RESULT_TO_AIOUSB_RESULT(bytesTransferred);
     
  out_CTR_8254ReadAll:
-    AIOUSB_UnLock();
     return result;
 }
 /*----------------------------------------------------------------------------*/
@@ -434,7 +422,6 @@ AIORET_TYPE CTR_8254ReadStatus(
 
     JUMP_IF_NO_VALID_USB( deviceDesc, retval, _check_block_index( deviceDesc, BlockIndex, CounterIndex ), usb, out_CTR_8254ReadStatus );  
 
-    AIOUSB_UnLock();
 
     controlValue = (( unsigned short )CounterIndex << 8) | ( unsigned short )BlockIndex;
 
@@ -454,11 +441,123 @@ AIORET_TYPE CTR_8254ReadStatus(
         result = LIBUSB_RESULT_TO_AIOUSB_RESULT(bytesTransferred);
 
  out_CTR_8254ReadStatus:
-    AIOUSB_UnLock();
     return result;
 }
 
 
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Most recent divisor pairs, indexed by a hash of the root clock and
+ * requested rate. Rate sweeps and restarts at the same rate come up again
+ * and again, so they shouldn't pay for the search each time.
+ */
+#define CTR_DIVISOR_CACHE_SIZE 64
+
+struct aio_ctr_divisors {
+    long rootClock;
+    double hz;
+    unsigned short high;        /**< 0 for an empty slot */
+    unsigned short low;
+};
+
+static struct aio_ctr_divisors ctr_divisor_cache[ CTR_DIVISOR_CACHE_SIZE ];
+static pthread_mutex_t ctr_divisor_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned _ctr_divisor_slot( long rootClock, double hz )
+{
+    uint64_t key;
+    memcpy( &key, &hz, sizeof(key) );
+    key ^= (uint64_t)rootClock;
+    key *= 0x9e3779b97f4a7c15ull;
+    return (unsigned)( key >> 58 ) % CTR_DIVISOR_CACHE_SIZE;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Finds the pair of 16 bit divisors whose cascaded output is nearest
+ * hz. For each low divisor up to the square root of the total, only the two
+ * high divisors either side of the ideal one can be nearest, so checking
+ * those is exhaustive; the search stops early on an exact match.
+ */
+static void _ctr_search_divisors( long rootClock, double hz, unsigned short *pHigh, unsigned short *pLow )
+{
+    const long MIN_DIVISOR = 2, MAX_DIVISOR = 65535;
+    double total = (double)rootClock / hz;
+    long bestHigh = MIN_DIVISOR, bestLow = MIN_DIVISOR, low;
+    double bestError = fabs( (double)rootClock / ( MIN_DIVISOR * MIN_DIVISOR ) - hz );
+
+    for ( low = MIN_DIVISOR; low <= MAX_DIVISOR && bestError > 0; low ++ ) {
+        double ideal = total / low;
+        long high = ideal > MAX_DIVISOR ? MAX_DIVISOR : (long)ideal;
+        int candidate;
+        for ( candidate = 0; candidate < 2; candidate ++, high ++ ) {
+            if ( high < MIN_DIVISOR || high > MAX_DIVISOR )
+                continue;
+            double error = fabs( (double)rootClock / ( (double)high * low ) - hz );
+            if ( error < bestError ) {
+                bestError = error;
+                bestHigh = high;
+                bestLow = low;
+            }
+        }
+        if ( (double)low * low >= total )
+            break;
+    }
+
+    *pHigh = (unsigned short)bestHigh;
+    *pLow  = (unsigned short)bestLow;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Picks the two cascaded 8254 divisors that bring rootClock nearest
+ * to hz
+ * @param rootClock counter input clock, e.g. AIOUSBDevice::RootClock
+ * @param hz requested output rate
+ * @param [out] pHigh divisor for the first counter, the larger of the two
+ * @param [out] pLow divisor for the second counter
+ * @param [out] pActualHz rate the pair produces, may be NULL
+ * @param [out] pErrorHz actual minus requested, may be NULL
+ * @return AIOUSB_SUCCESS, or -AIOUSB_ERROR_INVALID_PARAMETER
+ */
+AIORET_TYPE CTR_SolveDivisors( long rootClock, double hz, unsigned short *pHigh, unsigned short *pLow, double *pActualHz, double *pErrorHz )
+{
+    AIO_ASSERT( pHigh );
+    AIO_ASSERT( pLow );
+    if ( rootClock <= 0 || !( hz > 0 ) )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+
+    unsigned slot = _ctr_divisor_slot( rootClock, hz );
+    unsigned short high = 0, low = 0;
+
+    pthread_mutex_lock( &ctr_divisor_cache_lock );
+    if ( ctr_divisor_cache[ slot ].high && ctr_divisor_cache[ slot ].rootClock == rootClock && ctr_divisor_cache[ slot ].hz == hz ) {
+        high = ctr_divisor_cache[ slot ].high;
+        low  = ctr_divisor_cache[ slot ].low;
+    }
+    pthread_mutex_unlock( &ctr_divisor_cache_lock );
+
+    if ( !high ) {
+        _ctr_search_divisors( rootClock, hz, &high, &low );
+        pthread_mutex_lock( &ctr_divisor_cache_lock );
+        ctr_divisor_cache[ slot ].rootClock = rootClock;
+        ctr_divisor_cache[ slot ].hz        = hz;
+        ctr_divisor_cache[ slot ].high      = high;
+        ctr_divisor_cache[ slot ].low       = low;
+        pthread_mutex_unlock( &ctr_divisor_cache_lock );
+    }
+
+    double actual = (double)rootClock / ( (double)high * low );
+    *pHigh = high;
+    *pLow  = low;
+    if ( pActualHz )
+        *pActualHz = actual;
+    if ( pErrorHz )
+        *pErrorHz = actual - hz;
+
+    return AIOUSB_SUCCESS;
+}
+
 /*----------------------------------------------------------------------------*/
 /**
  * @brief Calculates the register values for buf->divisora, and buf->divisorb to create
@@ -470,58 +569,15 @@ AIORET_TYPE CTR_8254ReadStatus(
  */
 AIORET_TYPE CTR_CalculateCountersForClock( int hz , int *diva, int *divb )
 {
-
     AIO_ASSERT( diva );
     AIO_ASSERT( divb );
-    float l;
-    int divisora, divisorb, divisorab;
-    int min_err, err;
+    unsigned short divisora, divisorb;
 
-    if (  hz == 0 ) {
+    if ( hz <= 0 ) {
         return -AIOUSB_ERROR_INVALID_PARAMETER;
     }
-    if (   hz * 4 >= ROOTCLOCK ) {
-        divisora = 2;
-        divisorb = 2;
-    } else { 
-        divisorab = ROOTCLOCK / hz;
-        l = sqrt( divisorab );
-        if ( l > 0xffff ) { 
-            divisora = 0xffff;
-            divisorb = 0xffff;
-            min_err  = abs((int)(round(((ROOTCLOCK / hz) - (int)(divisora * l)))));
-        } else  { 
-            divisora  = round( divisorab / l );
-            l         = round(sqrt( divisorab ));
-            divisorb  = l;
-
-            min_err = abs(((ROOTCLOCK / hz) - (int)(divisora * l)));
-      
-            for ( unsigned lv = l ; lv >= 2 ; lv -- ) {
-                unsigned olddivisora = (int)round((double)divisorab / lv);
-                if (  olddivisora > 0xffff ) { 
-                    AIOUSB_DEVEL( "Found value > 0xff..resetting" );
-                    break;
-                } else { 
-                    divisora = olddivisora;
-                }
-
-                err = abs((int)((ROOTCLOCK / hz) - (divisora * lv)));
-                if (  err <= 0  ) {
-                    min_err = 0;
-                    AIOUSB_DEVEL("Found zero error: %d\n", lv );
-                    divisorb = lv;
-                    break;
-                } 
-                if (  err < min_err  ) {
-                    AIOUSB_DEVEL( "Found new error: using lv=%d\n", (int)lv);
-                    divisorb = lv;
-                    min_err = err;
-                }
-                divisora = (int)round(divisorab / divisorb);
-            }
-        }
-    }
+    CTR_SolveDivisors( ROOTCLOCK, hz, &divisora, &divisorb, NULL, NULL );
+
     *diva = divisora;
     *divb = divisorb;
     return AIOUSB_SUCCESS;
@@ -538,7 +594,6 @@ AIORET_TYPE CTR_StartOutputFreq(unsigned long DeviceIndex, unsigned long BlockIn
 
     if (*pHz <= 0) {
                                 /* turn off counters */
-          AIOUSB_UnLock();
           result = CTR_8254Mode(DeviceIndex, BlockIndex, 1, 2);
           if (result != AIOUSB_SUCCESS)
               return result;
@@ -547,62 +602,17 @@ AIORET_TYPE CTR_StartOutputFreq(unsigned long DeviceIndex, unsigned long BlockIn
               return result;
           *pHz = 0;                                                                   /* actual clock speed*/
       } else {
-           long rootClock = deviceDesc->RootClock;
-          AIOUSB_UnLock();
-           long frequency = ( long )*pHz;
-           long MIN_DIVISOR = 2;
-           long MAX_DIVISOR = 65535;
-          long bestHighDivisor = MIN_DIVISOR,
-               bestLowDivisor = MIN_DIVISOR,
-               minFreqError = 0;
-          AIOUSB_BOOL minFreqErrorValid = AIOUSB_FALSE;
-           long divisor = ( long )round(( double )rootClock / ( double )frequency);
-#if defined(DEBUG_START_CLOCK)
-          printf(
-              "Calculating divisors (total divisor = %ld)\n"
-              "  %8s  %8s  %8s\n",
-              divisor, "High", "Low", "Error"
-              );
-#endif
-          if (divisor > MIN_DIVISOR * MIN_DIVISOR) {
-                long lowDivisor;
-                for(lowDivisor = ( long )sqrt(divisor); lowDivisor >= MIN_DIVISOR; lowDivisor--) {
-                      long highDivisor = divisor / lowDivisor;
-                       long freqError = labs(frequency - rootClock / (highDivisor * lowDivisor));
-#if defined(DEBUG_START_CLOCK)
-                      printf("  %8ld  %8ld  %8ld\n", highDivisor, lowDivisor, freqError);
-#endif
-                      if (highDivisor > MAX_DIVISOR) {
-                          /* this divisor would exceed the maximum; use best divisor calculated thus far*/
-                            break;
-                        } else if (freqError == 0) {
-                          /* these divisors have no error; no need to continue searching for divisors*/
-                            minFreqErrorValid = AIOUSB_TRUE;
-                            minFreqError = freqError;
-                            bestHighDivisor = highDivisor;
-                            bestLowDivisor = lowDivisor;
-                            break;
-                        } else if (
-                          !minFreqErrorValid ||
-                          freqError < minFreqError
-                          ) {
-                            minFreqErrorValid = AIOUSB_TRUE;
-                            minFreqError = freqError;
-                            bestHighDivisor = highDivisor;
-                            bestLowDivisor = lowDivisor;
-                        }
-                  }
-            }
-#if defined(DEBUG_START_CLOCK)
-          printf("  %8ld  %8ld  %8ld (final)\n", bestHighDivisor, bestLowDivisor, minFreqError);
-#endif
-          result = CTR_8254ModeLoad(DeviceIndex, BlockIndex, 1, 2, ( unsigned short )bestHighDivisor);
+          unsigned short bestHighDivisor, bestLowDivisor;
+          AIORET_TYPE retval = CTR_SolveDivisors( deviceDesc->RootClock, *pHz, &bestHighDivisor, &bestLowDivisor, NULL, NULL );
+          if (retval != AIOUSB_SUCCESS)
+              return retval;
+          result = CTR_8254ModeLoad(DeviceIndex, BlockIndex, 1, 2, bestHighDivisor);
           if (result != AIOUSB_SUCCESS)
               return result;
-          result = CTR_8254ModeLoad(DeviceIndex, BlockIndex, 2, 3, ( unsigned short )bestLowDivisor);
+          result = CTR_8254ModeLoad(DeviceIndex, BlockIndex, 2, 3, bestLowDivisor);
           if (result != AIOUSB_SUCCESS)
               return result;
-          *pHz = rootClock / (bestHighDivisor * bestLowDivisor);              /* actual clock speed*/
+          *pHz = (double)deviceDesc->RootClock / ( (double)bestHighDivisor * bestLowDivisor ); /* actual clock speed*/
       }
 
     return result;
@@ -621,7 +631,6 @@ AIORET_TYPE CTR_8254SelectGate(
     JUMP_IF_NO_VALID_USB( deviceDesc, result, _check_valid_counter_device_for_gate(deviceDesc, GateIndex ), usb, out_CTR_8254SelectGate );
 
     
-    AIOUSB_UnLock();
     bytesTransferred = usb->usb_control_transfer(usb,
                                                  USB_WRITE_TO_DEVICE, 
                                                  AUR_CTR_SELGATE,
@@ -635,7 +644,6 @@ AIORET_TYPE CTR_8254SelectGate(
         result = LIBUSB_RESULT_TO_AIOUSB_RESULT(bytesTransferred);
 
  out_CTR_8254SelectGate:
-    AIOUSB_UnLock();
     return result;
 }
 
@@ -656,7 +664,6 @@ AIORET_TYPE CTR_8254ReadLatched(
     
     READ_BYTES = deviceDesc->Counters * COUNTERS_PER_BLOCK * sizeof(unsigned short) + 1 ;/* for "old data" flag */
     
-    AIOUSB_UnLock();
     bytesTransferred = usb->usb_control_transfer(usb,
                                                  USB_READ_FROM_DEVICE, 
                                                  AUR_CTR_READLATCHED,
@@ -670,7 +677,6 @@ AIORET_TYPE CTR_8254ReadLatched(
         result = LIBUSB_RESULT_TO_AIOUSB_RESULT(bytesTransferred);
     
  out_CTR_8254ReadLatched:
-    AIOUSB_UnLock();
     return retval;
 }
 
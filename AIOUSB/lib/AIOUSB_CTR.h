@@ -14,6 +14,7 @@ namespace AIOUSB {
 
 /* BEGIN AIOUSB_API */
 PUBLIC_EXTERN AIORET_TYPE CTR_CalculateCountersForClock( int hz , int *diva, int *divb );
+PUBLIC_EXTERN AIORET_TYPE CTR_SolveDivisors( long rootClock, double hz, unsigned short *pHigh, unsigned short *pLow, double *pActualHz, double *pErrorHz );
 PUBLIC_EXTERN AIORET_TYPE CTR_8254Mode( unsigned long DeviceIndex, unsigned long BlockIndex, unsigned long CounterIndex, unsigned long Mode ); 
 PUBLIC_EXTERN AIORET_TYPE CTR_8254Load( unsigned long DeviceIndex, unsigned long BlockIndex, unsigned long CounterIndex, unsigned short LoadValue ); 
 PUBLIC_EXTERN AIORET_TYPE CTR_8254ModeLoad( unsigned long DeviceIndex, unsigned long BlockIndex, unsigned long CounterIndex, unsigned long Mode, unsigned short LoadValue ); 
@@ -11,6 +11,7 @@
 #include "AIOUSB_Core.h"
 #include "AIODeviceTable.h"
 #include "AIOUSB_ADC.h"
+#include "AIOCalCache.h"
 #include <assert.h>
 #include <math.h>
 #include <stdio.h>
@@ -159,6 +160,17 @@ ProductIDName productIDNameTable[] = {
 
 #if defined(AIOUSB_ENABLE_MUTEX)
 static pthread_mutex_t aiousbMutex;
+static pthread_once_t aiousbMutexOnce = PTHREAD_ONCE_INIT;
+static unsigned long aiousbMutexContention = 0;
+
+static void _init_aiousb_mutex(void)
+{
+    pthread_mutexattr_t mutexAttr;
+    pthread_mutexattr_init( &mutexAttr );
+    pthread_mutexattr_settype( &mutexAttr, PTHREAD_MUTEX_RECURSIVE );
+    pthread_mutex_init( &aiousbMutex, &mutexAttr );
+    pthread_mutexattr_destroy( &mutexAttr );
+}
 #endif
 
 
@@ -186,11 +198,20 @@ static pthread_mutex_t aiousbMutex;
  *   foreground thread monitors the progress. In such a case, the background thread might update
  *   a status variable which the foreground thread monitors. This form of resource sharing is
  *   supported by our mutual exclusion scheme.
+ *
+ * - The global lock below only serializes populating deviceTable[]. Per-device state is
+ *   guarded by each AIOUSBDevice's own locks (see AIOUSBDeviceWriteLock() and
+ *   AIOUSBDeviceLockWorker()), so threads driving different devices never wait for
+ *   each other.
  */
 
 AIOUSB_BOOL AIOUSB_Lock() {
     assert(AIOUSB_IsInit());
 #if defined(AIOUSB_ENABLE_MUTEX)
+    pthread_once( &aiousbMutexOnce, _init_aiousb_mutex );
+    if ( pthread_mutex_trylock( &aiousbMutex ) == 0 )
+        return AIOUSB_TRUE;
+    __sync_fetch_and_add( &aiousbMutexContention, 1 );
     return(pthread_mutex_lock(&aiousbMutex) == 0);
 #else
     return AIOUSB_TRUE;
@@ -206,6 +227,17 @@ AIOUSB_BOOL AIOUSB_UnLock() {
 #endif
 }
 
+/**
+ * @brief Number of times AIOUSB_Lock() had to wait for another thread
+ */
+AIORET_TYPE AIOUSB_GetLockContention() {
+#if defined(AIOUSB_ENABLE_MUTEX)
+    return (AIORET_TYPE)aiousbMutexContention;
+#else
+    return 0;
+#endif
+}
+
 PUBLIC_EXTERN AIORET_TYPE AIOUSB_ResetChip( unsigned long DeviceIndex )
 {
     unsigned char data[2] = {0x01};
@@ -237,8 +269,8 @@ unsigned long AIOUSB_Validate_Lock(unsigned long *DeviceIndex)
          */
         result = AIOUSB_ERROR_FILE_NOT_FOUND;
         int index;
-        for(index = 0; index < MAX_USB_DEVICES; index++) {
-            if(deviceTable[ index ].usb_device != NULL) {
+        for(index = 0; index < AIODeviceTableGetCapacity(); index++) {
+            if(_get_device_no_error( index )->usb_device != NULL) {
                 *DeviceIndex = index;
                 result = AIOUSB_SUCCESS;
                 break;                                              // from for()
@@ -250,8 +282,8 @@ unsigned long AIOUSB_Validate_Lock(unsigned long *DeviceIndex)
          */
         result = AIOUSB_ERROR_FILE_NOT_FOUND;
         int index;
-        for(index = 0; index < MAX_USB_DEVICES; index++) {
-            if(deviceTable[ index ].usb_device != NULL) {
+        for(index = 0; index < AIODeviceTableGetCapacity(); index++) {
+            if(_get_device_no_error( index )->usb_device != NULL) {
                 if(result != AIOUSB_SUCCESS) {
                     /*
                      * this is the first device found; save this index, but
@@ -270,8 +302,8 @@ unsigned long AIOUSB_Validate_Lock(unsigned long *DeviceIndex)
         }
     } else {
         if(
-           *DeviceIndex < MAX_USB_DEVICES &&
-           deviceTable[ *DeviceIndex ].usb_device != NULL
+           _get_device_no_error( *DeviceIndex ) != NULL &&
+           _get_device_no_error( *DeviceIndex )->usb_device != NULL
            )
             result = AIOUSB_SUCCESS;
         else
@@ -291,8 +323,8 @@ unsigned long AIOUSB_Validate(unsigned long *DeviceIndex)
        */
         result = AIOUSB_ERROR_FILE_NOT_FOUND;
         int index;
-        for(index = 0; index < MAX_USB_DEVICES; index++) {
-            if(deviceTable[ index ].usb_device != NULL) {
+        for(index = 0; index < AIODeviceTableGetCapacity(); index++) {
+            if(_get_device_no_error( index )->usb_device != NULL) {
                 *DeviceIndex = index;
                 result = AIOUSB_SUCCESS;
                 break;                                                      // from for()
@@ -303,8 +335,8 @@ unsigned long AIOUSB_Validate(unsigned long *DeviceIndex)
        * find first device on bus, ensuring that it's the only device
        */
           result = AIOUSB_ERROR_FILE_NOT_FOUND;
-          for(int index = 0; index < MAX_USB_DEVICES; index++) {
-                if(deviceTable[ index ].usb_device != NULL) {
+          for(int index = 0; index < AIODeviceTableGetCapacity(); index++) {
+                if(_get_device_no_error( index )->usb_device != NULL) {
                       if(result != AIOUSB_SUCCESS) { /* found a device */
                         /*
                          * this is the first device found; save this index, but
@@ -326,8 +358,8 @@ unsigned long AIOUSB_Validate(unsigned long *DeviceIndex)
        * simply verify that the supplied index is valid
        */
       if(
-         *DeviceIndex < MAX_USB_DEVICES &&
-         deviceTable[ *DeviceIndex ].usb_device != NULL
+         _get_device_no_error( *DeviceIndex ) != NULL &&
+         _get_device_no_error( *DeviceIndex )->usb_device != NULL
          )
         result = AIOUSB_SUCCESS;
       else
@@ -347,14 +379,13 @@ unsigned long ResolveDeviceIndex(unsigned long DeviceIndex) {
 DeviceDescriptor *DeviceTableAtIndex( unsigned long DeviceIndex ) { 
     AIOUSB_Validate( &DeviceIndex  );
 
-    DeviceDescriptor * deviceDesc = &deviceTable[ DeviceIndex ];
+    DeviceDescriptor * deviceDesc = _get_device_no_error( DeviceIndex );
 
     return deviceDesc;
 }
 
 /*------------------------------------------------------------------------*/
 /**
- * @todo Replace AIOUSB_Lock() with thread safe lock on a per device index basis
  * @todo Insert correct error messages into global error string in case of failure
  */
 DeviceDescriptor *DeviceTableAtIndex_Lock( unsigned long DeviceIndex ) 
@@ -363,7 +394,7 @@ DeviceDescriptor *DeviceTableAtIndex_Lock( unsigned long DeviceIndex )
     if ( result != AIOUSB_SUCCESS ) {
         return NULL;
     }
-    DeviceDescriptor * deviceDesc = &deviceTable[ DeviceIndex ];
+    DeviceDescriptor * deviceDesc = _get_device_no_error( DeviceIndex );
 
     return deviceDesc;
 }
@@ -381,7 +412,7 @@ DeviceDescriptor *AIOUSB_GetDevice( unsigned long DeviceIndex )
         return NULL;
     }
 
-    DeviceDescriptor *deviceDesc = &deviceTable[ DeviceIndex ];
+    DeviceDescriptor *deviceDesc = _get_device_no_error( DeviceIndex );
 
     return deviceDesc;
 }
@@ -413,7 +444,7 @@ long AIOUSB_GetStreamingBlockSize(unsigned long DeviceIndex) {
           return -result;
 
 
-    DeviceDescriptor *deviceDesc = &deviceTable[ DeviceIndex ];
+    DeviceDescriptor *deviceDesc = _get_device_no_error( DeviceIndex );
     if(deviceDesc->bADCStream || deviceDesc->bDIOStream)
         BlockSize = deviceDesc->StreamingBlockSize;
     else
@@ -431,7 +462,7 @@ unsigned long AIOUSB_SetStreamingBlockSize(
      if(result != AIOUSB_SUCCESS)
           return result;
 
-     DeviceDescriptor * deviceDesc = &deviceTable[ DeviceIndex ];
+     DeviceDescriptor * deviceDesc = _get_device_no_error( DeviceIndex );
 
      BlockSize = ( BlockSize < 1024*64 ? 1024 * 64 : BlockSize );
 
@@ -519,7 +550,7 @@ AIORESULT AIOUSB_GetMiscClock(
     double clockHz = 0;                                                         // return reasonable value on error
 
     if( AIOUSB_Validate(&DeviceIndex) == AIOUSB_SUCCESS )
-        clockHz = deviceTable[ DeviceIndex ].miscClockHz;
+        clockHz = _get_device_no_error( DeviceIndex )->miscClockHz;
     return clockHz;
 }
 
@@ -533,7 +564,7 @@ AIORESULT AIOUSB_SetMiscClock(
 
     unsigned long result = AIOUSB_Validate(&DeviceIndex);
     if(result == AIOUSB_SUCCESS)
-        deviceTable[ DeviceIndex ].miscClockHz = clockHz;
+        _get_device_no_error( DeviceIndex )->miscClockHz = clockHz;
 
     return result;
 }
@@ -544,7 +575,7 @@ unsigned AIOUSB_GetCommTimeout(
     unsigned timeout = 1000;
 
     if (AIOUSB_Validate(&DeviceIndex) == AIOUSB_SUCCESS)
-        timeout = deviceTable[ DeviceIndex ].commTimeout;
+        timeout = _get_device_no_error( DeviceIndex )->commTimeout;
 
     return timeout;
 }
@@ -557,18 +588,19 @@ unsigned long AIOUSB_SetCommTimeout(
 
     unsigned long result = AIOUSB_Validate(&DeviceIndex);
     if(result == AIOUSB_SUCCESS)
-        deviceTable[ DeviceIndex ].commTimeout = timeout;
+        _get_device_no_error( DeviceIndex )->commTimeout = timeout;
 
     return result;
 }
 
 unsigned long AIOUSB_Validate_Device(unsigned long DeviceIndex) {
     unsigned long result;
-    DeviceDescriptor *const deviceDesc = &deviceTable[ DeviceIndex ];
+    DeviceDescriptor *deviceDesc;
 
     result = AIOUSB_Validate(&DeviceIndex);
     if (result != AIOUSB_SUCCESS)
         goto RETURN_AIOUSB_Validate_Device;
+    deviceDesc = _get_device_no_error( DeviceIndex );
 
     if (deviceDesc->bADCStream == AIOUSB_FALSE) {
         result = AIOUSB_ERROR_NOT_SUPPORTED;
@@ -609,66 +641,18 @@ AIORESULT AIOUSB_InitConfigBlock(ADConfigBlock *config, unsigned long DeviceInde
 
 /*------------------------------------------------------------------------*/
 /**
- * @param DeviceIndex
- * @param fileName
- * @return
- */
-unsigned long AIOUSB_ADC_LoadCalTable(
-                                      unsigned long DeviceIndex,
-                                      const char *fileName
-                                      )
-{
-    if(fileName == 0)
-        return AIOUSB_ERROR_INVALID_PARAMETER;
-
-    unsigned long result = AIOUSB_Validate(&DeviceIndex);
-
-    DeviceDescriptor *const deviceDesc = &deviceTable[ DeviceIndex ];
-    if (deviceDesc->bADCStream == AIOUSB_FALSE)
-        return AIOUSB_ERROR_NOT_SUPPORTED;
-
-    if((result = ADC_QueryCal(DeviceIndex)) != AIOUSB_SUCCESS)
-          return result;
-
-    unsigned short *const calTable = ( unsigned short* )malloc(CAL_TABLE_WORDS * sizeof(unsigned short));
-    assert(calTable != 0);
-    if(calTable != 0) {
-          struct stat fileInfo;
-          if(stat(fileName, &fileInfo) == 0) {
-                if(fileInfo.st_size == CAL_TABLE_WORDS * sizeof(unsigned short)) {
-                      FILE *const calFile = fopen(fileName, "r");
-                      if(calFile != NULL) {
-                            const size_t wordsRead = fread(calTable, sizeof(unsigned short), CAL_TABLE_WORDS, calFile);
-                            fclose(calFile);
-                            if(wordsRead == ( size_t )CAL_TABLE_WORDS)
-                                result = AIOUSB_ADC_SetCalTable(DeviceIndex, calTable);
-                            else
-                                result = AIOUSB_ERROR_FILE_NOT_FOUND;
-                        }else
-                          result = AIOUSB_ERROR_FILE_NOT_FOUND;
-                  }else
-                    result = AIOUSB_ERROR_INVALID_DATA;              // file size incorrect
-            }else
-              result = AIOUSB_ERROR_FILE_NOT_FOUND;
-          free(calTable);
-      }else
-        result = AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
-
-    return result;
-}
-/*------------------------------------------------------------------------*/
-/**
+ * @brief Sends calTable to the board unless it already holds it
  * @param DeviceIndex
  * @param calTable
+ * @param hash AIOCalTableHash() of calTable
  * @return
  */
-unsigned long AIOUSB_ADC_SetCalTable(
-                                     unsigned long DeviceIndex,
-                                     const unsigned short calTable[]
-                                     )
+static unsigned long _adc_set_cal_table(
+                                        unsigned long DeviceIndex,
+                                        const unsigned short calTable[],
+                                        uint64_t hash
+                                        )
 {
-    if(calTable == 0)
-        return AIOUSB_ERROR_INVALID_PARAMETER;
     unsigned long result = AIOUSB_SUCCESS;
     AIOUSBDevice *deviceDesc = AIODeviceTableGetDeviceAtIndex( DeviceIndex, &result );
     if ( result != AIOUSB_SUCCESS )
@@ -678,6 +662,24 @@ unsigned long AIOUSB_ADC_SetCalTable(
         return result;    
 
     int bytesTransferred = 0;
+    int calMode = -1;
+
+    /*
+     * the cal mode register picks which table the board loads, so the
+     * board only holds this one if it went in under the current mode
+     * and nothing has been loaded since
+     */
+    AIOUSBDeviceWriteLock( deviceDesc );
+    if ( deviceDesc->deviceConfigBlock.size > AD_CONFIG_CAL_MODE )
+        calMode = deviceDesc->deviceConfigBlock.registers[ AD_CONFIG_CAL_MODE ];
+    if ( calMode >= 0 && deviceDesc->calTableMode == calMode && deviceDesc->calTableHash == hash ) {
+        deviceDesc->calUploadsAvoided ++;
+        AIOUSBDeviceUnlock( deviceDesc );
+        return AIOUSB_SUCCESS;
+    }
+    deviceDesc->calTableMode = -1;
+    deviceDesc->calAutoHash = 0;
+    AIOUSBDeviceUnlock( deviceDesc );
 
     /*
      * send calibration table to SRAM one block at a time; according to
@@ -724,9 +726,70 @@ unsigned long AIOUSB_ADC_SetCalTable(
         sramAddress += num_to_write;
     }
 
+    if ( result == AIOUSB_SUCCESS ) {
+        AIOUSBDeviceWriteLock( deviceDesc );
+        deviceDesc->calTableHash = hash;
+        deviceDesc->calTableMode = calMode;
+        AIOUSBDeviceUnlock( deviceDesc );
+    }
+
     return result;
 }
 
+/*------------------------------------------------------------------------*/
+/**
+ * @brief Loads a calibration file into the board. The file comes
+ * through AIOCalCache, so it is only read again once it changes.
+ * @param DeviceIndex
+ * @param fileName
+ * @return
+ */
+unsigned long AIOUSB_ADC_LoadCalTable(
+                                      unsigned long DeviceIndex,
+                                      const char *fileName
+                                      )
+{
+    if(fileName == 0)
+        return AIOUSB_ERROR_INVALID_PARAMETER;
+
+    unsigned long result = AIOUSB_Validate(&DeviceIndex);
+    if (result != AIOUSB_SUCCESS)
+        return result;
+
+    DeviceDescriptor *const deviceDesc = _get_device_no_error( DeviceIndex );
+    if (deviceDesc->bADCStream == AIOUSB_FALSE)
+        return AIOUSB_ERROR_NOT_SUPPORTED;
+
+    if((result = ADC_QueryCal(DeviceIndex)) != AIOUSB_SUCCESS)
+          return result;
+
+    AIOCalTable *table = AIOCalCacheOpenFile( fileName );
+    if ( !table )
+        return (unsigned long)-(AIORET_TYPE)aio_errno;
+
+    result = _adc_set_cal_table( DeviceIndex, table->table, table->hash );
+    AIOCalCacheRelease( table );
+
+    return result;
+}
+/*------------------------------------------------------------------------*/
+/**
+ * @brief Loads calTable into the board's SRAM, unless the board is known
+ * to hold it already under the current cal mode
+ * @param DeviceIndex
+ * @param calTable
+ * @return
+ */
+unsigned long AIOUSB_ADC_SetCalTable(
+                                     unsigned long DeviceIndex,
+                                     const unsigned short calTable[]
+                                     )
+{
+    if(calTable == 0)
+        return AIOUSB_ERROR_INVALID_PARAMETER;
+    return _adc_set_cal_table( DeviceIndex, calTable, AIOCalTableHash( calTable, CAL_TABLE_WORDS ) );
+}
+
 
 
 
@@ -74,6 +74,7 @@ PUBLIC_EXTERN AIORET_TYPE AIOUSB_ResetChip( unsigned long DeviceIndex );
 #ifndef SWIG
 PUBLIC_EXTERN AIOUSB_BOOL AIOUSB_Lock(void);
 PUBLIC_EXTERN AIOUSB_BOOL AIOUSB_UnLock(void);
+PUBLIC_EXTERN AIORET_TYPE AIOUSB_GetLockContention(void);
 
 PUBLIC_EXTERN AIORESULT AIOUSB_InitTest(void);
 PUBLIC_EXTERN AIORESULT AIOUSB_Validate( unsigned long *DeviceIndex );
@@ -121,6 +122,34 @@ PUBLIC_EXTERN AIORESULT AIOUSB_Validate_Device( unsigned long DeviceIndex );
 
 /* END AIOUSB_API */
 
+/*
+ * building blocks of an immediate scan, shared by AIOUSB_GetScan() and
+ * AIOPreparedScan
+ */
+AIOUSB_BOOL adc_prepare_immediate_scan( AIOUSBDevice *deviceDesc, ADCConfigBlock *config, int *numChannels,
+                                        int *samplesPerChannel, AIOUSB_BOOL *discardFirstSample );
+AIORET_TYPE adc_start_immediate_scan( AIOUSBDevice *deviceDesc, USBDevice *usb, unsigned numSamples );
+AIORET_TYPE adc_get_bulk_data( ADCConfigBlock *config,USBDevice *usb,  unsigned char endpoint, 
+                               unsigned char *data, int datasize,int *bytes, unsigned timeout  );
+AIORET_TYPE adc_average_immediate_scan( const unsigned short *sampleBuffer, int numChannels, int samplesPerChannel,
+                                        AIOUSB_BOOL discardFirstSample, unsigned short counts[] );
+
+/* tears down the threads ADC_BulkAcquire() keeps per device */
+void adc_bulk_worker_stop( AIOUSBDevice *deviceDesc );
+
+/* tears down the thread DIO_StreamFrameAsync() keeps per device */
+void dio_stream_worker_stop( AIOUSBDevice *device );
+
+/* tears down DIO_BeginTransaction()/DIO_SetAutoFlush() state, dropping unsent bits */
+void dio_batch_stop( AIOUSBDevice *device );
+
+/* tears down an open DACOutputOpen() stream, dropping unsent points */
+void dac_stream_stop( AIOUSBDevice *device );
+
+/* moves one frame over the open DIO stream, see AIOUSB_DIO.c */
+AIORESULT dio_stream_transfer( AIOUSBDevice *device, USBDevice *usb, AIOUSB_BOOL isRead,
+                               unsigned char *data, unsigned long length, unsigned long *total );
+
 #if 0
 /*
  * these will be moved to aiousb.h when they are ready to be made public
@@ -70,7 +70,6 @@ unsigned long CustomEEPROMWrite(
 
     EXIT_FN_IF_NO_VALID_USB( deviceDesc , retval, _check_eeprom_data((AIORET_TYPE)result,DeviceIndex,StartAddress,DataSize,Data ), usb, out_CustomEEPROMWrite );
 
-    AIOUSB_UnLock();
     bytesTransferred = usb->usb_control_transfer(usb,
                                                  USB_WRITE_TO_DEVICE, 
                                                  AUR_EEPROM_WRITE,
@@ -84,7 +83,6 @@ unsigned long CustomEEPROMWrite(
         result = LIBUSB_RESULT_TO_AIOUSB_RESULT(bytesTransferred);
 
  out_CustomEEPROMWrite:
-    AIOUSB_UnLock();
     return result;
 }
 
@@ -113,7 +111,6 @@ unsigned long CustomEEPROMRead(
 
     EXIT_FN_IF_NO_VALID_USB( deviceDesc , retval, _check_eeprom_data((AIORET_TYPE)result,DeviceIndex,StartAddress,*DataSize,Data ) , usb, out_CustomEEPROMRead );
 
-    AIOUSB_UnLock();
     bytesTransferred  = usb->usb_control_transfer(usb,
                                                   USB_READ_FROM_DEVICE, 
                                                   AUR_EEPROM_READ,
@@ -127,7 +124,6 @@ unsigned long CustomEEPROMRead(
         result = LIBUSB_RESULT_TO_AIOUSB_RESULT(bytesTransferred);
 
  out_CustomEEPROMRead:
-    AIOUSB_UnLock();
     return result;
 }
 
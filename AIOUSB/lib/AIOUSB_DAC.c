@@ -8,8 +8,13 @@
 
 #include "AIOUSB_Core.h"
 #include "AIODeviceTable.h"
+#include "AIODACPreparedUpdate.h"
+#include "AIOUSB_CTR.h"
 #include <math.h>
 #include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
 
 #ifdef __cplusplus
 namespace AIOUSB {
@@ -203,6 +208,35 @@ unsigned long DACMultiDirect( unsigned long DeviceIndex,
     return result;
 }
 
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Writes numUpdates successive settings of the same DACs. Unlike
+ * DACMultiDirect() the blocks are laid out once for the whole batch,
+ * and there is no limit on its size.
+ * @param DeviceIndex
+ * @param channels DAC numbers, each at most once
+ * @param numChannels
+ * @param counts numUpdates rows of numChannels counts, in channels order
+ * @param numUpdates
+ * @return updates sent, or a negative error if none could be
+ */
+AIORET_TYPE DACMultiDirectBatch( unsigned long DeviceIndex,
+                                 const unsigned short *channels,
+                                 unsigned numChannels,
+                                 const unsigned short *counts,
+                                 unsigned long numUpdates
+                                 )
+{
+    AIO_ASSERT( counts );
+    AIODACPreparedUpdate *update = NewAIODACPreparedUpdate( DeviceIndex, channels, numChannels );
+    AIO_ERROR_VALID_AIORET_TYPE( aio_errno, update );
+
+    AIORET_TYPE retval = AIODACPreparedUpdateWriteBatch( update, counts, numUpdates );
+    DeleteAIODACPreparedUpdate( update );
+
+    return retval;
+}
+
 /*----------------------------------------------------------------------------*/
 /*
  * @brief Sets the range code for the DAC
@@ -245,64 +279,508 @@ unsigned long DACSetBoardRange(unsigned long DeviceIndex,unsigned long RangeCode
 
 
 /*----------------------------------------------------------------------------*/
-unsigned long DACOutputOpen(unsigned long DeviceIndex,double *pClockHz) {
-  // TODO: this function is not yet implemented
-    return AIOUSB_ERROR_NOT_SUPPORTED;
+/**
+ * @brief DAC streaming (USB-DA12-8A). DACOutputFrame() and
+ * DACOutputFrameRaw() copy samples into one of two blocks, device->DACData[],
+ * while a thread sends the other one to the board with bulk transfers.
+ * hDACDataSem counts the blocks free to fill, so a caller only waits once
+ * it has got a whole block ahead of the USB bus. A filled block is handed
+ * to the thread when the next sample arrives, so DACOutputClose() always
+ * has the last sample at hand to mark it EOM.
+ */
+#define DAC_STREAM_BLOCKS           2
+#define DAC_STREAM_BLOCK_BYTES      ( 32 * 1024 )
+#define DAC_STREAM_AUTOSTART_BYTES  ( 160 * 1024 ) /* 1 1/4 of the board's two 128K SRAM banks */
+#define DAC_STREAM_MAX_DACS         8
+#define DAC_CONTROL_START           1
+
+struct aio_dac_stream {
+    AIOUSBDevice *device;
+    unsigned char *blocks[ DAC_STREAM_BLOCKS ];     /**< device->DACData points here */
+    unsigned long length[ DAC_STREAM_BLOCKS ];      /**< bytes filled in each block */
+    unsigned filling;                               /**< block PendingDACData points to, if not NULL */
+    unsigned head;                                  /**< next block for the thread */
+    unsigned queued;                                /**< blocks handed to the thread and not yet sent */
+    unsigned long bytesSent;
+    unsigned short point[ DAC_STREAM_MAX_DACS ];    /**< last point written, for DACOutputClose() */
+    unsigned pointSamples;
+    AIOUSB_BOOL pointDone;                          /**< point[] ends with an EOD sample */
+    pthread_t thread;
+    pthread_cond_t changed;                         /**< with hDACDataMutex: block queued, block sent, or quit */
+    AIORESULT lastResult;                           /**< first error since DACOutputOpen() */
+    AIOUSB_BOOL quit;
+};
+
+/*----------------------------------------------------------------------------*/
+static AIORESULT _dac_control( AIOUSBDevice *device, unsigned short value )
+{
+    USBDevice *usb = AIOUSBDeviceGetUSBHandle( device );
+    AIO_ERROR_VALID_DATA( AIOUSB_ERROR_DEVICE_NOT_CONNECTED, usb );
+
+    int bytesTransferred = usb->usb_control_transfer( usb,
+                                                      USB_WRITE_TO_DEVICE,
+                                                      AUR_DAC_CONTROL,
+                                                      value,
+                                                      0,
+                                                      0,
+                                                      0,
+                                                      device->commTimeout
+                                                      );
+    if ( bytesTransferred != 0 )
+        return LIBUSB_RESULT_TO_AIOUSB_RESULT( bytesTransferred );
+    return AIOUSB_SUCCESS;
 }
 
+/*----------------------------------------------------------------------------*/
+static void *DACStreamWorker( void *arg )
+{
+    struct aio_dac_stream *stream = (struct aio_dac_stream *)arg;
+    AIOUSBDevice *device = stream->device;
+
+    pthread_mutex_lock( &device->hDACDataMutex );
+    for (;;) {
+        while ( !stream->quit && !stream->queued )
+            pthread_cond_wait( &stream->changed, &device->hDACDataMutex );
+        if ( stream->quit )
+            break;
+        unsigned char *data = stream->blocks[ stream->head ];
+        unsigned long length = stream->length[ stream->head ];
+        pthread_mutex_unlock( &device->hDACDataMutex );
+
+        AIORESULT result = AIOUSB_SUCCESS;
+        unsigned long total = 0;
+        USBDevice *usb = AIOUSBDeviceGetUSBHandle( device );
+        if ( !usb )
+            result = AIOUSB_ERROR_DEVICE_NOT_CONNECTED;
+        while ( result == AIOUSB_SUCCESS && total < length ) {
+            int bytes = 0;
+            int libusbResult = usb->usb_bulk_transfer( usb,
+                                                       LIBUSB_ENDPOINT_OUT | USB_BULK_WRITE_ENDPOINT,
+                                                       data + total,
+                                                       (int)( length - total ),
+                                                       &bytes,
+                                                       10000 );
+            if ( libusbResult != LIBUSB_SUCCESS )
+                result = LIBUSB_RESULT_TO_AIOUSB_RESULT( libusbResult );
+            else if ( bytes <= 0 )
+                result = AIOUSB_ERROR_TIMEOUT;
+            else
+                total += bytes;
+        }
+
+        pthread_mutex_lock( &device->hDACDataMutex );
+        stream->bytesSent += total;
+        if ( result == AIOUSB_SUCCESS && !device->bDACStarted &&
+             stream->bytesSent >= DAC_STREAM_AUTOSTART_BYTES ) {
+            result = _dac_control( device, DAC_CONTROL_START );
+            if ( result == AIOUSB_SUCCESS )
+                device->bDACStarted = AIOUSB_TRUE;
+        }
+        if ( result != AIOUSB_SUCCESS && stream->lastResult == AIOUSB_SUCCESS )
+            stream->lastResult = result;
+        stream->length[ stream->head ] = 0;
+        stream->head = ( stream->head + 1 ) % DAC_STREAM_BLOCKS;
+        stream->queued --;
+        pthread_cond_broadcast( &stream->changed );
+        sem_post( &device->hDACDataSem );
+    }
+    pthread_mutex_unlock( &device->hDACDataMutex );
+
+    return NULL;
+}
 
 /*----------------------------------------------------------------------------*/
-unsigned long DACOutputClose(unsigned long DeviceIndex,unsigned long bWait) {
-  // TODO: this function is not yet implemented
-    return AIOUSB_ERROR_NOT_SUPPORTED;
+/**
+ * @brief Hands the block being filled to the thread
+ */
+static void _dac_stream_queue( AIOUSBDevice *device, struct aio_dac_stream *stream )
+{
+    pthread_mutex_lock( &device->hDACDataMutex );
+    stream->queued ++;
+    stream->filling = ( stream->filling + 1 ) % DAC_STREAM_BLOCKS;
+    pthread_cond_broadcast( &stream->changed );
+    pthread_mutex_unlock( &device->hDACDataMutex );
+    device->PendingDACData = NULL;
 }
 
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Copies numSamples samples into the blocks. Unless raw, only the
+ * D/A counts are kept, the last sample of every pointSamples gets EOD, and
+ * the last sample of all gets EOF.
+ */
+static AIORESULT _dac_stream_put( AIOUSBDevice *device, struct aio_dac_stream *stream,
+                                  const unsigned short *samples, unsigned long numSamples,
+                                  AIOUSB_BOOL raw, unsigned pointSamples )
+{
+    unsigned long index;
+
+    for ( index = 0; index < numSamples; index ++ ) {
+        unsigned short sample = samples[ index ];
+        if ( !raw ) {
+            sample &= DAC_STREAM_COUNTS_MASK;
+            if ( index % pointSamples == pointSamples - 1 )
+                sample |= DAC_STREAM_EOD;
+            if ( index == numSamples - 1 )
+                sample |= DAC_STREAM_EOF;
+        }
+
+        if ( device->PendingDACData &&
+             stream->length[ stream->filling ] == DAC_STREAM_BLOCK_BYTES )
+            _dac_stream_queue( device, stream );
+        if ( !device->PendingDACData ) {
+            while ( sem_wait( &device->hDACDataSem ) != 0 && errno == EINTR )
+                ;
+            pthread_mutex_lock( &device->hDACDataMutex );
+            AIORESULT result = stream->lastResult;
+            pthread_mutex_unlock( &device->hDACDataMutex );
+            if ( result != AIOUSB_SUCCESS ) {
+                sem_post( &device->hDACDataSem );
+                return result;
+            }
+            device->PendingDACData = stream->blocks[ stream->filling ];
+        }
+
+        memcpy( device->PendingDACData + stream->length[ stream->filling ], &sample, sizeof(sample) );
+        stream->length[ stream->filling ] += sizeof(sample);
+
+        if ( stream->pointDone ) {
+            stream->pointSamples = 0;
+            stream->pointDone = AIOUSB_FALSE;
+        }
+        if ( stream->pointSamples < DAC_STREAM_MAX_DACS )
+            stream->point[ stream->pointSamples ++ ] = sample;
+        if ( sample & DAC_STREAM_EOD )
+            stream->pointDone = AIOUSB_TRUE;
+    }
+
+    return AIOUSB_SUCCESS;
+}
 
 /*----------------------------------------------------------------------------*/
-unsigned long DACOutputCloseNoEnd( unsigned long DeviceIndex, unsigned long bWait ) {
-  // TODO: this function is not yet implemented
-    return AIOUSB_ERROR_NOT_SUPPORTED;
+/**
+ * @brief Queues whatever has been filled and waits until the thread has
+ * sent all of it
+ */
+static AIORESULT _dac_stream_drain( AIOUSBDevice *device, struct aio_dac_stream *stream )
+{
+    AIORESULT result;
+
+    if ( device->PendingDACData && stream->length[ stream->filling ] )
+        _dac_stream_queue( device, stream );
+
+    pthread_mutex_lock( &device->hDACDataMutex );
+    while ( stream->queued )
+        pthread_cond_wait( &stream->changed, &device->hDACDataMutex );
+    result = stream->lastResult;
+    pthread_mutex_unlock( &device->hDACDataMutex );
+
+    return result;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Tears down the device's DAC stream without sending what is still
+ * queued
+ */
+void dac_stream_stop( AIOUSBDevice *device )
+{
+    struct aio_dac_stream *stream = device->dacStream;
+    int index;
+    if ( !stream )
+        return;
+
+    pthread_mutex_lock( &device->hDACDataMutex );
+    stream->quit = AIOUSB_TRUE;
+    pthread_cond_broadcast( &stream->changed );
+    pthread_mutex_unlock( &device->hDACDataMutex );
+
+    pthread_join( stream->thread, NULL );
+    pthread_cond_destroy( &stream->changed );
+    pthread_mutex_destroy( &device->hDACDataMutex );
+    sem_destroy( &device->hDACDataSem );
+    for ( index = 0; index < DAC_STREAM_BLOCKS; index ++ )
+        free( stream->blocks[ index ] );
+    free( stream );
+
+    device->dacStream = NULL;
+    device->DACData = NULL;
+    device->PendingDACData = NULL;
+    device->bDACOpen = AIOUSB_FALSE;
+    device->bDACClosing = AIOUSB_FALSE;
+    device->bDACStarted = AIOUSB_FALSE;
 }
 
+/*----------------------------------------------------------------------------*/
+static AIOUSBDevice *_check_dac_stream( unsigned long DeviceIndex, AIORESULT *result )
+{
+    AIOUSBDevice *device = AIODeviceTableGetDeviceAtIndex( DeviceIndex, result );
+    AIO_ERROR_VALID_DATA( NULL, *result == AIOUSB_SUCCESS );
+    AIO_ERROR_VALID_DATA_W_CODE( NULL, *result = AIOUSB_ERROR_NOT_SUPPORTED, device->bDACStream );
+    AIO_ERROR_VALID_DATA_W_CODE( NULL, *result = AIOUSB_ERROR_OPEN_FAILED, device->dacStream );
 
+    return device;
+}
 
 /*----------------------------------------------------------------------------*/
-unsigned long DACOutputSetCount(unsigned long DeviceIndex, unsigned long NewCount) {
-  // TODO: this function is not yet implemented
-    return AIOUSB_ERROR_NOT_SUPPORTED;
-} 
+/**
+ * @brief Opens a DAC stream clocked at *pClockHz, which is set to the rate
+ * the board can actually make. Points then go to the board with
+ * DACOutputFrame() or DACOutputFrameRaw(); it starts clocking them out by
+ * itself once it holds 160K bytes, or at DACOutputStart().
+ * @param DeviceIndex
+ * @param pClockHz points per second
+ * @return AIOUSB_SUCCESS or an error
+ */
+unsigned long DACOutputOpen(unsigned long DeviceIndex,double *pClockHz) 
+{
+    AIO_ERROR_VALID_DATA( AIOUSB_ERROR_INVALID_PARAMETER, pClockHz && *pClockHz > 0 );
+
+    AIORESULT result = AIOUSB_SUCCESS;
+    AIOUSBDevice *device = AIODeviceTableGetDeviceAtIndex( DeviceIndex, &result );
+    AIO_ERROR_VALID_DATA( result, result == AIOUSB_SUCCESS );
+    AIO_ERROR_VALID_DATA( AIOUSB_ERROR_NOT_SUPPORTED, device->bDACStream );
+    AIO_ERROR_VALID_DATA( AIOUSB_ERROR_OPEN_FAILED, !device->bDACOpen && !device->bDACClosing );
+    USBDevice *usb = AIODeviceTableGetUSBDeviceAtIndex( DeviceIndex, &result );
+    AIO_ERROR_VALID_DATA( result, result == AIOUSB_SUCCESS );
+
+    /* the point clock is the root clock divided down by two cascaded counters */
+    unsigned short divisors[ 2 ];
+    double actualHz;
+    AIORET_TYPE retval = CTR_SolveDivisors( device->RootClock, *pClockHz, &divisors[ 0 ], &divisors[ 1 ], &actualHz, NULL );
+    AIO_ERROR_VALID_DATA( (unsigned long)-retval, retval == AIOUSB_SUCCESS );
+    int bytesTransferred = usb->usb_control_transfer( usb,
+                                                      USB_WRITE_TO_DEVICE,
+                                                      AUR_DAC_DIVISOR,
+                                                      0,
+                                                      0,
+                                                      (unsigned char *)divisors,
+                                                      sizeof(divisors),
+                                                      device->commTimeout
+                                                      );
+    AIO_ERROR_VALID_DATA( LIBUSB_RESULT_TO_AIOUSB_RESULT( bytesTransferred ), bytesTransferred == sizeof(divisors) );
+
+    /* rewind the board's buffer */
+    bytesTransferred = usb->usb_control_transfer( usb,
+                                                  USB_WRITE_TO_DEVICE,
+                                                  AUR_DAC_DATAPTR,
+                                                  0,
+                                                  0,
+                                                  0,
+                                                  0,
+                                                  device->commTimeout
+                                                  );
+    AIO_ERROR_VALID_DATA( LIBUSB_RESULT_TO_AIOUSB_RESULT( bytesTransferred ), bytesTransferred == 0 );
+
+    struct aio_dac_stream *stream = (struct aio_dac_stream *)calloc( 1, sizeof(struct aio_dac_stream) );
+    AIO_ERROR_VALID_DATA( AIOUSB_ERROR_NOT_ENOUGH_MEMORY, stream );
+    int index;
+    for ( index = 0; index < DAC_STREAM_BLOCKS; index ++ ) {
+        stream->blocks[ index ] = (unsigned char *)malloc( DAC_STREAM_BLOCK_BYTES );
+        if ( !stream->blocks[ index ] ) {
+            result = AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+            goto err_DACOutputOpen;
+        }
+    }
+    stream->device = device;
+    stream->lastResult = AIOUSB_SUCCESS;
+    pthread_mutex_init( &device->hDACDataMutex, NULL );
+    pthread_cond_init( &stream->changed, NULL );
+    sem_init( &device->hDACDataSem, 0, DAC_STREAM_BLOCKS );
+    if ( pthread_create( &stream->thread, NULL, DACStreamWorker, stream ) != 0 ) {
+        pthread_mutex_destroy( &device->hDACDataMutex );
+        pthread_cond_destroy( &stream->changed );
+        sem_destroy( &device->hDACDataSem );
+        result = AIOUSB_ERROR_INVALID_THREAD;
+        goto err_DACOutputOpen;
+    }
+
+    AIOUSBDeviceWriteLock( device );
+    device->dacStream = stream;
+    device->DACData = stream->blocks;
+    device->PendingDACData = NULL;
+    device->bDACOpen = AIOUSB_TRUE;
+    device->bDACClosing = AIOUSB_FALSE;
+    device->bDACStarted = AIOUSB_FALSE;
+    AIOUSBDeviceUnlock( device );
+
+    *pClockHz = actualHz;
+    return result;
+
+ err_DACOutputOpen:
+    for ( index = 0; index < DAC_STREAM_BLOCKS; index ++ )
+        free( stream->blocks[ index ] );
+    free( stream );
+    return result;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Sends everything still buffered, starts the board if it hasn't
+ * started, and closes the stream. With end, the last point is marked EOM
+ * so the board stops after it; without, the board carries on as the data
+ * tells it, e.g. looping on LOOP.
+ */
+static unsigned long _dac_output_close( unsigned long DeviceIndex, AIOUSB_BOOL end )
+{
+    AIORESULT result = AIOUSB_SUCCESS;
+    AIOUSBDevice *device = _check_dac_stream( DeviceIndex, &result );
+    AIO_ERROR_VALID_DATA( result, result == AIOUSB_SUCCESS );
+    struct aio_dac_stream *stream = device->dacStream;
+
+    AIOUSBDeviceWriteLock( device );
+    device->bDACClosing = AIOUSB_TRUE;
+    AIOUSBDeviceUnlock( device );
+
+    if ( end ) {
+        if ( device->PendingDACData && stream->length[ stream->filling ] ) {
+            unsigned short *last = (unsigned short *)( device->PendingDACData + stream->length[ stream->filling ] ) - 1;
+            *last |= DAC_STREAM_EOM;
+        } else if ( stream->pointSamples ) {
+            unsigned short point[ DAC_STREAM_MAX_DACS ];
+            memcpy( point, stream->point, sizeof(point) );
+            point[ stream->pointSamples - 1 ] |= DAC_STREAM_EOM | DAC_STREAM_EOF | DAC_STREAM_EOD;
+            result = _dac_stream_put( device, stream, point, stream->pointSamples, AIOUSB_TRUE, 0 );
+        }
+    }
+
+    if ( result == AIOUSB_SUCCESS )
+        result = _dac_stream_drain( device, stream );
+    if ( result == AIOUSB_SUCCESS && !device->bDACStarted && stream->bytesSent ) {
+        result = _dac_control( device, DAC_CONTROL_START );
+        if ( result == AIOUSB_SUCCESS )
+            device->bDACStarted = AIOUSB_TRUE;
+    }
+
+    dac_stream_stop( device );
 
+    return result;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Sends everything still buffered with the last point marked EOM,
+ * so the board stops after playing it, and closes the stream
+ * @param DeviceIndex
+ * @param bWait unused; this always returns once the board has all the data
+ */
+unsigned long DACOutputClose(unsigned long DeviceIndex,unsigned long bWait) 
+{
+    return _dac_output_close( DeviceIndex, AIOUSB_TRUE );
+}
 
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Sends everything still buffered and closes the stream without
+ * ending it, for waveforms that end or loop on their own EOM or LOOP bits
+ * @param DeviceIndex
+ * @param bWait unused; this always returns once the board has all the data
+ */
+unsigned long DACOutputCloseNoEnd( unsigned long DeviceIndex, unsigned long bWait ) 
+{
+    return _dac_output_close( DeviceIndex, AIOUSB_FALSE );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Sets how many DACs, from DAC 0 up, each point of later
+ * DACOutputFrame() calls drives
+ * @param DeviceIndex
+ * @param NewCount 1 to the number of DACs on the board
+ */
+unsigned long DACOutputSetCount(unsigned long DeviceIndex, unsigned long NewCount) 
+{
+    AIORESULT result = AIOUSB_SUCCESS;
+    AIOUSBDevice *device = AIODeviceTableGetDeviceAtIndex( DeviceIndex, &result );
+    AIO_ERROR_VALID_DATA( result, result == AIOUSB_SUCCESS );
+    AIO_ERROR_VALID_DATA( AIOUSB_ERROR_NOT_SUPPORTED, device->bDACStream );
+    AIO_ERROR_VALID_DATA( AIOUSB_ERROR_INVALID_PARAMETER,
+                          NewCount >= 1 && NewCount <= device->ImmDACs && NewCount <= DAC_STREAM_MAX_DACS );
+
+    device->DACsUsed = NewCount;
+
+    return result;
+}
 
 /*----------------------------------------------------------------------------*/
+/**
+ * @brief Adds FramePoints points to the stream, each of them DACsUsed
+ * counts (see DACOutputSetCount()) for DAC 0 up. The board pulses its
+ * frame pin after the last one. Blocks while both buffers are waiting
+ * for the USB bus.
+ * @param DeviceIndex
+ * @param FramePoints
+ * @param FrameData FramePoints * DACsUsed counts
+ */
 unsigned long DACOutputFrame(unsigned long DeviceIndex,
                              unsigned long FramePoints,
                              unsigned short *FrameData
-                             ) {
-  // TODO: this function is not yet implemented
-    return AIOUSB_ERROR_NOT_SUPPORTED;
-}
+                             ) 
+{
+    AIO_ERROR_VALID_DATA( AIOUSB_ERROR_INVALID_PARAMETER, FrameData );
+    AIO_ERROR_VALID_DATA( AIOUSB_SUCCESS, FramePoints ); /* NOOP */
 
+    AIORESULT result = AIOUSB_SUCCESS;
+    AIOUSBDevice *device = _check_dac_stream( DeviceIndex, &result );
+    AIO_ERROR_VALID_DATA( result, result == AIOUSB_SUCCESS );
 
+    return _dac_stream_put( device, device->dacStream, FrameData, FramePoints * device->DACsUsed,
+                            AIOUSB_FALSE, device->DACsUsed );
+}
 
 /*----------------------------------------------------------------------------*/
+/**
+ * @brief Like DACOutputFrame(), but the samples go to the board as they are,
+ * with the DAC_STREAM_* bits set by the caller
+ * @param DeviceIndex
+ * @param FramePoints
+ * @param FrameData FramePoints * DACsUsed samples
+ */
 unsigned long DACOutputFrameRaw(
                                 unsigned long DeviceIndex,
                                 unsigned long FramePoints,
                                 unsigned short *FrameData
-                                ) {
-  // TODO: this function is not yet implemented
-    return AIOUSB_ERROR_NOT_SUPPORTED;
-}
+                                ) 
+{
+    AIO_ERROR_VALID_DATA( AIOUSB_ERROR_INVALID_PARAMETER, FrameData );
+    AIO_ERROR_VALID_DATA( AIOUSB_SUCCESS, FramePoints ); /* NOOP */
 
+    AIORESULT result = AIOUSB_SUCCESS;
+    AIOUSBDevice *device = _check_dac_stream( DeviceIndex, &result );
+    AIO_ERROR_VALID_DATA( result, result == AIOUSB_SUCCESS );
 
+    return _dac_stream_put( device, device->dacStream, FrameData, FramePoints * device->DACsUsed,
+                            AIOUSB_TRUE, device->DACsUsed );
+}
 
 /*----------------------------------------------------------------------------*/
+/**
+ * @brief Starts the board clocking out points before it holds the 160K
+ * bytes that start it by itself. Everything buffered so far is sent
+ * first; send at least 128K bytes or the whole waveform before calling
+ * this.
+ * @param DeviceIndex
+ */
 unsigned long DACOutputStart(
                              unsigned long DeviceIndex
-                             ) {
-  // TODO: this function is not yet implemented
-    return AIOUSB_ERROR_NOT_SUPPORTED;
+                             ) 
+{
+    AIORESULT result = AIOUSB_SUCCESS;
+    AIOUSBDevice *device = _check_dac_stream( DeviceIndex, &result );
+    AIO_ERROR_VALID_DATA( result, result == AIOUSB_SUCCESS );
+
+    result = _dac_stream_drain( device, device->dacStream );
+    AIO_ERROR_VALID_DATA( result, result == AIOUSB_SUCCESS );
+
+    pthread_mutex_lock( &device->hDACDataMutex );
+    if ( !device->bDACStarted ) {
+        result = _dac_control( device, DAC_CONTROL_START );
+        if ( result == AIOUSB_SUCCESS )
+            device->bDACStarted = AIOUSB_TRUE;
+    }
+    pthread_mutex_unlock( &device->hDACDataMutex );
+
+    return result;
 }
 
 
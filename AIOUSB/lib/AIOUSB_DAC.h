@@ -12,6 +12,7 @@ namespace AIOUSB
 /* BEGIN AIOUSB_API */
 PUBLIC_EXTERN unsigned long DACDirect(unsigned long DeviceIndex,unsigned short Channel,unsigned short Value );
 PUBLIC_EXTERN unsigned long DACMultiDirect(unsigned long DeviceIndex,unsigned short *pDACData,unsigned long DACDataCount );
+PUBLIC_EXTERN AIORET_TYPE DACMultiDirectBatch(unsigned long DeviceIndex,const unsigned short *channels,unsigned numChannels,const unsigned short *counts,unsigned long numUpdates );
 PUBLIC_EXTERN unsigned long DACSetBoardRange(unsigned long DeviceIndex,unsigned long RangeCode );
 PUBLIC_EXTERN unsigned long DACOutputOpen(unsigned long DeviceIndex,double *pClockHz );
 PUBLIC_EXTERN unsigned long DACOutputClose(unsigned long DeviceIndex,unsigned long bWait );
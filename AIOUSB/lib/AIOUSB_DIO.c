@@ -10,7 +10,10 @@
 #include "AIODeviceTable.h"
 #include "AIOUSB_Core.h"
 #include "USBDevice.h"
+#include "AIOTime.h"
 #include <arpa/inet.h>
+#include <pthread.h>
+#include <errno.h>
 
 #ifdef __cplusplus
 namespace AIOUSB {
@@ -300,6 +303,122 @@ AIORESULT DIO_ConfigurationQuery(
     return result;
 }
 
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Output bits set with DIO_Write1() and DIO_Write8() while a
+ * transaction is open, or while auto-flush is on, are collected here and
+ * sent together as one DIO write. mask marks the bits written since the
+ * last flush and value holds what they were written to; at flush time
+ * they are merged into LastDIOData, so bits nobody touched keep their
+ * last written level.
+ */
+struct aio_dio_batch {
+    AIOUSBDevice *device;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;     /**< something was deferred, a transaction ended, or quit */
+    DIOPackedBuf *mask;
+    DIOPackedBuf *value;
+    DIOPackedBuf *image;        /**< scratch for the merge */
+    unsigned pending;           /**< writes deferred since the last flush */
+    AIOUSB_BOOL inTransaction;
+    unsigned long flushInterval; /**< ms, 0 == auto-flush off */
+    uint64_t firstPendingNs;
+    pthread_t thread;
+    AIOUSB_BOOL threadRunning;
+    AIOUSB_BOOL quit;
+    AIORESULT lastResult;       /**< first error an auto-flush hit, returned by the next commit */
+};
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Sends the deferred bits as one write. Called with batch->lock
+ * held; takes the device lock for the merge and the send, so it never
+ * interleaves with an immediate write on another thread. The order is
+ * always batch->lock first, then the device lock.
+ */
+static AIORESULT _dio_batch_flush( AIOUSBDevice *device, struct aio_dio_batch *batch )
+{
+    AIORESULT result = AIOUSB_SUCCESS;
+    USBDevice *usb;
+    int bytesTransferred;
+
+    if ( !batch->pending )
+        return AIOUSB_SUCCESS;
+
+    AIOUSBDeviceWriteLock( device );
+    DIOPackedBufSetBytes( batch->image, device->LastDIOData, device->DIOBytes );
+    DIOPackedBufWriteMasked( batch->image, batch->mask, batch->value );
+    DIOPackedBufGetBytes( batch->image, device->LastDIOData, device->DIOBytes );
+    DIOPackedBufClearMasked( batch->mask, batch->mask );
+    batch->pending = 0;
+
+    usb = AIOUSBDeviceGetUSBHandle( device );
+    if ( !usb ) {
+        result = AIOUSB_ERROR_DEVICE_NOT_CONNECTED;
+        goto out_dio_batch_flush;
+    }
+    bytesTransferred = usb->usb_control_transfer( usb,
+                                                  USB_WRITE_TO_DEVICE,
+                                                  AUR_DIO_WRITE,
+                                                  0,
+                                                  0,
+                                                  device->LastDIOData,
+                                                  device->DIOBytes,
+                                                  device->commTimeout );
+    if ( bytesTransferred != (int)device->DIOBytes )
+        result = LIBUSB_RESULT_TO_AIOUSB_RESULT( bytesTransferred );
+
+ out_dio_batch_flush:
+    AIOUSBDeviceUnlock( device );
+    return result;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Defers a write of numBits bits starting at firstBit if the device
+ * is collecting writes
+ * @return AIOUSB_TRUE if the write was deferred, AIOUSB_FALSE if the
+ * caller should send it now
+ */
+static AIOUSB_BOOL _dio_batch_record( AIOUSBDevice *device, unsigned long firstBit, unsigned numBits, unsigned long bits )
+{
+    struct aio_dio_batch *batch = device->dioBatch;
+    if ( !batch )
+        return AIOUSB_FALSE;
+
+    pthread_mutex_lock( &batch->lock );
+    if ( !batch->inTransaction && !batch->flushInterval ) {
+        pthread_mutex_unlock( &batch->lock );
+        return AIOUSB_FALSE;
+    }
+    for ( unsigned i = 0; i < numBits; i ++ ) {
+        DIOPackedBufSetIndex( batch->mask, firstBit + i, 1 );
+        DIOPackedBufSetIndex( batch->value, firstBit + i, ( bits >> i ) & 1 );
+    }
+    if ( batch->pending ++ == 0 ) {
+        batch->firstPendingNs = AIOTimeNowNs();
+        pthread_cond_broadcast( &batch->changed );
+    }
+    pthread_mutex_unlock( &batch->lock );
+
+    return AIOUSB_TRUE;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Forgets deferred bits, for a DIO_WriteAll() that overwrites them
+ */
+static void _dio_batch_discard( AIOUSBDevice *device )
+{
+    struct aio_dio_batch *batch = device->dioBatch;
+    if ( !batch )
+        return;
+    pthread_mutex_lock( &batch->lock );
+    DIOPackedBufClearMasked( batch->mask, batch->mask );
+    batch->pending = 0;
+    pthread_mutex_unlock( &batch->lock );
+}
+
 /*----------------------------------------------------------------------------*/
 AIORESULT DIO_WriteAll(
                        unsigned long DeviceIndex,
@@ -321,6 +440,9 @@ AIORESULT DIO_WriteAll(
 
     char foo[10] = {};
     memcpy(foo, pData, device->DIOBytes);
+    _dio_batch_discard( device );
+
+    AIOUSBDeviceWriteLock( device );
     memcpy(device->LastDIOData, pData, device->DIOBytes);
 
     int bytesTransferred = usb->usb_control_transfer(usb,
@@ -332,6 +454,7 @@ AIORESULT DIO_WriteAll(
                                                      device->DIOBytes,
                                                      device->commTimeout
                                                      );
+    AIOUSBDeviceUnlock( device );
 
 
     if (bytesTransferred != (signed)device->DIOBytes )
@@ -357,6 +480,9 @@ AIORESULT DIO_Write8(
     if (!usb  )
         return AIOUSB_ERROR_DEVICE_NOT_CONNECTED;
 
+    if ( ByteIndex < device->DIOBytes && _dio_batch_record( device, ByteIndex * BITS_PER_BYTE, BITS_PER_BYTE, Data ) )
+        return AIOUSB_SUCCESS;
+
     int dioBytes = device->DIOBytes;
 
 
@@ -366,6 +492,7 @@ AIORESULT DIO_Write8(
     if (!dataBuffer )
         return AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
 
+    AIOUSBDeviceWriteLock( device );
     device->LastDIOData[ ByteIndex ] = Data;
     memcpy(dataBuffer, device->LastDIOData, dioBytes);
     
@@ -378,6 +505,7 @@ AIORESULT DIO_Write8(
                                                      dioBytes,
                                                      device->commTimeout
                                                      );
+    AIOUSBDeviceUnlock( device );
     if (bytesTransferred != dioBytes)
         result = LIBUSB_RESULT_TO_AIOUSB_RESULT(bytesTransferred);
     free(dataBuffer);
@@ -404,13 +532,22 @@ AIORESULT DIO_Write1(
     AIOUSBDevice *deviceDesc = _check_dio( DeviceIndex, &result );
     USBDevice *usb;
     AIO_ERROR_VALID_DATA( result, result == AIOUSB_SUCCESS );
-    AIO_ASSERT_AIORET_TYPE( AIOUSB_ERROR_INVALID_PARAMETER, BYTE_INDEX(BitIndex) < deviceDesc->DIOBytes );
+    /* before the batch, which would otherwise accept and drop a bad bit */
+    AIO_ERROR_VALID_DATA( AIOUSB_ERROR_BAD_TOKEN_TYPE,  deviceDesc->DIOBytes );
+    AIO_ERROR_VALID_DATA( AIOUSB_ERROR_INVALID_ADDRESS, BYTE_INDEX( BitIndex ) < deviceDesc->DIOBytes );
     AIO_ASSERT_AIORET_TYPE( AIOUSB_ERROR_INVALID_PARAMETER, bData == AIOUSB_FALSE || bData == AIOUSB_TRUE );
 
     AIO_ERROR_VALID_DATA_RETVAL( AIOUSB_ERROR_NOT_ENOUGH_MEMORY, deviceDesc->LastDIOData );
     usb = AIOUSBDeviceGetUSBHandle( deviceDesc );
     AIO_ERROR_VALID_DATA_RETVAL( AIOUSB_ERROR_INVALID_USBDEVICE , usb );
 
+    if ( _dio_batch_record( deviceDesc, BitIndex, 1, bData ) )
+        return AIOUSB_SUCCESS;
+
+    /* may go to the board or the property cache, so before the lock */
+    EnsurePNPData( DeviceIndex );
+
+    AIOUSBDeviceWriteLock( deviceDesc );
     unsigned char value = deviceDesc->LastDIOData[ BYTE_INDEX(BitIndex) ];
     unsigned char bitMask = 1 << (BitIndex % BITS_PER_BYTE);
     if (bData == AIOUSB_FALSE)
@@ -418,15 +555,12 @@ AIORESULT DIO_Write1(
     else
         value |= bitMask;
 
-    AIO_ERROR_VALID_DATA_RETVAL( AIOUSB_ERROR_BAD_TOKEN_TYPE,  deviceDesc->DIOBytes );
-    AIO_ERROR_VALID_DATA_RETVAL( AIOUSB_ERROR_INVALID_ADDRESS, BYTE_INDEX( BitIndex ) < deviceDesc->DIOBytes );
-
     if ( bData ) {
         deviceDesc->LastDIOData[BYTE_INDEX(BitIndex)] = deviceDesc->LastDIOData[BYTE_INDEX(BitIndex)] | ( 1 << (BitIndex & 7));
     } else {
         deviceDesc->LastDIOData[BYTE_INDEX(BitIndex)] = deviceDesc->LastDIOData[BYTE_INDEX(BitIndex)] & ( ~(1 << (BitIndex & 7)));
     }
-    
+
     if ( deviceDesc->bFirmware20 && DeviceHasPNPByte( &deviceDesc->PNPData ) && ( deviceDesc->PNPData.HasDIOWrite1 != 0 ) ) {
         retval = usb->usb_control_transfer( usb,
                                             USB_WRITE_TO_DEVICE,
@@ -446,6 +580,7 @@ AIORESULT DIO_Write1(
                                             deviceDesc->DIOBytes,
                                             deviceDesc->commTimeout );
     }
+    AIOUSBDeviceUnlock( deviceDesc );
     if ( retval < 0 ) {
         result = AIOUSB_ERROR_INTERNAL_ERROR;
     }
@@ -453,6 +588,225 @@ AIORESULT DIO_Write1(
     return result;
 }
 
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Auto-flush thread: sends deferred bits flushInterval ms after the
+ * first of them was written, unless a transaction is holding them
+ */
+static void *DIOBatchFlusher( void *arg )
+{
+    struct aio_dio_batch *batch = (struct aio_dio_batch *)arg;
+
+    pthread_mutex_lock( &batch->lock );
+    while ( !batch->quit ) {
+        struct timespec deadline;
+        if ( !batch->pending || batch->inTransaction || !batch->flushInterval ) {
+            pthread_cond_wait( &batch->changed, &batch->lock );
+            continue;
+        }
+        AIOTimeToTimespec( &deadline, batch->firstPendingNs + (uint64_t)batch->flushInterval * 1000000 );
+        if ( pthread_cond_timedwait( &batch->changed, &batch->lock, &deadline ) == ETIMEDOUT &&
+             batch->pending && !batch->inTransaction && batch->flushInterval && !batch->quit ) {
+            AIORESULT result = _dio_batch_flush( batch->device, batch );
+            if ( result != AIOUSB_SUCCESS && batch->lastResult == AIOUSB_SUCCESS )
+                batch->lastResult = result;
+        }
+    }
+    pthread_mutex_unlock( &batch->lock );
+
+    return NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+static struct aio_dio_batch *_dio_batch_get( AIOUSBDevice *device, AIORESULT *result )
+{
+    struct aio_dio_batch *batch;
+    pthread_condattr_t attr;
+
+    AIOUSBDeviceWriteLock( device );
+    if ( (batch = device->dioBatch) )
+        goto out_dio_batch_get;
+
+    if ( !device->LastDIOData ) {
+        *result = AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+        goto out_dio_batch_get;
+    }
+    batch = (struct aio_dio_batch *)calloc( 1, sizeof(struct aio_dio_batch) );
+    if ( !batch ) {
+        *result = AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+        goto out_dio_batch_get;
+    }
+    batch->device = device;
+    batch->mask   = NewDIOPackedBuf( device->DIOBytes * BITS_PER_BYTE );
+    batch->value  = NewDIOPackedBuf( device->DIOBytes * BITS_PER_BYTE );
+    batch->image  = NewDIOPackedBuf( device->DIOBytes * BITS_PER_BYTE );
+    if ( !batch->mask || !batch->value || !batch->image ) {
+        DeleteDIOPackedBuf( batch->mask );
+        DeleteDIOPackedBuf( batch->value );
+        DeleteDIOPackedBuf( batch->image );
+        free( batch );
+        batch = NULL;
+        *result = AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+        goto out_dio_batch_get;
+    }
+    batch->lastResult = AIOUSB_SUCCESS;
+    pthread_mutex_init( &batch->lock, NULL );
+    pthread_condattr_init( &attr );
+    pthread_condattr_setclock( &attr, CLOCK_MONOTONIC );
+    pthread_cond_init( &batch->changed, &attr );
+    pthread_condattr_destroy( &attr );
+    device->dioBatch = batch;
+
+ out_dio_batch_get:
+    AIOUSBDeviceUnlock( device );
+    return batch;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Tears down the device's write batch without sending what it
+ * holds; the device is going away
+ */
+void dio_batch_stop( AIOUSBDevice *device )
+{
+    struct aio_dio_batch *batch = device->dioBatch;
+    if ( !batch )
+        return;
+
+    pthread_mutex_lock( &batch->lock );
+    batch->quit = AIOUSB_TRUE;
+    pthread_cond_broadcast( &batch->changed );
+    pthread_mutex_unlock( &batch->lock );
+
+    if ( batch->threadRunning )
+        pthread_join( batch->thread, NULL );
+    pthread_mutex_destroy( &batch->lock );
+    pthread_cond_destroy( &batch->changed );
+    DeleteDIOPackedBuf( batch->mask );
+    DeleteDIOPackedBuf( batch->value );
+    DeleteDIOPackedBuf( batch->image );
+    free( batch );
+    device->dioBatch = NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Starts collecting DIO_Write1() and DIO_Write8() calls instead of
+ * sending each one. They reach the board together, as a single write,
+ * at DIO_CommitTransaction(). DIO_WriteAll() still goes out at once and
+ * replaces anything collected.
+ * @param DeviceIndex
+ * @return AIOUSB_SUCCESS or an error
+ */
+AIORESULT DIO_BeginTransaction( unsigned long DeviceIndex )
+{
+    AIORESULT result = AIOUSB_SUCCESS;
+    AIOUSBDevice *device = _check_dio( DeviceIndex, &result );
+    AIO_ERROR_VALID_DATA( result, result == AIOUSB_SUCCESS );
+    struct aio_dio_batch *batch = _dio_batch_get( device, &result );
+    AIO_ERROR_VALID_DATA( result, batch );
+
+    pthread_mutex_lock( &batch->lock );
+    batch->inTransaction = AIOUSB_TRUE;
+    pthread_mutex_unlock( &batch->lock );
+
+    return result;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Sends every bit written since DIO_BeginTransaction(), or since
+ * the last auto-flush, in one write, and ends the transaction
+ * @param DeviceIndex
+ * @return AIOUSB_SUCCESS, the error of this write, or the first error an
+ * auto-flush hit since the last commit
+ */
+AIORESULT DIO_CommitTransaction( unsigned long DeviceIndex )
+{
+    AIORESULT result = AIOUSB_SUCCESS;
+    AIOUSBDevice *device = _check_dio( DeviceIndex, &result );
+    AIO_ERROR_VALID_DATA( result, result == AIOUSB_SUCCESS );
+    struct aio_dio_batch *batch = device->dioBatch;
+    if ( !batch )
+        return AIOUSB_SUCCESS;
+
+    pthread_mutex_lock( &batch->lock );
+    batch->inTransaction = AIOUSB_FALSE;
+    result = _dio_batch_flush( device, batch );
+    if ( result == AIOUSB_SUCCESS )
+        result = batch->lastResult;
+    batch->lastResult = AIOUSB_SUCCESS;
+    pthread_cond_broadcast( &batch->changed );
+    pthread_mutex_unlock( &batch->lock );
+
+    return result;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Ends the transaction and drops the bits written in it; LastDIOData
+ * and the board keep their levels from before
+ */
+AIORESULT DIO_AbortTransaction( unsigned long DeviceIndex )
+{
+    AIORESULT result = AIOUSB_SUCCESS;
+    AIOUSBDevice *device = _check_dio( DeviceIndex, &result );
+    AIO_ERROR_VALID_DATA( result, result == AIOUSB_SUCCESS );
+    struct aio_dio_batch *batch = device->dioBatch;
+    if ( !batch )
+        return AIOUSB_SUCCESS;
+
+    pthread_mutex_lock( &batch->lock );
+    batch->inTransaction = AIOUSB_FALSE;
+    DIOPackedBufClearMasked( batch->mask, batch->mask );
+    batch->pending = 0;
+    pthread_cond_broadcast( &batch->changed );
+    pthread_mutex_unlock( &batch->lock );
+
+    return result;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief With a non-zero interval, DIO_Write1() and DIO_Write8() are always
+ * collected, and a background thread sends them as one write interval
+ * ms after the first of a burst. An open transaction holds them until
+ * it is committed. An interval of 0 turns this off and sends anything
+ * still collected.
+ * @param DeviceIndex
+ * @param interval milliseconds
+ */
+AIORESULT DIO_SetAutoFlush( unsigned long DeviceIndex, unsigned long interval )
+{
+    AIORESULT result = AIOUSB_SUCCESS;
+    AIOUSBDevice *device = _check_dio( DeviceIndex, &result );
+    AIO_ERROR_VALID_DATA( result, result == AIOUSB_SUCCESS );
+    struct aio_dio_batch *batch = device->dioBatch;
+    if ( !batch && !interval )
+        return AIOUSB_SUCCESS;
+    if ( !batch ) {
+        batch = _dio_batch_get( device, &result );
+        AIO_ERROR_VALID_DATA( result, batch );
+    }
+
+    pthread_mutex_lock( &batch->lock );
+    if ( interval && !batch->threadRunning ) {
+        if ( pthread_create( &batch->thread, NULL, DIOBatchFlusher, batch ) != 0 ) {
+            result = AIOUSB_ERROR_INVALID_THREAD;
+            goto out_DIO_SetAutoFlush;
+        }
+        batch->threadRunning = AIOUSB_TRUE;
+    }
+    batch->flushInterval = interval;
+    if ( !interval && !batch->inTransaction )
+        result = _dio_batch_flush( device, batch );
+    pthread_cond_broadcast( &batch->changed );
+
+ out_DIO_SetAutoFlush:
+    pthread_mutex_unlock( &batch->lock );
+    return result;
+}
+
 /*----------------------------------------------------------------------------*/
 AIORESULT DIO_ReadAll(
                       unsigned long DeviceIndex,
@@ -546,6 +900,58 @@ AIORET_TYPE DIO_ReadAllToDIOBuf(
     return result;
 }
 
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Reads every DIO byte straight into a packed buffer, with no
+ * expansion to one char per bit
+ * @param DeviceIndex
+ * @param buf resized to DIOBytes * 8 bits
+ * @return AIOUSB_SUCCESS or a negative error
+ */
+AIORET_TYPE DIO_ReadAllToDIOPackedBuf(
+                                      unsigned long DeviceIndex,
+                                      DIOPackedBuf *buf
+                                      )
+{
+    AIO_ASSERT_DIOBUF( buf );
+
+    AIORESULT result = AIOUSB_SUCCESS;
+    AIOUSBDevice *device = NULL;
+    unsigned char *tmpbuf;
+    int bytesTransferred;
+
+    USBDevice *usb = _check_dio_get_device_handle( DeviceIndex, &device, &result );
+    AIO_ERROR_VALID_DATA( -(AIORET_TYPE)result, result == AIOUSB_SUCCESS );
+
+    tmpbuf = (unsigned char *)malloc( device->DIOBytes );
+    AIO_ERROR_VALID_DATA_RETVAL( AIOUSB_ERROR_NOT_ENOUGH_MEMORY, tmpbuf );
+
+    bytesTransferred = usb->usb_control_transfer(usb,
+                                                 USB_READ_FROM_DEVICE,
+                                                 AUR_DIO_READ,
+                                                 0,
+                                                 0,
+                                                 tmpbuf,
+                                                 device->DIOBytes,
+                                                 device->commTimeout
+                                                 );
+    if ( bytesTransferred != (int)device->DIOBytes ) {
+        result = LIBUSB_RESULT_TO_AIOUSB_RESULT( bytesTransferred );
+        goto out_DIO_ReadAllToDIOPackedBuf;
+    }
+
+    if ( DIOPackedBufSize( buf ) != device->DIOBytes * BITS_PER_BYTE &&
+         !DIOPackedBufResize( buf, device->DIOBytes * BITS_PER_BYTE ) ) {
+        result = AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+        goto out_DIO_ReadAllToDIOPackedBuf;
+    }
+    DIOPackedBufSetBytes( buf, tmpbuf, device->DIOBytes );
+
+ out_DIO_ReadAllToDIOPackedBuf:
+    free( tmpbuf );
+    return -(AIORET_TYPE)result;
+}
+
 /*----------------------------------------------------------------------------*/
 AIORESULT DIO_ReadAllToCharStr(
                                unsigned long DeviceIndex,
@@ -658,8 +1064,10 @@ AIORESULT DIO_StreamOpen( unsigned long DeviceIndex,
                                                      device->commTimeout
                                                      );
     if (bytesTransferred == 0) {
+        AIOUSBDeviceWriteLock( device );
         device->bDIOOpen = AIOUSB_TRUE;
         device->bDIORead = bIsRead ? AIOUSB_TRUE : AIOUSB_FALSE;
+        AIOUSBDeviceUnlock( device );
     } else {
         result = LIBUSB_RESULT_TO_AIOUSB_RESULT(bytesTransferred);
     }
@@ -675,8 +1083,12 @@ AIORESULT DIO_StreamClose(
 {
     AIORESULT result = AIOUSB_SUCCESS;
     AIOUSBDevice *device =  _check_dio_stream( DeviceIndex, &result );
-    if (result == AIOUSB_SUCCESS ) 
+    if (result == AIOUSB_SUCCESS ) {
+        dio_stream_worker_stop( device );
+        AIOUSBDeviceWriteLock( device );
         device->bDIOOpen = AIOUSB_FALSE;
+        AIOUSBDeviceUnlock( device );
+    }
 
     return result;
 }
@@ -741,11 +1153,66 @@ AIORESULT DIO_StreamSetClocks(
 
 #define GET_ENDPOINT( isread )  ( isread ? (LIBUSB_ENDPOINT_IN | USB_BULK_READ_ENDPOINT) : (LIBUSB_ENDPOINT_OUT | USB_BULK_WRITE_ENDPOINT) )
 
+#define DIO_STREAM_PACKET_SIZE 512 /* high speed bulk packet */
+
 int pow_of_minsize( int val  ) 
 {
     return ((val / 512)+1)*512;
 }
 
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Moves length bytes between the board and data. Whole packets
+ * go straight to or from data in blocks of up to StreamingBlockSize;
+ * only a partial last packet passes through a packet sized bounce
+ * buffer, because the board always transfers whole packets.
+ * @param[out] total bytes of data transferred
+ */
+AIORESULT dio_stream_transfer( AIOUSBDevice *device, USBDevice *usb, AIOUSB_BOOL isRead,
+                               unsigned char *data, unsigned long length, unsigned long *total )
+{
+    AIORESULT result = AIOUSB_SUCCESS;
+    unsigned char endpoint = GET_ENDPOINT( isRead );
+    unsigned long blockSize = device->StreamingBlockSize - device->StreamingBlockSize % DIO_STREAM_PACKET_SIZE;
+    unsigned long body = length - length % DIO_STREAM_PACKET_SIZE;
+    unsigned char tail[ DIO_STREAM_PACKET_SIZE ];
+    int libusbResult, bytes;
+
+    if ( blockSize == 0 )
+        blockSize = DIO_STREAM_PACKET_SIZE;
+    *total = 0;
+
+    while ( *total < body ) {
+        int request = (int)MIN( blockSize, body - *total );
+        bytes = 0;
+        libusbResult = usb->usb_bulk_transfer( usb, endpoint, data + *total, request, &bytes, 10000 );
+        if ( libusbResult != LIBUSB_SUCCESS && libusbResult != LIBUSB_ERROR_OVERFLOW )
+            return LIBUSB_RESULT_TO_AIOUSB_RESULT( libusbResult );
+        if ( bytes <= 0 )
+            return AIOUSB_ERROR_TIMEOUT;
+        *total += MIN( (unsigned long)bytes, body - *total );
+    }
+
+    if ( *total < length ) {
+        unsigned long rest = length - *total;
+        if ( !isRead ) {
+            memcpy( tail, data + *total, rest );
+            memset( tail + rest, 0, sizeof(tail) - rest );
+        }
+        bytes = 0;
+        libusbResult = usb->usb_bulk_transfer( usb, endpoint, tail, sizeof(tail), &bytes, 10000 );
+        if ( libusbResult != LIBUSB_SUCCESS && libusbResult != LIBUSB_ERROR_OVERFLOW )
+            return LIBUSB_RESULT_TO_AIOUSB_RESULT( libusbResult );
+        if ( bytes <= 0 )
+            return AIOUSB_ERROR_TIMEOUT;
+        rest = MIN( (unsigned long)bytes, rest );
+        if ( isRead )
+            memcpy( data + *total, tail, rest );
+        *total += rest;
+    }
+
+    return result;
+}
 
 /*----------------------------------------------------------------------------*/
 AIORESULT DIO_StreamFrame(
@@ -763,67 +1230,250 @@ AIORESULT DIO_StreamFrame(
     AIOUSBDevice *device = NULL;
     AIORESULT result = AIOUSB_SUCCESS;
     USBDevice *deviceHandle = _check_dio_get_device_handle( DeviceIndex, &device, &result );
+    unsigned long total = 0;
 
     AIO_ERROR_VALID_DATA(AIOUSB_ERROR_DEVICE_NOT_CONNECTED, deviceHandle );
     AIO_ERROR_VALID_DATA(result, result == AIOUSB_SUCCESS );
 
-    int streamingBlockSize = ( int )device->StreamingBlockSize;
+    result = dio_stream_transfer( device, deviceHandle, device->bDIORead, (unsigned char *)pFrameData,
+                                   FramePoints * sizeof(unsigned short), &total );
+    if (result == AIOUSB_SUCCESS)
+        *BytesTransferred = total;
 
-    /**
-     * @note convert parameter types to those that libusb likes
-     */
-    unsigned char *data = ( unsigned char* )pFrameData;
-    unsigned char *tmpdata = (unsigned char *)malloc(streamingBlockSize * sizeof(unsigned char));
-
-    int remaining = ( int )FramePoints * sizeof(unsigned short);
-    int total = 0;
-    int libusbResult;
-    int minval;
-    int bytes;
-
-    //
-    // If its a stream write operation have to preload tmpdata with the first 'N' bytes
-    //   
-    if (!(device->bDIORead))
-            memcpy(tmpdata, data, MIN(streamingBlockSize,remaining));
-   
-    while (remaining > 0) {
-        minval = ((remaining < streamingBlockSize) ? pow_of_minsize(remaining) : streamingBlockSize);
-        libusbResult = deviceHandle->usb_bulk_transfer(deviceHandle,
-                                                           GET_ENDPOINT( device->bDIORead ),
-                                                           tmpdata,
-                                                           minval,
-                                                           &bytes,
-                                                           10000
-                                                           );
-
-        if (libusbResult == LIBUSB_SUCCESS || libusbResult == LIBUSB_ERROR_OVERFLOW ) {
-            if (bytes > 0) {
-                if (device->bDIORead) {
-                    memcpy(data, tmpdata, MIN(bytes,remaining));
-                    data += MIN(bytes, remaining );
-                    total += MIN(bytes, remaining);
-                    remaining -= MIN(bytes,remaining);
-                } else {
-                    data += MIN(bytes, remaining );
-                    total += MIN(bytes, remaining);
-                    remaining -= MIN(bytes,remaining);
-                    memcpy(tmpdata, data, MIN(bytes,remaining));
-
-                }
-            } else {
-                result = LIBUSB_RESULT_TO_AIOUSB_RESULT(libusbResult);
-                break;
-            }
+    return result;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Frames queued by DIO_StreamFrameAsync() are moved by one thread
+ * per device, one after the other, so the next frame's first bulk
+ * transfer follows the previous frame's last one without a round trip
+ * through the caller. The thread is created by the first queued frame
+ * and kept until the stream is closed.
+ */
+struct aio_dio_stream_job {
+    unsigned short *pFrameData;
+    unsigned long length;                   /**< bytes */
+    DIOStreamCallback callback;
+    void *userdata;
+    struct aio_dio_stream_job *next;
+};
+
+struct aio_dio_stream_worker {
+    unsigned long DeviceIndex;
+    AIOUSBDevice *device;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;                 /**< job queued, job finished, or quit */
+    struct aio_dio_stream_job *head;
+    struct aio_dio_stream_job *tail;
+    unsigned long pending;                  /**< queued plus in flight */
+    AIORESULT lastResult;                   /**< first error since the last DIO_StreamWait() */
+    unsigned waiters;                       /**< DIO_StreamWait() callers holding the worker */
+    AIOUSB_BOOL quit;
+};
+
+static void *DIOStreamWorker( void *arg )
+{
+    struct aio_dio_stream_worker *worker = (struct aio_dio_stream_worker *)arg;
+
+    for (;;) {
+        struct aio_dio_stream_job *job;
+        pthread_mutex_lock( &worker->lock );
+        while ( !worker->quit && !worker->head )
+            pthread_cond_wait( &worker->changed, &worker->lock );
+        job = worker->head;
+        if ( job ) {
+            worker->head = job->next;
+            if ( !worker->head )
+                worker->tail = NULL;
         }
+        pthread_mutex_unlock( &worker->lock );
+        if ( !job )
+            break;
+
+        unsigned long total = 0;
+        AIORESULT result = AIOUSB_ERROR_DEVICE_NOT_CONNECTED;
+        USBDevice *usb = AIOUSBDeviceGetUSBHandle( worker->device );
+        if ( usb )
+            result = dio_stream_transfer( worker->device, usb, worker->device->bDIORead,
+                                           (unsigned char *)job->pFrameData, job->length, &total );
+        if ( job->callback )
+            job->callback( worker->DeviceIndex, job->pFrameData, total, result, job->userdata );
+
+        pthread_mutex_lock( &worker->lock );
+        if ( result != AIOUSB_SUCCESS && worker->lastResult == AIOUSB_SUCCESS )
+            worker->lastResult = result;
+        worker->pending --;
+        pthread_cond_broadcast( &worker->changed );
+        pthread_mutex_unlock( &worker->lock );
+        free( job );
     }
-    if (result == AIOUSB_SUCCESS)
-        *BytesTransferred = total;
+    return NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Stops the device's stream thread once every queued frame has
+ * been transferred. The worker is taken off the device first, so no new
+ * DIO_StreamWait() can find it, and is only freed after the waiters that
+ * already hold it have returned.
+ */
+void dio_stream_worker_stop( AIOUSBDevice *device )
+{
+    struct aio_dio_stream_worker *worker;
+
+    AIOUSBDeviceWriteLock( device );
+    worker = device->dioStreamWorker;
+    device->dioStreamWorker = NULL;
+    AIOUSBDeviceUnlock( device );
+    if ( !worker )
+        return;
+
+    pthread_mutex_lock( &worker->lock );
+    worker->quit = AIOUSB_TRUE;
+    pthread_cond_broadcast( &worker->changed );
+    pthread_mutex_unlock( &worker->lock );
+
+    pthread_join( worker->thread, NULL );
+
+    pthread_mutex_lock( &worker->lock );
+    while ( worker->waiters )
+        pthread_cond_wait( &worker->changed, &worker->lock );
+    pthread_mutex_unlock( &worker->lock );
+
+    pthread_mutex_destroy( &worker->lock );
+    pthread_cond_destroy( &worker->changed );
+    free( worker );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Queues a frame for the open stream and returns at once. The
+ * frame is read into, or written from, pFrameData directly, so the
+ * buffer must stay put until the frame's callback has run or
+ * DIO_StreamWait() has returned. Queue the next frame before the current
+ * one completes to keep the board streaming without gaps.
+ * @param DeviceIndex
+ * @param FramePoints number of 16 bit samples in the frame
+ * @param pFrameData
+ * @param callback called from the stream thread when the frame is done, may be NULL
+ * @param userdata passed to callback
+ * @return AIOUSB_SUCCESS if the frame was queued
+ */
+AIORESULT DIO_StreamFrameAsync(
+                               unsigned long DeviceIndex,
+                               unsigned long FramePoints,
+                               unsigned short *pFrameData,
+                               DIOStreamCallback callback,
+                               void *userdata
+                               )
+{
+    AIO_ASSERT( pFrameData );
+    AIO_ASSERT_RET( AIOUSB_ERROR_INVALID_PARAMETER, FramePoints );
+
+    AIORESULT result = AIOUSB_SUCCESS;
+    AIOUSBDevice *device = _check_dio_stream( DeviceIndex, &result );
+    AIO_ERROR_VALID_DATA( result, result == AIOUSB_SUCCESS );
+
+    struct aio_dio_stream_job *job = (struct aio_dio_stream_job *)calloc( 1, sizeof(struct aio_dio_stream_job) );
+    AIO_ERROR_VALID_DATA( AIOUSB_ERROR_NOT_ENOUGH_MEMORY, job );
+    job->pFrameData = pFrameData;
+    job->length     = FramePoints * sizeof(unsigned short);
+    job->callback   = callback;
+    job->userdata   = userdata;
+
+    AIOUSBDeviceWriteLock( device );
+    if ( !device->dioStreamWorker ) {
+        struct aio_dio_stream_worker *worker = (struct aio_dio_stream_worker *)calloc( 1, sizeof(struct aio_dio_stream_worker) );
+        if ( !worker ) {
+            result = AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+            goto err_DIO_StreamFrameAsync;
+        }
+        worker->DeviceIndex = DeviceIndex;
+        worker->device      = device;
+        worker->lastResult  = AIOUSB_SUCCESS;
+        pthread_mutex_init( &worker->lock, NULL );
+        pthread_cond_init( &worker->changed, NULL );
+        if ( pthread_create( &worker->thread, NULL, DIOStreamWorker, worker ) != 0 ) {
+            pthread_mutex_destroy( &worker->lock );
+            pthread_cond_destroy( &worker->changed );
+            free( worker );
+            result = AIOUSB_ERROR_INVALID_THREAD;
+            goto err_DIO_StreamFrameAsync;
+        }
+        device->dioStreamWorker = worker;
+    }
+
+    pthread_mutex_lock( &device->dioStreamWorker->lock );
+    if ( device->dioStreamWorker->tail )
+        device->dioStreamWorker->tail->next = job;
+    else
+        device->dioStreamWorker->head = job;
+    device->dioStreamWorker->tail = job;
+    device->dioStreamWorker->pending ++;
+    pthread_cond_broadcast( &device->dioStreamWorker->changed );
+    pthread_mutex_unlock( &device->dioStreamWorker->lock );
+    AIOUSBDeviceUnlock( device );
+
+    return result;
 
-    free(tmpdata);
+ err_DIO_StreamFrameAsync:
+    AIOUSBDeviceUnlock( device );
+    free( job );
     return result;
 }
 
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Blocks until every frame queued with DIO_StreamFrameAsync() has
+ * been transferred
+ * @param DeviceIndex
+ * @param timeout milliseconds to wait, 0 waits for as long as it takes
+ * @return the first error any of those frames hit, AIOUSB_SUCCESS, or
+ * AIOUSB_ERROR_TIMEOUT if frames are still pending
+ */
+AIORESULT DIO_StreamWait( unsigned long DeviceIndex, unsigned long timeout )
+{
+    AIORESULT result = AIOUSB_SUCCESS;
+    struct timespec deadline;
+    int waitResult = 0;
+    AIOUSBDevice *device = _check_dio( DeviceIndex, &result );
+    AIO_ERROR_VALID_DATA( result, result == AIOUSB_SUCCESS );
+
+    /* hold the worker so that a concurrent close can't free it under us */
+    AIOUSBDeviceReadLock( device );
+    struct aio_dio_stream_worker *worker = device->dioStreamWorker;
+    if ( worker ) {
+        pthread_mutex_lock( &worker->lock );
+        worker->waiters ++;
+        pthread_mutex_unlock( &worker->lock );
+    }
+    AIOUSBDeviceUnlock( device );
+    if ( !worker )
+        return AIOUSB_SUCCESS;
+
+    AIOTimeDeadline( &deadline, CLOCK_REALTIME, timeout );
+
+    pthread_mutex_lock( &worker->lock );
+    while ( worker->pending && waitResult != ETIMEDOUT ) {
+        if ( timeout == 0 )
+            pthread_cond_wait( &worker->changed, &worker->lock );
+        else
+            waitResult = pthread_cond_timedwait( &worker->changed, &worker->lock, &deadline );
+    }
+    if ( worker->pending ) {
+        result = AIOUSB_ERROR_TIMEOUT;
+    } else {
+        result = worker->lastResult;
+        worker->lastResult = AIOUSB_SUCCESS;
+    }
+    worker->waiters --;
+    pthread_cond_broadcast( &worker->changed );
+    pthread_mutex_unlock( &worker->lock );
+
+    return result;
+}
 
 
 #ifdef __cplusplus
@@ -928,6 +1578,247 @@ TEST(DIO,CheckConfigureEx)
 
 }
 
+static unsigned short stream_frame[ 3000 ];
+static int stream_transfers = 0, stream_outside = 0;
+static int fake_stream_bulk( USBDevice *usb, unsigned char endpoint, unsigned char *data, int length, int *actual_length, unsigned int timeout )
+{
+    unsigned char *frame = (unsigned char *)stream_frame;
+    if ( data < frame || data + length > frame + sizeof(stream_frame) )
+        stream_outside ++;
+    for ( int i = 0; i < length; i ++ )
+        data[i] = (unsigned char)i;
+    *actual_length = length;
+    stream_transfers ++;
+    return LIBUSB_SUCCESS;
+}
+
+static unsigned long stream_callback_bytes = 0;
+static void stream_callback( unsigned long DeviceIndex, unsigned short *pFrameData, unsigned long BytesTransferred,
+                             unsigned long result, void *userdata )
+{
+    if ( result == AIOUSB_SUCCESS )
+        stream_callback_bytes += BytesTransferred;
+}
+
+static AIORESULT stream_wait_result = AIOUSB_ERROR_TIMEOUT;
+static void *stream_waiter( void *arg )
+{
+    stream_wait_result = DIO_StreamWait( 0, 0 );
+    return NULL;
+}
+
+TEST(DIO,StreamFrameReadsIntoCallerBuffer)
+{
+    int numDevices = 0;
+    unsigned long bytes = 0;
+    AIORESULT result;
+    USBDevice usb;
+    memset( &usb, 0, sizeof(usb) );
+    usb.usb_bulk_transfer = fake_stream_bulk;
+
+    AIODeviceTableInit();
+    AIODeviceTableAddDeviceToDeviceTableWithUSBDevice( &numDevices, USB_DIO_16A, &usb );
+    AIOUSBDevice *dev = AIODeviceTableGetDeviceAtIndex( 0, &result );
+    dev->StreamingBlockSize = 2048;
+    dev->bDIOOpen = AIOUSB_TRUE;
+    dev->bDIORead = AIOUSB_TRUE;
+
+    /* 6000 bytes: two 2048 byte blocks, one 1536 byte block, then a 368 byte tail */
+    EXPECT_EQ( AIOUSB_SUCCESS, DIO_StreamFrame( 0, 3000, stream_frame, &bytes ) );
+    EXPECT_EQ( 6000u, bytes );
+    EXPECT_EQ( 4, stream_transfers );
+    EXPECT_EQ( 1, stream_outside ) << "only the tail goes through the bounce buffer";
+    EXPECT_EQ( 0, ((unsigned char *)stream_frame)[2048] );
+    EXPECT_EQ( 0, ((unsigned char *)stream_frame)[5632] );
+    EXPECT_EQ( 5, ((unsigned char *)stream_frame)[5637] );
+
+    stream_transfers = stream_outside = 0;
+    for ( int i = 0; i < 4; i ++ )
+        EXPECT_EQ( AIOUSB_SUCCESS, DIO_StreamFrameAsync( 0, 512, &stream_frame[ i * 512 ], stream_callback, NULL ) );
+    EXPECT_EQ( AIOUSB_SUCCESS, DIO_StreamWait( 0, 0 ) );
+    EXPECT_EQ( 4 * 1024ul, stream_callback_bytes );
+    EXPECT_EQ( 0, stream_outside );
+
+    /* a close racing a waiter must leave the worker alive until the wait returns */
+    pthread_t waiter;
+    for ( int i = 0; i < 4; i ++ )
+        EXPECT_EQ( AIOUSB_SUCCESS, DIO_StreamFrameAsync( 0, 512, &stream_frame[ i * 512 ], stream_callback, NULL ) );
+    ASSERT_EQ( 0, pthread_create( &waiter, NULL, stream_waiter, NULL ) );
+    EXPECT_EQ( AIOUSB_SUCCESS, DIO_StreamClose( 0 ) );
+    pthread_join( waiter, NULL );
+    EXPECT_EQ( AIOUSB_SUCCESS, stream_wait_result );
+    EXPECT_FALSE( dev->dioStreamWorker );
+
+    dev->usb_device = NULL;
+    ClearAIODeviceTable( numDevices );
+}
+
+static int fake_dio_read( USBDevice *usb, uint8_t request_type, uint8_t bRequest, uint16_t wValue, uint16_t wIndex,
+                          unsigned char *data, uint16_t wLength, unsigned int timeout )
+{
+    for ( int i = 0; i < wLength; i ++ )
+        data[i] = (unsigned char)( 0x11 * ( i + 1 ) );
+    return wLength;
+}
+
+TEST(DIO,ReadAllToDIOPackedBufKeepsBoardBitOrder)
+{
+    int numDevices = 0;
+    AIORESULT result;
+    USBDevice usb;
+    memset( &usb, 0, sizeof(usb) );
+    usb.usb_control_transfer = fake_dio_read;
+
+    AIODeviceTableInit();
+    AIODeviceTableAddDeviceToDeviceTableWithUSBDevice( &numDevices, USB_DIO_96, &usb );
+    AIOUSBDevice *dev = AIODeviceTableGetDeviceAtIndex( 0, &result );
+
+    DIOPackedBuf *buf = NewDIOPackedBuf( 0 );
+    EXPECT_EQ( AIOUSB_SUCCESS, DIO_ReadAllToDIOPackedBuf( 0, buf ) );
+    EXPECT_EQ( 96u, DIOPackedBufSize( buf ) );
+    EXPECT_EQ( 0x8877665544332211ull, buf->words[0] );
+    EXPECT_EQ( 0xccbbaa99ull, buf->words[1] );
+    DeleteDIOPackedBuf( buf );
+
+    dev->usb_device = NULL;
+    ClearAIODeviceTable( numDevices );
+}
+
+static int batch_writes = 0;
+static unsigned char batch_sent[4];
+static pthread_mutex_t batch_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t batch_written = PTHREAD_COND_INITIALIZER;
+static int fake_dio_write( USBDevice *usb, uint8_t request_type, uint8_t bRequest, uint16_t wValue, uint16_t wIndex,
+                           unsigned char *data, uint16_t wLength, unsigned int timeout )
+{
+    if ( bRequest == AUR_DIO_WRITE ) {
+        pthread_mutex_lock( &batch_lock );
+        batch_writes ++;
+        memcpy( batch_sent, data, wLength < sizeof(batch_sent) ? wLength : sizeof(batch_sent) );
+        pthread_cond_broadcast( &batch_written );
+        pthread_mutex_unlock( &batch_lock );
+    }
+    return wLength;
+}
+
+/* waits up to a second for the fake to have seen count writes */
+static int wait_for_batch_writes( int count )
+{
+    struct timespec deadline;
+    AIOTimeDeadline( &deadline, CLOCK_REALTIME, 1000 );
+    pthread_mutex_lock( &batch_lock );
+    while ( batch_writes < count &&
+            pthread_cond_timedwait( &batch_written, &batch_lock, &deadline ) == 0 )
+        ;
+    int seen = batch_writes;
+    pthread_mutex_unlock( &batch_lock );
+    return seen;
+}
+
+TEST(DIO,TransactionCoalescesWritesIntoOneTransfer)
+{
+    int numDevices = 0;
+    AIORESULT result;
+    USBDevice usb;
+    memset( &usb, 0, sizeof(usb) );
+    usb.usb_control_transfer = fake_dio_write;
+
+    AIODeviceTableInit();
+    AIODeviceTableAddDeviceToDeviceTableWithUSBDevice( &numDevices, USB_IIRO_16, &usb );
+    AIOUSBDevice *dev = AIODeviceTableGetDeviceAtIndex( 0, &result );
+    memset( dev->LastDIOData, 0, dev->DIOBytes );
+
+    batch_writes = 0;
+    EXPECT_EQ( AIOUSB_SUCCESS, DIO_BeginTransaction( 0 ) );
+    for ( int i = 0; i < 40; i ++ )
+        EXPECT_EQ( AIOUSB_SUCCESS, (AIORESULT)DIO_Write1( 0, i % 16, (i / 16) % 2 == 0 ) );
+    EXPECT_EQ( AIOUSB_SUCCESS, (AIORESULT)DIO_Write8( 0, 1, 0xa5 ) );
+    EXPECT_EQ( 0, batch_writes );
+    EXPECT_EQ( AIOUSB_SUCCESS, DIO_CommitTransaction( 0 ) );
+    EXPECT_EQ( 1, batch_writes );
+    /* bits 0-7 were last written 1 in the third pass, byte 1 by Write8 */
+    EXPECT_EQ( 0xff, dev->LastDIOData[0] );
+    EXPECT_EQ( 0xa5, dev->LastDIOData[1] );
+    EXPECT_EQ( 0xff, batch_sent[0] );
+    EXPECT_EQ( 0xa5, batch_sent[1] );
+
+    EXPECT_EQ( AIOUSB_SUCCESS, DIO_BeginTransaction( 0 ) );
+    DIO_Write1( 0, 0, 0 );
+    EXPECT_EQ( AIOUSB_SUCCESS, DIO_AbortTransaction( 0 ) );
+    EXPECT_EQ( 0xff, dev->LastDIOData[0] );
+
+    /* a bad bit is refused, not collected */
+    EXPECT_EQ( AIOUSB_SUCCESS, DIO_BeginTransaction( 0 ) );
+    EXPECT_EQ( AIOUSB_ERROR_INVALID_ADDRESS, DIO_Write1( 0, dev->DIOBytes * BITS_PER_BYTE, 1 ) );
+    EXPECT_EQ( 0u, dev->dioBatch->pending );
+    EXPECT_EQ( AIOUSB_SUCCESS, DIO_CommitTransaction( 0 ) );
+    EXPECT_EQ( 1, batch_writes ) << "Nothing was pending, so nothing was sent";
+    EXPECT_EQ( AIOUSB_SUCCESS, (AIORESULT)DIO_Write1( 0, 0, 0 ) );
+    EXPECT_EQ( 2, batch_writes );
+    EXPECT_EQ( 0xfe, dev->LastDIOData[0] );
+
+    dev->usb_device = NULL;
+    ClearAIODeviceTable( numDevices );
+}
+
+TEST(DIO,AutoFlushSendsABurstOnce)
+{
+    int numDevices = 0;
+    AIORESULT result;
+    USBDevice usb;
+    memset( &usb, 0, sizeof(usb) );
+    usb.usb_control_transfer = fake_dio_write;
+
+    AIODeviceTableInit();
+    AIODeviceTableAddDeviceToDeviceTableWithUSBDevice( &numDevices, USB_IIRO_16, &usb );
+    AIOUSBDevice *dev = AIODeviceTableGetDeviceAtIndex( 0, &result );
+    memset( dev->LastDIOData, 0, dev->DIOBytes );
+
+    batch_writes = 0;
+    EXPECT_EQ( AIOUSB_SUCCESS, DIO_SetAutoFlush( 0, 20 ) );
+    for ( int i = 0; i < 16; i ++ )
+        DIO_Write1( 0, i, i % 2 );
+    EXPECT_EQ( 0, batch_writes );
+    EXPECT_EQ( 1, wait_for_batch_writes( 1 ) );
+    EXPECT_EQ( 0xaa, batch_sent[0] );
+    EXPECT_EQ( 0xaa, batch_sent[1] );
+
+    DIO_Write8( 0, 0, 0x0f );
+    EXPECT_EQ( AIOUSB_SUCCESS, DIO_SetAutoFlush( 0, 0 ) );
+    EXPECT_EQ( 2, batch_writes );
+    EXPECT_EQ( 0x0f, batch_sent[0] );
+
+    dev->usb_device = NULL;
+    ClearAIODeviceTable( numDevices );
+    EXPECT_FALSE( dev->dioBatch );
+}
+
+TEST(DIO,CloseAllDevicesStopsTheAutoFlusher)
+{
+    int numDevices = 0;
+    AIORESULT result;
+    USBDevice usb;
+    memset( &usb, 0, sizeof(usb) );
+    usb.usb_control_transfer = fake_dio_write;
+
+    AIODeviceTableInit();
+    AIODeviceTableAddDeviceToDeviceTableWithUSBDevice( &numDevices, USB_IIRO_16, &usb );
+    AIOUSBDevice *dev = AIODeviceTableGetDeviceAtIndex( 0, &result );
+    memset( dev->LastDIOData, 0, dev->DIOBytes );
+
+    /* the pending write would be flushed from LastDIOData after it is freed */
+    batch_writes = 0;
+    EXPECT_EQ( AIOUSB_SUCCESS, DIO_SetAutoFlush( 0, 50 ) );
+    DIO_Write1( 0, 3, 1 );
+    CloseAllDevices();
+    EXPECT_FALSE( dev->dioBatch );
+    EXPECT_FALSE( dev->LastDIOData );
+    usleep( 100000 );
+    EXPECT_EQ( 0, batch_writes );
+
+    dev->usb_device = NULL;
+    ClearAIODeviceTable( numDevices );
+}
 
 #include <unistd.h>
 #include <stdio.h>
@@ -19,6 +19,13 @@ namespace AIOUSB
 {
 #endif
 
+/**
+ * @brief Called on the stream thread when a frame queued with
+ * DIO_StreamFrameAsync() has been transferred
+ */
+typedef void (*DIOStreamCallback)( unsigned long DeviceIndex, unsigned short *pFrameData, unsigned long BytesTransferred,
+                                   unsigned long result, void *userdata );
+
 /* BEGIN AIOUSB_API */
 PUBLIC_EXTERN AIORESULT DIO_ConfigureWithDIOBuf( unsigned long DeviceIndex, unsigned char bTristate, AIOChannelMask *mask, DIOBuf *buf ); 
 PUBLIC_EXTERN unsigned long DIO_Configure( unsigned long DeviceIndex, unsigned char bTristate, void *pOutMask, void *pData ); 
@@ -29,6 +36,10 @@ PUBLIC_EXTERN unsigned long DIO_WriteAll( unsigned long DeviceIndex, void *pData
 PUBLIC_EXTERN unsigned long DIO_Write8( unsigned long DeviceIndex, unsigned long ByteIndex, unsigned char Data ); 
 
 PUBLIC_EXTERN unsigned long DIO_Write1( unsigned long DeviceIndex, unsigned long BitIndex, unsigned char bData ); 
+PUBLIC_EXTERN AIORESULT DIO_BeginTransaction( unsigned long DeviceIndex );
+PUBLIC_EXTERN AIORESULT DIO_CommitTransaction( unsigned long DeviceIndex );
+PUBLIC_EXTERN AIORESULT DIO_AbortTransaction( unsigned long DeviceIndex );
+PUBLIC_EXTERN AIORESULT DIO_SetAutoFlush( unsigned long DeviceIndex, unsigned long interval );
 
 
 PUBLIC_EXTERN AIORET_TYPE DIO_ReadAllToDIOBuf( unsigned long DeviceIndex, DIOBuf *buf );
@@ -36,6 +47,7 @@ PUBLIC_EXTERN AIORET_TYPE DIO_ReadAllToDIOBuf( unsigned long DeviceIndex, DIOBuf
 PUBLIC_EXTERN AIORET_TYPE DIO_ReadIntoDIOBuf( unsigned long DeviceIndex, DIOBuf *buf ) ACCES_DEPRECATED("Please use DIO_ReadAllToDIOBuf");
 #endif
 PUBLIC_EXTERN AIORESULT DIO_ReadAll( unsigned long DeviceIndex, void *buf );
+PUBLIC_EXTERN AIORET_TYPE DIO_ReadAllToDIOPackedBuf( unsigned long DeviceIndex, DIOPackedBuf *buf );
 
 
 PUBLIC_EXTERN unsigned long DIO_ReadAllToCharStr( unsigned long DeviceIndex, char *buf, unsigned size ); 
@@ -45,6 +57,8 @@ PUBLIC_EXTERN unsigned long DIO_StreamOpen( unsigned long DeviceIndex, unsigned
 PUBLIC_EXTERN unsigned long DIO_StreamClose( unsigned long DeviceIndex ); 
 PUBLIC_EXTERN unsigned long DIO_StreamSetClocks( unsigned long DeviceIndex, double *ReadClockHz, double *WriteClockHz ); 
 PUBLIC_EXTERN unsigned long DIO_StreamFrame( unsigned long DeviceIndex, unsigned long FramePoints, unsigned short *pFrameData, unsigned long *BytesTransferred );
+PUBLIC_EXTERN AIORESULT DIO_StreamFrameAsync( unsigned long DeviceIndex, unsigned long FramePoints, unsigned short *pFrameData, DIOStreamCallback callback, void *userdata );
+PUBLIC_EXTERN AIORESULT DIO_StreamWait( unsigned long DeviceIndex, unsigned long timeout );
 /* END AIOUSB_API */
 
 #ifdef __aiousb_cplusplus
@@ -101,20 +101,24 @@ unsigned long AIOUSB_GetDeviceByProductID(int minProductID,
     if(non_usb_supported_device(minProductID, maxProductID, maxDevices, deviceList))
         return AIOUSB_ERROR_INVALID_PARAMETER;
 
-    int index, numDevices = 0;
+    int capacity = (int)AIODeviceTableGetCapacity();
+    int *indices = (int *)malloc( capacity * sizeof(int) );
+    if ( !indices )
+        return AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+    int numIndices = (int)AIODeviceTableGetIndicesByProductID( minProductID, maxProductID, indices, capacity );
+    int numDevices = 0;
 
-    for(index = 0; index < MAX_USB_DEVICES && numDevices < maxDevices; index++) {
-        if( deviceTable[ index ].usb_device != NULL &&
-            deviceTable[ index ].ProductID >= ( unsigned )minProductID &&
-            deviceTable[ index ].ProductID <= ( unsigned )maxProductID
-            ) {
+    for( int i = 0; i < numIndices && numDevices < maxDevices; i++ ) {
+        AIOUSBDevice *device = _get_device_no_error( indices[i] );
+        if ( device->usb_device != NULL ) {
             /**< deviceList[] contains device index-product ID pairs, one pair per device found */
-            deviceList[ 1 + numDevices * 2 ] = index;
-            deviceList[ 1 + numDevices * 2 + 1 ] = ( int )deviceTable[ index ].ProductID;
+            deviceList[ 1 + numDevices * 2 ] = indices[i];
+            deviceList[ 1 + numDevices * 2 + 1 ] = ( int )device->ProductID;
             numDevices++;
         }
     }
     deviceList[ 0 ] = numDevices;
+    free( indices );
 
     return AIOUSB_SUCCESS;
 }
@@ -147,12 +151,17 @@ AIORESULT GetDeviceSerialNumber(unsigned long DeviceIndex, uint64_t *pSerialNumb
     uint64_t buffer_data = -1;
     AIORESULT result = AIOUSB_SUCCESS;
 
-    AIODeviceTableGetDeviceAtIndex( DeviceIndex, &result );
+    AIOUSBDevice *device = AIODeviceTableGetDeviceAtIndex( DeviceIndex, &result );
+    if ( device && device->cachedSerialNumber != 0 ) {
+        *pSerialNumber = device->cachedSerialNumber;
+        goto out_GetDeviceSerialNumber;
+    }
     result = GenericVendorRead( DeviceIndex, AUR_EEPROM_READ , EEPROM_SERIAL_NUMBER_ADDRESS, 0 , &buffer_data, &bytes_read );
 
     if( result != AIOUSB_SUCCESS )
         goto out_GetDeviceSerialNumber;
 
+    AIODeviceTableSetSerialNumber( DeviceIndex, buffer_data );
     *pSerialNumber = buffer_data;
 
 out_GetDeviceSerialNumber:
@@ -163,36 +172,61 @@ out_GetDeviceSerialNumber:
 /*----------------------------------------------------------------------------*/
 unsigned long GetDeviceBySerialNumber(uint64_t serialNumber) 
 {
-    unsigned long deviceIndex = diNone;
-
-    if (serialNumber == 0 )
-        return deviceIndex;
-
-    int index;
-    for(index = 0; index < MAX_USB_DEVICES; index++) {
-          if(deviceTable[ index ].usb_device != NULL) {
-
-                uint64_t deviceSerialNumber;
-                unsigned long result = GetDeviceSerialNumber(index, &deviceSerialNumber);
-
-                if( result == AIOUSB_SUCCESS && deviceSerialNumber == serialNumber ) {
-                      deviceIndex = index;
-                      break;
-                  }
-                /**
-                 * else, even if we get an error requesting the serial number from
-                 * this device, keep searching
-                 */
-          }
-      }
-
-    return deviceIndex;
+    AIORET_TYPE index;
+
+    if (serialNumber == 0 || !AIOUSB_IsInit() )
+        return diNone;
+
+    if ( (index = AIODeviceTableLookupSerialNumber( serialNumber )) >= 0 )
+        return (unsigned long)index;
+
+    /**
+     * Not seen yet: read the serial number of every device that hasn't
+     * reported one. Each board is only asked once, after that this is a
+     * hash lookup. Errors reading a board are skipped so the search continues.
+     */
+    for( unsigned long i = 0; i < (unsigned long)AIODeviceTableGetCapacity(); i++ ) {
+        AIOUSBDevice *device = _get_device_no_error( i );
+        if( device->usb_device != NULL && device->cachedSerialNumber == 0 ) {
+            uint64_t deviceSerialNumber;
+            GetDeviceSerialNumber( i, &deviceSerialNumber );
+        }
+    }
+
+    index = AIODeviceTableLookupSerialNumber( serialNumber );
+    return index >= 0 ? (unsigned long)index : (unsigned long)diNone;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Result buffer handed back through *where by the AIOUSB_FindDevices
+ * family. The table only grows, so the buffer is replaced only when it
+ * gains capacity, and a replaced buffer is kept rather than freed because
+ * callers may still hold a pointer into it. That happens at most once per
+ * table chunk.
+ */
+struct find_devices_buffer {
+    int *indices;
+    int capacity;
+};
+
+static int *_find_devices_buffer( struct find_devices_buffer *buf, int capacity )
+{
+    if ( capacity > buf->capacity ) {
+        int *indices = (int *)malloc( capacity * sizeof(int) );
+        if ( !indices )
+            return NULL;
+        buf->indices = indices;
+        buf->capacity = capacity;
+    }
+    return buf->indices;
 }
 
 /*----------------------------------------------------------------------------*/
 /**
  * @brief Friendly function that can be called first. It 
- * @param where 
+ * @param where set to a library-owned array of device indices, which stays
+ *        allocated but is overwritten by the next call
  * @param length 
  * @param is_ok_device 
  * 
@@ -205,27 +239,64 @@ AIORET_TYPE AIOUSB_FindDevices( int **where, int *length , AIOUSB_BOOL (*is_ok_d
     if ( !AIOUSB_IsInit() )
         AIOUSB_Init();
 
-    unsigned long deviceMask = AIOUSB_GetAllDevices();
-    static int indices[MAX_USB_DEVICES];
-    int index = 0;
+    static struct find_devices_buffer found;
     AIORESULT retval = AIOUSB_ERROR_DEVICE_NOT_FOUND;
+    int capacity = (int)AIODeviceTableGetCapacity();
     *length = 0;
 
-    while ( deviceMask  ) {
-        if ( deviceMask & 1 ) {
-            if ( is_ok_device( &deviceTable[index] ) == AIOUSB_TRUE )  { 
-                retval = AIOUSB_SUCCESS;
-                indices[(*length)++] = index;
-            }
+    int *indices = _find_devices_buffer( &found, capacity );
+    AIO_ERROR_VALID_DATA( AIOUSB_ERROR_NOT_ENOUGH_MEMORY, indices );
+
+    for ( int index = 0; index < capacity; index ++ ) {
+        AIORESULT res = AIOUSB_SUCCESS;
+        AIOUSBDevice *dev = AIODeviceTableGetDeviceAtIndex( index, &res );
+        if ( res == AIOUSB_SUCCESS && is_ok_device( dev ) == AIOUSB_TRUE )  { 
+            retval = AIOUSB_SUCCESS;
+            indices[(*length)++] = index;
         }
-        index++;
-        deviceMask >>= 1;
     }
     if ( retval == AIOUSB_SUCCESS )
         *where = indices;
     return retval;
 }
 
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Resolves every range of the group through the device table's
+ * product ID index
+ * @return number of distinct device indices written to indices, which
+ * must hold AIODeviceTableGetCapacity() entries
+ */
+static int _find_group_indices( int *indices, AIOProductGroup *pg )
+{
+    int capacity = (int)AIODeviceTableGetCapacity();
+    int found = 0;
+    int *matches = (int *)malloc( capacity * sizeof(int) );
+    if ( !matches )
+        return 0;
+
+    for ( size_t i = 0; i < pg->_num_groups; i ++ ) {
+        int n = (int)AIODeviceTableGetIndicesByProductID( pg->_groups[i]->_start, pg->_groups[i]->_end, matches, capacity );
+        for ( int j = 0; j < n; j ++ ) {
+            int seen = 0;
+            for ( int k = 0; k < found && !seen; k ++ )
+                seen = ( indices[k] == matches[j] );
+            if ( !seen && found < capacity )
+                indices[found++] = matches[j];
+        }
+    }
+
+    /* ranges may come in any order, keep the results in device order */
+    for ( int i = 1; i < found; i ++ ) {
+        int tmp = indices[i], j;
+        for ( j = i; j > 0 && indices[j-1] > tmp; j -- )
+            indices[j] = indices[j-1];
+        indices[j] = tmp;
+    }
+    free( matches );
+    return found;
+}
+
 /*----------------------------------------------------------------------------*/
 AIORET_TYPE AIOUSB_FindDeviceIndicesByGroup( intlist *indices, AIOProductGroup *pg )
 {
@@ -234,28 +305,30 @@ AIORET_TYPE AIOUSB_FindDeviceIndicesByGroup( intlist *indices, AIOProductGroup *
     if ( !AIOUSB_IsInit() )
         AIOUSB_Init();
 
-    int index = 0;
-    unsigned long deviceMask = AIOUSB_GetAllDevices();
-
     AIORET_TYPE retval = -AIOUSB_ERROR_DEVICE_NOT_FOUND;
-    while ( deviceMask ) {
-        if ( deviceMask & 1 ) {
-            AIOUSBDevice *dev = &deviceTable[index];
-            if ( AIOProductGroupContains( pg, dev->ProductID ) >= AIOUSB_SUCCESS ) {
-                retval = AIOUSB_SUCCESS;
-                TailQListintInsert( indices , NewTailQListEntryint( index ));
-            }
-        }
-        index++;
-        deviceMask >>= 1;
+    int *found = (int *)malloc( AIODeviceTableGetCapacity() * sizeof(int) );
+    if ( !found ) {
+        DeleteAIOProductGroup( pg );
+        return -AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
     }
+    int length = _find_group_indices( found, pg );
 
+    for ( int i = 0; i < length; i ++ ) {
+        retval = AIOUSB_SUCCESS;
+        TailQListintInsert( indices , NewTailQListEntryint( found[i] ));
+    }
+
+    free( found );
     DeleteAIOProductGroup( pg );
 
     return retval;
 }
 
 /*----------------------------------------------------------------------------*/
+/**
+ * @brief Like AIOUSB_FindDevices(), *where points at a library-owned array
+ * that stays allocated but is overwritten by the next call
+ */
 AIORET_TYPE AIOUSB_FindDevicesByGroup( int **where, int *length, AIOProductGroup *pg )
 {
     AIO_ASSERT( where );
@@ -264,26 +337,19 @@ AIORET_TYPE AIOUSB_FindDevicesByGroup( int **where, int *length, AIOProductGroup
     if ( !AIOUSB_IsInit() )
         AIOUSB_Init();
     AIORET_TYPE retval = -AIOUSB_ERROR_DEVICE_NOT_FOUND;
-    unsigned long deviceMask = AIOUSB_GetAllDevices();
-    static int indices[MAX_USB_DEVICES];
-
-    int index = 0;
-
-    *length = 0;
+    static struct find_devices_buffer found;
 
-    while ( deviceMask  ) {
-        if ( deviceMask & 1 ) {
-            AIOUSBDevice *dev = &deviceTable[index];
-            if ( AIOProductGroupContains( pg, dev->ProductID ) >= AIOUSB_SUCCESS ) {
-                retval = AIOUSB_SUCCESS;
-                indices[(*length)++] = index;
-            }
-        }
-        index++;
-        deviceMask >>= 1;
+    int *indices = _find_devices_buffer( &found, (int)AIODeviceTableGetCapacity() );
+    if ( !indices ) {
+        DeleteAIOProductGroup( pg );
+        return -AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
     }
-    if ( retval == AIOUSB_SUCCESS )
+
+    *length = _find_group_indices( indices, pg );
+    if ( *length > 0 ) {
+        retval = AIOUSB_SUCCESS;
         *where = indices;
+    }
 
     DeleteAIOProductGroup( pg );
     return retval;
@@ -349,7 +415,7 @@ const char *AIOUSB_GetResultCodeAsString(unsigned long result_value)
         /**
          * build index of result codes
          */
-        int index;
+        unsigned int index;
         for(index = 0; index < NUM_RESULT_CODES; index++)
             resultCodeIndex[ index ] = &resultCodeTable[ index ];
         qsort(resultCodeIndex, NUM_RESULT_CODES, sizeof(struct ResultCodeName *), CompareResultCodes);
@@ -394,8 +460,8 @@ AIORET_TYPE AIOUSB_ShowDevices( AIODisplayType display_type )
         break;
     }
     int previous=0;
-    for(int index = 0; index < MAX_USB_DEVICES; index++) {
-        if ( deviceTable[ index ].usb_device ) {
+    for(int index = 0; index < AIODeviceTableGetCapacity(); index++) {
+        if ( _get_device_no_error( index )->usb_device ) {
             int MAX_NAME_SIZE = 100;
             char name[ MAX_NAME_SIZE + 1 ];
             unsigned long productID;
@@ -517,10 +583,12 @@ TEST(AIODeviceTable, SetsUpDefaults )
     EXPECT_GE( ret, AIOUSB_SUCCESS );
     EXPECT_EQ( length, 1 );
 
+    int *first = indices;
     ret = AIOUSB_FindDevicesByGroup( &indices, &length, NewAIOProductGroup(1,AIO_RANGE(USB_DIO_32,USB_AI16_16E)));    
 
     EXPECT_GE( ret, AIOUSB_SUCCESS );
     EXPECT_EQ( length, 2 );
+    EXPECT_EQ( first, indices ) << "Earlier results are not moved by a later call";
 
     ClearAIODeviceTable( numDevices );
 }
@@ -309,6 +309,311 @@ AIORET_TYPE DIOBufSetByteAtIndex( DIOBuf *buf, unsigned index, char  value ) {
     return retval;
 }
 
+/*----------------------------------------------------------------------------*/
+static unsigned _packed_words( unsigned size )
+{
+    return ( size + 63 ) / 64;
+}
+
+/*----------------------------------------------------------------------------*/
+/* clears the bits past size in the last word */
+static void _packed_trim( DIOPackedBuf *buf )
+{
+    if ( buf->size % 64 )
+        buf->words[ buf->numWords - 1 ] &= ( (uint64_t)1 << ( buf->size % 64 ) ) - 1;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Constructor for a packed bit vector of size bits, all 0
+ * @param size number of bits
+ * @return DIOPackedBuf * or NULL if failure
+ */
+DIOPackedBuf *NewDIOPackedBuf( unsigned size )
+{
+    DIOPackedBuf *tmp = (DIOPackedBuf *)calloc( 1, sizeof(DIOPackedBuf) );
+    if ( !tmp )
+        return tmp;
+    tmp->numWords = _packed_words( size );
+    tmp->words = (uint64_t *)calloc( tmp->numWords ? tmp->numWords : 1, sizeof(uint64_t) );
+    if ( !tmp->words ) {
+        free( tmp );
+        return NULL;
+    }
+    tmp->size = size;
+    return tmp;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Constructor from raw DIO bytes, as returned by DIO_ReadAll()
+ * @param bytes
+ * @param numBytes the buffer holds numBytes * 8 bits
+ */
+DIOPackedBuf *NewDIOPackedBufFromBytes( const unsigned char *bytes, unsigned numBytes )
+{
+    AIO_ASSERT_RET( NULL, bytes );
+    DIOPackedBuf *tmp = NewDIOPackedBuf( numBytes * BITS_PER_BYTE );
+    if ( tmp )
+        DIOPackedBufSetBytes( tmp, bytes, numBytes );
+    return tmp;
+}
+
+/*----------------------------------------------------------------------------*/
+void DeleteDIOPackedBuf( DIOPackedBuf *buf )
+{
+    if ( !buf )
+        return;
+    free( buf->words );
+    free( buf );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Changes the number of bits, keeping the low bits and zeroing any
+ * new ones
+ */
+DIOPackedBuf *DIOPackedBufResize( DIOPackedBuf *buf, unsigned size )
+{
+    AIO_ASSERT_RET( NULL, buf );
+    unsigned numWords = _packed_words( size );
+    uint64_t *words = (uint64_t *)realloc( buf->words, ( numWords ? numWords : 1 ) * sizeof(uint64_t) );
+    if ( !words )
+        return NULL;
+    if ( numWords > buf->numWords )
+        memset( &words[ buf->numWords ], 0, ( numWords - buf->numWords ) * sizeof(uint64_t) );
+    buf->words    = words;
+    buf->numWords = numWords;
+    buf->size     = size;
+    if ( numWords )
+        _packed_trim( buf );
+    return buf;
+}
+
+/*----------------------------------------------------------------------------*/
+unsigned DIOPackedBufSize( DIOPackedBuf *buf )
+{
+    return buf->size;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @return 0 or 1 if successful, < 0 indicates a failure
+ */
+AIORET_TYPE DIOPackedBufGetIndex( DIOPackedBuf *buf, unsigned index )
+{
+    AIO_ASSERT_DIOBUF( buf );
+    AIO_ERROR_VALID_AIORET_TYPE( AIOUSB_ERROR_INVALID_INDEX, index < buf->size );
+
+    return ( buf->words[ index / 64 ] >> ( index % 64 ) ) & 1;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE DIOPackedBufSetIndex( DIOPackedBuf *buf, unsigned index, unsigned value )
+{
+    AIO_ASSERT_DIOBUF( buf );
+    AIO_ERROR_VALID_AIORET_TYPE( AIOUSB_ERROR_INVALID_INDEX, index < buf->size );
+    AIO_ERROR_VALID_AIORET_TYPE( AIOUSB_ERROR_INVALID_PARAMETER, value == 0 || value == 1 );
+
+    uint64_t bit = (uint64_t)1 << ( index % 64 );
+    if ( value )
+        buf->words[ index / 64 ] |= bit;
+    else
+        buf->words[ index / 64 ] &= ~bit;
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Loads the low numBytes * 8 bits from raw DIO bytes; bits above
+ * are left alone
+ */
+AIORET_TYPE DIOPackedBufSetBytes( DIOPackedBuf *buf, const unsigned char *bytes, unsigned numBytes )
+{
+    AIO_ASSERT_DIOBUF( buf );
+    AIO_ASSERT( bytes );
+    AIO_ERROR_VALID_AIORET_TYPE( AIOUSB_ERROR_INVALID_INDEX, numBytes * BITS_PER_BYTE <= buf->size );
+
+    for ( unsigned i = 0; i < numBytes; i ++ ) {
+        unsigned shift = ( i % 8 ) * BITS_PER_BYTE;
+        buf->words[ i / 8 ] = ( buf->words[ i / 8 ] & ~( (uint64_t)0xff << shift ) ) | ( (uint64_t)bytes[i] << shift );
+    }
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Stores the low numBytes * 8 bits as raw DIO bytes, ready for
+ * DIO_WriteAll()
+ */
+AIORET_TYPE DIOPackedBufGetBytes( DIOPackedBuf *buf, unsigned char *bytes, unsigned numBytes )
+{
+    AIO_ASSERT_DIOBUF( buf );
+    AIO_ASSERT( bytes );
+    AIO_ERROR_VALID_AIORET_TYPE( AIOUSB_ERROR_INVALID_INDEX, numBytes <= buf->numWords * 8 );
+
+    for ( unsigned i = 0; i < numBytes; i ++ )
+        bytes[i] = (unsigned char)( buf->words[ i / 8 ] >> ( ( i % 8 ) * BITS_PER_BYTE ) );
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @return the number of bits that are 1
+ */
+AIORET_TYPE DIOPackedBufPopcount( DIOPackedBuf *buf )
+{
+    AIO_ASSERT_DIOBUF( buf );
+    AIORET_TYPE count = 0;
+    for ( unsigned i = 0; i < buf->numWords; i ++ )
+        count += __builtin_popcountll( buf->words[i] );
+    return count;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief buf |= mask; both must be the same size
+ */
+AIORET_TYPE DIOPackedBufSetMasked( DIOPackedBuf *buf, DIOPackedBuf *mask )
+{
+    AIO_ASSERT_DIOBUF( buf && mask );
+    AIO_ERROR_VALID_AIORET_TYPE( AIOUSB_ERROR_INVALID_PARAMETER, buf->size == mask->size );
+    for ( unsigned i = 0; i < buf->numWords; i ++ )
+        buf->words[i] |= mask->words[i];
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief buf &= ~mask; both must be the same size
+ */
+AIORET_TYPE DIOPackedBufClearMasked( DIOPackedBuf *buf, DIOPackedBuf *mask )
+{
+    AIO_ASSERT_DIOBUF( buf && mask );
+    AIO_ERROR_VALID_AIORET_TYPE( AIOUSB_ERROR_INVALID_PARAMETER, buf->size == mask->size );
+    for ( unsigned i = 0; i < buf->numWords; i ++ )
+        buf->words[i] &= ~mask->words[i];
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Copies the bits of value selected by mask into buf, leaving the
+ * others: buf = (buf & ~mask) | (value & mask)
+ */
+AIORET_TYPE DIOPackedBufWriteMasked( DIOPackedBuf *buf, DIOPackedBuf *mask, DIOPackedBuf *value )
+{
+    AIO_ASSERT_DIOBUF( buf && mask && value );
+    AIO_ERROR_VALID_AIORET_TYPE( AIOUSB_ERROR_INVALID_PARAMETER, buf->size == mask->size && buf->size == value->size );
+    for ( unsigned i = 0; i < buf->numWords; i ++ )
+        buf->words[i] = ( buf->words[i] & ~mask->words[i] ) | ( value->words[i] & mask->words[i] );
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief diff = a ^ b, the bits that differ; diff may be a or b
+ * @return the number of bits that differ
+ */
+AIORET_TYPE DIOPackedBufDiff( DIOPackedBuf *diff, DIOPackedBuf *a, DIOPackedBuf *b )
+{
+    AIO_ASSERT_DIOBUF( diff && a && b );
+    AIO_ERROR_VALID_AIORET_TYPE( AIOUSB_ERROR_INVALID_PARAMETER, diff->size == a->size && a->size == b->size );
+    AIORET_TYPE count = 0;
+    for ( unsigned i = 0; i < diff->numWords; i ++ ) {
+        diff->words[i] = a->words[i] ^ b->words[i];
+        count += __builtin_popcountll( diff->words[i] );
+    }
+    return count;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Moves every bit count places towards the top; bits shifted past
+ * the end are lost and the bottom fills with 0
+ */
+AIORET_TYPE DIOPackedBufShiftLeft( DIOPackedBuf *buf, unsigned count )
+{
+    AIO_ASSERT_DIOBUF( buf );
+    unsigned wordShift = count / 64, bitShift = count % 64;
+
+    for ( int i = (int)buf->numWords - 1; i >= 0; i -- ) {
+        int src = i - (int)wordShift;
+        uint64_t v = 0;
+        if ( src >= 0 ) {
+            v = buf->words[src] << bitShift;
+            if ( bitShift && src > 0 )
+                v |= buf->words[src - 1] >> ( 64 - bitShift );
+        }
+        buf->words[i] = v;
+    }
+    if ( buf->numWords )
+        _packed_trim( buf );
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Moves every bit count places towards bit 0; the top fills with 0
+ */
+AIORET_TYPE DIOPackedBufShiftRight( DIOPackedBuf *buf, unsigned count )
+{
+    AIO_ASSERT_DIOBUF( buf );
+    unsigned wordShift = count / 64, bitShift = count % 64;
+
+    for ( unsigned i = 0; i < buf->numWords; i ++ ) {
+        unsigned src = i + wordShift;
+        uint64_t v = 0;
+        if ( src < buf->numWords ) {
+            v = buf->words[src] >> bitShift;
+            if ( bitShift && src + 1 < buf->numWords )
+                v |= buf->words[src + 1] << ( 64 - bitShift );
+        }
+        buf->words[i] = v;
+    }
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Produces the DIOBuf form, the same DIOBuf that DIOBufReplaceString()
+ * makes from the raw bytes. A size that isn't a whole number of bytes is
+ * rounded up.
+ * @param buf
+ * @param out DIOBuf to fill in, or NULL to create one
+ * @return out, the new DIOBuf, or NULL on failure
+ */
+DIOBuf *DIOPackedBufToDIOBuf( DIOPackedBuf *buf, DIOBuf *out )
+{
+    AIO_ASSERT_RET( NULL, buf );
+    unsigned numBytes = ( buf->size + BITS_PER_BYTE - 1 ) / BITS_PER_BYTE;
+    char *bytes = (char *)malloc( numBytes ? numBytes : 1 );
+    if ( !bytes )
+        return NULL;
+    DIOPackedBufGetBytes( buf, (unsigned char *)bytes, numBytes );
+
+    if ( !out )
+        out = NewDIOBufFromChar( bytes, numBytes );
+    else
+        out = DIOBufReplaceString( out, bytes, numBytes );
+    free( bytes );
+    return out;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Loads a DIOBuf, the inverse of DIOPackedBufToDIOBuf(). buf is
+ * resized to the DIOBuf's whole bytes.
+ */
+AIORET_TYPE DIOPackedBufFromDIOBuf( DIOPackedBuf *buf, DIOBuf *in )
+{
+    AIO_ASSERT_DIOBUF( buf && in );
+    unsigned numBytes = DIOBufByteSize( in );
+
+    AIO_ERROR_VALID_AIORET_TYPE( AIOUSB_ERROR_NOT_ENOUGH_MEMORY, DIOPackedBufResize( buf, numBytes * BITS_PER_BYTE ) );
+    return DIOPackedBufSetBytes( buf, (unsigned char *)DIOBufToBinary( in ), numBytes );
+}
+
 #ifdef __cplusplus 
 }
 #endif
@@ -495,6 +800,106 @@ TEST(DIOBuf, Toggle_interview ) {
     free(tmp);
 }
 
+TEST(DIOPackedBuf, BytesRoundTripAndIndexing ) {
+    unsigned char bytes[12] = { 0x01, 0x80, 0, 0, 0, 0, 0, 0, 0xff, 0, 0, 0x40 };
+    unsigned char back[12];
+    DIOPackedBuf *buf = NewDIOPackedBufFromBytes( bytes, 12 );
+    ASSERT_TRUE( buf );
+    EXPECT_EQ( 96u, DIOPackedBufSize( buf ) );
+    EXPECT_EQ( 2u, buf->numWords );
+    EXPECT_EQ( 1, DIOPackedBufGetIndex( buf, 0 ) );
+    EXPECT_EQ( 1, DIOPackedBufGetIndex( buf, 15 ) );
+    EXPECT_EQ( 1, DIOPackedBufGetIndex( buf, 64 ) );
+    EXPECT_EQ( 1, DIOPackedBufGetIndex( buf, 94 ) );
+    EXPECT_EQ( 0, DIOPackedBufGetIndex( buf, 95 ) );
+    EXPECT_EQ( -AIOUSB_ERROR_INVALID_INDEX, DIOPackedBufGetIndex( buf, 96 ) );
+    EXPECT_EQ( 11, DIOPackedBufPopcount( buf ) );
+
+    EXPECT_EQ( AIOUSB_SUCCESS, DIOPackedBufSetIndex( buf, 95, 1 ) );
+    DIOPackedBufGetBytes( buf, back, 12 );
+    EXPECT_EQ( 0xc0, back[11] );
+    EXPECT_EQ( 0, memcmp( bytes, back, 11 ) );
+    DeleteDIOPackedBuf( buf );
+}
+
+TEST(DIOPackedBuf, MaskedSetClearAndDiff ) {
+    DIOPackedBuf *buf  = NewDIOPackedBuf( 96 );
+    DIOPackedBuf *mask = NewDIOPackedBuf( 96 );
+    DIOPackedBuf *val  = NewDIOPackedBuf( 96 );
+    DIOPackedBuf *diff = NewDIOPackedBuf( 96 );
+    DIOPackedBuf *small = NewDIOPackedBuf( 32 );
+
+    for ( unsigned i = 60; i < 70; i ++ )
+        DIOPackedBufSetIndex( mask, i, 1 );
+    EXPECT_EQ( AIOUSB_SUCCESS, DIOPackedBufSetMasked( buf, mask ) );
+    EXPECT_EQ( 10, DIOPackedBufPopcount( buf ) );
+    EXPECT_EQ( -AIOUSB_ERROR_INVALID_PARAMETER, DIOPackedBufSetMasked( buf, small ) );
+
+    DIOPackedBufSetIndex( val, 61, 1 );
+    DIOPackedBufSetIndex( val, 90, 1 );
+    EXPECT_EQ( AIOUSB_SUCCESS, DIOPackedBufWriteMasked( buf, mask, val ) );
+    EXPECT_EQ( 1, DIOPackedBufPopcount( buf ) ) << "bit 90 is outside the mask";
+    EXPECT_EQ( 1, DIOPackedBufGetIndex( buf, 61 ) );
+
+    EXPECT_EQ( 1, DIOPackedBufDiff( diff, buf, val ) );
+    EXPECT_EQ( 1, DIOPackedBufGetIndex( diff, 90 ) );
+
+    DIOPackedBufSetMasked( buf, mask );
+    DIOPackedBufClearMasked( buf, val );
+    EXPECT_EQ( 9, DIOPackedBufPopcount( buf ) );
+
+    DeleteDIOPackedBuf( buf );
+    DeleteDIOPackedBuf( mask );
+    DeleteDIOPackedBuf( val );
+    DeleteDIOPackedBuf( diff );
+    DeleteDIOPackedBuf( small );
+}
+
+TEST(DIOPackedBuf, ShiftsCrossWordsAndDropOffTheEnd ) {
+    DIOPackedBuf *buf = NewDIOPackedBuf( 100 );
+    DIOPackedBufSetIndex( buf, 0, 1 );
+    DIOPackedBufSetIndex( buf, 63, 1 );
+
+    DIOPackedBufShiftLeft( buf, 3 );
+    EXPECT_EQ( 1, DIOPackedBufGetIndex( buf, 3 ) );
+    EXPECT_EQ( 1, DIOPackedBufGetIndex( buf, 66 ) );
+    EXPECT_EQ( 2, DIOPackedBufPopcount( buf ) );
+
+    DIOPackedBufShiftLeft( buf, 33 );
+    EXPECT_EQ( 1, DIOPackedBufGetIndex( buf, 36 ) );
+    EXPECT_EQ( 1, DIOPackedBufGetIndex( buf, 99 ) );
+    DIOPackedBufShiftLeft( buf, 1 );
+    EXPECT_EQ( 1, DIOPackedBufPopcount( buf ) ) << "bit 99 is the last one kept";
+
+    DIOPackedBufShiftRight( buf, 37 );
+    EXPECT_EQ( 1, DIOPackedBufGetIndex( buf, 0 ) );
+    DIOPackedBufShiftLeft( buf, 99 );
+    EXPECT_EQ( 1, DIOPackedBufGetIndex( buf, 99 ) );
+    DIOPackedBufShiftRight( buf, 65 );
+    EXPECT_EQ( 1, DIOPackedBufGetIndex( buf, 34 ) );
+    DIOPackedBufShiftRight( buf, 200 );
+    EXPECT_EQ( 0, DIOPackedBufPopcount( buf ) );
+    DeleteDIOPackedBuf( buf );
+}
+
+TEST(DIOPackedBuf, LegacyFormOnDemand ) {
+    DIOPackedBuf *buf = NewDIOPackedBufFromBytes( (const unsigned char *)"Test", 4 );
+    DIOBuf *legacy = DIOPackedBufToDIOBuf( buf, NULL );
+    DIOBuf *expected = NewDIOBufFromChar( "Test", 4 );
+    ASSERT_TRUE( legacy );
+    EXPECT_STREQ( DIOBufToString( expected ), DIOBufToString( legacy ) );
+
+    DIOPackedBuf *back = NewDIOPackedBuf( 0 );
+    EXPECT_EQ( AIOUSB_SUCCESS, DIOPackedBufFromDIOBuf( back, legacy ) );
+    EXPECT_EQ( 32u, DIOPackedBufSize( back ) );
+    EXPECT_EQ( 0, DIOPackedBufDiff( back, back, buf ) );
+
+    DeleteDIOBuf( legacy );
+    DeleteDIOBuf( expected );
+    DeleteDIOPackedBuf( back );
+    DeleteDIOPackedBuf( buf );
+}
+
 
 int main( int argc , char *argv[] ) 
 {
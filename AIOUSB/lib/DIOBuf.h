@@ -47,6 +47,21 @@ typedef struct {
 
 typedef unsigned char DIOBufferType ;
 
+/**
+ * @brief DIOPackedBuf: the same bit vector packed 64 bits to a word, for
+ * code that works on whole DIO images rather than single bits. Bit n is
+ * bit n of the board, i.e. bit n % 8 of byte n / 8 as DIO_ReadAll() and
+ * DIO_WriteAll() lay them out, so a DIO-96 image is two words instead
+ * of 96 bytes. Population count, masked set/clear, XOR diff and shifts
+ * run a word at a time. DIOPackedBufToDIOBuf() gives the DIOBuf form
+ * only when something needs it.
+ */
+typedef struct {
+    unsigned size;              /**< Size in bits */
+    unsigned numWords;
+    uint64_t *words;            /**< bits past size are kept at 0 */
+} DIOPackedBuf;
+
 /* BEGIN AIOUSB_API */
 
 PUBLIC_EXTERN DIOBuf *NewDIOBuf ( unsigned size );
@@ -67,6 +82,25 @@ PUBLIC_EXTERN AIORET_TYPE DIOBufGetIndex( DIOBuf *buf, int index );
 PUBLIC_EXTERN AIORET_TYPE DIOBufGetByteAtIndex( DIOBuf *buf, unsigned index, char *value);
 PUBLIC_EXTERN AIORET_TYPE DIOBufSetByteAtIndex( DIOBuf *buf, unsigned index, char  value );
 
+PUBLIC_EXTERN DIOPackedBuf *NewDIOPackedBuf( unsigned size );
+PUBLIC_EXTERN DIOPackedBuf *NewDIOPackedBufFromBytes( const unsigned char *bytes, unsigned numBytes );
+PUBLIC_EXTERN void DeleteDIOPackedBuf( DIOPackedBuf *buf );
+PUBLIC_EXTERN DIOPackedBuf *DIOPackedBufResize( DIOPackedBuf *buf, unsigned size );
+PUBLIC_EXTERN unsigned DIOPackedBufSize( DIOPackedBuf *buf );
+PUBLIC_EXTERN AIORET_TYPE DIOPackedBufGetIndex( DIOPackedBuf *buf, unsigned index );
+PUBLIC_EXTERN AIORET_TYPE DIOPackedBufSetIndex( DIOPackedBuf *buf, unsigned index, unsigned value );
+PUBLIC_EXTERN AIORET_TYPE DIOPackedBufSetBytes( DIOPackedBuf *buf, const unsigned char *bytes, unsigned numBytes );
+PUBLIC_EXTERN AIORET_TYPE DIOPackedBufGetBytes( DIOPackedBuf *buf, unsigned char *bytes, unsigned numBytes );
+PUBLIC_EXTERN AIORET_TYPE DIOPackedBufPopcount( DIOPackedBuf *buf );
+PUBLIC_EXTERN AIORET_TYPE DIOPackedBufSetMasked( DIOPackedBuf *buf, DIOPackedBuf *mask );
+PUBLIC_EXTERN AIORET_TYPE DIOPackedBufClearMasked( DIOPackedBuf *buf, DIOPackedBuf *mask );
+PUBLIC_EXTERN AIORET_TYPE DIOPackedBufWriteMasked( DIOPackedBuf *buf, DIOPackedBuf *mask, DIOPackedBuf *value );
+PUBLIC_EXTERN AIORET_TYPE DIOPackedBufDiff( DIOPackedBuf *diff, DIOPackedBuf *a, DIOPackedBuf *b );
+PUBLIC_EXTERN AIORET_TYPE DIOPackedBufShiftLeft( DIOPackedBuf *buf, unsigned count );
+PUBLIC_EXTERN AIORET_TYPE DIOPackedBufShiftRight( DIOPackedBuf *buf, unsigned count );
+PUBLIC_EXTERN DIOBuf *DIOPackedBufToDIOBuf( DIOPackedBuf *buf, DIOBuf *out );
+PUBLIC_EXTERN AIORET_TYPE DIOPackedBufFromDIOBuf( DIOPackedBuf *buf, DIOBuf *in );
+
 /* END AIOUSB_API */
 
 #ifdef __aiousb_cplusplus
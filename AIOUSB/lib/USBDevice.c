@@ -10,6 +10,7 @@
 #include "libusb.h"
 #include "AIODeviceTable.h"
 #include "AIOEither.h"
+#include <pthread.h>
 
 #ifdef __cplusplus
 #include <iostream>
@@ -178,35 +179,106 @@ int USBDeviceClose( USBDevice *usb )
 }
 
 /*----------------------------------------------------------------------------*/
+#define AIOUSB_MAX_PROBE_THREADS 8
+
+struct usb_probe_job {
+    USBDevice *devs;
+    libusb_device **usb_devices;
+    struct libusb_device_descriptor *descs;
+    int count;
+    int next;                   /**< next device to open, taken with __sync_fetch_and_add */
+    unsigned char *opened;      /**< per device, nonzero once it opened */
+};
+
+static void *_probe_thread( void *arg )
+{
+    struct usb_probe_job *job = (struct usb_probe_job *)arg;
+    int i;
+    while ( ( i = __sync_fetch_and_add( &job->next, 1 ) ) < job->count ) {
+        LIBUSBArgs args = { libusb_ref_device( job->usb_devices[i] ), NULL, &job->descs[i] };
+        AIOEither usbretval = InitializeUSBDevice( &job->devs[i], &args );
+        if ( AIOEitherHasError( &usbretval ) ) {
+            libusb_unref_device( args.dev );
+            AIOEitherClear( &usbretval );
+        } else {
+            job->opened[i] = 1;
+        }
+    }
+    return NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Finds every ACCES board on the bus and opens it. Opening a board
+ * (open, claim, configure) is a handful of round trips each, so with
+ * more than one board they are opened from a few threads at once.
+ * Boards that fail to open are left out of devs and size; the call only
+ * fails if none of them opened.
+ */
 AIORET_TYPE AddAllACCESUSBDevices( libusb_device **deviceList , USBDevice **devs , int *size )
 {
     AIORET_TYPE result = AIOUSB_ERROR_DEVICE_NOT_FOUND;
-    int numAccesDevices = 0;
+    struct usb_probe_job job = { NULL, NULL, NULL, 0, 0, NULL };
+    USBDevice *grown;
+    int opened = 0;
+    pthread_t threads[AIOUSB_MAX_PROBE_THREADS];
+    int numThreads = 0;
     int numDevices = libusb_get_device_list(NULL, &deviceList);
-    if (numDevices > 0) {
-        for ( int index = 0; index < numDevices && numAccesDevices < MAX_USB_DEVICES; index++, numAccesDevices ++) {
-            struct libusb_device_descriptor libusbDeviceDesc;
-            libusb_device *usb_device = deviceList[ index ];
-
-            int libusbResult = libusb_get_device_descriptor(usb_device, &libusbDeviceDesc);
-
-            if (libusbResult == LIBUSB_SUCCESS) {
-
-                if (libusbDeviceDesc.idVendor == ACCES_VENDOR_ID  &&
-                    VALID_ENUM(ProductIDS, libusbDeviceDesc.idProduct ) 
-                    ) {
-                    *size += 1;
-                    *devs = (USBDevice*)realloc( *devs, (*size )*(sizeof(USBDevice)));
-                    memset(&(*devs)[*size-1],0,sizeof(USBDevice));
-                    LIBUSBArgs args = { libusb_ref_device(usb_device), NULL, &libusbDeviceDesc };
-                    AIOEither usbretval = InitializeUSBDevice( &( *devs)[*size-1] , &args );
-                    if ( AIOEitherHasError( &usbretval ) )
-                        return -AIOUSB_ERROR_USB_INIT;
-                    result = AIOUSB_SUCCESS;
-                }
-            }
+
+    if ( numDevices <= 0 )
+        return result;
+
+    job.usb_devices = (libusb_device **)calloc( numDevices, sizeof(libusb_device *) );
+    job.descs = (struct libusb_device_descriptor *)calloc( numDevices, sizeof(struct libusb_device_descriptor) );
+    job.opened = (unsigned char *)calloc( numDevices, sizeof(unsigned char) );
+    if ( !job.usb_devices || !job.descs || !job.opened ) {
+        result = -AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+        goto out_AddAllACCESUSBDevices;
+    }
+
+    for ( int index = 0; index < numDevices; index++ ) {
+        libusb_device *usb_device = deviceList[ index ];
+        if ( libusb_get_device_descriptor( usb_device, &job.descs[job.count] ) == LIBUSB_SUCCESS &&
+             job.descs[job.count].idVendor == ACCES_VENDOR_ID  &&
+             VALID_ENUM(ProductIDS, job.descs[job.count].idProduct ) ) {
+            job.usb_devices[job.count++] = usb_device;
         }
     }
+    if ( job.count == 0 )
+        goto out_AddAllACCESUSBDevices;
+
+    grown = (USBDevice*)realloc( *devs, ( *size + job.count )*(sizeof(USBDevice)));
+    if ( !grown ) {
+        result = -AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+        goto out_AddAllACCESUSBDevices;
+    }
+    *devs = grown;
+    job.devs = &(*devs)[*size];
+    memset( job.devs, 0, job.count * sizeof(USBDevice) );
+
+    if ( job.count > 1 ) {
+        while ( numThreads < job.count && numThreads < AIOUSB_MAX_PROBE_THREADS &&
+                pthread_create( &threads[numThreads], NULL, _probe_thread, &job ) == 0 )
+            numThreads ++;
+    }
+    _probe_thread( &job );      /* whatever the threads haven't taken, and everything if none started */
+    for ( int i = 0; i < numThreads; i ++ )
+        pthread_join( threads[i], NULL );
+
+    for ( int i = 0; i < job.count; i ++ ) {
+        if ( !job.opened[i] )
+            continue;
+        if ( opened != i )
+            job.devs[opened] = job.devs[i];
+        opened ++;
+    }
+    *size += opened;
+    result = opened ? AIOUSB_SUCCESS : -AIOUSB_ERROR_USB_INIT;
+
+ out_AddAllACCESUSBDevices:
+    free( job.usb_devices );
+    free( job.descs );
+    free( job.opened );
     return (AIORET_TYPE)result;
 }
 
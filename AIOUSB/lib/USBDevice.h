@@ -44,6 +44,7 @@ struct USBDevice {
     int conf;
     int origconf;
     int altset;
+    void *mockData;             /**< state of the mocks/ backend driving this device, NULL for real boards */
 };
 
 typedef struct aiousb_libusb_args {
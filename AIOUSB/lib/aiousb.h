@@ -21,8 +21,20 @@
 #include "AIOUSB_Properties.h"
 #include "AIOUSB_DIO.h"
 #include "AIOUSB_ADC.h"
+#include "AIOPreparedScan.h"
+#include "AIOHotplug.h"
+#include "AIOPropertyCache.h"
+#include "AIODIOStream.h"
+#include "AIODIOEvents.h"
 #include "AIOUSB_CTR.h"
 #include "AIOUSB_DAC.h"
+#include "AIODACWaveform.h"
+#include "AIODACPreparedUpdate.h"
+#include "AIOControlLoop.h"
+#include "AIOCounterStream.h"
+#include "AIOPollScheduler.h"
+#include "AIOCalCache.h"
+#include "AIOHostCal.h"
 #include "AIOUSB_CustomEEPROM.h"
 #include "USBDevice.h"
 #include "AIOUSB_Log.h"
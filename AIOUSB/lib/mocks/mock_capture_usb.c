@@ -4,7 +4,15 @@
  * @date   Tue Feb 17 12:01:40 2015
  * 
  * @brief  This file will allow capturing of all USB traffic, in and out
- * 
+ *
+ * By default every transfer is appended as a line of text to
+ * USB_DATALOG_NAME. Setting USB_DATALOG_FORMAT=binary instead
+ * records each transfer (header, payload and timestamps, see
+ * mock_usb_record.h) into a preallocated ring which a background
+ * thread drains to disk, so capturing costs a memcpy per transfer
+ * rather than a formatted write. Binary captures can be played back
+ * with libmock_replay_usb.so. USB_DATALOG_RING_SIZE sets the size of
+ * the ring in bytes.
  */
 
 #include <stdlib.h>
@@ -13,12 +21,15 @@
 #include <string.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <pthread.h>
+#include <time.h>
 #include "AIOTypes.h"
 #include "USBDevice.h"
 #include "AIOUSB_Core.h"
 #include "AIOUSB_Log.h"
 
 #include <dlfcn.h>
+#include "mock_usb_record.h"
 
 #ifdef __cplusplus
 namespace AIOUSB {
@@ -43,6 +54,220 @@ int (*orig_usb_get_config)( USBDevice *usb, ADCConfigBlock *configBlock );
 
 FILE *outfile;
 
+/*----------------------------------------------------------------------------*/
+/* Binary capture                                                             */
+/*----------------------------------------------------------------------------*/
+
+#define DEFAULT_CAPTURE_RING_SIZE ( 8 * 1024 * 1024 )
+
+typedef struct capture_ring {
+    unsigned char *buf;
+    size_t size;
+    size_t head;                /**< total bytes ever produced */
+    size_t tail;                /**< total bytes ever written to disk */
+    pthread_mutex_t lock;
+    pthread_cond_t data_ready;
+    pthread_cond_t space_ready;
+    pthread_t writer;
+    int running;
+    unsigned long stalls;       /**< times a producer waited for space */
+} CaptureRing;
+
+static AIOUSB_BOOL binary_mode = AIOUSB_FALSE;
+static CaptureRing ring = { NULL, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+static uint64_t capture_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * @brief Drains the ring to outfile. The fwrite happens outside the
+ * lock; producers only ever advance head, and tail is not advanced
+ * until the bytes are on their way to disk.
+ */
+static void *capture_writer( void *arg )
+{
+    pthread_mutex_lock( &ring.lock );
+    for (;;) {
+        while ( ring.head == ring.tail && ring.running )
+            pthread_cond_wait( &ring.data_ready, &ring.lock );
+        if ( ring.head == ring.tail && !ring.running )
+            break;
+
+        size_t offset = ring.tail % ring.size;
+        size_t count  = ring.head - ring.tail;
+        if ( offset + count > ring.size )
+            count = ring.size - offset;
+
+        pthread_mutex_unlock( &ring.lock );
+        fwrite( &ring.buf[offset], 1, count, outfile );
+        pthread_mutex_lock( &ring.lock );
+
+        ring.tail += count;
+        pthread_cond_broadcast( &ring.space_ready );
+    }
+    pthread_mutex_unlock( &ring.lock );
+    fflush( outfile );
+    return NULL;
+}
+
+static void ring_copy_in( const unsigned char *src, size_t length )
+{
+    size_t offset = ring.head % ring.size;
+    size_t first = ( offset + length > ring.size ? ring.size - offset : length );
+    memcpy( &ring.buf[offset], src, first );
+    if ( first < length )
+        memcpy( &ring.buf[0], src + first, length - first );
+    ring.head += length;
+}
+
+/**
+ * @brief Appends a record and its payload to the ring. Records are
+ * never dropped: if the writer falls behind the producer waits,
+ * and records larger than the whole ring are written through once
+ * the ring has drained.
+ */
+static void capture_record( MockUSBRecord *rec, const unsigned char *payload )
+{
+    size_t total = sizeof(MockUSBRecord) + rec->payload_length;
+
+    pthread_mutex_lock( &ring.lock );
+    if ( total > ring.size ) {
+        while ( ring.head != ring.tail )
+            pthread_cond_wait( &ring.space_ready, &ring.lock );
+        fwrite( rec, sizeof(MockUSBRecord), 1, outfile );
+        if ( rec->payload_length )
+            fwrite( payload, 1, rec->payload_length, outfile );
+    } else {
+        if ( ring.head - ring.tail + total > ring.size ) {
+            ring.stalls ++;
+            while ( ring.head - ring.tail + total > ring.size )
+                pthread_cond_wait( &ring.space_ready, &ring.lock );
+        }
+        ring_copy_in( (unsigned char *)rec, sizeof(MockUSBRecord) );
+        if ( rec->payload_length )
+            ring_copy_in( payload, rec->payload_length );
+        pthread_cond_signal( &ring.data_ready );
+    }
+    pthread_mutex_unlock( &ring.lock );
+}
+
+static void capture_shutdown(void)
+{
+    pthread_mutex_lock( &ring.lock );
+    ring.running = 0;
+    pthread_cond_signal( &ring.data_ready );
+    pthread_mutex_unlock( &ring.lock );
+    pthread_join( ring.writer, NULL );
+    if ( ring.stalls )
+        fprintf(stderr,"USB capture: writer fell behind %lu times, consider a larger USB_DATALOG_RING_SIZE\n", ring.stalls );
+    fclose( outfile );
+    free( ring.buf );
+}
+
+static int capture_start( void )
+{
+    char *tmp = getenv("USB_DATALOG_RING_SIZE");
+    ring.size = ( tmp && atol(tmp) > 0 ? (size_t)atol(tmp) : DEFAULT_CAPTURE_RING_SIZE );
+    ring.buf  = (unsigned char *)malloc( ring.size );
+    if ( !ring.buf )
+        return -AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+
+    MockUSBFileHeader header;
+    memcpy( header.magic, MOCK_USB_FILE_MAGIC, sizeof(header.magic) );
+    header.version = MOCK_USB_FILE_VERSION;
+    header.record_header_size = sizeof(MockUSBRecord);
+    fwrite( &header, sizeof(header), 1, outfile );
+
+    ring.running = 1;
+    if ( pthread_create( &ring.writer, NULL, capture_writer, NULL ) != 0 ) {
+        free( ring.buf );
+        ring.buf = NULL;
+        return -AIOUSB_ERROR_INVALID_THREAD;
+    }
+    atexit( capture_shutdown );
+    return AIOUSB_SUCCESS;
+}
+
+static void capture_init_record( MockUSBRecord *rec, USBDevice *usb, MOCK_USB_RECORD_TYPE type )
+{
+    memset( rec, 0, sizeof(MockUSBRecord) );
+    rec->type = (uint8_t)type;
+    rec->idProduct = usb->deviceDesc.idProduct;
+    if ( usb->device ) {
+        rec->bus     = libusb_get_bus_number( usb->device );
+        rec->address = libusb_get_device_address( usb->device );
+    }
+}
+
+static int capture_control_transfer( USBDevice *usbdev, uint8_t request_type, uint8_t bRequest, uint16_t wValue, uint16_t wIndex, unsigned char *data, uint16_t wLength, unsigned int timeout )
+{
+    MockUSBRecord rec;
+    capture_init_record( &rec, usbdev, MOCK_USB_RECORD_CONTROL );
+    rec.request_type = request_type;
+    rec.bRequest     = bRequest;
+    rec.wValue       = wValue;
+    rec.wIndex       = wIndex;
+    rec.length       = wLength;
+
+    rec.start_ns = capture_now_ns();
+    rec.retval   = orig_usb_control_transfer( usbdev, request_type, bRequest, wValue, wIndex, data, wLength, timeout );
+    rec.end_ns   = capture_now_ns();
+
+    if ( request_type & LIBUSB_ENDPOINT_IN )
+        rec.payload_length = ( rec.retval > 0 ? rec.retval : 0 );
+    else
+        rec.payload_length = wLength;
+    rec.actual_length = rec.payload_length;
+
+    capture_record( &rec, data );
+    return rec.retval;
+}
+
+static int capture_bulk_transfer( USBDevice *dev_handle, unsigned char endpoint, unsigned char *data, int length, int *actual_length, unsigned int timeout )
+{
+    MockUSBRecord rec;
+    capture_init_record( &rec, dev_handle, MOCK_USB_RECORD_BULK );
+    rec.request_type = endpoint;
+    rec.length       = length;
+
+    rec.start_ns = capture_now_ns();
+    rec.retval   = orig_usb_bulk_transfer( dev_handle, endpoint, data, length, actual_length, timeout );
+    rec.end_ns   = capture_now_ns();
+
+    rec.actual_length = *actual_length;
+    if ( endpoint & LIBUSB_ENDPOINT_IN )
+        rec.payload_length = ( *actual_length > 0 ? *actual_length : 0 );
+    else
+        rec.payload_length = length;
+
+    capture_record( &rec, data );
+    return rec.retval;
+}
+
+static int capture_reset_device( USBDevice *usbdev )
+{
+    MockUSBRecord rec;
+    capture_init_record( &rec, usbdev, MOCK_USB_RECORD_RESET );
+    rec.start_ns = capture_now_ns();
+    rec.retval   = orig_usb_reset_device( usbdev );
+    rec.end_ns   = capture_now_ns();
+    capture_record( &rec, NULL );
+    return rec.retval;
+}
+
+static void capture_device( USBDevice *usb )
+{
+    MockUSBRecord rec;
+    capture_init_record( &rec, usb, MOCK_USB_RECORD_DEVICE );
+    rec.start_ns = rec.end_ns = capture_now_ns();
+    rec.payload_length = sizeof(struct libusb_device_descriptor);
+    capture_record( &rec, (unsigned char *)&usb->deviceDesc );
+}
+
 
 int mock_usb_control_transfer( USBDevice *usbdev, uint8_t request_type, uint8_t bRequest, uint16_t wValue, uint16_t wIndex, unsigned char *data, uint16_t wLength, unsigned int timeout )
 {
@@ -152,17 +377,37 @@ AIOEither InitializeUSBDevice( USBDevice *usb, LIBUSBArgs *args )
 
     printf("Wrapped the original !!\n");
     retval = init_usb_device( usb, args );
-    char *fname = getenv("USB_DATALOG_NAME");
-    if ( !fname ) { 
-        fname = (char *)"usb_data_log.txt";
-    }
+
+    char *format = getenv("USB_DATALOG_FORMAT");
+    if ( format && strcmp(format,"binary") == 0 )
+        binary_mode = AIOUSB_TRUE;
+
+    if ( !outfile ) {
+        char *fname = getenv("USB_DATALOG_NAME");
+        if ( !fname ) { 
+            fname = (char *)( binary_mode ? "usb_data_log.bin" : "usb_data_log.txt" );
+        }
     
-    outfile = fopen(fname,"a+");
-    if (!outfile ) {
-        fprintf(stderr,"Can't open outputfile\n");
+        outfile = fopen(fname, binary_mode ? "w" : "a+");
+        if (!outfile ) {
+            fprintf(stderr,"Can't open outputfile\n");
+        } else if ( binary_mode && capture_start() != AIOUSB_SUCCESS ) {
+            fprintf(stderr,"Can't start USB capture writer, falling back to text\n");
+            binary_mode = AIOUSB_FALSE;
+        }
     }
 
-    if ( !AIOEitherHasError( &retval ) ) {
+    if ( !AIOEitherHasError( &retval ) && outfile && binary_mode ) {
+        orig_usb_control_transfer  = usb->usb_control_transfer;
+        orig_usb_bulk_transfer     = usb->usb_bulk_transfer;
+        orig_usb_reset_device      = usb->usb_reset_device;
+
+        usb->usb_control_transfer  = capture_control_transfer;
+        usb->usb_bulk_transfer     = capture_bulk_transfer;
+        usb->usb_reset_device      = capture_reset_device;
+
+        capture_device( usb );
+    } else if ( !AIOEitherHasError( &retval ) ) {
         orig_usb_control_transfer  = usb->usb_control_transfer;
         orig_usb_bulk_transfer     = usb->usb_bulk_transfer;
         orig_usb_request           = usb->usb_request;
@@ -0,0 +1,111 @@
+/**
+ * @file   mock_fake_device.h
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  Fake boards for the SELF_TEST builds: a USBDevice whose
+ *         transfer functions come from the test, registered in the
+ *         device table like an enumerated board
+ *
+ * Fixtures derive from MockFakeDeviceTest, call its SetUp() first and
+ * add their boards with AddFakeDevice(). TearDown() detaches the fakes
+ * before clearing the table, so the table never frees them.
+ */
+
+#ifndef _MOCK_FAKE_DEVICE_H
+#define _MOCK_FAKE_DEVICE_H
+
+#include "AIODeviceTable.h"
+#include "AIOUSBDevice.h"
+#include "gtest/gtest.h"
+#include <string.h>
+
+namespace AIOUSB {
+
+#define MOCK_FAKE_DEVICES 8
+
+typedef int (*mock_control_fn)( USBDevice *usb, uint8_t request_type, uint8_t bRequest, uint16_t wValue, uint16_t wIndex,
+                                unsigned char *data, uint16_t wLength, unsigned int timeout );
+typedef int (*mock_bulk_fn)( USBDevice *usb, unsigned char endpoint, unsigned char *data, int length, int *actual_length, unsigned int timeout );
+
+/* what a board does for the transfers a test doesn't care about */
+static inline int mock_fake_control( USBDevice *usb, uint8_t request_type, uint8_t bRequest, uint16_t wValue, uint16_t wIndex,
+                                     unsigned char *data, uint16_t wLength, unsigned int timeout )
+{
+    return wLength;
+}
+
+static inline int mock_fake_bulk( USBDevice *usb, unsigned char endpoint, unsigned char *data, int length, int *actual_length, unsigned int timeout )
+{
+    *actual_length = length;
+    return LIBUSB_SUCCESS;
+}
+
+static inline int mock_fake_put_config( USBDevice *usb, ADCConfigBlock *config )
+{
+    return (int)config->size;
+}
+
+static inline int mock_fake_get_config( USBDevice *usb, ADCConfigBlock *config )
+{
+    memset( config->registers, 0, config->size );
+    return AIOUSB_SUCCESS;
+}
+
+/**
+ * @brief Device index a fake was added at, for transfer functions shared
+ * by several boards; -1 if it isn't in the table
+ */
+static inline int mock_fake_device_index( USBDevice *usb )
+{
+    AIORESULT result;
+    for ( unsigned long index = 0; index < (unsigned long)AIODeviceTableGetCapacity(); index ++ ) {
+        AIOUSBDevice *device = AIODeviceTableGetDeviceAtIndex( index, &result );
+        if ( device && device->usb_device == usb )
+            return (int)index;
+    }
+    return -1;
+}
+
+class MockFakeDeviceTest : public ::testing::Test
+{
+ protected:
+    virtual void SetUp() {
+        numDevices = 0;
+        result = AIOUSB_SUCCESS;
+        AIODeviceTableInit();
+    }
+    virtual void TearDown() {
+        for ( int i = 0; i < numDevices; i ++ )
+            AIODeviceTableGetDeviceAtIndex( i, &result )->usb_device = NULL;
+        ClearAIODeviceTable( numDevices );
+    }
+
+    /**
+     * @brief Adds a board at the next index, backed by a zeroed USBDevice
+     * with the given transfer functions and pass-through configuration
+     */
+    AIOUSBDevice *AddFakeDevice( unsigned long productID,
+                                 mock_control_fn control = mock_fake_control,
+                                 mock_bulk_fn bulk = mock_fake_bulk ) {
+        int index = numDevices;
+        if ( index >= MOCK_FAKE_DEVICES )
+            return NULL;
+        memset( &usb[index], 0, sizeof(USBDevice) );
+        usb[index].usb_control_transfer = control;
+        usb[index].usb_bulk_transfer    = bulk;
+        usb[index].usb_put_config       = mock_fake_put_config;
+        usb[index].usb_get_config       = mock_fake_get_config;
+        if ( AIODeviceTableAddDeviceToDeviceTableWithUSBDevice( &numDevices, productID, &usb[index] ) != AIOUSB_SUCCESS )
+            return NULL;
+        return AIODeviceTableGetDeviceAtIndex( index, &result );
+    }
+
+    USBDevice usb[ MOCK_FAKE_DEVICES ];
+    int numDevices;
+    AIORESULT result;
+};
+
+}
+
+#endif
@@ -0,0 +1,351 @@
+/**
+ * @file   mock_replay_usb.c
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  Replays a binary capture made by mock_capture_usb.c
+ *         (USB_DATALOG_FORMAT=binary) through the USBDevice function
+ *         table, so that acquisition code can be exercised without
+ *         hardware.
+ *
+ * Environment:
+ *   USB_REPLAY_NAME   capture to replay (default usb_data_log.bin)
+ *   USB_REPLAY_SPEED  "original" waits so every transfer completes at
+ *                     the same offset from the first one as it did when
+ *                     recorded; "max" (the default) returns as fast as
+ *                     the data can be copied
+ *   USB_REPLAY_STRICT if set, a request that does not match the next
+ *                     recorded one fails with LIBUSB_ERROR_IO instead of
+ *                     only being reported on stderr
+ *
+ * One fake device is created per device recorded in the capture, told
+ * apart by product ID, bus and address. Transfers are replayed in
+ * recorded order per device. Version 1 captures have no bus or address,
+ * so there boards that share a product ID share one stream.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include "AIOTypes.h"
+#include "USBDevice.h"
+#include "AIOUSB_Core.h"
+#include "libusb.h"
+#include "mock_usb_record.h"
+
+#include <dlfcn.h>
+
+#ifdef __cplusplus
+namespace AIOUSB {
+#endif
+
+typedef struct replay_stream {
+    uint16_t idProduct;
+    uint8_t bus;
+    uint8_t address;
+    MockUSBRecord **records;
+    size_t num_records;
+    size_t cursor;
+} ReplayStream;
+
+static unsigned char *capture = NULL;
+static ReplayStream *streams = NULL;
+static int num_streams = 0;
+static AIOUSB_BOOL original_speed = AIOUSB_FALSE;
+static AIOUSB_BOOL strict = AIOUSB_FALSE;
+static uint64_t record_epoch_ns = 0;
+static uint64_t replay_epoch_ns = 0;
+static pthread_mutex_t replay_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t replay_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static ReplayStream *replay_find_stream( const MockUSBRecord *rec )
+{
+    for ( int i = 0; i < num_streams; i ++ ) {
+        if ( streams[i].idProduct == rec->idProduct && streams[i].bus == rec->bus && streams[i].address == rec->address )
+            return &streams[i];
+    }
+    return NULL;
+}
+
+/**
+ * @brief The stream a replayed device was created for; mockData is
+ * copied along with the rest of the USBDevice into the device table
+ */
+static ReplayStream *replay_device_stream( USBDevice *usb )
+{
+    return (ReplayStream *)usb->mockData;
+}
+
+/**
+ * @brief Forgets a capture that could not be used, so that discovery
+ * falls back to the real bus
+ */
+static void replay_unload( void )
+{
+    for ( int i = 0; i < num_streams; i ++ )
+        free( streams[i].records );
+    free( streams );
+    streams = NULL;
+    num_streams = 0;
+    free( capture );
+    capture = NULL;
+    record_epoch_ns = 0;
+}
+
+/**
+ * @brief Reads the whole capture into memory and indexes it by device,
+ * so that replaying a transfer is a pointer bump and a memcpy
+ */
+static AIORET_TYPE replay_load( const char *fname )
+{
+    FILE *fp = fopen( fname, "r" );
+    if ( !fp ) {
+        fprintf(stderr,"Can't open USB replay file %s: %s\n", fname, strerror(errno) );
+        return -AIOUSB_ERROR_FILE_NOT_FOUND;
+    }
+    fseek( fp, 0, SEEK_END );
+    long size = ftell( fp );
+    fseek( fp, 0, SEEK_SET );
+
+    if ( size < (long)sizeof(MockUSBFileHeader) ) {
+        fclose( fp );
+        fprintf(stderr,"%s is too short to be a binary USB capture\n", fname );
+        return -AIOUSB_ERROR_INVALID_DATA;
+    }
+    capture = (unsigned char *)malloc( size );
+    if ( !capture || fread( capture, 1, size, fp ) != (size_t)size ) {
+        fclose( fp );
+        replay_unload();
+        return -AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+    }
+    fclose( fp );
+
+    MockUSBFileHeader *header = (MockUSBFileHeader *)capture;
+    if ( memcmp( header->magic, MOCK_USB_FILE_MAGIC, sizeof(header->magic) ) != 0 ||
+         header->version < 1 || header->version > MOCK_USB_FILE_VERSION ||
+         header->record_header_size != sizeof(MockUSBRecord) ) {
+        fprintf(stderr,"%s is not a binary USB capture this build can replay\n", fname );
+        replay_unload();
+        return -AIOUSB_ERROR_INVALID_DATA;
+    }
+
+    long pos;
+    for ( pos = sizeof(MockUSBFileHeader); pos + (long)sizeof(MockUSBRecord) <= size; ) {
+        MockUSBRecord *rec = (MockUSBRecord *)&capture[pos];
+        long next = pos + sizeof(MockUSBRecord) + rec->payload_length;
+        if ( next > size )
+            break;
+
+        ReplayStream *stream = replay_find_stream( rec );
+        if ( rec->type == MOCK_USB_RECORD_DEVICE ) {
+            if ( !stream ) {
+                ReplayStream *grown = (ReplayStream *)realloc( streams, (num_streams + 1)*sizeof(ReplayStream) );
+                if ( !grown ) {
+                    replay_unload();
+                    return -AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+                }
+                streams = grown;
+                stream = &streams[num_streams++];
+                memset( stream, 0, sizeof(ReplayStream) );
+                stream->idProduct = rec->idProduct;
+                stream->bus       = rec->bus;
+                stream->address   = rec->address;
+            }
+        } else if ( stream ) {
+            if ( !record_epoch_ns )
+                record_epoch_ns = rec->start_ns;
+            MockUSBRecord **grown = (MockUSBRecord **)realloc( stream->records, (stream->num_records + 1)*sizeof(MockUSBRecord*) );
+            if ( !grown ) {
+                replay_unload();
+                return -AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+            }
+            stream->records = grown;
+            stream->records[stream->num_records++] = rec;
+        }
+        pos = next;
+    }
+    if ( pos != size )
+        fprintf(stderr,"Ignoring truncated record at end of %s\n", fname );
+    if ( !num_streams ) {
+        fprintf(stderr,"%s holds no devices\n", fname );
+        replay_unload();
+        return -AIOUSB_ERROR_DEVICE_NOT_FOUND;
+    }
+
+    return num_streams;
+}
+
+/**
+ * @brief Returns the next recorded transfer for this device, waiting
+ * until its recorded completion time if replaying at original speed
+ */
+static MockUSBRecord *replay_next( USBDevice *usb, MOCK_USB_RECORD_TYPE type )
+{
+    MockUSBRecord *rec = NULL;
+    pthread_mutex_lock( &replay_lock );
+    ReplayStream *stream = replay_device_stream( usb );
+    if ( stream && stream->cursor < stream->num_records ) {
+        rec = stream->records[stream->cursor++];
+        if ( !replay_epoch_ns )
+            replay_epoch_ns = replay_now_ns() - ( rec->start_ns - record_epoch_ns );
+    }
+    pthread_mutex_unlock( &replay_lock );
+
+    if ( !rec ) {
+        fprintf(stderr,"USB replay: capture exhausted for product %#x\n", usb->deviceDesc.idProduct );
+        return NULL;
+    }
+    if ( rec->type != type ) {
+        fprintf(stderr,"USB replay: expected record type %d, replaying type %d\n", (int)type, (int)rec->type );
+        return NULL;
+    }
+
+    if ( original_speed ) {
+        uint64_t due = replay_epoch_ns + ( rec->end_ns - record_epoch_ns );
+        uint64_t now = replay_now_ns();
+        if ( due > now ) {
+            struct timespec ts = { (time_t)((due - now) / 1000000000ULL), (long)((due - now) % 1000000000ULL) };
+            nanosleep( &ts, NULL );
+        }
+    }
+    return rec;
+}
+
+static int replay_control_transfer( USBDevice *usb, uint8_t request_type, uint8_t bRequest, uint16_t wValue, uint16_t wIndex, unsigned char *data, uint16_t wLength, unsigned int timeout )
+{
+    MockUSBRecord *rec = replay_next( usb, MOCK_USB_RECORD_CONTROL );
+    if ( !rec )
+        return LIBUSB_ERROR_IO;
+
+    if ( rec->request_type != request_type || rec->bRequest != bRequest ||
+         rec->wValue != wValue || rec->wIndex != wIndex || rec->length != wLength ) {
+        fprintf(stderr,"USB replay: control %#2.2x/%#2.2x (%#4.4x,%#4.4x) does not match recorded %#2.2x/%#2.2x (%#4.4x,%#4.4x)\n",
+                request_type, bRequest, wValue, wIndex, rec->request_type, rec->bRequest, rec->wValue, rec->wIndex );
+        if ( strict )
+            return LIBUSB_ERROR_IO;
+    }
+
+    if ( ( request_type & LIBUSB_ENDPOINT_IN ) && data )
+        memcpy( data, (unsigned char *)(rec + 1), MIN( rec->payload_length, wLength ) );
+
+    return rec->retval;
+}
+
+static int replay_bulk_transfer( USBDevice *usb, unsigned char endpoint, unsigned char *data, int length, int *actual_length, unsigned int timeout )
+{
+    AIO_ASSERT_USB( usb );
+    AIO_ASSERT( data );
+    AIO_ASSERT( actual_length );
+
+    MockUSBRecord *rec = replay_next( usb, MOCK_USB_RECORD_BULK );
+    if ( !rec ) {
+        *actual_length = 0;
+        return LIBUSB_ERROR_IO;
+    }
+
+    if ( rec->request_type != endpoint || rec->length != length ) {
+        fprintf(stderr,"USB replay: bulk %#2.2x of %d bytes does not match recorded %#2.2x of %d bytes\n",
+                endpoint, length, rec->request_type, rec->length );
+        if ( strict ) {
+            *actual_length = 0;
+            return LIBUSB_ERROR_IO;
+        }
+    }
+
+    if ( endpoint & LIBUSB_ENDPOINT_IN ) {
+        *actual_length = MIN( (int)rec->payload_length, length );
+        memcpy( data, (unsigned char *)(rec + 1), *actual_length );
+    } else {
+        *actual_length = MIN( rec->actual_length, length );
+    }
+
+    return rec->retval;
+}
+
+static int replay_reset_device( USBDevice *usb )
+{
+    MockUSBRecord *rec = replay_next( usb, MOCK_USB_RECORD_RESET );
+    return ( rec ? rec->retval : LIBUSB_ERROR_IO );
+}
+
+static int replay_request( USBDevice *usb, uint8_t request_type, uint8_t bRequest, uint16_t wValue, uint16_t wIndex, unsigned char *data, uint16_t wLength, unsigned int timeout )
+{
+    return 1;
+}
+
+typedef AIORET_TYPE (*add_devices_fn)( libusb_device **deviceList , USBDevice **devs , int *size );
+
+/**
+ * @brief Replaces device discovery with the devices found in the
+ * capture; falls back to the real discovery if no capture can be
+ * loaded
+ */
+AIORET_TYPE AddAllACCESUSBDevices( libusb_device **deviceList , USBDevice **devs , int *size )
+{
+    AIORET_TYPE result = 0;
+    static add_devices_fn orig_AddAllACCESUSBDevices = NULL;
+
+    if (!orig_AddAllACCESUSBDevices) {
+#ifdef __cplusplus
+        orig_AddAllACCESUSBDevices = (add_devices_fn)dlsym(RTLD_NEXT,"_ZN6AIOUSB21AddAllACCESUSBDevicesEPP13libusb_devicePPNS_9USBDeviceEPi");
+#else
+        orig_AddAllACCESUSBDevices = (add_devices_fn)dlsym(RTLD_NEXT,"AddAllACCESUSBDevices");
+#endif
+    }
+
+    char *tmp = getenv("USB_REPLAY_SPEED");
+    original_speed = ( tmp && strcmp(tmp,"original") == 0 ? AIOUSB_TRUE : AIOUSB_FALSE );
+    strict = ( getenv("USB_REPLAY_STRICT") ? AIOUSB_TRUE : AIOUSB_FALSE );
+
+    char *fname = getenv("USB_REPLAY_NAME");
+    if ( !fname )
+        fname = (char *)"usb_data_log.bin";
+
+    if ( !capture && replay_load( fname ) <= 0 ) {
+        fprintf(stderr,"No devices to replay, using original AddAllACCESUSBDevices\n");
+        return orig_AddAllACCESUSBDevices ? orig_AddAllACCESUSBDevices( deviceList, devs, size ) : -AIOUSB_ERROR_DEVICE_NOT_FOUND;
+    }
+
+    for ( int i = 0; i < num_streams && *size < MAX_USB_DEVICES; i ++ ) {
+        *size += 1;
+        *devs = (USBDevice*)realloc( *devs, (*size )*(sizeof(USBDevice)));
+        USBDevice *usb = &(*devs)[*size-1];
+        memset( usb, 0, sizeof(USBDevice) );
+        usb->debug = AIOUSB_FALSE;
+        usb->usb_control_transfer  = replay_control_transfer;
+        usb->usb_bulk_transfer     = replay_bulk_transfer;
+        usb->usb_request           = replay_request;
+        usb->usb_reset_device      = replay_reset_device;
+        usb->usb_put_config        = USBDevicePutADCConfigBlock;
+        usb->usb_get_config        = USBDeviceFetchADCConfigBlock;
+        usb->mockData              = &streams[i];
+
+        /* The device record carries the descriptor the device enumerated with */
+        for ( long pos = sizeof(MockUSBFileHeader); ; ) {
+            MockUSBRecord *rec = (MockUSBRecord *)&capture[pos];
+            if ( rec->type == MOCK_USB_RECORD_DEVICE && replay_find_stream( rec ) == &streams[i] ) {
+                memcpy( &usb->deviceDesc, rec + 1, sizeof(struct libusb_device_descriptor) );
+                break;
+            }
+            pos += sizeof(MockUSBRecord) + rec->payload_length;
+        }
+        result += 1;
+    }
+
+    return result;
+}
+
+#ifdef __cplusplus
+}
+#endif
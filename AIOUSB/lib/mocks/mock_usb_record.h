@@ -0,0 +1,64 @@
+/**
+ * @file   mock_usb_record.h
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  On-disk format shared by the binary USB capture
+ *         (mock_capture_usb.c) and the replay backend (mock_replay_usb.c)
+ *
+ * A capture file is a MockUSBFileHeader followed by a stream of
+ * records. Each record is a fixed MockUSBRecord header immediately
+ * followed by payload_length bytes of transfer data. Everything is
+ * written in host byte order; captures are meant to be replayed on
+ * the machine (or at least the architecture) that recorded them.
+ */
+
+#ifndef _MOCK_USB_RECORD_H
+#define _MOCK_USB_RECORD_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+namespace AIOUSB {
+#endif
+
+#define MOCK_USB_FILE_MAGIC     "AIOUSBR1"
+#define MOCK_USB_FILE_VERSION   2   /**< 2: records carry bus and address */
+
+typedef enum {
+    MOCK_USB_RECORD_DEVICE  = 1,    /**< payload is the libusb_device_descriptor */
+    MOCK_USB_RECORD_CONTROL = 2,
+    MOCK_USB_RECORD_BULK    = 3,
+    MOCK_USB_RECORD_RESET   = 4
+} MOCK_USB_RECORD_TYPE;
+
+typedef struct mock_usb_file_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_header_size;
+} MockUSBFileHeader;
+
+typedef struct mock_usb_record {
+    uint8_t  type;
+    uint8_t  request_type;      /**< control: bmRequestType, bulk: endpoint */
+    uint8_t  bRequest;
+    uint8_t  bus;               /**< bus number of that device, 0 in version 1 captures */
+    uint16_t idProduct;         /**< device the transfer was issued to */
+    uint16_t wValue;
+    uint16_t wIndex;
+    uint8_t  address;           /**< its address on the bus, 0 in version 1 captures */
+    uint8_t  reserved2;
+    int32_t  length;            /**< requested length */
+    int32_t  retval;            /**< return value of the original call */
+    int32_t  actual_length;     /**< bulk: bytes actually moved */
+    uint32_t payload_length;    /**< bytes of data following this header */
+    uint32_t reserved3;
+    uint64_t start_ns;          /**< CLOCK_MONOTONIC when the call began */
+    uint64_t end_ns;            /**< CLOCK_MONOTONIC when the call returned */
+} MockUSBRecord;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
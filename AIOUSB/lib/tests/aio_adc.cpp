@@ -1,4 +1,5 @@
 #include "AIOCommandLine.h"
+#include "AIOCalCache.h"
 #include "gtest/gtest.h"
 #include "tap.h"
 
@@ -33,6 +34,200 @@ TEST(ADCFunctions, CanDetermineCalibration )
 
 #include <unistd.h>
 #include <stdio.h>
+#include <poll.h>
+
+static volatile int bulk_completions = 0;
+static unsigned long bulk_completion_result = AIOUSB_ERROR_INVALID_DATA;
+
+static int fake_control_transfer( USBDevice *usb, uint8_t request_type, uint8_t bRequest, uint16_t wValue, uint16_t wIndex, unsigned char *data, uint16_t wLength, unsigned int timeout ) { return LIBUSB_ERROR_IO; }
+
+static int slow_bulk_transfer( USBDevice *usb, unsigned char endpoint, unsigned char *data, int length, int *actual_length, unsigned int timeout )
+{
+    usleep( 50000 );
+    memset( data, 0x55, length );
+    *actual_length = length;
+    return LIBUSB_SUCCESS;
+}
+
+static int slow_control_transfer( USBDevice *usb, uint8_t request_type, uint8_t bRequest, uint16_t wValue, uint16_t wIndex, unsigned char *data, uint16_t wLength, unsigned int timeout )
+{
+    usleep( 20000 );
+    return wLength;
+}
+
+static void count_completion( unsigned long DeviceIndex, unsigned long result, void *userdata )
+{
+    bulk_completions ++;
+    bulk_completion_result = result;
+}
+
+TEST(ADCFunctions, BulkAcquireSignalsCompletion )
+{
+    int numDevices = 0;
+    AIORESULT result;
+    USBDevice usb;
+    unsigned short buf[256];
+    uint64_t events = 0;
+
+    memset(&usb, 0, sizeof(usb));
+    usb.usb_control_transfer = fake_control_transfer;
+    usb.usb_bulk_transfer    = slow_bulk_transfer;
+
+    AIODeviceTableInit();
+    AIODeviceTableAddDeviceToDeviceTableWithUSBDevice( &numDevices, USB_AI16_16A, &usb );
+    AIOUSBDevice *dev = AIODeviceTableGetDeviceAtIndex( numDevices - 1, &result );
+    ASSERT_TRUE( dev );
+    dev->StreamingBlockSize = sizeof(buf);
+
+    int fd = (int)ADC_BulkGetEventFd( numDevices - 1 );
+    ASSERT_GE( fd, 0 );
+    EXPECT_EQ( fd, ADC_BulkGetEventFd( numDevices - 1 ) ) << "The same descriptor is handed out every time";
+    EXPECT_EQ( AIOUSB_SUCCESS, ADC_BulkSetCallback( numDevices - 1, count_completion, NULL ));
+
+    ASSERT_EQ( AIOUSB_SUCCESS, ADC_BulkAcquire( numDevices - 1, sizeof(buf), buf ));
+    EXPECT_EQ( AIOUSB_ERROR_TIMEOUT, ADC_BulkWait( numDevices - 1, 1 ));
+    EXPECT_EQ( AIOUSB_SUCCESS, ADC_BulkWait( numDevices - 1, 0 ));
+    EXPECT_EQ( 0x5555, buf[255] );
+
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    ASSERT_EQ( 1, poll( &pfd, 1, 1000 ));
+    ASSERT_EQ( (ssize_t)sizeof(events), read( fd, &events, sizeof(events) ));
+    EXPECT_EQ( 1, events );
+    for ( int i = 0; i < 1000 && !bulk_completions; i ++ )
+        usleep( 1000 );             /* callback runs on the worker after waiters are released */
+    EXPECT_EQ( 1, bulk_completions );
+    EXPECT_EQ( AIOUSB_SUCCESS, bulk_completion_result );
+
+    /* the second acquire runs on the threads the first one created */
+    struct aio_bulk_worker *worker = dev->bulkWorker;
+    ASSERT_TRUE( worker );
+    ASSERT_EQ( AIOUSB_SUCCESS, ADC_BulkAcquire( numDevices - 1, sizeof(buf), buf ));
+    EXPECT_EQ( AIOUSB_ERROR_OPEN_FAILED, ADC_BulkAcquire( numDevices - 1, sizeof(buf), buf )) << "One acquire at a time";
+    EXPECT_EQ( AIOUSB_SUCCESS, ADC_BulkWait( numDevices - 1, 0 ));
+    EXPECT_EQ( worker, dev->bulkWorker );
+
+    ADC_BulkSetCallback( numDevices - 1, NULL, NULL );
+    dev->usb_device = NULL;
+    ClearAIODeviceTable( numDevices );
+    EXPECT_FALSE( dev->bulkWorker ) << "Clearing the table stops the threads";
+}
+
+TEST(ADCFunctions, StoppingTheWorkerFinishesAQueuedAcquire )
+{
+    int numDevices = 0;
+    AIORESULT result;
+    USBDevice usb;
+    unsigned short buf[256];
+
+    memset(&usb, 0, sizeof(usb));
+    usb.usb_control_transfer = slow_control_transfer;
+    usb.usb_bulk_transfer    = slow_bulk_transfer;
+
+    AIODeviceTableInit();
+    AIODeviceTableAddDeviceToDeviceTableWithUSBDevice( &numDevices, USB_AI16_16A, &usb );
+    AIOUSBDevice *dev = AIODeviceTableGetDeviceAtIndex( numDevices - 1, &result );
+    ASSERT_TRUE( dev );
+    dev->StreamingBlockSize = sizeof(buf);
+
+    /* the stop lands while the reader is still starting the acquire, before it arms the clock */
+    alarm( 10 );
+    for ( int i = 0; i < 3; i ++ ) {
+        ASSERT_EQ( AIOUSB_SUCCESS, ADC_BulkAcquire( numDevices - 1, sizeof(buf), buf ));
+        adc_bulk_worker_stop( dev );
+        EXPECT_FALSE( dev->bulkWorker );
+        EXPECT_FALSE( dev->workerBusy ) << "The queued acquire ran to completion";
+    }
+    alarm( 0 );
+
+    dev->usb_device = NULL;
+    ClearAIODeviceTable( numDevices );
+}
+
+static int cal_blocks_loaded = 0;
+
+static int cal_control_transfer( USBDevice *usb, uint8_t request_type, uint8_t bRequest, uint16_t wValue, uint16_t wIndex, unsigned char *data, uint16_t wLength, unsigned int timeout )
+{
+    if ( bRequest == AUR_PROBE_CALFEATURE ) {
+        data[0] = 0xBB;
+        return 1;
+    }
+    if ( bRequest == 0xBB ) {
+        cal_blocks_loaded ++;
+        return 0;
+    }
+    return wLength;
+}
+
+static int cal_bulk_transfer( USBDevice *usb, unsigned char endpoint, unsigned char *data, int length, int *actual_length, unsigned int timeout )
+{
+    *actual_length = length;
+    return LIBUSB_SUCCESS;
+}
+
+static void write_cal_file( const char *name, unsigned short offset )
+{
+    static unsigned short table[ CAL_TABLE_WORDS ];
+    char temp[ 64 ];
+    snprintf( temp, sizeof(temp), "%s.new", name );
+    for ( int i = 0; i < CAL_TABLE_WORDS; i ++ )
+        table[i] = (unsigned short)( i + offset );
+    FILE *calFile = fopen( temp, "w" );
+    ASSERT_TRUE( calFile );
+    ASSERT_EQ( (size_t)CAL_TABLE_WORDS, fwrite( table, sizeof(unsigned short), CAL_TABLE_WORDS, calFile ));
+    fclose( calFile );
+    ASSERT_EQ( 0, rename( temp, name ));
+}
+
+TEST(ADCFunctions, CalTableOnlyGoesToBoardsThatLackIt )
+{
+    int numDevices = 0;
+    AIORESULT result;
+    USBDevice usb;
+    const int blocks = CAL_TABLE_WORDS / 1024;
+    char name[ 64 ];
+    snprintf( name, sizeof(name), "/tmp/aio_adc_cal_%d.bin", (int)getpid() );
+
+    memset(&usb, 0, sizeof(usb));
+    usb.usb_control_transfer = cal_control_transfer;
+    usb.usb_bulk_transfer    = cal_bulk_transfer;
+    AIODeviceTableInit();
+    AIODeviceTableAddDeviceToDeviceTableWithUSBDevice( &numDevices, USB_AI16_16A, &usb );
+    unsigned long index = numDevices - 1;
+    AIOUSBDevice *dev = AIODeviceTableGetDeviceAtIndex( index, &result );
+    ASSERT_TRUE( dev );
+    dev->deviceConfigBlock.size = 20;
+    dev->deviceConfigBlock.registers[ AD_CONFIG_CAL_MODE ] = 0x01;
+    AIOCalCacheClear();
+    cal_blocks_loaded = 0;
+
+    write_cal_file( name, 0 );
+    EXPECT_EQ( AIOUSB_SUCCESS, AIOUSB_ADC_LoadCalTable( index, name ));
+    EXPECT_EQ( blocks, cal_blocks_loaded );
+    EXPECT_EQ( AIOUSB_SUCCESS, AIOUSB_ADC_LoadCalTable( index, name ));
+    EXPECT_EQ( blocks, cal_blocks_loaded ) << "The board already holds it";
+    EXPECT_EQ( 1, AIOUSBDeviceGetCalUploadsAvoided( dev ));
+    EXPECT_EQ( 1, AIOCalCacheGetHits() );
+
+    dev->deviceConfigBlock.registers[ AD_CONFIG_CAL_MODE ] = 0x05;
+    EXPECT_EQ( AIOUSB_SUCCESS, AIOUSB_ADC_LoadCalTable( index, name ));
+    EXPECT_EQ( 2 * blocks, cal_blocks_loaded ) << "Another cal mode loads another table";
+
+    write_cal_file( name, 1 );
+    EXPECT_EQ( AIOUSB_SUCCESS, AIOUSB_ADC_LoadCalTable( index, name ));
+    EXPECT_EQ( 3 * blocks, cal_blocks_loaded ) << "A changed file is read again";
+    EXPECT_EQ( 2, AIOCalCacheGetMisses() );
+
+    AIOUSBDeviceInvalidateADCConfigCache( dev );
+    dev->deviceConfigBlock.size = 20;
+    EXPECT_EQ( AIOUSB_SUCCESS, AIOUSB_ADC_LoadCalTable( index, name ));
+    EXPECT_EQ( 4 * blocks, cal_blocks_loaded ) << "Nothing is assumed after a reset";
+
+    unlink( name );
+    EXPECT_EQ( AIOUSB_ERROR_FILE_NOT_FOUND, AIOUSB_ADC_LoadCalTable( index, name ));
+    AIOCalCacheClear();
+    dev->usb_device = NULL;
+    ClearAIODeviceTable( numDevices );
+}
 
 int main(int argc, char *argv[] )
 {
@@ -0,0 +1,120 @@
+#include "aiousb.h"
+
+#include "gtest/gtest.h"
+#include <math.h>
+#include <vector>
+
+using namespace AIOUSB;
+
+/* nearest rate any pair of divisors can make, by trying every product */
+static double nearest_rate( long rootClock, double hz )
+{
+    double best = -1;
+    long total = (long)( rootClock / hz );
+    for ( long product = total - 64; product <= total + 64; product ++ ) {
+        if ( product < 4 )
+            continue;
+        for ( long low = 2; low * low <= product; low ++ ) {
+            if ( product % low == 0 && product / low <= 65535 ) {
+                double rate = (double)rootClock / product;
+                if ( best < 0 || fabs( rate - hz ) < fabs( best - hz ) )
+                    best = rate;
+                break;
+            }
+        }
+    }
+    return best;
+}
+
+TEST(CTR, SolverIsExactWhenTheRateDivides )
+{
+    unsigned short high, low;
+    double actual, error;
+    ASSERT_EQ( AIOUSB_SUCCESS, CTR_SolveDivisors( ROOTCLOCK, 1000, &high, &low, &actual, &error ) );
+    EXPECT_EQ( 10000, high * low );
+    EXPECT_GE( high, low );
+    EXPECT_EQ( 1000.0, actual );
+    EXPECT_EQ( 0.0, error );
+
+    ASSERT_EQ( AIOUSB_SUCCESS, CTR_SolveDivisors( ROOTCLOCK, 4e6, &high, &low, &actual, NULL ) );
+    EXPECT_EQ( 2, high );
+    EXPECT_EQ( 2, low ) << "fastest the counters go";
+    ASSERT_EQ( AIOUSB_SUCCESS, CTR_SolveDivisors( ROOTCLOCK, 0.0001, &high, &low, &actual, NULL ) );
+    EXPECT_EQ( 65535, high );
+    EXPECT_EQ( 65535, low ) << "slowest the counters go";
+
+    EXPECT_LT( CTR_SolveDivisors( ROOTCLOCK, 0, &high, &low, NULL, NULL ), 0 );
+}
+
+TEST(CTR, SolverFindsTheNearestAchievableRate )
+{
+    double rates[] = { 99.997, 333.3, 1234.5, 7919, 12345.678, 99991, 0.37 };
+    for ( size_t i = 0; i < sizeof(rates) / sizeof(rates[0]); i ++ ) {
+        unsigned short high, low;
+        double actual, error;
+        ASSERT_EQ( AIOUSB_SUCCESS, CTR_SolveDivisors( ROOTCLOCK, rates[i], &high, &low, &actual, &error ) );
+        EXPECT_DOUBLE_EQ( (double)ROOTCLOCK / ( (double)high * low ), actual );
+        EXPECT_DOUBLE_EQ( actual - rates[i], error );
+        EXPECT_LE( fabs( error ), fabs( nearest_rate( ROOTCLOCK, rates[i] ) - rates[i] ) ) << rates[i] << " Hz";
+
+        unsigned short again_high, again_low;
+        CTR_SolveDivisors( ROOTCLOCK, rates[i], &again_high, &again_low, NULL, NULL );
+        EXPECT_EQ( high, again_high );
+        EXPECT_EQ( low, again_low );
+    }
+}
+
+TEST(CTR, CalculateCountersForClockUsesTheSolver )
+{
+    int diva, divb;
+    unsigned short high, low;
+    for ( int hz = 1; hz < 200000; hz = hz * 3 + 7 ) {
+        ASSERT_EQ( AIOUSB_SUCCESS, CTR_CalculateCountersForClock( hz, &diva, &divb ) );
+        CTR_SolveDivisors( ROOTCLOCK, hz, &high, &low, NULL, NULL );
+        EXPECT_EQ( high, diva );
+        EXPECT_EQ( low, divb );
+    }
+    EXPECT_LT( CTR_CalculateCountersForClock( 0, &diva, &divb ), 0 );
+}
+
+static std::vector<unsigned short> loads;
+static int fake_ctr_control( USBDevice *usb, uint8_t request_type, uint8_t bRequest, uint16_t wValue, uint16_t wIndex,
+                             unsigned char *data, uint16_t wLength, unsigned int timeout )
+{
+    if ( bRequest == AUR_CTR_MODELOAD )
+        loads.push_back( wIndex );
+    return wLength;
+}
+
+TEST(CTR, StartOutputFreqReportsTheActualRate )
+{
+    int numDevices = 0;
+    USBDevice usb;
+    memset( &usb, 0, sizeof(usb) );
+    usb.usb_control_transfer = fake_ctr_control;
+    loads.clear();
+    AIODeviceTableInit();
+    AIODeviceTableAddDeviceToDeviceTableWithUSBDevice( &numDevices, USB_AI16_16A, &usb );
+    AIORESULT result;
+    AIOUSBDevice *dev = AIODeviceTableGetDeviceAtIndex( 0, &result );
+
+    double hz = 3333;
+    ASSERT_EQ( AIOUSB_SUCCESS, CTR_StartOutputFreq( 0, 0, &hz ) );
+    ASSERT_EQ( 2u, loads.size() );
+    EXPECT_DOUBLE_EQ( (double)dev->RootClock / ( (double)loads[0] * loads[1] ), hz );
+    EXPECT_NEAR( 3333.333, hz, 0.001 ) << "10 MHz / 3000";
+
+    dev->usb_device = NULL;
+    ClearAIODeviceTable( numDevices );
+}
+
+int main(int argc, char *argv[] )
+{
+    testing::InitGoogleTest(&argc, argv);
+    testing::TestEventListeners & listeners = testing::UnitTest::GetInstance()->listeners();
+#ifdef GTEST_TAP_PRINT_TO_STDOUT
+    delete listeners.Release(listeners.default_result_printer());
+#endif
+
+    return RUN_ALL_TESTS();
+}
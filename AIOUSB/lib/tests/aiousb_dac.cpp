@@ -1,6 +1,8 @@
 #include "aiousb.h"
 
 #include "gtest/gtest.h"
+#include <algorithm>
+#include <vector>
 
 using namespace AIOUSB;
 TEST(DAC, RangeChecking )
@@ -25,6 +27,98 @@ TEST(DAC, RangeChecking )
     ASSERT_EQ( AIOUSB_ERROR_OPEN_FAILED, retval );
 }
 
+static std::vector<unsigned short> streamed;
+static std::vector<int> dacRequests;
+static int fake_dac_control( USBDevice *usb, uint8_t request_type, uint8_t bRequest, uint16_t wValue, uint16_t wIndex,
+                             unsigned char *data, uint16_t wLength, unsigned int timeout )
+{
+    dacRequests.push_back( bRequest );
+    return wLength;
+}
+
+static int fake_dac_bulk( USBDevice *usb, unsigned char endpoint, unsigned char *data, int length, int *actual_length, unsigned int timeout )
+{
+    const unsigned short *samples = (const unsigned short *)data;
+    streamed.insert( streamed.end(), samples, samples + length / 2 );
+    *actual_length = length;
+    return LIBUSB_SUCCESS;
+}
+
+TEST(DAC, StreamFramesMarkPointsAndEnd )
+{
+    int numDevices = 0;
+    AIORESULT result;
+    USBDevice usb;
+    memset( &usb, 0, sizeof(usb) );
+    usb.usb_control_transfer = fake_dac_control;
+    usb.usb_bulk_transfer = fake_dac_bulk;
+    streamed.clear();
+    dacRequests.clear();
+
+    AIODeviceTableInit();
+    AIODeviceTableAddDeviceToDeviceTableWithUSBDevice( &numDevices, USB_DA12_8A, &usb );
+    AIOUSBDevice *dev = AIODeviceTableGetDeviceAtIndex( 0, &result );
+
+    double hz = 1000;
+    unsigned short frame[3 * 2] = { 1, 2, 3, 4, 5, 0xf006 };
+    EXPECT_EQ( AIOUSB_ERROR_OPEN_FAILED, DACOutputFrame( 0, 3, frame ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, DACOutputOpen( 0, &hz ) );
+    EXPECT_DOUBLE_EQ( 1000.0, hz );
+    EXPECT_EQ( AIOUSB_ERROR_OPEN_FAILED, DACDirect( 0, 0, 0 ) );
+    EXPECT_EQ( AIOUSB_SUCCESS, DACOutputSetCount( 0, 2 ) );
+    EXPECT_EQ( AIOUSB_SUCCESS, DACOutputFrame( 0, 3, frame ) );
+    EXPECT_TRUE( streamed.empty() );
+    EXPECT_EQ( AIOUSB_SUCCESS, DACOutputClose( 0, AIOUSB_TRUE ) );
+
+    ASSERT_EQ( 6u, streamed.size() );
+    EXPECT_EQ( 1, streamed[0] );
+    EXPECT_EQ( 2 | DAC_STREAM_EOD, streamed[1] );
+    EXPECT_EQ( 4 | DAC_STREAM_EOD, streamed[3] );
+    EXPECT_EQ( 6 | DAC_STREAM_EOD | DAC_STREAM_EOF | DAC_STREAM_EOM, streamed[5] );
+    /* too little data to start by itself, so close starts it */
+    EXPECT_EQ( AUR_DAC_CONTROL, dacRequests.back() );
+    EXPECT_FALSE( dev->bDACOpen );
+    EXPECT_FALSE( dev->dacStream );
+
+    dev->usb_device = NULL;
+    ClearAIODeviceTable( numDevices );
+}
+
+TEST(DAC, StreamDoubleBuffersLongWaveforms )
+{
+    int numDevices = 0;
+    AIORESULT result;
+    USBDevice usb;
+    memset( &usb, 0, sizeof(usb) );
+    usb.usb_control_transfer = fake_dac_control;
+    usb.usb_bulk_transfer = fake_dac_bulk;
+    streamed.clear();
+    dacRequests.clear();
+
+    AIODeviceTableInit();
+    AIODeviceTableAddDeviceToDeviceTableWithUSBDevice( &numDevices, USB_DA12_8A, &usb );
+    AIOUSBDevice *dev = AIODeviceTableGetDeviceAtIndex( 0, &result );
+
+    double hz = 100000;
+    ASSERT_EQ( AIOUSB_SUCCESS, DACOutputOpen( 0, &hz ) );
+    EXPECT_EQ( AIOUSB_SUCCESS, DACOutputSetCount( 0, 1 ) );
+    std::vector<unsigned short> wave( 1000 );
+    for ( size_t i = 0; i < wave.size(); i ++ )
+        wave[i] = (unsigned short)( i * 4 );
+    for ( int i = 0; i < 100; i ++ )
+        ASSERT_EQ( AIOUSB_SUCCESS, DACOutputFrame( 0, wave.size(), &wave[0] ) );
+    EXPECT_EQ( AIOUSB_SUCCESS, DACOutputCloseNoEnd( 0, AIOUSB_TRUE ) );
+
+    ASSERT_EQ( 100000u, streamed.size() );
+    EXPECT_EQ( ( 999 * 4 ) | DAC_STREAM_EOD | DAC_STREAM_EOF, streamed.back() );
+    EXPECT_EQ( 0 | DAC_STREAM_EOD, streamed[1000] );
+    /* the board started itself after 160K bytes, and only once */
+    EXPECT_EQ( 1, std::count( dacRequests.begin(), dacRequests.end(), (int)AUR_DAC_CONTROL ) );
+
+    dev->usb_device = NULL;
+    ClearAIODeviceTable( numDevices );
+}
+
 
 int main(int argc, char *argv[] )
 {
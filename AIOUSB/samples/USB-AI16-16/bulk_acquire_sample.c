@@ -266,21 +266,21 @@ int main( int argc, char **argv ) {
                 AIOUSB_GetResultCodeAsString( result ), 
                 BULK_BYTES );
     /*
-     * use bulk poll to monitor progress
+     * wait for the acquire to finish, reporting progress once a second
      */
     if( result == AIOUSB_SUCCESS ) {
         unsigned long bytesRemaining = BULK_BYTES;
         for( int seconds = 0; seconds < 100; seconds++ ) {
-            sleep( 1 );
-            result = ADC_BulkPoll( deviceIndex, &bytesRemaining );
+            result = ADC_BulkWait( deviceIndex, 1000 );
+            ADC_BulkPoll( deviceIndex, &bytesRemaining );
             if( result == AIOUSB_SUCCESS ) {
                 printf( "  %lu bytes remaining\n", bytesRemaining );
-                if( bytesRemaining == 0 )
-                    break;
+                break;
+            } else if( result == AIOUSB_ERROR_TIMEOUT ) {
+                printf( "  %lu bytes remaining\n", bytesRemaining );
             } else {
-                printf( "Error '%s' polling bulk acquire progress\n", 
+                printf( "Error '%s' waiting for bulk acquire\n", 
                         AIOUSB_GetResultCodeAsString( result ) );
-                sleep(1);
                 break;
             }
         }